@@ -3,8 +3,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 /*
 "ARMTIMER_CTRL_WAIT_KERNEL_RESPONSE"
@@ -14,6 +17,7 @@ Else, application will wait a specific time (defined in ARMTIMER_CTRL_WAIT_TIME_
 #define ARMTIMER_CTRL_WAIT_KERNEL_RESPONSE
 
 #define ARMTIMER_CTRL_PROC_FILE_DIR "/proc/ARMTIMER_Ctrl"
+#define ARMTIMER_CTRL_DEV_FILE_DIR "/dev/ARMTIMER_Ctrl"
 #define ARMTIMER_CTRL_WAIT_TIME_US 1
 
 #define ARMTIMER_DATAIO_SIZE_BYTES 5
@@ -44,10 +48,27 @@ Else, application will wait a specific time (defined in ARMTIMER_CTRL_WAIT_TIME_
 #define ARMTIMER_CMD_GET_PREDIV_VALUE 23
 #define ARMTIMER_CMD_GET_FREERUN_COUNTER_VALUE 24
 
+#define ARMTIMER_CMD_RING_DOORBELL 0xFE
 #define ARMTIMER_CMD_KERNEL_RESPONSE 0xFF
 
+#define ARMTIMER_IOCTL_MAGIC 'a'
+#define ARMTIMER_IOCTL_RUN_CMD _IOWR(ARMTIMER_IOCTL_MAGIC, 0, uint8_t[ARMTIMER_DATAIO_SIZE_BYTES])
+
+#define ARMTIMER_RING_SIZE_BYTES 4096
+#define ARMTIMER_RING_HEADER_SIZE_BYTES 16
+#define ARMTIMER_RING_ENTRY_SIZE_BYTES 8
+#define ARMTIMER_RING_ENTRIES 256
+
+#define ARMTIMER_RING_SQ_TAIL_UINTP_POS 0
+#define ARMTIMER_RING_SQ_HEAD_UINTP_POS 1
+#define ARMTIMER_RING_FLAGS_UINTP_POS 2
+
+#define ARMTIMER_RING_FLAG_KERNEL_POLL 0x1
+
 int armtimer_proc_fd = -1;
+int armtimer_dev_fd = -1;
 void *armtimer_data_io = NULL;
+void *armtimer_ring = NULL;
 
 void armtimer_ctrl_wait(void)
 {
@@ -68,32 +89,106 @@ bool armtimer_init(void)
 	armtimer_proc_fd = open(ARMTIMER_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(armtimer_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	armtimer_dev_fd = open(ARMTIMER_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	armtimer_data_io = malloc(ARMTIMER_DATAIO_SIZE_BYTES);
 	return true;
 }
 
 #ifdef ARMTIMER_CTRL_WAIT_KERNEL_RESPONSE
-void armtimer_call_kernel(void)
+void armtimer_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) armtimer_data_io;
-	write(armtimer_proc_fd, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(armtimer_proc_fd, data_io, ARMTIMER_DATAIO_SIZE_BYTES);
 
 	do{
-		read(armtimer_proc_fd, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
+		read(armtimer_proc_fd, data_io, ARMTIMER_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != ARMTIMER_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void armtimer_call_kernel(void)
+void armtimer_call_kernel_proc(void *data_io)
 {
-	write(armtimer_proc_fd, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
+	write(armtimer_proc_fd, data_io, ARMTIMER_DATAIO_SIZE_BYTES);
 	armtimer_ctrl_wait();
-	read(armtimer_proc_fd, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
+	read(armtimer_proc_fd, data_io, ARMTIMER_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void armtimer_call_kernel_ioctl(void *data_io)
+{
+	ioctl(armtimer_dev_fd, ARMTIMER_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void armtimer_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) armtimer_ring;
+	uint8_t *ring_entries = ((uint8_t*) armtimer_ring) + ARMTIMER_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[ARMTIMER_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%ARMTIMER_RING_ENTRIES)*ARMTIMER_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[ARMTIMER_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[ARMTIMER_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[ARMTIMER_RING_FLAGS_UINTP_POS] & ARMTIMER_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, ARMTIMER_DATAIO_SIZE_BYTES);
+		doorbell[0] = ARMTIMER_CMD_RING_DOORBELL;
+		if(armtimer_dev_fd >= 0) armtimer_call_kernel_ioctl(doorbell);
+		else armtimer_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[ARMTIMER_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(armtimer_data_io, pentry, ARMTIMER_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void armtimer_call_kernel(void)
+{
+	if(armtimer_ring != NULL) armtimer_call_kernel_ring();
+	else if(armtimer_dev_fd >= 0) armtimer_call_kernel_ioctl(armtimer_data_io);
+	else armtimer_call_kernel_proc(armtimer_data_io);
+
+	return;
+}
+
+bool armtimer_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(armtimer_ring != NULL) munmap(armtimer_ring, ARMTIMER_RING_SIZE_BYTES);
+		armtimer_ring = NULL;
+		return true;
+	}
+
+	if(armtimer_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (armtimer_dev_fd >= 0) ? armtimer_dev_fd : armtimer_proc_fd;
+	void *p_ring = mmap(NULL, ARMTIMER_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	armtimer_ring = p_ring;
+	return true;
+}
+
+bool armtimer_ring_is_enabled(void)
+{
+	return (armtimer_ring != NULL);
+}
+
+bool armtimer_ioctl_is_enabled(void)
+{
+	return (armtimer_dev_fd >= 0);
+}
+
 void armtimer_set_load_value(uint32_t value)
 {
 	uint8_t *pbyte = (uint8_t*) armtimer_data_io;
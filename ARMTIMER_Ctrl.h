@@ -17,6 +17,15 @@ bool armtimer_is_active(void);
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool armtimer_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool armtimer_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool armtimer_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/ARMTIMER_Ctrl" instead of write()/read() calls on the proc file.
+bool armtimer_ioctl_is_enabled(void);
 
 void armtimer_set_load_value(uint32_t value);
 uint32_t armtimer_get_load_value(void);
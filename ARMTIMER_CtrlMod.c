@@ -5,8 +5,15 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 #define ARMTIMER_TIMER_PRESCALE_NONE 0
@@ -50,11 +57,59 @@
 #define ARMTIMER_CMD_GET_PREDIV_VALUE 23
 #define ARMTIMER_CMD_GET_FREERUN_COUNTER_VALUE 24
 
+#define ARMTIMER_CMD_RING_DOORBELL 0xFE
 #define ARMTIMER_CMD_KERNEL_RESPONSE 0xFF
 
+#define ARMTIMER_IOCTL_MAGIC 'a'
+#define ARMTIMER_IOCTL_RUN_CMD _IOWR(ARMTIMER_IOCTL_MAGIC, 0, unsigned char[ARMTIMER_DATAIO_SIZE_BYTES])
+
+/*
+ * ARMTIMER Command Ring Structure (ARMTIMER_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: ARMTIMER_RING_ENTRIES entries of ARMTIMER_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%ARMTIMER_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a ARMTIMER_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define ARMTIMER_RING_SIZE_BYTES 4096
+#define ARMTIMER_RING_HEADER_SIZE_BYTES 16
+#define ARMTIMER_RING_ENTRY_SIZE_BYTES 8
+#define ARMTIMER_RING_ENTRIES 256
+
+#define ARMTIMER_RING_SQ_TAIL_UINTP_POS 0
+#define ARMTIMER_RING_SQ_HEAD_UINTP_POS 1
+#define ARMTIMER_RING_FLAGS_UINTP_POS 2
+
+#define ARMTIMER_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} armtimer_file_ctx_t;
+
 static struct proc_dir_entry *armtimer_proc = NULL;
 static unsigned int *armtimer_mapping = NULL;
-static void *armtimer_data_io = NULL;
+static DEFINE_SPINLOCK(armtimer_lock);
+static struct task_struct *armtimer_ring_thread = NULL;
+static LIST_HEAD(armtimer_file_ctx_list);
+static DEFINE_MUTEX(armtimer_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int armtimer_is_reg_bit_active(unsigned int register_value, unsigned int reference_bit)
 {
@@ -220,19 +275,12 @@ unsigned int armtimer_get_freerun_counter_value(void)
 	return armtimer_mapping[ARMTIMER_COUNTER_UINTP_POS];
 }
 
-ssize_t armtimer_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+void armtimer_run_cmd(unsigned char *pbyte)
 {
-	copy_to_user(user, armtimer_data_io, ARMTIMER_DATAIO_SIZE_BYTES);
-	return size;
-}
-
-ssize_t armtimer_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
-{
-	copy_from_user(armtimer_data_io, user, ARMTIMER_DATAIO_SIZE_BYTES);
-
-	unsigned char *pbyte = (unsigned char*) armtimer_data_io;
 	unsigned int *puint = (unsigned int*) &pbyte[1];
 
+	spin_lock(&armtimer_lock);
+
 	switch(pbyte[0])
 	{
 		case ARMTIMER_CMD_SET_LOAD_VALUE:
@@ -336,13 +384,163 @@ ssize_t armtimer_mod_usrwrite(struct file *file, const char __user *user, size_t
 			break;
 	}
 
+	spin_unlock(&armtimer_lock);
+
 	pbyte[0] = ARMTIMER_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void armtimer_ring_drain(armtimer_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + ARMTIMER_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[ARMTIMER_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > ARMTIMER_RING_ENTRIES) sq_tail = ctx->ring_sq_head + ARMTIMER_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		armtimer_run_cmd(&ring_entries[(ctx->ring_sq_head%ARMTIMER_RING_ENTRIES)*ARMTIMER_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[ARMTIMER_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int armtimer_ring_poll_thread(void *arg)
+{
+	armtimer_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&armtimer_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &armtimer_file_ctx_list, list) armtimer_ring_drain(ctx);
+		mutex_unlock(&armtimer_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+int armtimer_mod_open(struct inode *inode, struct file *file)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) kzalloc(sizeof(armtimer_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(ARMTIMER_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(ARMTIMER_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(armtimer_ring_thread != NULL) ((unsigned int*) ctx->ring)[ARMTIMER_RING_FLAGS_UINTP_POS] = ARMTIMER_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&armtimer_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &armtimer_file_ctx_list);
+	mutex_unlock(&armtimer_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int armtimer_mod_release(struct inode *inode, struct file *file)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) file->private_data;
+
+	mutex_lock(&armtimer_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&armtimer_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t armtimer_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) file->private_data;
+
+	if(size > ARMTIMER_DATAIO_SIZE_BYTES) size = ARMTIMER_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t armtimer_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) file->private_data;
+
+	if(size != ARMTIMER_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == ARMTIMER_CMD_RING_DOORBELL) armtimer_ring_drain(ctx);
+
+	armtimer_run_cmd(pbyte);
 	return size;
 }
 
+int armtimer_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long armtimer_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	armtimer_file_ctx_t *ctx = (armtimer_file_ctx_t*) file->private_data;
+	unsigned char pbyte[ARMTIMER_DATAIO_SIZE_BYTES];
+
+	if(cmd != ARMTIMER_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, ARMTIMER_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == ARMTIMER_CMD_RING_DOORBELL) armtimer_ring_drain(ctx);
+
+	armtimer_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, ARMTIMER_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops armtimer_proc_ops = {
+	.proc_open = armtimer_mod_open,
+	.proc_release = armtimer_mod_release,
 	.proc_read = armtimer_mod_usrread,
-	.proc_write = armtimer_mod_usrwrite
+	.proc_write = armtimer_mod_usrwrite,
+	.proc_mmap = armtimer_mod_usrmmap
+};
+
+static const struct file_operations armtimer_fops = {
+	.owner = THIS_MODULE,
+	.open = armtimer_mod_open,
+	.release = armtimer_mod_release,
+	.read = armtimer_mod_usrread,
+	.write = armtimer_mod_usrwrite,
+	.mmap = armtimer_mod_usrmmap,
+	.unlocked_ioctl = armtimer_mod_ioctl
+};
+
+static struct miscdevice armtimer_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "ARMTIMER_Ctrl",
+	.fops = &armtimer_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -361,16 +559,30 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	armtimer_data_io = vmalloc(ARMTIMER_DATAIO_SIZE_BYTES);
+	if(misc_register(&armtimer_misc) < 0)
+	{
+		printk("ARMTIMER: Error registering device file\n");
+		proc_remove(armtimer_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		armtimer_ring_thread = kthread_run(armtimer_ring_poll_thread, NULL, "ARMTIMER_Ctrl_ring");
+		if(IS_ERR(armtimer_ring_thread)) armtimer_ring_thread = NULL;
+	}
+
 	printk("ARMTIMER Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
-	iounmap(armtimer_mapping);
+	//Interfaces and the ring thread go first, so no command can run on unmapped registers.
+	misc_deregister(&armtimer_misc);
 	proc_remove(armtimer_proc);
-	vfree(armtimer_data_io);
+	if(armtimer_ring_thread != NULL) kthread_stop(armtimer_ring_thread);
+	iounmap(armtimer_mapping);
 	printk("ARMTIMER Control Driver Disabled\n");
 	return;
 }
@@ -0,0 +1,488 @@
+#include "DMA_Benchmark.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "DMA_Ctrl.h"
+#include "DMA_Chain.h"
+#include "SYSTIMER_Ctrl.h"
+
+/*
+ * Every combination copies "size" bytes from a source buffer to a destination buffer, split at the length limit of the channel.
+ * The destination is cleared before each run and compared with the source after it.
+ *
+ * Simulated backend cost model (made up, only there so the sweep produces plausible, parameter dependent output):
+ * time = DMA_BENCHMARK_SIM_CTRLBLOCK_NS per control block + size/rate
+ * rate = base rate of the channel type, x DMA_BENCHMARK_SIM_128BIT_FACTOR with 128 bit width, x (1 + DMA_BENCHMARK_SIM_BURST_STEP*burst length, up to 8),
+ *        x DMA_BENCHMARK_SIM_WIDE_BURST_FACTOR with wide bursts (STD only), / (1 + wait cycles/8)
+ */
+
+#define DMA_BENCHMARK_STD_MAX_CHUNK 0x3FFFFFF0
+#define DMA_BENCHMARK_LITE_MAX_CHUNK 0xFFF0
+
+#define DMA_BENCHMARK_TIMEOUT_US 1000000
+
+#define DMA_BENCHMARK_SIM_SRC_BUS_ADDR 0x10000000
+#define DMA_BENCHMARK_SIM_DST_BUS_ADDR 0x20000000
+#define DMA_BENCHMARK_SIM_CTRLBLOCK_BUS_ADDR 0x30000000
+
+#define DMA_BENCHMARK_SIM_STD_MBS 250.0f
+#define DMA_BENCHMARK_SIM_LITE_MBS 125.0f
+#define DMA_BENCHMARK_SIM_128BIT_FACTOR 1.6f
+#define DMA_BENCHMARK_SIM_BURST_STEP 0.08f
+#define DMA_BENCHMARK_SIM_WIDE_BURST_FACTOR 1.1f
+#define DMA_BENCHMARK_SIM_CTRLBLOCK_NS 400.0f
+
+#define DMA_BENCHMARK_N_BURST_LENGTHS 5
+#define DMA_BENCHMARK_N_WAIT_CYCLES 3
+
+typedef struct {
+	uint8_t dma_ctrl;
+	bool lite;
+	uint32_t size;
+	uint8_t burst_length;
+	bool wide_bursts;
+	bool width_128bit;
+	uint8_t wait_cycles;
+} dma_benchmark_params_t;
+
+const uint8_t dma_benchmark_burst_lengths[DMA_BENCHMARK_N_BURST_LENGTHS] = {0, 1, 3, 7, 15};
+const uint8_t dma_benchmark_wait_cycles[DMA_BENCHMARK_N_WAIT_CYCLES] = {0, 4, 16};
+
+bool dma_benchmark_simulated = false;
+bool dma_benchmark_polled = false;
+dma_buffer_t dma_benchmark_src;
+dma_buffer_t dma_benchmark_dst;
+dma_buffer_t dma_benchmark_ctrlblocks;
+dma_chain_t dma_benchmark_chain;
+
+uint64_t dma_benchmark_get_time_ns(clockid_t clock)
+{
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return (((uint64_t) now.tv_sec)*1000000000 + ((uint64_t) now.tv_nsec));
+}
+
+void dma_benchmark_get_default_config(dma_benchmark_config_t *config)
+{
+	memset(config, 0, sizeof(dma_benchmark_config_t));
+
+	config->simulate = false;
+	config->test_std = true;
+	config->test_lite = true;
+	config->wait_irq = true;
+	config->n_runs = 20;
+
+	config->sizes[0] = 4096;
+	config->sizes[1] = 65536;
+	config->sizes[2] = 1048576;
+	config->sizes[3] = 4194304;
+	config->n_sizes = 4;
+	return;
+}
+
+bool dma_benchmark_sim_alloc(dma_buffer_t *p_buffer, uint32_t bus_addr, uint32_t size)
+{
+	memset(p_buffer, 0, sizeof(dma_buffer_t));
+	if(posix_memalign(&p_buffer->virt, 4096, size))
+	{
+		p_buffer->virt = NULL;
+		return false;
+	}
+
+	memset(p_buffer->virt, 0, size);
+	p_buffer->bus_addr = bus_addr;
+	p_buffer->size = size;
+	return true;
+}
+
+void dma_benchmark_free_buffer(dma_buffer_t *p_buffer)
+{
+	if(dma_benchmark_simulated) free(p_buffer->virt);
+	else if(p_buffer->virt != NULL) dma_buffer_free(p_buffer);
+
+	memset(p_buffer, 0, sizeof(dma_buffer_t));
+	return;
+}
+
+void dma_benchmark_free_buffers(void)
+{
+	dma_benchmark_free_buffer(&dma_benchmark_ctrlblocks);
+	dma_benchmark_free_buffer(&dma_benchmark_dst);
+	dma_benchmark_free_buffer(&dma_benchmark_src);
+	return;
+}
+
+bool dma_benchmark_alloc_buffers(uint32_t max_size)
+{
+	uint32_t max_ctrlblock = max_size/DMA_BENCHMARK_LITE_MAX_CHUNK + 1;
+	uint32_t ctrlblock_size = max_ctrlblock*sizeof(dma_ctrlblock_t);
+	uint32_t n = 0;
+	bool ok = false;
+
+	memset(&dma_benchmark_src, 0, sizeof(dma_buffer_t));
+	memset(&dma_benchmark_dst, 0, sizeof(dma_buffer_t));
+	memset(&dma_benchmark_ctrlblocks, 0, sizeof(dma_buffer_t));
+
+	if(dma_benchmark_simulated)
+	{
+		ok = dma_benchmark_sim_alloc(&dma_benchmark_src, DMA_BENCHMARK_SIM_SRC_BUS_ADDR, max_size);
+		ok = (ok && dma_benchmark_sim_alloc(&dma_benchmark_dst, DMA_BENCHMARK_SIM_DST_BUS_ADDR, max_size));
+		ok = (ok && dma_benchmark_sim_alloc(&dma_benchmark_ctrlblocks, DMA_BENCHMARK_SIM_CTRLBLOCK_BUS_ADDR, ctrlblock_size));
+	}
+	else
+	{
+		ok = dma_buffer_alloc(&dma_benchmark_src, max_size);
+		ok = (ok && dma_buffer_alloc(&dma_benchmark_dst, max_size));
+		ok = (ok && dma_buffer_alloc(&dma_benchmark_ctrlblocks, ctrlblock_size));
+	}
+
+	ok = (ok && dma_chain_create_in_buffer(&dma_benchmark_chain, &dma_benchmark_ctrlblocks, 0, max_ctrlblock));
+
+	if(!ok)
+	{
+		dma_benchmark_free_buffers();
+		return false;
+	}
+
+	while(n < max_size)
+	{
+		((uint8_t*) dma_benchmark_src.virt)[n] = (uint8_t) (n*31 + 7);
+		n++;
+	}
+
+	return true;
+}
+
+//Builds the chain of one combination. Returns false if it doesn't pass "dma_chain_validate()".
+bool dma_benchmark_build_chain(const dma_benchmark_params_t *params)
+{
+	dma_ctrlblock_t template;
+	uint32_t max_chunk = DMA_BENCHMARK_STD_MAX_CHUNK;
+	uint32_t offset = 0;
+	uint32_t chunk = 0;
+
+	if(params->lite) max_chunk = DMA_BENCHMARK_LITE_MAX_CHUNK;
+
+	dma_reset_ctrlblock(&template);
+	dma_enable_src_addr_inc(&template, true);
+	dma_enable_dst_addr_inc(&template, true);
+	dma_enable_src_read_128bit_width(&template, params->width_128bit);
+	dma_enable_dst_write_128bit_width(&template, params->width_128bit);
+	dma_disable_wide_bursts(&template, !params->wide_bursts);
+	dma_set_burst_length(&template, params->burst_length);
+	dma_set_wait_cycles(&template, params->wait_cycles);
+	dma_enable_wait_write_response(&template, true);
+	dma_set_permap(&template, DMA_PERMAP_ALWAYS_ON);
+
+	dma_chain_clear(&dma_benchmark_chain);
+
+	while(offset < params->size)
+	{
+		chunk = params->size - offset;
+		if(chunk > max_chunk) chunk = max_chunk;
+
+		if(dma_chain_add(&dma_benchmark_chain, &template, dma_benchmark_src.bus_addr + offset, dma_benchmark_dst.bus_addr + offset, chunk) < 0) return false;
+		offset += chunk;
+	}
+
+	dma_enable_intr(dma_chain_get_ctrlblock(&dma_benchmark_chain, dma_benchmark_chain.n_ctrlblock - 1), true);
+
+	return (dma_chain_validate(&dma_benchmark_chain, (params->lite ? DMA_LITE_CH0 : DMA_STD_CH0), NULL) == DMA_CHAIN_OK);
+}
+
+//Copies the chain in software. Returns the modeled transfer time in microseconds.
+float dma_benchmark_sim_run(const dma_benchmark_params_t *params)
+{
+	const dma_ctrlblock_t *p_ctrlblock = NULL;
+	uint32_t index = 0;
+	uint32_t burst_length = params->burst_length;
+	float rate_mbs = DMA_BENCHMARK_SIM_STD_MBS;
+
+	while(index < dma_benchmark_chain.n_ctrlblock)
+	{
+		p_ctrlblock = dma_chain_get_ctrlblock(&dma_benchmark_chain, index);
+		memcpy(((uint8_t*) dma_benchmark_dst.virt) + (p_ctrlblock->dst_addr - dma_benchmark_dst.bus_addr), ((const uint8_t*) dma_benchmark_src.virt) + (p_ctrlblock->src_addr - dma_benchmark_src.bus_addr), p_ctrlblock->transfer_length);
+		index++;
+	}
+
+	if(params->lite) rate_mbs = DMA_BENCHMARK_SIM_LITE_MBS;
+	if(params->width_128bit) rate_mbs *= DMA_BENCHMARK_SIM_128BIT_FACTOR;
+	if(burst_length > 8) burst_length = 8;
+	rate_mbs *= (1.0f + DMA_BENCHMARK_SIM_BURST_STEP*((float) burst_length));
+	if(params->wide_bursts && !params->lite) rate_mbs *= DMA_BENCHMARK_SIM_WIDE_BURST_FACTOR;
+	rate_mbs /= (1.0f + ((float) params->wait_cycles)/8.0f);
+
+	//MB/s = bytes/us
+	return (DMA_BENCHMARK_SIM_CTRLBLOCK_NS*((float) dma_benchmark_chain.n_ctrlblock))/1000.0f + ((float) params->size)/rate_mbs;
+}
+
+//Polls the ACTIVE flag. Returns false on timeout.
+bool dma_benchmark_poll(uint8_t dma_ctrl, uint32_t start_us)
+{
+	while(dma_get_transfer_active(dma_ctrl))
+	{
+		if((systimer_get_counter_value_l32() - start_us) > DMA_BENCHMARK_TIMEOUT_US) return false;
+	}
+
+	return true;
+}
+
+//Runs the chain on the channel. Returns false on timeout or DMA error.
+bool dma_benchmark_hw_run(const dma_benchmark_params_t *params, bool wait_irq, float *p_latency_us)
+{
+	uint32_t start_us = 0;
+	uint32_t end_us = 0;
+	bool ok = true;
+	int ret = 0;
+
+	dma_set_ctrlblock_addr_phys(params->dma_ctrl, dma_benchmark_chain.bus_addr);
+
+	start_us = systimer_get_counter_value_l32();
+	dma_set_transfer_active(params->dma_ctrl, true);
+
+	if(wait_irq && !dma_benchmark_polled)
+	{
+		//A completion left over from an earlier run returns early. The chain is only done once ACTIVE is cleared.
+		ret = dma_wait(params->dma_ctrl, DMA_BENCHMARK_TIMEOUT_US);
+		if(ret == 0) ok = false;
+		else if(ret > 0) ok = dma_benchmark_poll(params->dma_ctrl, start_us);
+		else if((ret < 0) && !dma_error_occurred(params->dma_ctrl))
+		{
+			//No completion interrupt for this channel: poll it from now on.
+			dma_benchmark_polled = true;
+			ok = dma_benchmark_poll(params->dma_ctrl, start_us);
+		}
+	}
+	else ok = dma_benchmark_poll(params->dma_ctrl, start_us);
+
+	end_us = systimer_get_counter_value_l32();
+
+	if(!ok || dma_error_occurred(params->dma_ctrl))
+	{
+		dma_abort(params->dma_ctrl);
+		dma_reset(params->dma_ctrl);
+		return false;
+	}
+
+	*p_latency_us = (float) (end_us - start_us);
+	return true;
+}
+
+void dma_benchmark_run_combination(const dma_benchmark_params_t *params, const dma_benchmark_config_t *config, FILE *out)
+{
+	uint64_t cpu_ns = 0;
+	uint64_t wall_ns = 0;
+	uint64_t cpu_start_ns = 0;
+	uint64_t wall_start_ns = 0;
+	float latency_us = 0.0f;
+	float latency_min_us = 0.0f;
+	float latency_max_us = 0.0f;
+	float latency_sum_us = 0.0f;
+	float latency_avg_us = 0.0f;
+	float bandwidth_mbs = 0.0f;
+	float cpu_percent = 0.0f;
+	uint32_t n_done = 0;
+	uint32_t n_errors = 0;
+	uint32_t n_run = 0;
+	const char *wait = NULL;
+	bool ok = false;
+
+	//A combination the channel can't run is reported with every run failed.
+	if(!dma_benchmark_build_chain(params)) n_errors = config->n_runs;
+	else while(n_run < config->n_runs)
+	{
+		memset(dma_benchmark_dst.virt, 0, params->size);
+
+		cpu_start_ns = dma_benchmark_get_time_ns(CLOCK_PROCESS_CPUTIME_ID);
+		wall_start_ns = dma_benchmark_get_time_ns(CLOCK_MONOTONIC);
+
+		if(dma_benchmark_simulated)
+		{
+			latency_us = dma_benchmark_sim_run(params);
+			ok = true;
+		}
+		else ok = dma_benchmark_hw_run(params, config->wait_irq, &latency_us);
+
+		cpu_ns += dma_benchmark_get_time_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start_ns;
+		wall_ns += dma_benchmark_get_time_ns(CLOCK_MONOTONIC) - wall_start_ns;
+
+		if(ok && memcmp(dma_benchmark_dst.virt, dma_benchmark_src.virt, params->size)) ok = false;
+
+		if(ok)
+		{
+			if((n_done == 0) || (latency_us < latency_min_us)) latency_min_us = latency_us;
+			if((n_done == 0) || (latency_us > latency_max_us)) latency_max_us = latency_us;
+			latency_sum_us += latency_us;
+			n_done++;
+		}
+		else n_errors++;
+
+		n_run++;
+	}
+
+	if(n_done)
+	{
+		latency_avg_us = latency_sum_us/((float) n_done);
+		if(latency_avg_us > 0.0f) bandwidth_mbs = ((float) params->size)/latency_avg_us;
+	}
+
+	if(wall_ns) cpu_percent = (((float) cpu_ns)*100.0f)/((float) wall_ns);
+
+	if(dma_benchmark_simulated) wait = "none";
+	else if(config->wait_irq && !dma_benchmark_polled) wait = "irq";
+	else wait = "poll";
+
+	fprintf(out, "%s,%u,%s,%u,%u,%u,%u,%u,%s,%u,%.3f,%.3f,%.3f,%.1f,%.1f,%u\n",
+		(dma_benchmark_simulated ? "sim" : "hw"),
+		params->dma_ctrl,
+		(params->lite ? "LITE" : "STD"),
+		params->size,
+		params->burst_length,
+		params->wide_bursts,
+		params->width_128bit,
+		params->wait_cycles,
+		wait,
+		config->n_runs,
+		latency_min_us,
+		latency_avg_us,
+		latency_max_us,
+		bandwidth_mbs,
+		cpu_percent,
+		n_errors);
+
+	return;
+}
+
+void dma_benchmark_run_channel(uint8_t dma_ctrl, bool lite, const dma_benchmark_config_t *config, FILE *out)
+{
+	dma_benchmark_params_t params;
+	uint32_t n_size = 0;
+	uint8_t n_burst = 0;
+	uint8_t n_wait = 0;
+	uint8_t n_wide = 0;
+	uint8_t n_width = 0;
+
+	memset(&params, 0, sizeof(dma_benchmark_params_t));
+	params.dma_ctrl = dma_ctrl;
+	params.lite = lite;
+
+	dma_benchmark_polled = false;
+	if(!dma_benchmark_simulated) dma_enable_ctrl(dma_ctrl, true);
+
+	while(n_size < config->n_sizes)
+	{
+		params.size = config->sizes[n_size];
+
+		n_burst = 0;
+		while(n_burst < DMA_BENCHMARK_N_BURST_LENGTHS)
+		{
+			params.burst_length = dma_benchmark_burst_lengths[n_burst];
+
+			//LITE channels have no wide bursts.
+			n_wide = 0;
+			while(n_wide < (lite ? 1 : 2))
+			{
+				params.wide_bursts = (n_wide != 0);
+
+				n_width = 0;
+				while(n_width < 2)
+				{
+					params.width_128bit = (n_width != 0);
+
+					n_wait = 0;
+					while(n_wait < DMA_BENCHMARK_N_WAIT_CYCLES)
+					{
+						params.wait_cycles = dma_benchmark_wait_cycles[n_wait];
+						dma_benchmark_run_combination(&params, config, out);
+						n_wait++;
+					}
+
+					n_width++;
+				}
+
+				n_wide++;
+			}
+
+			n_burst++;
+		}
+
+		n_size++;
+	}
+
+	return;
+}
+
+//Reserves a channel of the requested type. Returns the channel, or -1 if none is free.
+int dma_benchmark_alloc_channel(bool lite)
+{
+	int dma_ctrl = -1;
+
+	if(dma_benchmark_simulated) return (lite ? DMA_LITE_CH0 : DMA_STD_CH0);
+
+	if(!lite) return dma_channel_alloc(0, 0);
+
+	//LITE channels are preferred with DMA_CHANNEL_ALLOC_LITE_OK, but a STD channel is handed out if no LITE channel is free.
+	dma_ctrl = dma_channel_alloc(DMA_CHANNEL_ALLOC_LITE_OK, 0);
+	if((dma_ctrl >= 0) && (dma_ctrl <= DMA_STD_CH6))
+	{
+		dma_channel_free((uint8_t) dma_ctrl);
+		return -1;
+	}
+
+	return dma_ctrl;
+}
+
+bool dma_benchmark_run(const dma_benchmark_config_t *config, FILE *out)
+{
+	uint32_t max_size = 0;
+	uint32_t n_size = 0;
+	int dma_ctrl = -1;
+	uint8_t n_type = 0;
+	bool lite = false;
+
+	if((config == NULL) || (out == NULL)) return false;
+	if((config->n_runs == 0) || (config->n_sizes == 0) || (config->n_sizes > DMA_BENCHMARK_MAX_SIZES)) return false;
+
+	while(n_size < config->n_sizes)
+	{
+		if((config->sizes[n_size] == 0) || (config->sizes[n_size] & 0xF)) return false;
+		if(config->sizes[n_size] > max_size) max_size = config->sizes[n_size];
+		n_size++;
+	}
+
+	dma_benchmark_simulated = config->simulate;
+
+	if(!dma_benchmark_simulated)
+	{
+		if(!dma_is_active()) if(!dma_init()) return false;
+		if(!dma_ioctl_is_enabled()) return false;
+		if(!systimer_is_active()) if(!systimer_init()) return false;
+	}
+
+	if(!dma_benchmark_alloc_buffers(max_size)) return false;
+
+	fprintf(out, "backend,dma_ctrl,type,size,burst_length,wide_bursts,width_128bit,wait_cycles,wait,runs,latency_min_us,latency_avg_us,latency_max_us,bandwidth_mbs,cpu_percent,errors\n");
+
+	while(n_type < 2)
+	{
+		lite = (n_type != 0);
+		n_type++;
+
+		if(lite && !config->test_lite) continue;
+		if(!lite && !config->test_std) continue;
+
+		dma_ctrl = dma_benchmark_alloc_channel(lite);
+		if(dma_ctrl < 0) continue;
+
+		dma_benchmark_run_channel((uint8_t) dma_ctrl, lite, config, out);
+
+		if(!dma_benchmark_simulated) dma_channel_free((uint8_t) dma_ctrl);
+	}
+
+	dma_benchmark_free_buffers();
+	return true;
+}
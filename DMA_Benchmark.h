@@ -0,0 +1,39 @@
+//DMA throughput and latency benchmark
+
+#ifndef DMA_BENCHMARK_H
+#define DMA_BENCHMARK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DMA_BENCHMARK_MAX_SIZES 16
+
+typedef struct {
+	//If true, no driver is used: transfers are copied in software and timed with a fixed cost model (see DMA_Benchmark.c).
+	//Only meant to run the sweep and its output pipeline on a build host. The numbers say nothing about the hardware.
+	bool simulate;
+	//Test a STD channel, a LITE channel, or both. Channels are reserved with "dma_channel_alloc()". A type with no free channel is skipped.
+	bool test_std;
+	bool test_lite;
+	//If true, completion is waited for with "dma_wait()" (sleeping). Otherwise (or if the channel has no IRQ) the ACTIVE flag is polled.
+	bool wait_irq;
+	//Transfers per combination.
+	uint32_t n_runs;
+	//Transfer sizes in bytes, multiples of 16.
+	uint32_t sizes[DMA_BENCHMARK_MAX_SIZES];
+	uint32_t n_sizes;
+} dma_benchmark_config_t;
+
+//Fills "config" with the default sweep: STD and LITE channels, 4 KB to 4 MB, 20 runs each, waiting on interrupts, on the real driver.
+void dma_benchmark_get_default_config(dma_benchmark_config_t *config);
+
+//Runs memory to memory transfers for every combination of channel type, size, burst length, wide bursts, 128 bit width and wait cycles.
+//Writes one CSV line per combination to "out", after a header line:
+//backend,dma_ctrl,type,size,burst_length,wide_bursts,width_128bit,wait_cycles,wait,runs,latency_min_us,latency_avg_us,latency_max_us,bandwidth_mbs,cpu_percent,errors
+//Latency is measured with the SYSTIMER (1 us resolution) from setting ACTIVE to seeing the transfer done. Bandwidth is size/average latency, in MB/s.
+//"wait" is irq, poll, or none (simulated). "cpu_percent" is the CPU time used by this process over the wall time of the runs. "errors" counts DMA errors, timeouts and data mismatches.
+//Returns false if the benchmark could not be set up.
+bool dma_benchmark_run(const dma_benchmark_config_t *config, FILE *out);
+
+#endif
@@ -0,0 +1,203 @@
+#include "DMA_Chain.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "DMA_Ctrl.h"
+
+/*
+ * Control blocks are stored back to back (32 bytes each) from "bus_addr", which is 32 byte aligned.
+ * Links are bus addresses computed from the index, so building and patching a chain never calls the driver or the MMU helpers.
+ */
+
+#define DMA_CHAIN_STD_MAX_LENGTH 0x3FFFFFFF
+#define DMA_CHAIN_LITE_MAX_LENGTH 0xFFFF
+
+#define DMA_CHAIN_TI_TDMODE (1 << 1)
+#define DMA_CHAIN_TI_DST_WIDTH (1 << 5)
+#define DMA_CHAIN_TI_SRC_WIDTH (1 << 9)
+
+bool dma_chain_create(dma_chain_t *p_chain, uint32_t max_ctrlblock)
+{
+	if((p_chain == NULL) || (max_ctrlblock == 0)) return false;
+
+	memset(p_chain, 0, sizeof(dma_chain_t));
+	if(!dma_buffer_alloc(&p_chain->buffer, max_ctrlblock*sizeof(dma_ctrlblock_t))) return false;
+
+	p_chain->ctrlblock = (dma_ctrlblock_t*) p_chain->buffer.virt;
+	p_chain->bus_addr = p_chain->buffer.bus_addr;
+	p_chain->max_ctrlblock = max_ctrlblock;
+	p_chain->own_buffer = true;
+	return true;
+}
+
+bool dma_chain_create_in_buffer(dma_chain_t *p_chain, const dma_buffer_t *p_buffer, uint32_t offset, uint32_t max_ctrlblock)
+{
+	if((p_chain == NULL) || (p_buffer == NULL) || (max_ctrlblock == 0)) return false;
+	if((offset & 0x1F) || ((p_buffer->bus_addr + offset) & 0x1F)) return false;
+	if(((uint64_t) offset + ((uint64_t) max_ctrlblock)*sizeof(dma_ctrlblock_t)) > p_buffer->size) return false;
+
+	memset(p_chain, 0, sizeof(dma_chain_t));
+	p_chain->buffer = *p_buffer;
+	p_chain->ctrlblock = (dma_ctrlblock_t*) (((uint8_t*) p_buffer->virt) + offset);
+	p_chain->bus_addr = p_buffer->bus_addr + offset;
+	p_chain->max_ctrlblock = max_ctrlblock;
+	p_chain->own_buffer = false;
+	return true;
+}
+
+void dma_chain_destroy(dma_chain_t *p_chain)
+{
+	if(p_chain == NULL) return;
+
+	if(p_chain->own_buffer) dma_buffer_free(&p_chain->buffer);
+	memset(p_chain, 0, sizeof(dma_chain_t));
+	return;
+}
+
+void dma_chain_clear(dma_chain_t *p_chain)
+{
+	p_chain->n_ctrlblock = 0;
+	return;
+}
+
+uint32_t dma_chain_get_bus_addr(const dma_chain_t *p_chain, uint32_t index)
+{
+	return (p_chain->bus_addr + index*sizeof(dma_ctrlblock_t));
+}
+
+//Writes the link of the last control block: back to the first one, or end of chain.
+void dma_chain_link_last(dma_chain_t *p_chain)
+{
+	if(p_chain->n_ctrlblock == 0) return;
+
+	if(p_chain->loop) p_chain->ctrlblock[p_chain->n_ctrlblock - 1].next_ctrlblock_addr = p_chain->bus_addr;
+	else p_chain->ctrlblock[p_chain->n_ctrlblock - 1].next_ctrlblock_addr = 0;
+
+	return;
+}
+
+int dma_chain_add(dma_chain_t *p_chain, const dma_ctrlblock_t *p_template, uint32_t src_addr, uint32_t dst_addr, uint32_t length)
+{
+	dma_ctrlblock_t *p_ctrlblock = NULL;
+	uint32_t index = p_chain->n_ctrlblock;
+
+	if((p_template == NULL) || (index >= p_chain->max_ctrlblock)) return -1;
+
+	p_ctrlblock = &p_chain->ctrlblock[index];
+	memset(p_ctrlblock, 0, sizeof(dma_ctrlblock_t));
+	p_ctrlblock->transfer_info = p_template->transfer_info;
+	p_ctrlblock->stride = p_template->stride;
+	p_ctrlblock->src_addr = src_addr;
+	p_ctrlblock->dst_addr = dst_addr;
+	p_ctrlblock->transfer_length = length;
+
+	if(index) p_chain->ctrlblock[index - 1].next_ctrlblock_addr = dma_chain_get_bus_addr(p_chain, index);
+
+	p_chain->n_ctrlblock++;
+	dma_chain_link_last(p_chain);
+	return (int) index;
+}
+
+void dma_chain_set_loop(dma_chain_t *p_chain, bool loop)
+{
+	p_chain->loop = loop;
+	dma_chain_link_last(p_chain);
+	return;
+}
+
+void dma_chain_set_src_addr(dma_chain_t *p_chain, uint32_t index, uint32_t src_addr)
+{
+	if(index >= p_chain->n_ctrlblock) return;
+
+	p_chain->ctrlblock[index].src_addr = src_addr;
+	return;
+}
+
+void dma_chain_set_dst_addr(dma_chain_t *p_chain, uint32_t index, uint32_t dst_addr)
+{
+	if(index >= p_chain->n_ctrlblock) return;
+
+	p_chain->ctrlblock[index].dst_addr = dst_addr;
+	return;
+}
+
+void dma_chain_set_length(dma_chain_t *p_chain, uint32_t index, uint32_t length)
+{
+	if(index >= p_chain->n_ctrlblock) return;
+
+	p_chain->ctrlblock[index].transfer_length = length;
+	return;
+}
+
+dma_ctrlblock_t *dma_chain_get_ctrlblock(dma_chain_t *p_chain, uint32_t index)
+{
+	if(index >= p_chain->n_ctrlblock) return NULL;
+
+	return &p_chain->ctrlblock[index];
+}
+
+int dma_chain_validate_ctrlblock(const dma_chain_t *p_chain, uint32_t index, bool lite)
+{
+	const dma_ctrlblock_t *p_ctrlblock = &p_chain->ctrlblock[index];
+	uint32_t expected_next = 0;
+
+	if(index < (p_chain->n_ctrlblock - 1)) expected_next = dma_chain_get_bus_addr(p_chain, index + 1);
+	else if(p_chain->loop) expected_next = p_chain->bus_addr;
+
+	if(p_ctrlblock->next_ctrlblock_addr != expected_next) return DMA_CHAIN_ERROR_LINK;
+
+	if((p_ctrlblock->transfer_info & DMA_CHAIN_TI_SRC_WIDTH) && (p_ctrlblock->src_addr & 0xF)) return DMA_CHAIN_ERROR_ALIGNMENT;
+	if((p_ctrlblock->transfer_info & DMA_CHAIN_TI_DST_WIDTH) && (p_ctrlblock->dst_addr & 0xF)) return DMA_CHAIN_ERROR_ALIGNMENT;
+
+	if(p_ctrlblock->transfer_info & DMA_CHAIN_TI_TDMODE)
+	{
+		if(lite) return DMA_CHAIN_ERROR_LITE_TDMODE;
+		if((p_ctrlblock->transfer_length & 0xFFFF) == 0) return DMA_CHAIN_ERROR_LENGTH;
+		if(p_ctrlblock->transfer_length & 0xC0000000) return DMA_CHAIN_ERROR_LENGTH;
+		return DMA_CHAIN_OK;
+	}
+
+	if(p_ctrlblock->transfer_length == 0) return DMA_CHAIN_ERROR_LENGTH;
+	if(lite && (p_ctrlblock->transfer_length > DMA_CHAIN_LITE_MAX_LENGTH)) return DMA_CHAIN_ERROR_LITE_LENGTH;
+	if(p_ctrlblock->transfer_length > DMA_CHAIN_STD_MAX_LENGTH) return DMA_CHAIN_ERROR_LENGTH;
+
+	return DMA_CHAIN_OK;
+}
+
+int dma_chain_validate(const dma_chain_t *p_chain, uint8_t dma_ctrl, uint32_t *p_bad_index)
+{
+	uint32_t index = 0;
+	int ret = DMA_CHAIN_OK;
+	bool lite = (dma_ctrl > DMA_STD_CH6);
+
+	if(p_bad_index != NULL) *p_bad_index = 0;
+
+	if(p_chain->n_ctrlblock == 0) return DMA_CHAIN_ERROR_EMPTY;
+	if(p_chain->bus_addr & 0x1F) return DMA_CHAIN_ERROR_ALIGNMENT;
+
+	while(index < p_chain->n_ctrlblock)
+	{
+		ret = dma_chain_validate_ctrlblock(p_chain, index, lite);
+		if(ret != DMA_CHAIN_OK)
+		{
+			if(p_bad_index != NULL) *p_bad_index = index;
+			return ret;
+		}
+
+		index++;
+	}
+
+	return DMA_CHAIN_OK;
+}
+
+bool dma_chain_launch(const dma_chain_t *p_chain, uint8_t dma_ctrl)
+{
+	if((p_chain->n_ctrlblock == 0) || (dma_ctrl > DMA_LITE_CH7)) return false;
+
+	dma_enable_ctrl(dma_ctrl, true);
+	dma_set_ctrlblock_addr_phys(dma_ctrl, p_chain->bus_addr);
+	dma_set_transfer_active(dma_ctrl, true);
+	return true;
+}
@@ -0,0 +1,68 @@
+//DMA control block chain builder
+
+#ifndef DMA_CHAIN_H
+#define DMA_CHAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DMA_Ctrl.h"
+
+#define DMA_CHAIN_OK 0
+#define DMA_CHAIN_ERROR_EMPTY 1
+#define DMA_CHAIN_ERROR_ALIGNMENT 2
+#define DMA_CHAIN_ERROR_LENGTH 3
+#define DMA_CHAIN_ERROR_LITE_LENGTH 4
+#define DMA_CHAIN_ERROR_LITE_TDMODE 5
+#define DMA_CHAIN_ERROR_LINK 6
+
+//Raw TXFR_LEN value of a 2D mode control block: XLENGTH = "row_bytes", YLENGTH = "ylength" (same fields as "dma_set_transfer_length_bytes()" and "dma_set_transfer_length_ext()").
+#define DMA_CHAIN_LENGTH_2D(row_bytes, ylength) ((((uint32_t) (ylength) & 0x3FFF) << 16) | ((uint32_t) (row_bytes) & 0xFFFF))
+
+//Control blocks laid out back to back in coherent memory, linked in order. Filled by the functions below, only read by the application.
+typedef struct {
+	dma_buffer_t buffer;
+	dma_ctrlblock_t *ctrlblock;
+	uint32_t bus_addr;
+	uint32_t n_ctrlblock;
+	uint32_t max_ctrlblock;
+	bool loop;
+	bool own_buffer;
+} dma_chain_t;
+
+//Allocates room for up to "max_ctrlblock" control blocks with "dma_buffer_alloc()".
+//Returns true if successful.
+bool dma_chain_create(dma_chain_t *p_chain, uint32_t max_ctrlblock);
+//Same as "dma_chain_create()", but places the control blocks inside a buffer of the application, at "offset" (multiple of 32).
+//The buffer is not released by "dma_chain_destroy()".
+bool dma_chain_create_in_buffer(dma_chain_t *p_chain, const dma_buffer_t *p_buffer, uint32_t offset, uint32_t max_ctrlblock);
+//Releases the chain. It must not be in use by any DMA channel.
+void dma_chain_destroy(dma_chain_t *p_chain);
+//Removes all control blocks, keeping the memory.
+void dma_chain_clear(dma_chain_t *p_chain);
+
+//Appends a copy of "p_template" (transfer info and stride) with the given addresses and raw TXFR_LEN value (bytes, or DMA_CHAIN_LENGTH_2D() in 2D mode).
+//Build the template once with "dma_reset_ctrlblock()" and the setters. The link from the previous control block is resolved here, without address translation.
+//Returns the index of the new control block, or -1 if the chain is full.
+int dma_chain_add(dma_chain_t *p_chain, const dma_ctrlblock_t *p_template, uint32_t src_addr, uint32_t dst_addr, uint32_t length);
+//If "loop" is true, the last control block links back to the first one. Otherwise the chain ends there.
+void dma_chain_set_loop(dma_chain_t *p_chain, bool loop);
+
+//Patches one control block of a built chain, for relaunching it as a template. Indexes out of range are ignored.
+void dma_chain_set_src_addr(dma_chain_t *p_chain, uint32_t index, uint32_t src_addr);
+void dma_chain_set_dst_addr(dma_chain_t *p_chain, uint32_t index, uint32_t dst_addr);
+void dma_chain_set_length(dma_chain_t *p_chain, uint32_t index, uint32_t length);
+//Returns control block "index" for any other change, or NULL if out of range. Don't change its link.
+dma_ctrlblock_t *dma_chain_get_ctrlblock(dma_chain_t *p_chain, uint32_t index);
+//Returns the bus address of control block "index".
+uint32_t dma_chain_get_bus_addr(const dma_chain_t *p_chain, uint32_t index);
+
+//Checks the chain against the limits of channel "dma_ctrl":
+//control blocks and links 32 byte aligned, 128 bit reads/writes on 16 byte aligned addresses, no empty transfers,
+//and on LITE channels no 2D mode and at most 65535 bytes per control block.
+//Returns DMA_CHAIN_OK, or a DMA_CHAIN_ERROR_* code with the index of the first bad control block in "p_bad_index" (if not NULL).
+int dma_chain_validate(const dma_chain_t *p_chain, uint8_t dma_ctrl, uint32_t *p_bad_index);
+//Starts channel "dma_ctrl" on the first control block. The chain is not validated again.
+bool dma_chain_launch(const dma_chain_t *p_chain, uint8_t dma_ctrl);
+
+#endif
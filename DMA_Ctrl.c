@@ -6,6 +6,10 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "MMU32_usr.h" //Use this for aarch32 GNU-Linux
 //#include "MMU64_usr.h" //Use this for aarch64 GNU-Linux
@@ -18,6 +22,8 @@ Else, application will wait a specific time (defined in DMA_CTRL_WAIT_TIME_US) i
 #define DMA_CTRL_WAIT_KERNEL_RESPONSE
 
 #define DMA_CTRL_PROC_FILE_DIR "/proc/DMA_Ctrl"
+#define DMA_CTRL_DEV_FILE_DIR "/dev/DMA_Ctrl"
+#define DMA_EVENT_DEV_FILE_DIR "/dev/DMA_Event"
 #define DMA_CTRL_WAIT_TIME_US 1
 
 #define DMA_DATAIO_SIZE_BYTES 6
@@ -77,11 +83,97 @@ Else, application will wait a specific time (defined in DMA_CTRL_WAIT_TIME_US) i
 #define DMA_CMD_DEBUG_GET_READ_ERROR 52
 #define DMA_CMD_DEBUG_GET_FIFO_ERROR 53
 #define DMA_CMD_DEBUG_GET_READLASTNOTSET_ERROR 54
+#define DMA_CMD_SET_IRQ_COALESCE 55
+#define DMA_CMD_GET_IRQ_COALESCE 56
+#define DMA_CMD_GET_FREE_CHANNELS 57
+#define DMA_CMD_SET_NEXTCB_ADDR 58
 
+#define DMA_CMD_RING_DOORBELL 0xFE
 #define DMA_CMD_KERNEL_RESPONSE 0xFF
 
+#define DMA_IOCTL_MAGIC 'd'
+#define DMA_IOCTL_RUN_CMD _IOWR(DMA_IOCTL_MAGIC, 0, uint8_t[DMA_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_ALLOC_BUFFER _IOWR(DMA_IOCTL_MAGIC, 1, uint8_t[DMA_BUFFER_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_FREE_BUFFER _IOW(DMA_IOCTL_MAGIC, 2, uint8_t[DMA_BUFFER_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_WAIT _IOWR(DMA_IOCTL_MAGIC, 3, uint8_t[DMA_WAIT_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_ALLOC_CHANNEL _IOWR(DMA_IOCTL_MAGIC, 4, uint8_t[DMA_CHANNEL_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_FREE_CHANNEL _IOW(DMA_IOCTL_MAGIC, 5, uint8_t[DMA_CHANNEL_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_SET_STREAM _IOW(DMA_IOCTL_MAGIC, 6, uint8_t[DMA_STREAM_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_GET_SNAPSHOT _IOWR(DMA_IOCTL_MAGIC, 7, uint8_t[DMA_SNAPSHOT_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_GET_SNAPSHOT_ALL _IOR(DMA_IOCTL_MAGIC, 8, uint8_t[DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES])
+
+#define DMA_BUFFER_DATAIO_SIZE_BYTES 16
+
+#define DMA_BUFFER_SIZE_UINTP_POS 0
+#define DMA_BUFFER_HANDLE_UINTP_POS 1
+#define DMA_BUFFER_BUS_ADDR_UINTP_POS 2
+#define DMA_BUFFER_MMAP_PGOFF_UINTP_POS 3
+
+#define DMA_WAIT_DATAIO_SIZE_BYTES 16
+
+#define DMA_WAIT_CTRL_UINTP_POS 0
+#define DMA_WAIT_TIMEOUT_UINTP_POS 1
+#define DMA_WAIT_COMPLETIONS_UINTP_POS 2
+#define DMA_WAIT_ERRORS_UINTP_POS 3
+
+#define DMA_CHANNEL_DATAIO_SIZE_BYTES 16
+
+#define DMA_CHANNEL_FLAGS_UINTP_POS 0
+#define DMA_CHANNEL_TIMEOUT_UINTP_POS 1
+#define DMA_CHANNEL_CTRL_UINTP_POS 2
+
+#define DMA_CHANNEL_ALLOC_FLAG_SPECIFIC 0x10
+
+#define DMA_STREAM_DATAIO_SIZE_BYTES 20
+#define DMA_STREAM_CTRLBLOCK_STRIDE_BYTES 32
+
+#define DMA_STREAM_CTRL_UINTP_POS 0
+#define DMA_STREAM_HANDLE_UINTP_POS 1
+#define DMA_STREAM_CURSOR_OFFSET_UINTP_POS 2
+#define DMA_STREAM_FIRST_CTRLBLOCK_UINTP_POS 3
+#define DMA_STREAM_N_PERIODS_UINTP_POS 4
+
+#define DMA_STREAM_CURSOR_PRODUCER_UINTP_POS 0
+#define DMA_STREAM_CURSOR_CONSUMER_UINTP_POS 1
+#define DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS 2
+
+/*
+ * Stream buffer layout (one buffer from "dma_buffer_alloc()"):
+ *
+ * BYTES 0 to 31: CURSOR AREA (shared with the driver, see DMA_IOCTL_SET_STREAM)
+ * BYTES 32 onwards: one control block per period
+ * After the control blocks: the period data, "period_bytes" per period
+ */
+
+#define DMA_STREAM_CURSOR_AREA_SIZE_BYTES 32
+
+#define DMA_SNAPSHOT_REGS_SIZE_BYTES 36
+#define DMA_SNAPSHOT_DATAIO_SIZE_BYTES (4 + DMA_SNAPSHOT_REGS_SIZE_BYTES)
+#define DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES (8 + 15*DMA_SNAPSHOT_REGS_SIZE_BYTES)
+
+#define DMA_SNAPSHOT_CTRL_UINTP_POS 0
+#define DMA_SNAPSHOT_REGS_UINTP_POS 1
+
+#define DMA_SNAPSHOT_ALL_INTR_STATUS_UINTP_POS 0
+#define DMA_SNAPSHOT_ALL_ENABLE_UINTP_POS 1
+#define DMA_SNAPSHOT_ALL_REGS_UINTP_POS 2
+
+#define DMA_RING_SIZE_BYTES 4096
+#define DMA_RING_HEADER_SIZE_BYTES 16
+#define DMA_RING_ENTRY_SIZE_BYTES 8
+#define DMA_RING_ENTRIES 256
+
+#define DMA_RING_SQ_TAIL_UINTP_POS 0
+#define DMA_RING_SQ_HEAD_UINTP_POS 1
+#define DMA_RING_FLAGS_UINTP_POS 2
+
+#define DMA_RING_FLAG_KERNEL_POLL 0x1
+
 int dma_proc_fd = -1;
+int dma_dev_fd = -1;
 void *dma_data_io = NULL;
+void *dma_ring = NULL;
+int dma_event_fd = -1;
 
 void dma_ctrl_wait(void)
 {
@@ -104,32 +196,657 @@ bool dma_init(void)
 	dma_proc_fd = open(DMA_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(dma_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	dma_dev_fd = open(DMA_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	dma_data_io = malloc(DMA_DATAIO_SIZE_BYTES);
 	return true;
 }
 
 #ifdef DMA_CTRL_WAIT_KERNEL_RESPONSE
-void dma_call_kernel(void)
+void dma_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) dma_data_io;
-	write(dma_proc_fd, dma_data_io, DMA_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(dma_proc_fd, data_io, DMA_DATAIO_SIZE_BYTES);
 
 	do{
-		read(dma_proc_fd, dma_data_io, DMA_DATAIO_SIZE_BYTES);
+		read(dma_proc_fd, data_io, DMA_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != DMA_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void dma_call_kernel(void)
+void dma_call_kernel_proc(void *data_io)
 {
-	write(dma_proc_fd, dma_data_io, DMA_DATAIO_SIZE_BYTES);
+	write(dma_proc_fd, data_io, DMA_DATAIO_SIZE_BYTES);
 	dma_ctrl_wait();
-	read(dma_proc_fd, dma_data_io, DMA_DATAIO_SIZE_BYTES);
+	read(dma_proc_fd, data_io, DMA_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void dma_call_kernel_ioctl(void *data_io)
+{
+	ioctl(dma_dev_fd, DMA_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void dma_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) dma_ring;
+	uint8_t *ring_entries = ((uint8_t*) dma_ring) + DMA_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[DMA_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%DMA_RING_ENTRIES)*DMA_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[DMA_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, dma_data_io, DMA_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[DMA_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[DMA_RING_FLAGS_UINTP_POS] & DMA_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, DMA_DATAIO_SIZE_BYTES);
+		doorbell[0] = DMA_CMD_RING_DOORBELL;
+		if(dma_dev_fd >= 0) dma_call_kernel_ioctl(doorbell);
+		else dma_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[DMA_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(dma_data_io, pentry, DMA_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void dma_call_kernel(void)
+{
+	if(dma_ring != NULL) dma_call_kernel_ring();
+	else if(dma_dev_fd >= 0) dma_call_kernel_ioctl(dma_data_io);
+	else dma_call_kernel_proc(dma_data_io);
+
+	return;
+}
+
+bool dma_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(dma_ring != NULL) munmap(dma_ring, DMA_RING_SIZE_BYTES);
+		dma_ring = NULL;
+		return true;
+	}
+
+	if(dma_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (dma_dev_fd >= 0) ? dma_dev_fd : dma_proc_fd;
+	void *p_ring = mmap(NULL, DMA_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	dma_ring = p_ring;
+	return true;
+}
+
+bool dma_ring_is_enabled(void)
+{
+	return (dma_ring != NULL);
+}
+
+bool dma_ioctl_is_enabled(void)
+{
+	return (dma_dev_fd >= 0);
+}
+
+bool dma_buffer_alloc(dma_buffer_t *p_buffer, uint32_t size)
+{
+	uint32_t buffer_io[DMA_BUFFER_DATAIO_SIZE_BYTES/4];
+	void *p = NULL;
+
+	if(dma_dev_fd < 0) return false;
+
+	memset(buffer_io, 0, DMA_BUFFER_DATAIO_SIZE_BYTES);
+	buffer_io[DMA_BUFFER_SIZE_UINTP_POS] = size;
+	if(ioctl(dma_dev_fd, DMA_IOCTL_ALLOC_BUFFER, buffer_io) < 0) return false;
+
+	p = mmap(NULL, buffer_io[DMA_BUFFER_SIZE_UINTP_POS], (PROT_READ | PROT_WRITE), MAP_SHARED, dma_dev_fd, ((off_t) buffer_io[DMA_BUFFER_MMAP_PGOFF_UINTP_POS])*sysconf(_SC_PAGESIZE));
+	if(p == MAP_FAILED)
+	{
+		ioctl(dma_dev_fd, DMA_IOCTL_FREE_BUFFER, buffer_io);
+		return false;
+	}
+
+	p_buffer->virt = p;
+	p_buffer->bus_addr = buffer_io[DMA_BUFFER_BUS_ADDR_UINTP_POS];
+	p_buffer->size = buffer_io[DMA_BUFFER_SIZE_UINTP_POS];
+	p_buffer->handle = buffer_io[DMA_BUFFER_HANDLE_UINTP_POS];
+	return true;
+}
+
+void dma_buffer_free(dma_buffer_t *p_buffer)
+{
+	uint32_t buffer_io[DMA_BUFFER_DATAIO_SIZE_BYTES/4];
+
+	if(p_buffer->virt == NULL) return;
+
+	munmap(p_buffer->virt, p_buffer->size);
+
+	memset(buffer_io, 0, DMA_BUFFER_DATAIO_SIZE_BYTES);
+	buffer_io[DMA_BUFFER_HANDLE_UINTP_POS] = p_buffer->handle;
+	ioctl(dma_dev_fd, DMA_IOCTL_FREE_BUFFER, buffer_io);
+
+	memset(p_buffer, 0, sizeof(dma_buffer_t));
+	return;
+}
+
+uint32_t dma_buffer_get_bus_addr(const dma_buffer_t *p_buffer, const void *p)
+{
+	return p_buffer->bus_addr + ((uint32_t) (((const uint8_t*) p) - ((const uint8_t*) p_buffer->virt)));
+}
+
+int dma_wait(uint8_t dma_ctrl, uint32_t timeout_us)
+{
+	uint32_t wait_io[DMA_WAIT_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return -1;
+
+	memset(wait_io, 0, DMA_WAIT_DATAIO_SIZE_BYTES);
+	wait_io[DMA_WAIT_CTRL_UINTP_POS] = dma_ctrl;
+	wait_io[DMA_WAIT_TIMEOUT_UINTP_POS] = timeout_us;
+
+	if(ioctl(dma_dev_fd, DMA_IOCTL_WAIT, wait_io) < 0) return (errno == ETIMEDOUT) ? 0 : -1;
+	if(wait_io[DMA_WAIT_ERRORS_UINTP_POS]) return -1;
+
+	return (int) wait_io[DMA_WAIT_COMPLETIONS_UINTP_POS];
+}
+
+int dma_channel_alloc(uint32_t flags, uint32_t timeout_us)
+{
+	uint32_t channel_io[DMA_CHANNEL_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return -1;
+
+	memset(channel_io, 0, DMA_CHANNEL_DATAIO_SIZE_BYTES);
+	channel_io[DMA_CHANNEL_FLAGS_UINTP_POS] = (flags & ~DMA_CHANNEL_ALLOC_FLAG_SPECIFIC);
+	channel_io[DMA_CHANNEL_TIMEOUT_UINTP_POS] = timeout_us;
+
+	if(ioctl(dma_dev_fd, DMA_IOCTL_ALLOC_CHANNEL, channel_io) < 0) return -1;
+	return (int) channel_io[DMA_CHANNEL_CTRL_UINTP_POS];
+}
+
+bool dma_channel_reserve(uint8_t dma_ctrl, uint32_t flags, uint32_t timeout_us)
+{
+	uint32_t channel_io[DMA_CHANNEL_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return false;
+
+	memset(channel_io, 0, DMA_CHANNEL_DATAIO_SIZE_BYTES);
+	channel_io[DMA_CHANNEL_FLAGS_UINTP_POS] = (flags | DMA_CHANNEL_ALLOC_FLAG_SPECIFIC);
+	channel_io[DMA_CHANNEL_TIMEOUT_UINTP_POS] = timeout_us;
+	channel_io[DMA_CHANNEL_CTRL_UINTP_POS] = dma_ctrl;
+
+	return (ioctl(dma_dev_fd, DMA_IOCTL_ALLOC_CHANNEL, channel_io) >= 0);
+}
+
+void dma_channel_free(uint8_t dma_ctrl)
+{
+	uint32_t channel_io[DMA_CHANNEL_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return;
+
+	memset(channel_io, 0, DMA_CHANNEL_DATAIO_SIZE_BYTES);
+	channel_io[DMA_CHANNEL_CTRL_UINTP_POS] = dma_ctrl;
+	ioctl(dma_dev_fd, DMA_IOCTL_FREE_CHANNEL, channel_io);
+	return;
+}
+
+uint32_t dma_get_free_channels(void)
+{
+	uint8_t *pbyte = (uint8_t*) dma_data_io;
+	uint32_t *puint = (uint32_t*) &pbyte[2];
+	pbyte[0] = DMA_CMD_GET_FREE_CHANNELS;
+	pbyte[1] = 0xFF;
+
+	dma_call_kernel();
+	return puint[0];
+}
+
+bool dma_stream_set_tracking(dma_stream_t *p_stream, bool enable)
+{
+	uint32_t stream_io[DMA_STREAM_DATAIO_SIZE_BYTES/4];
+
+	memset(stream_io, 0, DMA_STREAM_DATAIO_SIZE_BYTES);
+	stream_io[DMA_STREAM_CTRL_UINTP_POS] = p_stream->dma_ctrl;
+
+	if(enable)
+	{
+		stream_io[DMA_STREAM_HANDLE_UINTP_POS] = p_stream->buffer.handle;
+		stream_io[DMA_STREAM_CURSOR_OFFSET_UINTP_POS] = 0;
+		stream_io[DMA_STREAM_FIRST_CTRLBLOCK_UINTP_POS] = dma_buffer_get_bus_addr(&p_stream->buffer, p_stream->ctrlblock);
+		stream_io[DMA_STREAM_N_PERIODS_UINTP_POS] = p_stream->n_periods;
+	}
+
+	return (ioctl(dma_dev_fd, DMA_IOCTL_SET_STREAM, stream_io) >= 0);
+}
+
+bool dma_stream_create(dma_stream_t *p_stream, uint8_t dma_ctrl, uint8_t permap, uint32_t dst_addr, uint32_t period_bytes, uint32_t n_periods)
+{
+	uint32_t data_offset = DMA_STREAM_CURSOR_AREA_SIZE_BYTES + n_periods*DMA_STREAM_CTRLBLOCK_STRIDE_BYTES;
+	uint32_t n_period = 0;
+
+	if(dma_ctrl > DMA_LITE_CH7) return false;
+	if((period_bytes == 0) || (period_bytes > DMA_STREAM_MAX_PERIOD_BYTES) || (period_bytes & 0x3)) return false;
+	if((n_periods < 2) || (n_periods > DMA_STREAM_MAX_PERIODS)) return false;
+
+	memset(p_stream, 0, sizeof(dma_stream_t));
+	if(!dma_buffer_alloc(&p_stream->buffer, data_offset + n_periods*period_bytes)) return false;
+
+	p_stream->dma_ctrl = dma_ctrl;
+	p_stream->period_bytes = period_bytes;
+	p_stream->n_periods = n_periods;
+	p_stream->cursor = (volatile uint32_t*) p_stream->buffer.virt;
+	p_stream->ctrlblock = (dma_ctrlblock_t*) (((uint8_t*) p_stream->buffer.virt) + DMA_STREAM_CURSOR_AREA_SIZE_BYTES);
+	p_stream->data = ((uint8_t*) p_stream->buffer.virt) + data_offset;
+
+	//Ring of periods: every control block writes one period to the peripheral, paced by its DREQ, raises an interrupt and moves on to the next one.
+	while(n_period < n_periods)
+	{
+		dma_reset_ctrlblock(&p_stream->ctrlblock[n_period]);
+		dma_set_permap(&p_stream->ctrlblock[n_period], permap);
+		dma_set_dreq_calls_dst_writes(&p_stream->ctrlblock[n_period], true);
+		dma_enable_src_addr_inc(&p_stream->ctrlblock[n_period], true);
+		dma_enable_wait_write_response(&p_stream->ctrlblock[n_period], true);
+		dma_enable_intr(&p_stream->ctrlblock[n_period], true);
+		dma_set_src_addr_phys(&p_stream->ctrlblock[n_period], dma_buffer_get_bus_addr(&p_stream->buffer, p_stream->data + n_period*period_bytes));
+		dma_set_dst_addr_phys(&p_stream->ctrlblock[n_period], dst_addr);
+		dma_set_transfer_length_bytes(&p_stream->ctrlblock[n_period], (uint16_t) period_bytes);
+		dma_set_next_ctrlblock_addr_phys(&p_stream->ctrlblock[n_period], dma_buffer_get_bus_addr(&p_stream->buffer, &p_stream->ctrlblock[(n_period + 1)%n_periods]));
+		n_period++;
+	}
+
+	return true;
+}
+
+void dma_stream_destroy(dma_stream_t *p_stream)
+{
+	dma_stream_stop(p_stream);
+	dma_buffer_free(&p_stream->buffer);
+	memset(p_stream, 0, sizeof(dma_stream_t));
+	return;
+}
+
+bool dma_stream_start(dma_stream_t *p_stream)
+{
+	if(p_stream->buffer.virt == NULL) return false;
+	if(p_stream->running) return true;
+
+	if(!dma_stream_set_tracking(p_stream, true)) return false;
+
+	dma_enable_ctrl(p_stream->dma_ctrl, true);
+	dma_set_ctrlblock_addr_phys(p_stream->dma_ctrl, dma_buffer_get_bus_addr(&p_stream->buffer, p_stream->ctrlblock));
+	dma_set_transfer_active(p_stream->dma_ctrl, true);
+
+	p_stream->running = true;
+	return true;
+}
+
+void dma_stream_stop(dma_stream_t *p_stream)
+{
+	if(!p_stream->running) return;
+
+	dma_set_transfer_active(p_stream->dma_ctrl, false);
+	dma_abort(p_stream->dma_ctrl);
+	dma_reset(p_stream->dma_ctrl);
+	dma_stream_set_tracking(p_stream, false);
+
+	//A new start plays the ring from its first period again.
+	p_stream->cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS] = 0;
+	p_stream->cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS] = 0;
+	p_stream->running = false;
+	return;
+}
+
+uint32_t dma_stream_get_free_periods(dma_stream_t *p_stream)
+{
+	uint32_t producer = p_stream->cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS];
+	uint32_t consumer = __atomic_load_n(&p_stream->cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS], __ATOMIC_ACQUIRE);
+
+	//After an underrun, the producer may be behind the consumer. Those periods are lost, the whole ring is free.
+	if(((int32_t) (producer - consumer)) < 0) return p_stream->n_periods;
+
+	return (p_stream->n_periods - (producer - consumer));
+}
+
+void *dma_stream_get_write_period(dma_stream_t *p_stream)
+{
+	uint32_t producer = p_stream->cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS];
+	uint32_t consumer = __atomic_load_n(&p_stream->cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS], __ATOMIC_ACQUIRE);
+
+	if(dma_stream_get_free_periods(p_stream) == 0) return NULL;
+
+	//Skips the periods lost in an underrun, so the producer writes ahead of the channel again.
+	if(((int32_t) (producer - consumer)) < 0)
+	{
+		producer = consumer;
+		p_stream->cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS] = producer;
+	}
+
+	//While the channel plays period "consumer", that period is not free. A running stream always leaves it alone.
+	if(p_stream->running && (producer == consumer)) producer++;
+
+	p_stream->write_period = producer;
+	return (p_stream->data + (producer%p_stream->n_periods)*p_stream->period_bytes);
+}
+
+void dma_stream_commit_period(dma_stream_t *p_stream)
+{
+	__atomic_store_n(&p_stream->cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS], p_stream->write_period + 1, __ATOMIC_RELEASE);
+	return;
+}
+
+int dma_stream_wait(dma_stream_t *p_stream, uint32_t timeout_us)
+{
+	uint32_t n_free = dma_stream_get_free_periods(p_stream);
+
+	if(n_free) return (int) n_free;
+	if(!p_stream->running) return -1;
+
+	if(dma_wait(p_stream->dma_ctrl, timeout_us) < 0) return -1;
+	return (int) dma_stream_get_free_periods(p_stream);
+}
+
+uint32_t dma_stream_get_position(dma_stream_t *p_stream)
+{
+	return __atomic_load_n(&p_stream->cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS], __ATOMIC_ACQUIRE);
+}
+
+uint32_t dma_stream_get_underruns(dma_stream_t *p_stream)
+{
+	return p_stream->cursor[DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS];
+}
+
+bool dma_get_channel_snapshot(uint8_t dma_ctrl, dma_channel_snapshot_t *p_snapshot)
+{
+	uint32_t snapshot_io[DMA_SNAPSHOT_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return false;
+
+	snapshot_io[DMA_SNAPSHOT_CTRL_UINTP_POS] = dma_ctrl;
+	if(ioctl(dma_dev_fd, DMA_IOCTL_GET_SNAPSHOT, snapshot_io) < 0) return false;
+
+	memcpy(p_snapshot, &snapshot_io[DMA_SNAPSHOT_REGS_UINTP_POS], DMA_SNAPSHOT_REGS_SIZE_BYTES);
+	return true;
+}
+
+bool dma_get_snapshot(dma_snapshot_t *p_snapshot)
+{
+	uint32_t snapshot_io[DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES/4];
+
+	if(dma_dev_fd < 0) return false;
+
+	if(ioctl(dma_dev_fd, DMA_IOCTL_GET_SNAPSHOT_ALL, snapshot_io) < 0) return false;
+
+	p_snapshot->intr_status = snapshot_io[DMA_SNAPSHOT_ALL_INTR_STATUS_UINTP_POS];
+	p_snapshot->enable = snapshot_io[DMA_SNAPSHOT_ALL_ENABLE_UINTP_POS];
+	memcpy(p_snapshot->channel, &snapshot_io[DMA_SNAPSHOT_ALL_REGS_UINTP_POS], 15*DMA_SNAPSHOT_REGS_SIZE_BYTES);
+	return true;
+}
+
+bool dma_snapshot_ctrl_is_enabled(const dma_snapshot_t *p_snapshot, uint8_t dma_ctrl)
+{
+	if(dma_ctrl > DMA_LITE_CH7) return false;
+
+	return ((p_snapshot->enable & (1 << dma_ctrl)) != 0);
+}
+
+bool dma_snapshot_get_channel_intr_status(const dma_snapshot_t *p_snapshot, uint8_t dma_ctrl)
+{
+	if(dma_ctrl > DMA_LITE_CH7) return false;
+
+	return ((p_snapshot->intr_status & (1 << dma_ctrl)) != 0);
+}
+
+bool dma_snapshot_is_type_lite(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug & (1 << 28)) != 0);
+}
+
+bool dma_snapshot_get_transfer_active(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & 0x1) != 0);
+}
+
+bool dma_snapshot_transfer_done(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 1)) != 0);
+}
+
+bool dma_snapshot_get_intr_status(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 2)) != 0);
+}
+
+bool dma_snapshot_is_requesting_data(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 3)) != 0);
+}
+
+bool dma_snapshot_is_paused(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 4)) != 0);
+}
+
+bool dma_snapshot_is_paused_by_inactive_dreq(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 5)) != 0);
+}
+
+bool dma_snapshot_is_waiting_ostd_writes(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 6)) != 0);
+}
+
+bool dma_snapshot_error_occurred(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 8)) != 0);
+}
+
+uint32_t dma_snapshot_get_priority(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status >> 16) & 0xF);
+}
+
+uint32_t dma_snapshot_get_panic_priority(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status >> 20) & 0xF);
+}
+
+bool dma_snapshot_wait_ostd_writes_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 28)) != 0);
+}
+
+bool dma_snapshot_debug_pause_is_disabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->ctrl_status & (1 << 29)) != 0);
+}
+
+bool dma_snapshot_wide_bursts_is_disabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return false;
+	return ((p_snapshot->transfer_info & (1 << 26)) != 0);
+}
+
+uint32_t dma_snapshot_get_wait_cycles(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info >> 21) & 0x1F);
+}
+
+uint32_t dma_snapshot_get_permap(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info >> 16) & 0x1F);
+}
+
+uint32_t dma_snapshot_get_burst_length(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info >> 12) & 0xF);
+}
+
+bool dma_snapshot_ignore_src_reads_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return false;
+	return ((p_snapshot->transfer_info & (1 << 11)) != 0);
+}
+
+bool dma_snapshot_get_dreq_calls_src_reads(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 10)) != 0);
+}
+
+bool dma_snapshot_src_read_128bit_width_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 9)) != 0);
+}
+
+bool dma_snapshot_src_addr_inc_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 8)) != 0);
+}
+
+bool dma_snapshot_ignore_dst_writes_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return false;
+	return ((p_snapshot->transfer_info & (1 << 7)) != 0);
+}
+
+bool dma_snapshot_get_dreq_calls_dst_writes(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 6)) != 0);
+}
+
+bool dma_snapshot_dst_write_128bit_width_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 5)) != 0);
+}
+
+bool dma_snapshot_dst_addr_inc_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 4)) != 0);
+}
+
+bool dma_snapshot_wait_write_response_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & (1 << 3)) != 0);
+}
+
+bool dma_snapshot_tdmode_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return false;
+	return ((p_snapshot->transfer_info & (1 << 1)) != 0);
+}
+
+bool dma_snapshot_intr_is_enabled(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->transfer_info & 0x1) != 0);
+}
+
+uint32_t dma_snapshot_get_transfer_length_bytes(const dma_channel_snapshot_t *p_snapshot)
+{
+	return (p_snapshot->transfer_length & 0xFFFF);
+}
+
+uint32_t dma_snapshot_get_transfer_length_ext(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return 0;
+	return ((p_snapshot->transfer_length >> 16) & 0x3FFF);
+}
+
+uint32_t dma_snapshot_get_src_stride(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return 0;
+	return (p_snapshot->stride & 0xFFFF);
+}
+
+uint32_t dma_snapshot_get_dst_stride(const dma_channel_snapshot_t *p_snapshot)
+{
+	if(dma_snapshot_is_type_lite(p_snapshot)) return 0;
+	return ((p_snapshot->stride >> 16) & 0xFFFF);
+}
+
+uint32_t dma_snapshot_debug_get_version(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug >> 25) & 0x7);
+}
+
+uint32_t dma_snapshot_debug_get_state(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug >> 16) & 0x1FF);
+}
+
+uint32_t dma_snapshot_debug_get_id(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug >> 8) & 0xFF);
+}
+
+uint32_t dma_snapshot_debug_get_ostd_writes_counter(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug >> 4) & 0xF);
+}
+
+bool dma_snapshot_debug_get_read_error(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug & (1 << 2)) != 0);
+}
+
+bool dma_snapshot_debug_get_fifo_error(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug & (1 << 1)) != 0);
+}
+
+bool dma_snapshot_debug_readlast_not_set_error(const dma_channel_snapshot_t *p_snapshot)
+{
+	return ((p_snapshot->debug & 0x1) != 0);
+}
+
+bool dma_event_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(dma_event_fd >= 0) close(dma_event_fd);
+		dma_event_fd = -1;
+		return true;
+	}
+
+	if(dma_event_fd >= 0) return true;
+
+	dma_event_fd = open(DMA_EVENT_DEV_FILE_DIR, (O_RDONLY | O_NONBLOCK));
+	return (dma_event_fd >= 0);
+}
+
+int dma_event_get_fd(void)
+{
+	return dma_event_fd;
+}
+
+int dma_event_read(dma_event_t *events, int max_events, int timeout_ms)
+{
+	struct pollfd event_pollfd;
+	ssize_t n_bytes = 0;
+
+	if((dma_event_fd < 0) || (events == NULL) || (max_events <= 0)) return -1;
+
+	if(timeout_ms != 0)
+	{
+		event_pollfd.fd = dma_event_fd;
+		event_pollfd.events = POLLIN;
+		event_pollfd.revents = 0;
+		if(poll(&event_pollfd, 1, timeout_ms) <= 0) return 0;
+	}
+
+	n_bytes = read(dma_event_fd, events, (max_events*sizeof(dma_event_t)));
+	if(n_bytes < 0) return 0;
+
+	return (n_bytes/sizeof(dma_event_t));
+}
+
 bool dma_get_type(uint8_t dma_ctrl)
 {
 	if(dma_ctrl > DMA_LITE_CH7) return false;
@@ -658,6 +1375,18 @@ uint32_t dma_get_dst_stride(uint8_t dma_ctrl)
 	return puint[0];
 }
 
+void dma_set_channel_next_ctrlblock_addr_phys(uint8_t dma_ctrl, uint32_t addr)
+{
+	uint8_t *pbyte = (uint8_t*) dma_data_io;
+	uint32_t *puint = (uint32_t*) &pbyte[2];
+	pbyte[0] = DMA_CMD_SET_NEXTCB_ADDR;
+	pbyte[1] = dma_ctrl;
+	puint[0] = addr;
+
+	dma_call_kernel();
+	return;
+}
+
 uint32_t dma_get_next_ctrlblock_addr_phys(uint8_t dma_ctrl)
 {
 	uint8_t *pbyte = (uint8_t*) dma_data_io;
@@ -757,6 +1486,29 @@ bool dma_debug_readlast_not_set_error(uint8_t dma_ctrl)
 	return (puint[0] & 0x00000001);
 }
 
+void dma_set_irq_coalesce(uint8_t dma_ctrl, uint32_t n_irqs)
+{
+	uint8_t *pbyte = (uint8_t*) dma_data_io;
+	uint32_t *puint = (uint32_t*) &pbyte[2];
+	pbyte[0] = DMA_CMD_SET_IRQ_COALESCE;
+	pbyte[1] = dma_ctrl;
+	puint[0] = n_irqs;
+
+	dma_call_kernel();
+	return;
+}
+
+uint32_t dma_get_irq_coalesce(uint8_t dma_ctrl)
+{
+	uint8_t *pbyte = (uint8_t*) dma_data_io;
+	uint32_t *puint = (uint32_t*) &pbyte[2];
+	pbyte[0] = DMA_CMD_GET_IRQ_COALESCE;
+	pbyte[1] = dma_ctrl;
+
+	dma_call_kernel();
+	return puint[0];
+}
+
 void dma_disable_wide_bursts(dma_ctrlblock_t *p_ctrlblock, bool disable)
 {
 	p_ctrlblock->transfer_info &= ~(1 << 26);
@@ -74,12 +74,197 @@ typedef struct {
 	uint32_t unused_1;
 } dma_ctrlblock_t;
 
+//Physically contiguous, cache coherent buffer allocated by the driver.
+//"virt" is the user space mapping. "bus_addr" is the bus address of "virt" in the uncached 0xC0000000 alias, ready to be written to control blocks.
+typedef struct {
+	void *virt;
+	uint32_t bus_addr;
+	uint32_t size;
+	uint32_t handle;
+} dma_buffer_t;
+
+//Channel allocation flags.
+//"DMA_CHANNEL_ALLOC_TDMODE": the job uses 2D mode. "DMA_CHANNEL_ALLOC_FULL_LENGTH": the job needs transfer lengths over 65535 bytes. Both require a STD channel.
+//"DMA_CHANNEL_ALLOC_LITE_OK": a LITE channel is acceptable (and preferred, to keep STD channels free). "DMA_CHANNEL_ALLOC_WAIT": wait for a channel to be released if none fits.
+#define DMA_CHANNEL_ALLOC_TDMODE 0x1
+#define DMA_CHANNEL_ALLOC_FULL_LENGTH 0x2
+#define DMA_CHANNEL_ALLOC_LITE_OK 0x4
+#define DMA_CHANNEL_ALLOC_WAIT 0x8
+
+#define DMA_STREAM_MAX_PERIOD_BYTES 0xFFFC
+#define DMA_STREAM_MAX_PERIODS 1024
+
+//Cyclic stream to a DREQ paced peripheral. Filled by "dma_stream_create()", only read by the application.
+//"cursor" is shared with the driver: the application advances the producer count, the driver advances the consumer count (periods played) and the underrun count from the channel interrupt.
+typedef struct {
+	uint8_t dma_ctrl;
+	uint32_t period_bytes;
+	uint32_t n_periods;
+	dma_buffer_t buffer;
+	volatile uint32_t *cursor;
+	dma_ctrlblock_t *ctrlblock;
+	uint8_t *data;
+	uint32_t write_period;
+	bool running;
+} dma_stream_t;
+
+//Registers of one channel, read in one go by the driver ("dma_get_channel_snapshot()"). Decode them with the "dma_snapshot_" functions.
+//The fields follow the register order of the channel: CS, CONBLK_AD, TI, SOURCE_AD, DEST_AD, TXFR_LEN, STRIDE, NEXTCONBK, DEBUG.
+typedef struct {
+	uint32_t ctrl_status;
+	uint32_t ctrlblock_addr;
+	uint32_t transfer_info;
+	uint32_t src_addr;
+	uint32_t dst_addr;
+	uint32_t transfer_length;
+	uint32_t stride;
+	uint32_t next_ctrlblock_addr;
+	uint32_t debug;
+} dma_channel_snapshot_t;
+
+//Registers of all channels plus the global INTR_STATUS and ENABLE registers ("dma_get_snapshot()").
+typedef struct {
+	uint32_t intr_status;
+	uint32_t enable;
+	dma_channel_snapshot_t channel[15];
+} dma_snapshot_t;
+
+#define DMA_EVENT_FLAG_ERROR 0x1
+#define DMA_EVENT_FLAG_CHAIN_END 0x2
+
+//Completion event, as queued by the driver.
+//"timestamp_us" is the kernel monotonic clock (microseconds) when the interrupt was handled.
+//"n_irqs" is the number of completion interrupts reported by this event (more than 1 with interrupt coalescing).
+typedef struct {
+	uint64_t timestamp_us;
+	uint8_t dma_ctrl;
+	uint8_t flags;
+	uint8_t reserved[2];
+	uint32_t n_irqs;
+} dma_event_t;
+
 //Returns true if "dma_init()" has already been called.
 bool dma_is_active(void);
 //Initializes DMA procedure.
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool dma_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool dma_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool dma_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/DMA_Ctrl" instead of write()/read() calls on the proc file.
+bool dma_ioctl_is_enabled(void);
+//Allocates a physically contiguous, cache coherent buffer of "size" bytes (rounded up to a multiple of the page size) and maps it into "p_buffer->virt".
+//The buffer is zeroed. No address translation is needed for it: use "dma_buffer_get_bus_addr()" and the "_phys" functions.
+//Requires "/dev/DMA_Ctrl". Returns true if successful.
+bool dma_buffer_alloc(dma_buffer_t *p_buffer, uint32_t size);
+//Unmaps and releases a buffer allocated with "dma_buffer_alloc()". The buffer must not be in use by any DMA channel.
+void dma_buffer_free(dma_buffer_t *p_buffer);
+//Returns the bus address of "p", which must point inside "p_buffer".
+uint32_t dma_buffer_get_bus_addr(const dma_buffer_t *p_buffer, const void *p);
+//Sleeps until channel "dma_ctrl" raises a completion interrupt (a control block with "dma_enable_intr()" set) or an error, for up to "timeout_us" microseconds (0 waits indefinitely).
+//Interrupts raised since the previous call (or since "dma_init()") return immediately. The interrupt flag is cleared by the driver.
+//Returns the number of completion interrupts since the previous call, 0 on timeout, or -1 on error (transfer error, channel IRQ unavailable, or no "/dev/DMA_Ctrl").
+int dma_wait(uint8_t dma_ctrl, uint32_t timeout_us);
+//Reserves a free channel that fits "flags" (DMA_CHANNEL_ALLOC_*). Channels are spread over all engines the driver may hand out (channels of the kernel DMA engine are excluded).
+//With DMA_CHANNEL_ALLOC_WAIT, waits up to "timeout_us" microseconds (0 waits indefinitely) for a fitting channel to be released.
+//The channel is released (and reset) by "dma_channel_free()" or when the application exits. Requires "/dev/DMA_Ctrl".
+//Returns the channel (DMA_STD_CH0 to DMA_LITE_CH7), or -1 if no channel fits.
+int dma_channel_alloc(uint32_t flags, uint32_t timeout_us);
+//Same as "dma_channel_alloc()", for one specific channel. Returns true if "dma_ctrl" was reserved.
+bool dma_channel_reserve(uint8_t dma_ctrl, uint32_t flags, uint32_t timeout_us);
+//Releases a channel reserved by this application. The channel is reset.
+void dma_channel_free(uint8_t dma_ctrl);
+//Returns the channels that can be reserved right now (bit n = channel n).
+uint32_t dma_get_free_channels(void);
+//Creates a cyclic stream of "n_periods" periods (2 to DMA_STREAM_MAX_PERIODS) of "period_bytes" bytes each (multiple of 4, up to DMA_STREAM_MAX_PERIOD_BYTES) on channel "dma_ctrl".
+//Each period is written to the peripheral bus address "dst_addr" (not incremented), paced by the DREQ "permap" (DMA_PERMAP_*), and raises a completion interrupt. After the last period, the ring starts over.
+//The channel should be reserved with "dma_channel_alloc()" first. Requires "/dev/DMA_Ctrl". Returns true if successful.
+bool dma_stream_create(dma_stream_t *p_stream, uint8_t dma_ctrl, uint8_t permap, uint32_t dst_addr, uint32_t period_bytes, uint32_t n_periods);
+//Stops the stream (if running) and releases its buffer.
+void dma_stream_destroy(dma_stream_t *p_stream);
+//Attaches the stream cursor to the driver and starts the channel from the first period.
+//Fill at least one period before starting, or the first periods are counted as underruns.
+bool dma_stream_start(dma_stream_t *p_stream);
+//Stops the channel immediately and rewinds the stream. The underrun count is kept until the next start.
+void dma_stream_stop(dma_stream_t *p_stream);
+//Returns the number of periods that can be written right now.
+uint32_t dma_stream_get_free_periods(dma_stream_t *p_stream);
+//Returns the next period to be written ("period_bytes" bytes), or NULL if the ring is full.
+//If the application fell behind (underrun), the lost periods are skipped.
+void *dma_stream_get_write_period(dma_stream_t *p_stream);
+//Hands the period returned by "dma_stream_get_write_period()" to the DMA controller.
+void dma_stream_commit_period(dma_stream_t *p_stream);
+//Sleeps until at least one period is free, for up to "timeout_us" microseconds (0 waits indefinitely).
+//Returns the number of free periods, 0 on timeout, or -1 on error (transfer error, or the stream is stopped with a full ring).
+int dma_stream_wait(dma_stream_t *p_stream, uint32_t timeout_us);
+//Returns the number of periods played since the stream was started.
+uint32_t dma_stream_get_position(dma_stream_t *p_stream);
+//Returns the number of periods the channel played without fresh data, since the stream was last started.
+uint32_t dma_stream_get_underruns(dma_stream_t *p_stream);
+//Reads all registers of channel "dma_ctrl" with one system call. The values are mutually consistent: no command or interrupt handler of that channel runs while they are read.
+//Requires "/dev/DMA_Ctrl". Returns true if successful.
+bool dma_get_channel_snapshot(uint8_t dma_ctrl, dma_channel_snapshot_t *p_snapshot);
+//Reads the registers of all 15 channels plus INTR_STATUS and ENABLE with one system call. Each channel is consistent by itself.
+//Requires "/dev/DMA_Ctrl". Returns true if successful.
+bool dma_get_snapshot(dma_snapshot_t *p_snapshot);
+//Snapshot decoders. They work like the register getters of the same name, but on a snapshot, without calling the driver.
+//Flags cleared by reading through the getters (END, INT, DEBUG errors) are only reported here, never cleared.
+bool dma_snapshot_ctrl_is_enabled(const dma_snapshot_t *p_snapshot, uint8_t dma_ctrl);
+bool dma_snapshot_get_channel_intr_status(const dma_snapshot_t *p_snapshot, uint8_t dma_ctrl);
+bool dma_snapshot_is_type_lite(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_get_transfer_active(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_transfer_done(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_get_intr_status(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_is_requesting_data(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_is_paused(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_is_paused_by_inactive_dreq(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_is_waiting_ostd_writes(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_error_occurred(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_priority(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_panic_priority(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_wait_ostd_writes_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_debug_pause_is_disabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_wide_bursts_is_disabled(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_wait_cycles(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_permap(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_burst_length(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_ignore_src_reads_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_get_dreq_calls_src_reads(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_src_read_128bit_width_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_src_addr_inc_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_ignore_dst_writes_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_get_dreq_calls_dst_writes(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_dst_write_128bit_width_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_dst_addr_inc_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_wait_write_response_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_tdmode_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_intr_is_enabled(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_transfer_length_bytes(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_transfer_length_ext(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_src_stride(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_get_dst_stride(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_debug_get_version(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_debug_get_state(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_debug_get_id(const dma_channel_snapshot_t *p_snapshot);
+uint32_t dma_snapshot_debug_get_ostd_writes_counter(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_debug_get_read_error(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_debug_get_fifo_error(const dma_channel_snapshot_t *p_snapshot);
+bool dma_snapshot_debug_readlast_not_set_error(const dma_channel_snapshot_t *p_snapshot);
+//Opens the completion event queue of this application (enable = true) or closes it (enable = false).
+//While open, every completion reported by any channel is queued with a timestamp.
+//Returns true if successful.
+bool dma_event_enable(bool enable);
+//Returns the file descriptor of the event queue (for poll()/epoll), or -1 if it's not open.
+int dma_event_get_fd(void);
+//Reads up to "max_events" queued events into "events".
+//Waits up to "timeout_ms" milliseconds for the first event. timeout_ms = 0 doesn't wait, timeout_ms < 0 waits indefinitely.
+//Returns the number of events read, or -1 if the event queue is not open.
+int dma_event_read(dma_event_t *events, int max_events, int timeout_ms);
 
 void dma_reset_ctrlblock(dma_ctrlblock_t *p_ctrlblock);
 void dma_enable_ctrl(uint8_t dma_ctrl, bool enable);
@@ -129,6 +314,9 @@ uint32_t dma_get_transfer_length_bytes(uint8_t dma_ctrl);
 uint32_t dma_get_transfer_length_ext(uint8_t dma_ctrl);
 uint32_t dma_get_src_stride(uint8_t dma_ctrl);
 uint32_t dma_get_dst_stride(uint8_t dma_ctrl);
+//Writes the NEXTCONBK register of channel "dma_ctrl". The channel copies it from each control block it loads, so relinking a control block in memory has no effect once it is loaded.
+//This changes the control block that follows the loaded one instead. Only valid while the channel is paused ("dma_set_transfer_active(dma_ctrl, false)", then wait for "dma_is_paused()").
+void dma_set_channel_next_ctrlblock_addr_phys(uint8_t dma_ctrl, uint32_t addr);
 uint32_t dma_get_next_ctrlblock_addr_phys(uint8_t dma_ctrl);
 bool dma_debug_is_type_lite(uint8_t dma_ctrl);
 uint32_t dma_debug_get_version(uint8_t dma_ctrl);
@@ -138,6 +326,10 @@ uint32_t dma_debug_get_ostd_writes_counter(uint8_t dma_ctrl);
 bool dma_debug_get_read_error(uint8_t dma_ctrl);
 bool dma_debug_get_fifo_error(uint8_t dma_ctrl);
 bool dma_debug_readlast_not_set_error(uint8_t dma_ctrl);
+//Interrupt coalescing: completions of channel "dma_ctrl" are only reported every "n_irqs" interrupts, or earlier at the end of the chain or on error.
+//Useful for long chains with interrupts enabled on every control block. 0 or 1 reports every interrupt.
+void dma_set_irq_coalesce(uint8_t dma_ctrl, uint32_t n_irqs);
+uint32_t dma_get_irq_coalesce(uint8_t dma_ctrl);
 
 void dma_disable_wide_bursts(dma_ctrlblock_t *p_ctrlblock, bool disable);
 void dma_set_wait_cycles(dma_ctrlblock_t *p_ctrlblock, uint8_t wait_cycles);
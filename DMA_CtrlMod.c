@@ -5,8 +5,21 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
+#include <linux/of.h>
+#include <linux/of_irq.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 
 #define DMA_TYPE_STD 0
@@ -96,15 +109,309 @@
 #define DMA_CMD_DEBUG_GET_READ_ERROR 52
 #define DMA_CMD_DEBUG_GET_FIFO_ERROR 53
 #define DMA_CMD_DEBUG_GET_READLASTNOTSET_ERROR 54
+#define DMA_CMD_SET_IRQ_COALESCE 55
+#define DMA_CMD_GET_IRQ_COALESCE 56
+#define DMA_CMD_GET_FREE_CHANNELS 57
+#define DMA_CMD_SET_NEXTCB_ADDR 58
 
+#define DMA_CMD_RING_DOORBELL 0xFE
 #define DMA_CMD_KERNEL_RESPONSE 0xFF
 
+#define DMA_IOCTL_MAGIC 'd'
+#define DMA_IOCTL_RUN_CMD _IOWR(DMA_IOCTL_MAGIC, 0, unsigned char[DMA_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_ALLOC_BUFFER _IOWR(DMA_IOCTL_MAGIC, 1, unsigned char[DMA_BUFFER_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_FREE_BUFFER _IOW(DMA_IOCTL_MAGIC, 2, unsigned char[DMA_BUFFER_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_WAIT _IOWR(DMA_IOCTL_MAGIC, 3, unsigned char[DMA_WAIT_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_ALLOC_CHANNEL _IOWR(DMA_IOCTL_MAGIC, 4, unsigned char[DMA_CHANNEL_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_FREE_CHANNEL _IOW(DMA_IOCTL_MAGIC, 5, unsigned char[DMA_CHANNEL_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_SET_STREAM _IOW(DMA_IOCTL_MAGIC, 6, unsigned char[DMA_STREAM_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_GET_SNAPSHOT _IOWR(DMA_IOCTL_MAGIC, 7, unsigned char[DMA_SNAPSHOT_DATAIO_SIZE_BYTES])
+#define DMA_IOCTL_GET_SNAPSHOT_ALL _IOR(DMA_IOCTL_MAGIC, 8, unsigned char[DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES])
+
+/*
+ * DMA Buffer Command Structure (DMA_BUFFER_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only):
+ *
+ * UINT0: SIZE IN BYTES (written by user, rounded up to a multiple of PAGE_SIZE by kernel)
+ * UINT1: HANDLE (written by kernel on DMA_IOCTL_ALLOC_BUFFER, written by user on DMA_IOCTL_FREE_BUFFER)
+ * UINT2: BUS ADDRESS (written by kernel)
+ * UINT3: MMAP OFFSET IN PAGES (written by kernel)
+ *
+ * Buffers are physically contiguous and cache coherent (dma_alloc_coherent()).
+ * The bus address is given in the uncached 0xC0000000 alias, so it can be written directly to control blocks.
+ * The buffer is mapped into user space with mmap() on the same file, at offset (MMAP OFFSET*PAGE_SIZE).
+ * Buffers belong to the file they were allocated with. They are released with DMA_IOCTL_FREE_BUFFER or when that file is closed.
+ * DMA_IOCTL_FREE_BUFFER returns -EBUSY while the buffer is still mapped (munmap() it first) or used by a stream.
+ */
+
+#define DMA_BUFFER_DATAIO_SIZE_BYTES 16
+#define DMA_BUFFER_MAX_SIZE_BYTES 0x1000000
+
+#define DMA_BUFFER_SIZE_UINTP_POS 0
+#define DMA_BUFFER_HANDLE_UINTP_POS 1
+#define DMA_BUFFER_BUS_ADDR_UINTP_POS 2
+#define DMA_BUFFER_MMAP_PGOFF_UINTP_POS 3
+
+#define DMA_BUFFER_BUS_ALIAS_UNCACHED 0xC0000000
+
+/*
+ * DMA Wait Structure (DMA_WAIT_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only):
+ *
+ * UINT0: DMA CTRL (written by user)
+ * UINT1: TIMEOUT IN MICROSECONDS (written by user). 0 waits indefinitely.
+ * UINT2: COMPLETIONS (written by kernel)
+ * UINT3: ERRORS (written by kernel)
+ *
+ * The driver requests the IRQ of every channel outside the kernel DMA engine pool ("brcm,dma-channel-mask" in the device tree) and counts completion interrupts (control blocks with INTEN set) and errors per channel.
+ * DMA_IOCTL_WAIT sleeps until the channel reports completions or errors this file has not seen yet, and returns how many.
+ * Everything reported before the file was opened, or before the channel was reserved with DMA_IOCTL_ALLOC_CHANNEL, counts as seen.
+ * Returns -ETIMEDOUT on timeout, or -ENODEV if the IRQ of that channel could not be requested (or belongs to the kernel DMA engine).
+ *
+ * Interrupt coalescing (DMA_CMD_SET_IRQ_COALESCE, ARG = number of interrupts):
+ * Completions are reported (to waiters and to the event queue) every ARG interrupts, or earlier if the channel went idle (end of the chain) or has an error.
+ * 0 or 1 reports every interrupt.
+ */
+
+#define DMA_WAIT_DATAIO_SIZE_BYTES 16
+
+#define DMA_WAIT_CTRL_UINTP_POS 0
+#define DMA_WAIT_TIMEOUT_UINTP_POS 1
+#define DMA_WAIT_COMPLETIONS_UINTP_POS 2
+#define DMA_WAIT_ERRORS_UINTP_POS 3
+
+/*
+ * DMA Completion Event Structure (DMA_EVENT_SIZE_BYTES, read from "/dev/DMA_Event"):
+ *
+ * BYTES 0 to 7: TIMESTAMP (microseconds, monotonic clock)
+ * BYTE8: DMA CTRL
+ * BYTE9: FLAGS (DMA_EVENT_FLAG_*)
+ * BYTES 10 to 11: RESERVED
+ * BYTES 12 to 15 (1 UINT): NUMBER OF INTERRUPTS REPORTED BY THIS EVENT (more than 1 with interrupt coalescing)
+ *
+ * Every opener of "/dev/DMA_Event" gets its own ring of DMA_EVENT_RING_ENTRIES events, for all channels. If a ring is full, new events are dropped for that opener.
+ * A read() returns as many whole events as fit in the buffer. It blocks until at least one event is queued, unless O_NONBLOCK is set.
+ */
+
+#define DMA_EVENT_SIZE_BYTES 16
+#define DMA_EVENT_RING_ENTRIES 1024
+
+#define DMA_EVENT_FLAG_ERROR 0x1
+#define DMA_EVENT_FLAG_CHAIN_END 0x2
+
+/*
+ * DMA Channel Allocation Structure (DMA_CHANNEL_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only):
+ *
+ * UINT0: FLAGS (written by user, DMA_CHANNEL_ALLOC_FLAG_*)
+ * UINT1: TIMEOUT IN MICROSECONDS (written by user, with DMA_CHANNEL_ALLOC_FLAG_WAIT). 0 waits indefinitely.
+ * UINT2: DMA CTRL (written by kernel on DMA_IOCTL_ALLOC_CHANNEL, written by user on DMA_IOCTL_FREE_CHANNEL or with DMA_CHANNEL_ALLOC_FLAG_SPECIFIC)
+ * UINT3: RESERVED
+ *
+ * Only channels in the allocation mask are handed out. It is set by the "channel_mask" module parameter, or else it is every channel
+ * outside the kernel DMA engine pool ("brcm,dma-channel-mask" in the device tree). If that property can't be read, no channel is handed out.
+ * A channel fits a request if it is free and:
+ * DMA_CHANNEL_ALLOC_FLAG_TDMODE or DMA_CHANNEL_ALLOC_FLAG_FULL_LENGTH: it is a STD channel (LITE channels have no 2D mode and a 16 bit length).
+ * Otherwise: it is a STD channel, or a LITE channel if DMA_CHANNEL_ALLOC_FLAG_LITE_OK is set. LITE channels are preferred then, to keep STD channels for the jobs that need them.
+ * Among fitting channels of the same type, the search starts after the last allocated channel, so jobs spread over all engines.
+ * If no channel fits, returns -EBUSY, or with DMA_CHANNEL_ALLOC_FLAG_WAIT waits for a release (-ETIMEDOUT on timeout).
+ *
+ * Reservations are advisory: they don't restrict the regular commands. Channels belong to the file they were allocated with.
+ * A channel is reset when released with DMA_IOCTL_FREE_CHANNEL or when that file is closed.
+ */
+
+#define DMA_CHANNEL_DATAIO_SIZE_BYTES 16
+
+#define DMA_CHANNEL_FLAGS_UINTP_POS 0
+#define DMA_CHANNEL_TIMEOUT_UINTP_POS 1
+#define DMA_CHANNEL_CTRL_UINTP_POS 2
+
+#define DMA_CHANNEL_ALLOC_FLAG_TDMODE 0x1
+#define DMA_CHANNEL_ALLOC_FLAG_FULL_LENGTH 0x2
+#define DMA_CHANNEL_ALLOC_FLAG_LITE_OK 0x4
+#define DMA_CHANNEL_ALLOC_FLAG_WAIT 0x8
+#define DMA_CHANNEL_ALLOC_FLAG_SPECIFIC 0x10
+
+/*
+ * DMA Stream Structure (DMA_STREAM_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only):
+ *
+ * UINT0: DMA CTRL
+ * UINT1: CURSOR BUFFER HANDLE (0 stops tracking the stream of that channel)
+ * UINT2: CURSOR OFFSET IN BYTES (multiple of 4)
+ * UINT3: FIRST CTRLBLOCK BUS ADDRESS
+ * UINT4: NUMBER OF PERIODS
+ *
+ * A stream is a ring of NUMBER OF PERIODS control blocks, DMA_STREAM_CTRLBLOCK_STRIDE_BYTES apart, starting at FIRST CTRLBLOCK, each one raising an interrupt.
+ * The driver tracks it through the cursor area (DMA_STREAM_CURSOR_SIZE_BYTES), inside a buffer allocated with DMA_IOCTL_ALLOC_BUFFER and mapped by the application:
+ *
+ * UINT0: PRODUCER (written by user): number of periods written since the stream started.
+ * UINT1: CONSUMER (written by kernel): number of periods played since the stream started.
+ * UINT2: UNDERRUNS (written by kernel): number of periods started before the producer had written them.
+ * UINT3: RESERVED
+ *
+ * On every channel interrupt, the period being played is taken from the control block address register. CONSUMER moves forward to it (interrupts may be coalesced),
+ * and if PRODUCER hasn't moved past it, UNDERRUNS is incremented. CONSUMER and UNDERRUNS are cleared when tracking starts.
+ * The channel must not be reserved by another file and its IRQ must be available. The buffer can't be freed while it's tracked.
+ */
+
+#define DMA_STREAM_DATAIO_SIZE_BYTES 20
+#define DMA_STREAM_CURSOR_SIZE_BYTES 16
+#define DMA_STREAM_CTRLBLOCK_STRIDE_BYTES 32
+
+#define DMA_STREAM_CTRL_UINTP_POS 0
+#define DMA_STREAM_HANDLE_UINTP_POS 1
+#define DMA_STREAM_CURSOR_OFFSET_UINTP_POS 2
+#define DMA_STREAM_FIRST_CTRLBLOCK_UINTP_POS 3
+#define DMA_STREAM_N_PERIODS_UINTP_POS 4
+
+#define DMA_STREAM_CURSOR_PRODUCER_UINTP_POS 0
+#define DMA_STREAM_CURSOR_CONSUMER_UINTP_POS 1
+#define DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS 2
+
+/*
+ * DMA Snapshot Structure (DMA_SNAPSHOT_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only):
+ *
+ * UINT0: DMA CTRL (written by user)
+ * UINT1 to UINT9: CHANNEL REGISTERS (written by kernel), in DMA_MAPPING order: CS, CONBLK_AD, TI, SOURCE_AD, DEST_AD, TXFR_LEN, STRIDE, NEXTCONBK, DEBUG
+ *
+ * DMA Full Snapshot Structure (DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES, "/dev/DMA_Ctrl" ioctl only, written by kernel):
+ *
+ * UINT0: INTR STATUS
+ * UINT1: ENABLE
+ * UINT2 onwards: CHANNEL REGISTERS of channels 0 to 14, DMA_MAPPING_SIZE_UINT each, same order as above
+ *
+ * The registers of a channel are read under its channel lock, so no command or interrupt handler of that channel runs in between.
+ * Nothing is written back: flags cleared by writing 1 (INT, END, DEBUG errors) are left as they are.
+ */
+
+#define DMA_SNAPSHOT_DATAIO_SIZE_BYTES (4 + DMA_MAPPING_SIZE_BYTES)
+#define DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES (8 + 15*DMA_MAPPING_SIZE_BYTES)
+
+#define DMA_SNAPSHOT_CTRL_UINTP_POS 0
+#define DMA_SNAPSHOT_REGS_UINTP_POS 1
+
+#define DMA_SNAPSHOT_ALL_INTR_STATUS_UINTP_POS 0
+#define DMA_SNAPSHOT_ALL_ENABLE_UINTP_POS 1
+#define DMA_SNAPSHOT_ALL_REGS_UINTP_POS 2
+
+/*
+ * DMA Command Ring Structure (DMA_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: DMA_RING_ENTRIES entries of DMA_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%DMA_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a DMA_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define DMA_RING_SIZE_BYTES 4096
+#define DMA_RING_HEADER_SIZE_BYTES 16
+#define DMA_RING_ENTRY_SIZE_BYTES 8
+#define DMA_RING_ENTRIES 256
+
+#define DMA_RING_SQ_TAIL_UINTP_POS 0
+#define DMA_RING_SQ_HEAD_UINTP_POS 1
+#define DMA_RING_FLAGS_UINTP_POS 2
+
+#define DMA_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *virt;
+	dma_addr_t dma_handle;
+	size_t size;
+	unsigned int handle;
+	unsigned int n_streams;
+	unsigned int n_maps;
+	struct list_head list;
+} dma_buffer_t;
+
+typedef struct {
+	unsigned int irq;
+	unsigned int coalesce;
+	unsigned int pending;
+	unsigned int completions;
+	unsigned int errors;
+	wait_queue_head_t wait;
+} dma_irq_channel_t;
+
+typedef struct {
+	unsigned long long timestamp;
+	unsigned char dma_ctrl;
+	unsigned char flags;
+	unsigned char reserved[2];
+	unsigned int n_irqs;
+} dma_event_t;
+
+/*
+ * Single producer (IRQ handlers, serialized by dma_event_lock), single consumer (read(), serialized by read_mutex).
+ * "head" is only written by the producer and "tail" only by the consumer.
+ */
+
+typedef struct {
+	dma_event_t *ring;
+	unsigned int head;
+	unsigned int tail;
+	struct mutex read_mutex;
+	wait_queue_head_t wait;
+	struct list_head list;
+} dma_event_ctx_t;
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head buffer_list;
+	unsigned int buffer_next_handle;
+	struct mutex buffer_mutex;
+	unsigned int wait_completions[15];
+	unsigned int wait_errors[15];
+	struct list_head list;
+} dma_file_ctx_t;
+
+typedef struct {
+	dma_file_ctx_t *owner;
+	dma_buffer_t *buffer;
+	unsigned int *cursor;
+	unsigned int first_ctrlblock;
+	unsigned int n_periods;
+	unsigned int period;
+} dma_stream_t;
+
 static struct proc_dir_entry *dma_proc = NULL;
 static unsigned int **dma_std_mapping_group = NULL;
 static unsigned int **dma_lite_mapping_group = NULL;
 static unsigned int *dma_intr_status_reg = NULL;
 static unsigned int *dma_channel_enable_reg = NULL;
-static void *dma_data_io = NULL;
+static spinlock_t dma_ctrl_lock[15];
+static DEFINE_SPINLOCK(dma_channel_enable_lock);
+static struct task_struct *dma_ring_thread = NULL;
+static struct device *dma_buffer_dev = NULL;
+static dma_irq_channel_t dma_irq_channel[15];
+static LIST_HEAD(dma_event_ctx_list);
+static DEFINE_SPINLOCK(dma_event_lock);
+static dma_file_ctx_t *dma_channel_owner[15] = {NULL};
+static unsigned int dma_kernel_channel_mask = 0x7FFF;
+static unsigned int dma_channel_alloc_mask = 0;
+static unsigned int dma_channel_alloc_next = 0;
+static DEFINE_MUTEX(dma_channel_alloc_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(dma_channel_alloc_wait);
+static dma_stream_t dma_stream[15];
+static LIST_HEAD(dma_file_ctx_list);
+static DEFINE_MUTEX(dma_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
+
+static unsigned int channel_mask = 0;
+module_param(channel_mask, uint, 0444);
+MODULE_PARM_DESC(channel_mask, "Channels handed out by the channel allocator (bit n = channel n). 0 takes them from the device tree.");
 
 //=====================================================================================================================
 
@@ -638,7 +945,17 @@ unsigned int dma_get_dst_stride(unsigned int dma_ctrl)
 
 //STRIDE (READ ONLY)
 //=====================================================================================================================
-//NEXT CTRL BLOCK ADDR (READ ONLY)
+//NEXT CTRL BLOCK ADDR
+
+//The channel copies NEXTCONBK from each control block it loads, so this changes the control block that follows the loaded one. Only valid while the channel is paused.
+void dma_set_next_ctrlblock_addr(unsigned int dma_ctrl, unsigned int addr)
+{
+	unsigned int *dma_mapping = NULL;
+	dma_ctrl_map_to_type_pointer(dma_ctrl, NULL, &dma_mapping);
+
+	dma_mapping[DMA_NEXTCB_ADDR_UINTP_POS] = addr;
+	return;
+}
 
 unsigned int dma_get_next_ctrlblock_addr(unsigned int dma_ctrl)
 {
@@ -648,7 +965,7 @@ unsigned int dma_get_next_ctrlblock_addr(unsigned int dma_ctrl)
 	return dma_mapping[DMA_NEXTCB_ADDR_UINTP_POS];
 }
 
-//NEXT CTRL BLOCK ADDR (READ ONLY)
+//NEXT CTRL BLOCK ADDR
 //=====================================================================================================================
 //DEBUG
 
@@ -771,8 +1088,11 @@ void dma_enable_ctrl(unsigned int dma_ctrl, unsigned int enable)
 	if(dma_ctrl > 14) return;
 
 	enable &= 0x00000001;
+
+	spin_lock(&dma_channel_enable_lock);
 	*dma_channel_enable_reg &= ~(1 << dma_ctrl);
 	*dma_channel_enable_reg |= (enable << dma_ctrl);
+	spin_unlock(&dma_channel_enable_lock);
 	return;
 }
 
@@ -785,19 +1105,233 @@ unsigned int dma_ctrl_is_enabled(unsigned int dma_ctrl)
 
 //ENABLE CHANNEL
 //=====================================================================================================================
+//SNAPSHOT
 
-ssize_t dma_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+void dma_snapshot_channel(unsigned int dma_ctrl, unsigned int *p_regs)
 {
-	copy_to_user(user, dma_data_io, DMA_DATAIO_SIZE_BYTES);
-	return size;
+	unsigned int *dma_mapping = NULL;
+	unsigned long lock_flags = 0;
+	unsigned int n_reg = 0;
+
+	dma_ctrl_map_to_type_pointer(dma_ctrl, NULL, &dma_mapping);
+
+	spin_lock_irqsave(&dma_ctrl_lock[dma_ctrl], lock_flags);
+
+	while(n_reg < DMA_MAPPING_SIZE_UINT)
+	{
+		p_regs[n_reg] = dma_mapping[n_reg];
+		n_reg++;
+	}
+
+	spin_unlock_irqrestore(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	return;
 }
 
-ssize_t dma_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+int dma_snapshot(unsigned int *puint)
+{
+	if(puint[DMA_SNAPSHOT_CTRL_UINTP_POS] > DMA_LITE_CH7) return -EINVAL;
+
+	dma_snapshot_channel(puint[DMA_SNAPSHOT_CTRL_UINTP_POS], &puint[DMA_SNAPSHOT_REGS_UINTP_POS]);
+	return 0;
+}
+
+void dma_snapshot_all(unsigned int *puint)
+{
+	unsigned int n = 0;
+
+	puint[DMA_SNAPSHOT_ALL_INTR_STATUS_UINTP_POS] = dma_get_full_intr_status();
+	puint[DMA_SNAPSHOT_ALL_ENABLE_UINTP_POS] = (*dma_channel_enable_reg & 0x00007FFF);
+
+	while(n < 15)
+	{
+		dma_snapshot_channel(n, &puint[DMA_SNAPSHOT_ALL_REGS_UINTP_POS + n*DMA_MAPPING_SIZE_UINT]);
+		n++;
+	}
+
+	return;
+}
+
+//SNAPSHOT
+//=====================================================================================================================
+//CHANNEL ALLOCATOR
+
+unsigned int dma_channel_get_free_mask(void)
+{
+	unsigned int free_mask = 0;
+	unsigned int n = 0;
+
+	while(n < 15)
+	{
+		if(READ_ONCE(dma_channel_owner[n]) == NULL) free_mask |= (1 << n);
+		n++;
+	}
+
+	return (free_mask & dma_channel_alloc_mask);
+}
+
+unsigned int dma_channel_fits(unsigned int dma_ctrl, unsigned int flags)
+{
+	unsigned int type = 0;
+
+	if(!(dma_channel_alloc_mask & (1 << dma_ctrl))) return 0;
+	if(READ_ONCE(dma_channel_owner[dma_ctrl]) != NULL) return 0;
+
+	dma_ctrl_map_to_type_pointer(dma_ctrl, &type, NULL);
+	if(type == DMA_TYPE_STD) return 1;
+
+	if(flags & (DMA_CHANNEL_ALLOC_FLAG_TDMODE | DMA_CHANNEL_ALLOC_FLAG_FULL_LENGTH)) return 0;
+	return dma_is_reg_bit_active(flags, DMA_CHANNEL_ALLOC_FLAG_LITE_OK);
+}
+
+//Returns the channel to allocate, or -1 if none fits. Doesn't modify anything, so it can be used as a wait condition.
+int dma_channel_find(unsigned int flags, unsigned int specific_ctrl)
+{
+	unsigned int type = 0;
+	unsigned int dma_ctrl = 0;
+	unsigned int n = 0;
+	int std_ctrl = -1;
+
+	if(flags & DMA_CHANNEL_ALLOC_FLAG_SPECIFIC)
+	{
+		if(specific_ctrl > DMA_LITE_CH7) return -1;
+		if(dma_channel_fits(specific_ctrl, flags)) return specific_ctrl;
+		return -1;
+	}
+
+	while(n < 15)
+	{
+		dma_ctrl = (dma_channel_alloc_next + n)%15;
+		if(dma_channel_fits(dma_ctrl, flags))
+		{
+			dma_ctrl_map_to_type_pointer(dma_ctrl, &type, NULL);
+			if(type == DMA_TYPE_LITE) return dma_ctrl;
+			if(std_ctrl < 0) std_ctrl = dma_ctrl;
+		}
+
+		n++;
+	}
+
+	return std_ctrl;
+}
+
+int dma_channel_alloc(dma_file_ctx_t *ctx, unsigned int *puint)
+{
+	unsigned int flags = puint[DMA_CHANNEL_FLAGS_UINTP_POS];
+	unsigned int specific_ctrl = puint[DMA_CHANNEL_CTRL_UINTP_POS];
+	long remaining = usecs_to_jiffies(puint[DMA_CHANNEL_TIMEOUT_UINTP_POS]);
+	long ret = 0;
+	int dma_ctrl = -1;
+
+	if(!dma_channel_alloc_mask) return -ENODEV;
+
+	mutex_lock(&dma_channel_alloc_mutex);
+
+	while((dma_ctrl = dma_channel_find(flags, specific_ctrl)) < 0)
+	{
+		mutex_unlock(&dma_channel_alloc_mutex);
+
+		if(!(flags & DMA_CHANNEL_ALLOC_FLAG_WAIT)) return -EBUSY;
+
+		if(puint[DMA_CHANNEL_TIMEOUT_UINTP_POS])
+		{
+			ret = wait_event_interruptible_timeout(dma_channel_alloc_wait, (dma_channel_find(flags, specific_ctrl) >= 0), remaining);
+			if(ret == 0) return -ETIMEDOUT;
+			remaining = ret;
+		}
+		else ret = wait_event_interruptible(dma_channel_alloc_wait, (dma_channel_find(flags, specific_ctrl) >= 0));
+
+		if(ret < 0) return -ERESTARTSYS;
+
+		mutex_lock(&dma_channel_alloc_mutex);
+	}
+
+	WRITE_ONCE(dma_channel_owner[dma_ctrl], ctx);
+	dma_channel_alloc_next = (dma_ctrl + 1)%15;
+
+	mutex_unlock(&dma_channel_alloc_mutex);
+
+	puint[DMA_CHANNEL_CTRL_UINTP_POS] = dma_ctrl;
+	return 0;
+}
+
+//Must be called with dma_channel_alloc_mutex held.
+void dma_channel_release(unsigned int dma_ctrl)
+{
+	unsigned long lock_flags = 0;
+
+	spin_lock_irqsave(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	dma_reset(dma_ctrl);
+	dma_irq_channel[dma_ctrl].coalesce = 0;
+	dma_irq_channel[dma_ctrl].pending = 0;
+	spin_unlock_irqrestore(&dma_ctrl_lock[dma_ctrl], lock_flags);
+
+	WRITE_ONCE(dma_channel_owner[dma_ctrl], NULL);
+	return;
+}
+
+int dma_channel_free(dma_file_ctx_t *ctx, unsigned int dma_ctrl)
+{
+	if(dma_ctrl > DMA_LITE_CH7) return -EINVAL;
+
+	mutex_lock(&dma_channel_alloc_mutex);
+
+	if(dma_channel_owner[dma_ctrl] != ctx)
+	{
+		mutex_unlock(&dma_channel_alloc_mutex);
+		return -EINVAL;
+	}
+
+	dma_channel_release(dma_ctrl);
+	mutex_unlock(&dma_channel_alloc_mutex);
+
+	wake_up_interruptible(&dma_channel_alloc_wait);
+	return 0;
+}
+
+void dma_channel_free_all(dma_file_ctx_t *ctx)
 {
-	copy_from_user(dma_data_io, user, DMA_DATAIO_SIZE_BYTES);
+	unsigned int n_freed = 0;
+	unsigned int n = 0;
+
+	mutex_lock(&dma_channel_alloc_mutex);
+
+	while(n < 15)
+	{
+		if(dma_channel_owner[n] == ctx)
+		{
+			dma_channel_release(n);
+			n_freed++;
+		}
+
+		n++;
+	}
+
+	mutex_unlock(&dma_channel_alloc_mutex);
 
-	unsigned char *pbyte = (unsigned char*) dma_data_io;
+	if(n_freed) wake_up_interruptible(&dma_channel_alloc_wait);
+	return;
+}
+
+//CHANNEL ALLOCATOR
+//=====================================================================================================================
+
+void dma_run_cmd(unsigned char *pbyte)
+{
 	unsigned int *puint = (unsigned int*) &pbyte[2];
+	unsigned long lock_flags = 0;
+
+	if(pbyte[1] > DMA_LITE_CH7)
+	{
+		if(pbyte[0] == DMA_CMD_GET_FULL_INTR_STATUS) puint[0] = dma_get_full_intr_status();
+		else if(pbyte[0] == DMA_CMD_GET_FREE_CHANNELS) puint[0] = dma_channel_get_free_mask();
+
+		pbyte[0] = DMA_CMD_KERNEL_RESPONSE;
+		return;
+	}
+
+	//Commands are serialized per channel, so different channels can be driven concurrently.
+	//The channel IRQ handler takes the same lock.
+	spin_lock_irqsave(&dma_ctrl_lock[pbyte[1]], lock_flags);
 
 	switch(pbyte[0])
 	{
@@ -985,6 +1519,10 @@ ssize_t dma_mod_usrwrite(struct file *file, const char __user *user, size_t size
 			puint[0] = dma_get_dst_stride(pbyte[1]);
 			break;
 
+		case DMA_CMD_SET_NEXTCB_ADDR:
+			dma_set_next_ctrlblock_addr(pbyte[1], puint[0]);
+			break;
+
 		case DMA_CMD_GET_NEXTCB_ADDR:
 			puint[0] = dma_get_next_ctrlblock_addr(pbyte[1]);
 			break;
@@ -1020,68 +1558,910 @@ ssize_t dma_mod_usrwrite(struct file *file, const char __user *user, size_t size
 		case DMA_CMD_DEBUG_GET_READLASTNOTSET_ERROR:
 			puint[0] = dma_debug_get_read_last_not_set_error(pbyte[1]);
 			break;
+
+		case DMA_CMD_SET_IRQ_COALESCE:
+			dma_irq_channel[pbyte[1]].coalesce = puint[0];
+			break;
+
+		case DMA_CMD_GET_IRQ_COALESCE:
+			puint[0] = dma_irq_channel[pbyte[1]].coalesce;
+			break;
 	}
 
+	spin_unlock_irqrestore(&dma_ctrl_lock[pbyte[1]], lock_flags);
+
 	pbyte[0] = DMA_CMD_KERNEL_RESPONSE;
-	return size;
+	return;
 }
 
-static const struct proc_ops dma_proc_ops = {
-	.proc_read = dma_mod_usrread,
-	.proc_write = dma_mod_usrwrite
-};
+//=====================================================================================================================
+//COMMAND RING
 
-static int __init driver_enable(void)
+void dma_ring_drain(dma_file_ctx_t *ctx)
 {
-	dma_std_mapping_group = (unsigned int**) vmalloc(7*sizeof(unsigned int*));
-	dma_lite_mapping_group = (unsigned int**) vmalloc(8*sizeof(unsigned int*));
-
-	dma_std_mapping_group[0] = (unsigned int*) ioremap(DMA_STD_CH0_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[1] = (unsigned int*) ioremap(DMA_STD_CH1_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[2] = (unsigned int*) ioremap(DMA_STD_CH2_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[3] = (unsigned int*) ioremap(DMA_STD_CH3_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[4] = (unsigned int*) ioremap(DMA_STD_CH4_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[5] = (unsigned int*) ioremap(DMA_STD_CH5_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_std_mapping_group[6] = (unsigned int*) ioremap(DMA_STD_CH6_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + DMA_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
 
-	dma_lite_mapping_group[0] = (unsigned int*) ioremap(DMA_LITE_CH0_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[1] = (unsigned int*) ioremap(DMA_LITE_CH1_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[2] = (unsigned int*) ioremap(DMA_LITE_CH2_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[3] = (unsigned int*) ioremap(DMA_LITE_CH3_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[4] = (unsigned int*) ioremap(DMA_LITE_CH4_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[5] = (unsigned int*) ioremap(DMA_LITE_CH5_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[6] = (unsigned int*) ioremap(DMA_LITE_CH6_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
-	dma_lite_mapping_group[7] = (unsigned int*) ioremap(DMA_LITE_CH7_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	mutex_lock(&ctx->ring_mutex);
 
-	dma_intr_status_reg = (unsigned int*) ioremap(DMA_INTR_STATUS_REG_ADDR, sizeof(unsigned int));
-	dma_channel_enable_reg = (unsigned int*) ioremap(DMA_ENABLE_CH_REG_ADDR, sizeof(unsigned int));
+	sq_tail = smp_load_acquire(&ring_header[DMA_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > DMA_RING_ENTRIES) sq_tail = ctx->ring_sq_head + DMA_RING_ENTRIES;
 
-	if(dma_std_mapping_group[0] == NULL)
+	while(ctx->ring_sq_head != sq_tail)
 	{
-		printk("DMA: Error mapping DMA STD CH0 addr\n");
-		vfree(dma_std_mapping_group);
-		vfree(dma_lite_mapping_group);
-		return -1;
+		dma_run_cmd(&ring_entries[(ctx->ring_sq_head%DMA_RING_ENTRIES)*DMA_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[DMA_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
 	}
-	if(dma_std_mapping_group[1] == NULL)
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int dma_ring_poll_thread(void *arg)
+{
+	dma_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
 	{
-		printk("DMA: Error mapping DMA STD CH1 addr\n");
-		vfree(dma_std_mapping_group);
-		vfree(dma_lite_mapping_group);
-		return -1;
+		mutex_lock(&dma_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &dma_file_ctx_list, list) dma_ring_drain(ctx);
+		mutex_unlock(&dma_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
 	}
-	if(dma_std_mapping_group[2] == NULL)
+
+	return 0;
+}
+
+//COMMAND RING
+//=====================================================================================================================
+//DMA BUFFERS
+
+dma_buffer_t *dma_buffer_find(dma_file_ctx_t *ctx, unsigned int handle)
+{
+	dma_buffer_t *buffer = NULL;
+
+	list_for_each_entry(buffer, &ctx->buffer_list, list)
 	{
-		printk("DMA: Error mapping DMA STD CH2 addr\n");
-		vfree(dma_std_mapping_group);
-		vfree(dma_lite_mapping_group);
-		return -1;
+		if(buffer->handle == handle) return buffer;
 	}
-	if(dma_std_mapping_group[3] == NULL)
-	{
-		printk("DMA: Error mapping DMA STD CH3 addr\n");
-		vfree(dma_std_mapping_group);
-		vfree(dma_lite_mapping_group);
+
+	return NULL;
+}
+
+int dma_buffer_alloc(dma_file_ctx_t *ctx, unsigned int *puint)
+{
+	dma_buffer_t *buffer = NULL;
+	size_t size = PAGE_ALIGN((size_t) puint[DMA_BUFFER_SIZE_UINTP_POS]);
+
+	if(dma_buffer_dev == NULL) return -ENODEV;
+	if((size == 0) || (size > DMA_BUFFER_MAX_SIZE_BYTES)) return -EINVAL;
+
+	buffer = (dma_buffer_t*) kzalloc(sizeof(dma_buffer_t), GFP_KERNEL);
+	if(buffer == NULL) return -ENOMEM;
+
+	buffer->virt = dma_alloc_coherent(dma_buffer_dev, size, &buffer->dma_handle, GFP_KERNEL);
+	if(buffer->virt == NULL)
+	{
+		printk("DMA: Error allocating %u bytes of coherent memory\n", (unsigned int) size);
+		kfree(buffer);
+		return -ENOMEM;
+	}
+
+	memset(buffer->virt, 0, size);
+	buffer->size = size;
+
+	mutex_lock(&ctx->buffer_mutex);
+	buffer->handle = ctx->buffer_next_handle;
+	ctx->buffer_next_handle++;
+	list_add_tail(&buffer->list, &ctx->buffer_list);
+	mutex_unlock(&ctx->buffer_mutex);
+
+	puint[DMA_BUFFER_SIZE_UINTP_POS] = (unsigned int) size;
+	puint[DMA_BUFFER_HANDLE_UINTP_POS] = buffer->handle;
+	puint[DMA_BUFFER_BUS_ADDR_UINTP_POS] = (((unsigned int) buffer->dma_handle) & 0x3FFFFFFF) | DMA_BUFFER_BUS_ALIAS_UNCACHED;
+	puint[DMA_BUFFER_MMAP_PGOFF_UINTP_POS] = buffer->handle;
+	return 0;
+}
+
+void dma_buffer_release(dma_buffer_t *buffer)
+{
+	dma_free_coherent(dma_buffer_dev, buffer->size, buffer->virt, buffer->dma_handle);
+	kfree(buffer);
+	return;
+}
+
+int dma_buffer_free(dma_file_ctx_t *ctx, unsigned int handle)
+{
+	dma_buffer_t *buffer = NULL;
+
+	mutex_lock(&ctx->buffer_mutex);
+
+	buffer = dma_buffer_find(ctx, handle);
+	if((buffer != NULL) && (buffer->n_streams || buffer->n_maps))
+	{
+		mutex_unlock(&ctx->buffer_mutex);
+		return -EBUSY;
+	}
+
+	if(buffer != NULL) list_del(&buffer->list);
+	mutex_unlock(&ctx->buffer_mutex);
+
+	if(buffer == NULL) return -EINVAL;
+
+	dma_buffer_release(buffer);
+	return 0;
+}
+
+void dma_buffer_free_all(dma_file_ctx_t *ctx)
+{
+	dma_buffer_t *buffer = NULL;
+	dma_buffer_t *next = NULL;
+
+	list_for_each_entry_safe(buffer, next, &ctx->buffer_list, list)
+	{
+		list_del(&buffer->list);
+		dma_buffer_release(buffer);
+	}
+
+	return;
+}
+
+//A mapping keeps its file open, so the buffers of a file are never released (file close) while mapped.
+//DMA_IOCTL_FREE_BUFFER is refused while "n_maps" is not 0. Copies (fork) and splits of a mapping call open() too.
+void dma_buffer_vm_open(struct vm_area_struct *vma)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) vma->vm_file->private_data;
+	dma_buffer_t *buffer = (dma_buffer_t*) vma->vm_private_data;
+
+	mutex_lock(&ctx->buffer_mutex);
+	buffer->n_maps++;
+	mutex_unlock(&ctx->buffer_mutex);
+	return;
+}
+
+void dma_buffer_vm_close(struct vm_area_struct *vma)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) vma->vm_file->private_data;
+	dma_buffer_t *buffer = (dma_buffer_t*) vma->vm_private_data;
+
+	mutex_lock(&ctx->buffer_mutex);
+	buffer->n_maps--;
+	mutex_unlock(&ctx->buffer_mutex);
+	return;
+}
+
+static const struct vm_operations_struct dma_buffer_vm_ops = {
+	.open = dma_buffer_vm_open,
+	.close = dma_buffer_vm_close
+};
+
+int dma_buffer_mmap(dma_file_ctx_t *ctx, struct vm_area_struct *vma)
+{
+	dma_buffer_t *buffer = NULL;
+	int ret = -EINVAL;
+
+	mutex_lock(&ctx->buffer_mutex);
+
+	buffer = dma_buffer_find(ctx, (unsigned int) vma->vm_pgoff);
+	if((buffer != NULL) && ((vma->vm_end - vma->vm_start) <= buffer->size))
+	{
+		vma->vm_pgoff = 0;
+		ret = dma_mmap_coherent(dma_buffer_dev, vma, buffer->virt, buffer->dma_handle, buffer->size);
+	}
+
+	//open() is not called for the initial mapping.
+	if(ret == 0)
+	{
+		vma->vm_private_data = buffer;
+		vma->vm_ops = &dma_buffer_vm_ops;
+		buffer->n_maps++;
+	}
+
+	mutex_unlock(&ctx->buffer_mutex);
+	return ret;
+}
+
+//DMA BUFFERS
+//=====================================================================================================================
+//DMA STREAMS
+
+//Must be called with the buffer_mutex of the stream owner held.
+void dma_stream_detach(unsigned int dma_ctrl)
+{
+	dma_stream_t *stream = &dma_stream[dma_ctrl];
+	unsigned long lock_flags = 0;
+
+	if(stream->buffer == NULL) return;
+
+	stream->buffer->n_streams--;
+
+	spin_lock_irqsave(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	memset(stream, 0, sizeof(dma_stream_t));
+	spin_unlock_irqrestore(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	return;
+}
+
+int dma_stream_set(dma_file_ctx_t *ctx, unsigned int *puint)
+{
+	dma_stream_t *stream = NULL;
+	dma_buffer_t *buffer = NULL;
+	dma_file_ctx_t *owner = NULL;
+	unsigned int dma_ctrl = puint[DMA_STREAM_CTRL_UINTP_POS];
+	unsigned int offset = puint[DMA_STREAM_CURSOR_OFFSET_UINTP_POS];
+	unsigned int *cursor = NULL;
+	unsigned long lock_flags = 0;
+
+	if(dma_ctrl > DMA_LITE_CH7) return -EINVAL;
+	stream = &dma_stream[dma_ctrl];
+
+	owner = READ_ONCE(dma_channel_owner[dma_ctrl]);
+	if((owner != NULL) && (owner != ctx)) return -EBUSY;
+
+	mutex_lock(&ctx->buffer_mutex);
+
+	if((stream->owner != NULL) && (stream->owner != ctx))
+	{
+		mutex_unlock(&ctx->buffer_mutex);
+		return -EBUSY;
+	}
+
+	dma_stream_detach(dma_ctrl);
+
+	if(puint[DMA_STREAM_HANDLE_UINTP_POS] == 0)
+	{
+		mutex_unlock(&ctx->buffer_mutex);
+		return 0;
+	}
+
+	buffer = dma_buffer_find(ctx, puint[DMA_STREAM_HANDLE_UINTP_POS]);
+	if((buffer == NULL) || (offset & 0x3) || (((size_t) offset + DMA_STREAM_CURSOR_SIZE_BYTES) > buffer->size) || (puint[DMA_STREAM_N_PERIODS_UINTP_POS] < 2))
+	{
+		mutex_unlock(&ctx->buffer_mutex);
+		return -EINVAL;
+	}
+
+	if(!dma_irq_channel[dma_ctrl].irq)
+	{
+		mutex_unlock(&ctx->buffer_mutex);
+		return -ENODEV;
+	}
+
+	cursor = (unsigned int*) (((unsigned char*) buffer->virt) + offset);
+	WRITE_ONCE(cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS], 0);
+	WRITE_ONCE(cursor[DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS], 0);
+	buffer->n_streams++;
+
+	spin_lock_irqsave(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	stream->owner = ctx;
+	stream->buffer = buffer;
+	stream->cursor = cursor;
+	stream->first_ctrlblock = puint[DMA_STREAM_FIRST_CTRLBLOCK_UINTP_POS];
+	stream->n_periods = puint[DMA_STREAM_N_PERIODS_UINTP_POS];
+	stream->period = 0;
+	spin_unlock_irqrestore(&dma_ctrl_lock[dma_ctrl], lock_flags);
+
+	mutex_unlock(&ctx->buffer_mutex);
+	return 0;
+}
+
+void dma_stream_free_all(dma_file_ctx_t *ctx)
+{
+	unsigned int n = 0;
+
+	mutex_lock(&ctx->buffer_mutex);
+
+	while(n < 15)
+	{
+		if(dma_stream[n].owner == ctx) dma_stream_detach(n);
+		n++;
+	}
+
+	mutex_unlock(&ctx->buffer_mutex);
+	return;
+}
+
+//Must be called with dma_ctrl_lock[dma_ctrl] held, from the channel IRQ.
+void dma_stream_update(unsigned int dma_ctrl, unsigned int ctrlblock_addr)
+{
+	dma_stream_t *stream = &dma_stream[dma_ctrl];
+	unsigned int *cursor = stream->cursor;
+	unsigned int period = 0;
+	unsigned int consumer = 0;
+
+	if(cursor == NULL) return;
+
+	//The channel already loaded the control block of the period it plays now.
+	period = (ctrlblock_addr - stream->first_ctrlblock)/DMA_STREAM_CTRLBLOCK_STRIDE_BYTES;
+	if(period >= stream->n_periods) return;
+
+	consumer = cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS] + ((period + stream->n_periods - stream->period)%stream->n_periods);
+	stream->period = period;
+	smp_store_release(&cursor[DMA_STREAM_CURSOR_CONSUMER_UINTP_POS], consumer);
+
+	if(((int) (READ_ONCE(cursor[DMA_STREAM_CURSOR_PRODUCER_UINTP_POS]) - consumer)) <= 0)
+		WRITE_ONCE(cursor[DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS], cursor[DMA_STREAM_CURSOR_UNDERRUNS_UINTP_POS] + 1);
+
+	return;
+}
+
+//DMA STREAMS
+//=====================================================================================================================
+//DMA INTERRUPTS
+
+//Must be called with dma_event_lock held.
+void dma_event_push(unsigned int dma_ctrl, unsigned int flags, unsigned int n_irqs, unsigned long long timestamp)
+{
+	dma_event_ctx_t *ctx = NULL;
+	dma_event_t *p_event = NULL;
+
+	list_for_each_entry(ctx, &dma_event_ctx_list, list)
+	{
+		if((ctx->head - smp_load_acquire(&ctx->tail)) >= DMA_EVENT_RING_ENTRIES) continue;
+
+		p_event = &ctx->ring[ctx->head%DMA_EVENT_RING_ENTRIES];
+		p_event->timestamp = timestamp;
+		p_event->dma_ctrl = dma_ctrl;
+		p_event->flags = flags;
+		p_event->n_irqs = n_irqs;
+		smp_store_release(&ctx->head, ctx->head + 1);
+
+		wake_up_interruptible(&ctx->wait);
+	}
+
+	return;
+}
+
+irqreturn_t dma_irq_handler(int irq, void *dev_id)
+{
+	dma_irq_channel_t *channel = (dma_irq_channel_t*) dev_id;
+	unsigned int dma_ctrl = (unsigned int) (channel - dma_irq_channel);
+	unsigned int *dma_mapping = NULL;
+	unsigned int ctrl_status = 0;
+	unsigned int flags = 0;
+	unsigned int n_irqs = 0;
+
+	dma_ctrl_map_to_type_pointer(dma_ctrl, NULL, &dma_mapping);
+
+	spin_lock(&dma_ctrl_lock[dma_ctrl]);
+
+	//Channels 11 to 14 share one IRQ line.
+	ctrl_status = dma_mapping[DMA_CTRL_STATUS_UINTP_POS];
+	if(!(ctrl_status & (1 << 2)))
+	{
+		spin_unlock(&dma_ctrl_lock[dma_ctrl]);
+		return IRQ_NONE;
+	}
+
+	//Clears INT only. END is kept for "dma_transfer_done()" and ACTIVE is written back as read, so a running chain keeps going.
+	dma_mapping[DMA_CTRL_STATUS_UINTP_POS] = ((ctrl_status & ~(1 << 1)) | (1 << 2));
+
+	dma_stream_update(dma_ctrl, dma_mapping[DMA_CTRLBLOCK_ADDR_UINTP_POS]);
+
+	if(ctrl_status & (1 << 8)) flags |= DMA_EVENT_FLAG_ERROR;
+	if(!(ctrl_status & 1) || (dma_mapping[DMA_CTRLBLOCK_ADDR_UINTP_POS] == 0)) flags |= DMA_EVENT_FLAG_CHAIN_END;
+
+	channel->pending++;
+	if(flags || (channel->pending >= channel->coalesce))
+	{
+		n_irqs = channel->pending;
+		channel->pending = 0;
+		WRITE_ONCE(channel->completions, channel->completions + n_irqs);
+		if(flags & DMA_EVENT_FLAG_ERROR) WRITE_ONCE(channel->errors, channel->errors + 1);
+	}
+
+	spin_unlock(&dma_ctrl_lock[dma_ctrl]);
+
+	if(n_irqs)
+	{
+		spin_lock(&dma_event_lock);
+		dma_event_push(dma_ctrl, flags, n_irqs, (unsigned long long) ktime_to_us(ktime_get()));
+		spin_unlock(&dma_event_lock);
+
+		wake_up_interruptible(&channel->wait);
+	}
+
+	return IRQ_HANDLED;
+}
+
+unsigned int dma_irq_wait_ready(dma_file_ctx_t *ctx, unsigned int dma_ctrl)
+{
+	if(READ_ONCE(dma_irq_channel[dma_ctrl].completions) != ctx->wait_completions[dma_ctrl]) return 1;
+	if(READ_ONCE(dma_irq_channel[dma_ctrl].errors) != ctx->wait_errors[dma_ctrl]) return 1;
+	return 0;
+}
+
+int dma_irq_wait(dma_file_ctx_t *ctx, unsigned int *puint)
+{
+	unsigned int dma_ctrl = puint[DMA_WAIT_CTRL_UINTP_POS];
+	unsigned int completions = 0;
+	unsigned int errors = 0;
+	unsigned long lock_flags = 0;
+	long ret = 0;
+
+	if(dma_ctrl > DMA_LITE_CH7) return -EINVAL;
+	if(!dma_irq_channel[dma_ctrl].irq) return -ENODEV;
+
+	if(puint[DMA_WAIT_TIMEOUT_UINTP_POS])
+	{
+		ret = wait_event_interruptible_timeout(dma_irq_channel[dma_ctrl].wait, dma_irq_wait_ready(ctx, dma_ctrl), usecs_to_jiffies(puint[DMA_WAIT_TIMEOUT_UINTP_POS]));
+		if(ret == 0) return -ETIMEDOUT;
+	}
+	else ret = wait_event_interruptible(dma_irq_channel[dma_ctrl].wait, dma_irq_wait_ready(ctx, dma_ctrl));
+
+	if(ret < 0) return -ERESTARTSYS;
+
+	spin_lock_irqsave(&dma_ctrl_lock[dma_ctrl], lock_flags);
+	completions = dma_irq_channel[dma_ctrl].completions;
+	errors = dma_irq_channel[dma_ctrl].errors;
+	spin_unlock_irqrestore(&dma_ctrl_lock[dma_ctrl], lock_flags);
+
+	puint[DMA_WAIT_COMPLETIONS_UINTP_POS] = completions - ctx->wait_completions[dma_ctrl];
+	puint[DMA_WAIT_ERRORS_UINTP_POS] = errors - ctx->wait_errors[dma_ctrl];
+	ctx->wait_completions[dma_ctrl] = completions;
+	ctx->wait_errors[dma_ctrl] = errors;
+	return 0;
+}
+
+//DMA INTERRUPTS
+//=====================================================================================================================
+
+int dma_mod_open(struct inode *inode, struct file *file)
+{
+	unsigned int n = 0;
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) kzalloc(sizeof(dma_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(DMA_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(DMA_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	mutex_init(&ctx->buffer_mutex);
+	INIT_LIST_HEAD(&ctx->buffer_list);
+	ctx->buffer_next_handle = 1;
+
+	n = 0;
+	while(n < 15)
+	{
+		ctx->wait_completions[n] = READ_ONCE(dma_irq_channel[n].completions);
+		ctx->wait_errors[n] = READ_ONCE(dma_irq_channel[n].errors);
+		n++;
+	}
+
+	if(dma_ring_thread != NULL) ((unsigned int*) ctx->ring)[DMA_RING_FLAGS_UINTP_POS] = DMA_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&dma_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &dma_file_ctx_list);
+	mutex_unlock(&dma_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int dma_mod_release(struct inode *inode, struct file *file)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) file->private_data;
+
+	mutex_lock(&dma_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&dma_file_ctx_list_mutex);
+
+	dma_channel_free_all(ctx);
+	dma_stream_free_all(ctx);
+	dma_buffer_free_all(ctx);
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t dma_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) file->private_data;
+
+	if(size > DMA_DATAIO_SIZE_BYTES) size = DMA_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t dma_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) file->private_data;
+
+	if(size != DMA_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == DMA_CMD_RING_DOORBELL) dma_ring_drain(ctx);
+
+	dma_run_cmd(pbyte);
+	return size;
+}
+
+int dma_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return dma_buffer_mmap(ctx, vma);
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long dma_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	dma_file_ctx_t *ctx = (dma_file_ctx_t*) file->private_data;
+	unsigned char pbyte[DMA_DATAIO_SIZE_BYTES];
+	unsigned int puint[DMA_BUFFER_DATAIO_SIZE_BYTES/4];
+	unsigned int wait_io[DMA_WAIT_DATAIO_SIZE_BYTES/4];
+	unsigned int channel_io[DMA_CHANNEL_DATAIO_SIZE_BYTES/4];
+	unsigned int stream_io[DMA_STREAM_DATAIO_SIZE_BYTES/4];
+	unsigned int snapshot_io[DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES/4];
+	int ret = 0;
+
+	if(cmd == DMA_IOCTL_ALLOC_BUFFER)
+	{
+		if(copy_from_user(puint, (void __user*) arg, DMA_BUFFER_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+		ret = dma_buffer_alloc(ctx, puint);
+		if(ret < 0) return ret;
+
+		if(copy_to_user((void __user*) arg, puint, DMA_BUFFER_DATAIO_SIZE_BYTES))
+		{
+			dma_buffer_free(ctx, puint[DMA_BUFFER_HANDLE_UINTP_POS]);
+			return -EFAULT;
+		}
+
+		return 0;
+	}
+
+	if(cmd == DMA_IOCTL_FREE_BUFFER)
+	{
+		if(copy_from_user(puint, (void __user*) arg, DMA_BUFFER_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return dma_buffer_free(ctx, puint[DMA_BUFFER_HANDLE_UINTP_POS]);
+	}
+
+	if(cmd == DMA_IOCTL_ALLOC_CHANNEL)
+	{
+		if(copy_from_user(channel_io, (void __user*) arg, DMA_CHANNEL_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+		ret = dma_channel_alloc(ctx, channel_io);
+		if(ret < 0) return ret;
+
+		//Interrupts raised by the previous user of the channel count as seen, so DMA_IOCTL_WAIT only reports this file's transfers.
+		ctx->wait_completions[channel_io[DMA_CHANNEL_CTRL_UINTP_POS]] = READ_ONCE(dma_irq_channel[channel_io[DMA_CHANNEL_CTRL_UINTP_POS]].completions);
+		ctx->wait_errors[channel_io[DMA_CHANNEL_CTRL_UINTP_POS]] = READ_ONCE(dma_irq_channel[channel_io[DMA_CHANNEL_CTRL_UINTP_POS]].errors);
+
+		if(copy_to_user((void __user*) arg, channel_io, DMA_CHANNEL_DATAIO_SIZE_BYTES))
+		{
+			dma_channel_free(ctx, channel_io[DMA_CHANNEL_CTRL_UINTP_POS]);
+			return -EFAULT;
+		}
+
+		return 0;
+	}
+
+	if(cmd == DMA_IOCTL_FREE_CHANNEL)
+	{
+		if(copy_from_user(channel_io, (void __user*) arg, DMA_CHANNEL_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return dma_channel_free(ctx, channel_io[DMA_CHANNEL_CTRL_UINTP_POS]);
+	}
+
+	if(cmd == DMA_IOCTL_SET_STREAM)
+	{
+		if(copy_from_user(stream_io, (void __user*) arg, DMA_STREAM_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return dma_stream_set(ctx, stream_io);
+	}
+
+	if(cmd == DMA_IOCTL_GET_SNAPSHOT)
+	{
+		if(copy_from_user(snapshot_io, (void __user*) arg, DMA_SNAPSHOT_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+		ret = dma_snapshot(snapshot_io);
+		if(ret < 0) return ret;
+
+		if(copy_to_user((void __user*) arg, snapshot_io, DMA_SNAPSHOT_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return 0;
+	}
+
+	if(cmd == DMA_IOCTL_GET_SNAPSHOT_ALL)
+	{
+		dma_snapshot_all(snapshot_io);
+
+		if(copy_to_user((void __user*) arg, snapshot_io, DMA_SNAPSHOT_ALL_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return 0;
+	}
+
+	if(cmd == DMA_IOCTL_WAIT)
+	{
+		if(copy_from_user(wait_io, (void __user*) arg, DMA_WAIT_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+		ret = dma_irq_wait(ctx, wait_io);
+		if(ret < 0) return ret;
+
+		if(copy_to_user((void __user*) arg, wait_io, DMA_WAIT_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return 0;
+	}
+
+	if(cmd != DMA_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, DMA_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == DMA_CMD_RING_DOORBELL) dma_ring_drain(ctx);
+
+	dma_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, DMA_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
+static const struct proc_ops dma_proc_ops = {
+	.proc_open = dma_mod_open,
+	.proc_release = dma_mod_release,
+	.proc_read = dma_mod_usrread,
+	.proc_write = dma_mod_usrwrite,
+	.proc_mmap = dma_mod_usrmmap
+};
+
+static const struct file_operations dma_fops = {
+	.owner = THIS_MODULE,
+	.open = dma_mod_open,
+	.release = dma_mod_release,
+	.read = dma_mod_usrread,
+	.write = dma_mod_usrwrite,
+	.mmap = dma_mod_usrmmap,
+	.unlocked_ioctl = dma_mod_ioctl
+};
+
+static struct miscdevice dma_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "DMA_Ctrl",
+	.fops = &dma_fops,
+	.mode = 0666
+};
+
+int dma_event_open(struct inode *inode, struct file *file)
+{
+	unsigned long lock_flags = 0;
+	dma_event_ctx_t *ctx = (dma_event_ctx_t*) kzalloc(sizeof(dma_event_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->ring = (dma_event_t*) vmalloc(DMA_EVENT_RING_ENTRIES*sizeof(dma_event_t));
+	if(ctx->ring == NULL)
+	{
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->read_mutex);
+	init_waitqueue_head(&ctx->wait);
+
+	spin_lock_irqsave(&dma_event_lock, lock_flags);
+	list_add_tail(&ctx->list, &dma_event_ctx_list);
+	spin_unlock_irqrestore(&dma_event_lock, lock_flags);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int dma_event_release(struct inode *inode, struct file *file)
+{
+	unsigned long lock_flags = 0;
+	dma_event_ctx_t *ctx = (dma_event_ctx_t*) file->private_data;
+
+	spin_lock_irqsave(&dma_event_lock, lock_flags);
+	list_del(&ctx->list);
+	spin_unlock_irqrestore(&dma_event_lock, lock_flags);
+
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t dma_event_read(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	dma_event_ctx_t *ctx = (dma_event_ctx_t*) file->private_data;
+	size_t max_events = size/DMA_EVENT_SIZE_BYTES;
+	size_t n_event = 0;
+	unsigned int head = 0;
+
+	if(max_events == 0) return -EINVAL;
+
+	if(mutex_lock_interruptible(&ctx->read_mutex)) return -ERESTARTSYS;
+
+	while(smp_load_acquire(&ctx->head) == ctx->tail)
+	{
+		mutex_unlock(&ctx->read_mutex);
+
+		if(file->f_flags & O_NONBLOCK) return -EAGAIN;
+		if(wait_event_interruptible(ctx->wait, (smp_load_acquire(&ctx->head) != ctx->tail))) return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&ctx->read_mutex)) return -ERESTARTSYS;
+	}
+
+	head = smp_load_acquire(&ctx->head);
+
+	while((ctx->tail != head) && (n_event < max_events))
+	{
+		if(copy_to_user(&user[n_event*DMA_EVENT_SIZE_BYTES], &ctx->ring[ctx->tail%DMA_EVENT_RING_ENTRIES], DMA_EVENT_SIZE_BYTES)) break;
+
+		smp_store_release(&ctx->tail, ctx->tail + 1);
+		n_event++;
+	}
+
+	mutex_unlock(&ctx->read_mutex);
+
+	if(n_event == 0) return -EFAULT;
+	return (n_event*DMA_EVENT_SIZE_BYTES);
+}
+
+__poll_t dma_event_poll(struct file *file, poll_table *wait)
+{
+	dma_event_ctx_t *ctx = (dma_event_ctx_t*) file->private_data;
+
+	poll_wait(file, &ctx->wait, wait);
+
+	if(smp_load_acquire(&ctx->head) != ctx->tail) return (EPOLLIN | EPOLLRDNORM);
+	return 0;
+}
+
+static const struct file_operations dma_event_fops = {
+	.owner = THIS_MODULE,
+	.open = dma_event_open,
+	.release = dma_event_release,
+	.read = dma_event_read,
+	.poll = dma_event_poll,
+	.llseek = noop_llseek
+};
+
+static struct miscdevice dma_event_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "DMA_Event",
+	.fops = &dma_event_fops,
+	.mode = 0666
+};
+
+void dma_request_channel_irqs(void)
+{
+	struct device_node *dma_node = of_find_compatible_node(NULL, NULL, "brcm,bcm2835-dma");
+	u32 dt_mask = 0;
+	unsigned int n = 0;
+
+	while(n < 15)
+	{
+		init_waitqueue_head(&dma_irq_channel[n].wait);
+		n++;
+	}
+
+	if(dma_node == NULL)
+	{
+		printk("DMA: Error finding DMA device tree node. Completion interrupts disabled\n");
+		return;
+	}
+
+	//"brcm,dma-channel-mask" is the pool of the kernel DMA engine (bcm2835-dma). Its channel IRQs are left alone.
+	if(of_property_read_u32(dma_node, "brcm,dma-channel-mask", &dt_mask) < 0)
+	{
+		printk("DMA: Error reading \"brcm,dma-channel-mask\". Completion interrupts disabled\n");
+		of_node_put(dma_node);
+		return;
+	}
+
+	dma_kernel_channel_mask = (dt_mask & 0x7FFF);
+
+	//Interrupt "n" of the node is the IRQ of channel "n".
+	n = 0;
+	while(n < 15)
+	{
+		if(!(dma_kernel_channel_mask & (1 << n))) dma_irq_channel[n].irq = irq_of_parse_and_map(dma_node, n);
+		if(dma_irq_channel[n].irq)
+		{
+			if(request_irq(dma_irq_channel[n].irq, dma_irq_handler, IRQF_SHARED, "DMA_Ctrl", &dma_irq_channel[n]) < 0)
+			{
+				printk("DMA: Error requesting IRQ %d for channel %d\n", dma_irq_channel[n].irq, n);
+				dma_irq_channel[n].irq = 0;
+			}
+		}
+
+		n++;
+	}
+
+	of_node_put(dma_node);
+	return;
+}
+
+void dma_channel_alloc_init(void)
+{
+	if(channel_mask)
+	{
+		dma_channel_alloc_mask = (channel_mask & 0x7FFF);
+		return;
+	}
+
+	//Channels of the kernel DMA engine pool are never handed out. The mask is read by "dma_request_channel_irqs()".
+	dma_channel_alloc_mask = ((~dma_kernel_channel_mask) & 0x7FFF);
+	if(!dma_channel_alloc_mask) printk("DMA: No channel outside \"brcm,dma-channel-mask\". Channel allocator disabled (set \"channel_mask\")\n");
+	return;
+}
+
+void dma_free_channel_irqs(void)
+{
+	unsigned int n = 0;
+	while(n < 15)
+	{
+		if(dma_irq_channel[n].irq) free_irq(dma_irq_channel[n].irq, &dma_irq_channel[n]);
+		n++;
+	}
+
+	return;
+}
+
+static int __init driver_enable(void)
+{
+	unsigned int n = 0;
+	while(n < 15)
+	{
+		spin_lock_init(&dma_ctrl_lock[n]);
+		n++;
+	}
+
+	dma_std_mapping_group = (unsigned int**) vmalloc(7*sizeof(unsigned int*));
+	dma_lite_mapping_group = (unsigned int**) vmalloc(8*sizeof(unsigned int*));
+
+	dma_std_mapping_group[0] = (unsigned int*) ioremap(DMA_STD_CH0_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[1] = (unsigned int*) ioremap(DMA_STD_CH1_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[2] = (unsigned int*) ioremap(DMA_STD_CH2_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[3] = (unsigned int*) ioremap(DMA_STD_CH3_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[4] = (unsigned int*) ioremap(DMA_STD_CH4_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[5] = (unsigned int*) ioremap(DMA_STD_CH5_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_std_mapping_group[6] = (unsigned int*) ioremap(DMA_STD_CH6_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+
+	dma_lite_mapping_group[0] = (unsigned int*) ioremap(DMA_LITE_CH0_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[1] = (unsigned int*) ioremap(DMA_LITE_CH1_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[2] = (unsigned int*) ioremap(DMA_LITE_CH2_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[3] = (unsigned int*) ioremap(DMA_LITE_CH3_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[4] = (unsigned int*) ioremap(DMA_LITE_CH4_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[5] = (unsigned int*) ioremap(DMA_LITE_CH5_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[6] = (unsigned int*) ioremap(DMA_LITE_CH6_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+	dma_lite_mapping_group[7] = (unsigned int*) ioremap(DMA_LITE_CH7_BASE_ADDR, DMA_MAPPING_SIZE_BYTES);
+
+	dma_intr_status_reg = (unsigned int*) ioremap(DMA_INTR_STATUS_REG_ADDR, sizeof(unsigned int));
+	dma_channel_enable_reg = (unsigned int*) ioremap(DMA_ENABLE_CH_REG_ADDR, sizeof(unsigned int));
+
+	if(dma_std_mapping_group[0] == NULL)
+	{
+		printk("DMA: Error mapping DMA STD CH0 addr\n");
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
+		return -1;
+	}
+	if(dma_std_mapping_group[1] == NULL)
+	{
+		printk("DMA: Error mapping DMA STD CH1 addr\n");
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
+		return -1;
+	}
+	if(dma_std_mapping_group[2] == NULL)
+	{
+		printk("DMA: Error mapping DMA STD CH2 addr\n");
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
+		return -1;
+	}
+	if(dma_std_mapping_group[3] == NULL)
+	{
+		printk("DMA: Error mapping DMA STD CH3 addr\n");
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
 		return -1;
 	}
 	if(dma_std_mapping_group[4] == NULL)
@@ -1187,7 +2567,37 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	dma_data_io = vmalloc(DMA_DATAIO_SIZE_BYTES);
+	if(misc_register(&dma_misc) < 0)
+	{
+		printk("DMA: Error registering device file\n");
+		proc_remove(dma_proc);
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
+		return -1;
+	}
+
+	if(dma_set_coherent_mask(dma_misc.this_device, DMA_BIT_MASK(32)) < 0) printk("DMA: Error setting coherent DMA mask. DMA buffers are disabled\n");
+	else dma_buffer_dev = dma_misc.this_device;
+
+	if(misc_register(&dma_event_misc) < 0)
+	{
+		printk("DMA: Error registering event device file\n");
+		misc_deregister(&dma_misc);
+		proc_remove(dma_proc);
+		vfree(dma_std_mapping_group);
+		vfree(dma_lite_mapping_group);
+		return -1;
+	}
+
+	dma_request_channel_irqs();
+	dma_channel_alloc_init();
+
+	if(ring_poll_us)
+	{
+		dma_ring_thread = kthread_run(dma_ring_poll_thread, NULL, "DMA_Ctrl_ring");
+		if(IS_ERR(dma_ring_thread)) dma_ring_thread = NULL;
+	}
+
 	printk("DMA Control Driver Enabled\n");
 	return 0;
 }
@@ -1195,6 +2605,14 @@ static int __init driver_enable(void)
 static void __exit driver_disable(void)
 {
 	unsigned int n = 0;
+
+	//Interfaces and the ring thread go first, then IRQs, so nothing can touch the registers once they are unmapped.
+	misc_deregister(&dma_event_misc);
+	misc_deregister(&dma_misc);
+	proc_remove(dma_proc);
+	if(dma_ring_thread != NULL) kthread_stop(dma_ring_thread);
+	dma_free_channel_irqs();
+
 	while(n < 7)
 	{
 		iounmap(dma_std_mapping_group[n]);
@@ -1214,9 +2632,6 @@ static void __exit driver_disable(void)
 	vfree(dma_std_mapping_group);
 	vfree(dma_lite_mapping_group);
 
-	proc_remove(dma_proc);
-	vfree(dma_data_io);
-
 	printk("DMA Control Driver Disabled\n");
 	return;
 }
@@ -0,0 +1,671 @@
+#include "DMA_Memcpy.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "DMA_Ctrl.h"
+#include "DMA_Chain.h"
+
+/*
+ * A copy is split in up to DMA_MEMCPY_MAX_CHANNELS stripes, one per channel. Each stripe is one chain of control blocks:
+ *
+ * BODY: copies up to the channel length limit (DMA_MEMCPY_STD_MAX_CHUNK or DMA_MEMCPY_LITE_MAX_CHUNK).
+ * 128 bit reads and writes (and wide bursts) are used if both addresses are 16 byte aligned, in which case the body is a multiple of 16 bytes.
+ * TAIL: the last (length%16) bytes of a 128 bit stripe, copied with 32 bit reads and writes.
+ *
+ * The last control block of each stripe raises an interrupt (see "dma_wait()") and ends the chain.
+ * Stripe boundaries are multiples of 16 bytes, so every stripe keeps the alignment of the whole copy.
+ */
+
+#define DMA_MEMCPY_STD_MAX_CHUNK 0x3FFFFFF0
+#define DMA_MEMCPY_LITE_MAX_CHUNK 0xFFF0
+
+//Copies shorter than this per channel are not striped.
+#define DMA_MEMCPY_MIN_STRIPE_BYTES 65536
+
+#define DMA_MEMCPY_STD_BURST_LENGTH 8
+#define DMA_MEMCPY_LITE_BURST_LENGTH 4
+
+#define DMA_MEMCPY_SIM_CTRLBLOCK_BUS_ADDR 0x40000000
+
+/*
+ * 2D copies ("dma_memcpy_2d_async()") run on one channel.
+ *
+ * STD channel: TDMODE control blocks of up to DMA_MEMCPY_2D_MAX_ROWS rows each. XLENGTH is the row width, and after every row
+ * the addresses move by the stride (pitch - width, signed 16 bit). The engine performs YLENGTH + 1 rows.
+ * LITE channel (or a stride out of range, or DMA_MEMCPY_2D_PER_ROW): one control block per row (split at the channel length limit).
+ */
+
+#define DMA_MEMCPY_2D_MAX_WIDTH 0xFFFF
+#define DMA_MEMCPY_2D_MAX_ROWS 0x4000
+#define DMA_MEMCPY_2D_MIN_STRIDE (-32768)
+#define DMA_MEMCPY_2D_MAX_STRIDE 32767
+
+#define DMA_MEMCPY_2D_MAX_CTRLBLOCK_BYTES 0x1000000
+
+#define DMA_MEMCPY_TI_TDMODE (1 << 1)
+
+bool dma_memcpy_active = false;
+bool dma_memcpy_simulated = false;
+
+uint64_t dma_memcpy_get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (((uint64_t) now.tv_sec)*1000000000 + ((uint64_t) now.tv_nsec));
+}
+
+bool dma_memcpy_init(bool simulate)
+{
+	if(dma_memcpy_active) return true;
+
+	if(!simulate)
+	{
+		if(!dma_is_active()) if(!dma_init()) return false;
+
+		//Buffers, channel allocation and completion interrupts are only available through "/dev/DMA_Ctrl".
+		if(!dma_ioctl_is_enabled()) return false;
+	}
+
+	dma_memcpy_simulated = simulate;
+	dma_memcpy_active = true;
+	return true;
+}
+
+void dma_memcpy_deinit(void)
+{
+	dma_memcpy_active = false;
+	return;
+}
+
+void dma_memcpy_release(dma_memcpy_job_t *job)
+{
+	uint8_t n_channel = 0;
+
+	if(dma_memcpy_simulated)
+	{
+		free(job->ctrlblocks.virt);
+		memset(&job->ctrlblocks, 0, sizeof(dma_buffer_t));
+	}
+	else
+	{
+		while(n_channel < job->n_channels)
+		{
+			dma_channel_free(job->dma_ctrl[n_channel]);
+			n_channel++;
+		}
+
+		dma_buffer_free(&job->ctrlblocks);
+	}
+
+	job->n_channels = 0;
+	job->pending = false;
+	return;
+}
+
+//Reserves up to "n_wanted" channels, STD channels first. Only waits if no channel at all is free.
+bool dma_memcpy_alloc_channels(dma_memcpy_job_t *job, uint8_t n_wanted)
+{
+	int dma_ctrl = -1;
+
+	if(dma_memcpy_simulated)
+	{
+		while(job->n_channels < n_wanted)
+		{
+			job->dma_ctrl[job->n_channels] = job->n_channels;
+			job->n_channels++;
+		}
+
+		return true;
+	}
+
+	while(job->n_channels < n_wanted)
+	{
+		dma_ctrl = dma_channel_alloc(0, 0);
+		if(dma_ctrl < 0) dma_ctrl = dma_channel_alloc(DMA_CHANNEL_ALLOC_LITE_OK, 0);
+
+		if(dma_ctrl < 0)
+		{
+			if(job->n_channels) break;
+
+			dma_ctrl = dma_channel_alloc((DMA_CHANNEL_ALLOC_LITE_OK | DMA_CHANNEL_ALLOC_WAIT), 0);
+			if(dma_ctrl < 0) return false;
+		}
+
+		job->dma_ctrl[job->n_channels] = (uint8_t) dma_ctrl;
+		job->n_channels++;
+	}
+
+	return true;
+}
+
+bool dma_memcpy_alloc_ctrlblocks(dma_memcpy_job_t *job, uint32_t n_ctrlblock)
+{
+	uint32_t size = n_ctrlblock*sizeof(dma_ctrlblock_t);
+
+	if(!dma_memcpy_simulated) return dma_buffer_alloc(&job->ctrlblocks, size);
+
+	memset(&job->ctrlblocks, 0, sizeof(dma_buffer_t));
+	if(posix_memalign(&job->ctrlblocks.virt, sizeof(dma_ctrlblock_t), size))
+	{
+		job->ctrlblocks.virt = NULL;
+		return false;
+	}
+
+	memset(job->ctrlblocks.virt, 0, size);
+	job->ctrlblocks.bus_addr = DMA_MEMCPY_SIM_CTRLBLOCK_BUS_ADDR;
+	job->ctrlblocks.size = size;
+	return true;
+}
+
+//Sets up the transfer info of a memory to memory control block.
+void dma_memcpy_set_template(dma_ctrlblock_t *p_ctrlblock, bool wide, bool lite)
+{
+	dma_reset_ctrlblock(p_ctrlblock);
+	dma_enable_src_addr_inc(p_ctrlblock, true);
+	dma_enable_dst_addr_inc(p_ctrlblock, true);
+	dma_enable_src_read_128bit_width(p_ctrlblock, wide);
+	dma_enable_dst_write_128bit_width(p_ctrlblock, wide);
+	dma_disable_wide_bursts(p_ctrlblock, !wide);
+	dma_set_burst_length(p_ctrlblock, (lite ? DMA_MEMCPY_LITE_BURST_LENGTH : DMA_MEMCPY_STD_BURST_LENGTH));
+	dma_enable_wait_write_response(p_ctrlblock, true);
+	dma_set_permap(p_ctrlblock, DMA_PERMAP_ALWAYS_ON);
+	return;
+}
+
+//Writes the control block chain of one stripe, starting at "p_ctrlblock". Returns the number of control blocks written.
+uint32_t dma_memcpy_build_stripe(dma_memcpy_job_t *job, dma_ctrlblock_t *p_ctrlblock, uint32_t dst_addr, uint32_t src_addr, uint32_t length, bool lite)
+{
+	uint32_t max_chunk = DMA_MEMCPY_STD_MAX_CHUNK;
+	uint32_t chunk = 0;
+	uint32_t n_ctrlblock = 0;
+	bool aligned = !((dst_addr | src_addr) & 0xF);
+	bool wide = false;
+
+	if(lite) max_chunk = DMA_MEMCPY_LITE_MAX_CHUNK;
+
+	while(length)
+	{
+		chunk = length;
+		if(chunk > max_chunk) chunk = max_chunk;
+		if(aligned && (chunk >= 16)) chunk &= ~0xF;
+
+		wide = (aligned && !(chunk & 0xF));
+
+		dma_memcpy_set_template(&p_ctrlblock[n_ctrlblock], wide, lite);
+		dma_set_src_addr_phys(&p_ctrlblock[n_ctrlblock], src_addr);
+		dma_set_dst_addr_phys(&p_ctrlblock[n_ctrlblock], dst_addr);
+
+		//Outside 2D mode, the length of a STD channel is 30 bits wide. "dma_set_transfer_length_bytes()" only covers 16 bits.
+		p_ctrlblock[n_ctrlblock].transfer_length = chunk;
+
+		dst_addr += chunk;
+		src_addr += chunk;
+		length -= chunk;
+		n_ctrlblock++;
+
+		if(length) dma_set_next_ctrlblock_addr_phys(&p_ctrlblock[n_ctrlblock - 1], dma_buffer_get_bus_addr(&job->ctrlblocks, &p_ctrlblock[n_ctrlblock]));
+	}
+
+	dma_set_next_ctrlblock_addr_phys(&p_ctrlblock[n_ctrlblock - 1], 0);
+	dma_enable_intr(&p_ctrlblock[n_ctrlblock - 1], true);
+	return n_ctrlblock;
+}
+
+bool dma_memcpy_async(dma_memcpy_job_t *job, const dma_buffer_t *dst, uint32_t dst_offset, const dma_buffer_t *src, uint32_t src_offset, uint32_t length, uint8_t max_channels)
+{
+	dma_ctrlblock_t *ctrlblock = NULL;
+	uint32_t stripe_offset = 0;
+	uint32_t stripe_length = 0;
+	uint32_t max_chunk = 0;
+	uint32_t n_ctrlblock = 0;
+	uint8_t n_wanted = 0;
+	uint8_t n_channel = 0;
+	bool lite = false;
+
+	if(!dma_memcpy_active) return false;
+	if((job == NULL) || (dst == NULL) || (src == NULL) || (length == 0)) return false;
+	if((max_channels == 0) || (max_channels > DMA_MEMCPY_MAX_CHANNELS)) return false;
+	if(((uint64_t) dst_offset + length) > dst->size) return false;
+	if(((uint64_t) src_offset + length) > src->size) return false;
+
+	memset(job, 0, sizeof(dma_memcpy_job_t));
+	job->dst = *dst;
+	job->src = *src;
+	job->length = length;
+
+	n_wanted = max_channels;
+	if((length/DMA_MEMCPY_MIN_STRIPE_BYTES) < n_wanted) n_wanted = (uint8_t) (length/DMA_MEMCPY_MIN_STRIPE_BYTES);
+	if(n_wanted == 0) n_wanted = 1;
+
+	if(!dma_memcpy_alloc_channels(job, n_wanted)) return false;
+
+	//Upper bound: every stripe may need one tail control block.
+	while(n_channel < job->n_channels)
+	{
+		if(job->dma_ctrl[n_channel] > DMA_STD_CH6) max_chunk = DMA_MEMCPY_LITE_MAX_CHUNK;
+		else max_chunk = DMA_MEMCPY_STD_MAX_CHUNK;
+
+		n_ctrlblock += (length/job->n_channels)/max_chunk + 3;
+		n_channel++;
+	}
+
+	if(!dma_memcpy_alloc_ctrlblocks(job, n_ctrlblock))
+	{
+		dma_memcpy_release(job);
+		return false;
+	}
+
+	ctrlblock = (dma_ctrlblock_t*) job->ctrlblocks.virt;
+
+	n_channel = 0;
+	while(n_channel < job->n_channels)
+	{
+		if(n_channel == (job->n_channels - 1)) stripe_length = length - stripe_offset;
+		else stripe_length = (length/job->n_channels) & ~0xF;
+
+		lite = (dma_memcpy_simulated ? false : (job->dma_ctrl[n_channel] > DMA_STD_CH6));
+
+		job->ctrlblock_offset[n_channel] = job->n_ctrlblock;
+		job->n_ctrlblock += dma_memcpy_build_stripe(job, &ctrlblock[job->n_ctrlblock], dst->bus_addr + dst_offset + stripe_offset, src->bus_addr + src_offset + stripe_offset, stripe_length, lite);
+
+		stripe_offset += stripe_length;
+		n_channel++;
+	}
+
+	job->pending = true;
+	job->start_ns = dma_memcpy_get_time_ns();
+
+	if(dma_memcpy_simulated) return true;
+
+	n_channel = 0;
+	while(n_channel < job->n_channels)
+	{
+		dma_enable_ctrl(job->dma_ctrl[n_channel], true);
+		dma_set_ctrlblock_addr_phys(job->dma_ctrl[n_channel], dma_buffer_get_bus_addr(&job->ctrlblocks, &ctrlblock[job->ctrlblock_offset[n_channel]]));
+		dma_set_transfer_active(job->dma_ctrl[n_channel], true);
+		n_channel++;
+	}
+
+	return true;
+}
+
+bool dma_memcpy_2d_fits(const dma_buffer_t *p_buffer, uint32_t offset, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	return ((((uint64_t) offset) + ((uint64_t) (height - 1))*pitch + width) <= p_buffer->size);
+}
+
+bool dma_memcpy_2d_stride_fits(uint32_t pitch, uint32_t width)
+{
+	int64_t stride = ((int64_t) pitch) - ((int64_t) width);
+
+	return ((stride >= DMA_MEMCPY_2D_MIN_STRIDE) && (stride <= DMA_MEMCPY_2D_MAX_STRIDE));
+}
+
+//Writes the control blocks of a 2D copy into "job->ctrlblocks", either as TDMODE blocks or one chain per row. Returns false if they don't fit.
+bool dma_memcpy_build_2d(dma_memcpy_job_t *job, uint32_t dst_addr, uint32_t dst_pitch, uint32_t src_addr, uint32_t src_pitch, uint32_t width, uint32_t height, bool tdmode, bool lite)
+{
+	dma_chain_t chain;
+	dma_ctrlblock_t template;
+	uint32_t max_chunk = DMA_MEMCPY_STD_MAX_CHUNK;
+	uint32_t n_row = 0;
+	uint32_t n_rows = 0;
+	uint32_t offset = 0;
+	uint32_t chunk = 0;
+	bool wide = !((dst_addr | dst_pitch | src_addr | src_pitch | width) & 0xF);
+
+	if(!dma_chain_create_in_buffer(&chain, &job->ctrlblocks, 0, job->ctrlblocks.size/sizeof(dma_ctrlblock_t))) return false;
+
+	dma_memcpy_set_template(&template, wide, lite);
+
+	if(tdmode)
+	{
+		dma_enable_tdmode(&template, true);
+		dma_set_src_stride(&template, (uint16_t) (src_pitch - width));
+		dma_set_dst_stride(&template, (uint16_t) (dst_pitch - width));
+
+		while(n_row < height)
+		{
+			n_rows = height - n_row;
+			if(n_rows > DMA_MEMCPY_2D_MAX_ROWS) n_rows = DMA_MEMCPY_2D_MAX_ROWS;
+
+			if(dma_chain_add(&chain, &template, src_addr + n_row*src_pitch, dst_addr + n_row*dst_pitch, DMA_CHAIN_LENGTH_2D(width, n_rows - 1)) < 0) return false;
+			n_row += n_rows;
+		}
+	}
+	else
+	{
+		if(lite) max_chunk = DMA_MEMCPY_LITE_MAX_CHUNK;
+
+		while(n_row < height)
+		{
+			offset = 0;
+			while(offset < width)
+			{
+				chunk = width - offset;
+				if(chunk > max_chunk) chunk = max_chunk;
+
+				if(dma_chain_add(&chain, &template, src_addr + n_row*src_pitch + offset, dst_addr + n_row*dst_pitch + offset, chunk) < 0) return false;
+				offset += chunk;
+			}
+
+			n_row++;
+		}
+	}
+
+	dma_enable_intr(dma_chain_get_ctrlblock(&chain, chain.n_ctrlblock - 1), true);
+	job->n_ctrlblock = chain.n_ctrlblock;
+	return true;
+}
+
+bool dma_memcpy_2d_async(dma_memcpy_job_t *job, const dma_buffer_t *dst, uint32_t dst_offset, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_offset, uint32_t src_pitch, uint32_t width, uint32_t height, uint32_t flags)
+{
+	dma_ctrlblock_t *ctrlblock = NULL;
+	uint64_t n_ctrlblock = 0;
+	bool tdmode = false;
+	bool lite = false;
+
+	if(!dma_memcpy_active) return false;
+	if((job == NULL) || (dst == NULL) || (src == NULL) || (width == 0) || (height == 0)) return false;
+	if(dst_pitch < width) return false;
+	if(!dma_memcpy_2d_fits(dst, dst_offset, dst_pitch, width, height)) return false;
+	if(!dma_memcpy_2d_fits(src, src_offset, src_pitch, width, height)) return false;
+
+	memset(job, 0, sizeof(dma_memcpy_job_t));
+	job->dst = *dst;
+	job->src = *src;
+	job->length = width*height;
+
+	if(!dma_memcpy_alloc_channels(job, 1)) return false;
+
+	lite = (dma_memcpy_simulated ? false : (job->dma_ctrl[0] > DMA_STD_CH6));
+	tdmode = (!lite && !(flags & DMA_MEMCPY_2D_PER_ROW) && (width <= DMA_MEMCPY_2D_MAX_WIDTH));
+	tdmode = (tdmode && dma_memcpy_2d_stride_fits(dst_pitch, width) && dma_memcpy_2d_stride_fits(src_pitch, width));
+
+	if(tdmode) n_ctrlblock = (height + DMA_MEMCPY_2D_MAX_ROWS - 1)/DMA_MEMCPY_2D_MAX_ROWS;
+	else if(lite) n_ctrlblock = ((uint64_t) height)*((width + DMA_MEMCPY_LITE_MAX_CHUNK - 1)/DMA_MEMCPY_LITE_MAX_CHUNK);
+	else n_ctrlblock = ((uint64_t) height)*((width + DMA_MEMCPY_STD_MAX_CHUNK - 1)/DMA_MEMCPY_STD_MAX_CHUNK);
+
+	if((n_ctrlblock*sizeof(dma_ctrlblock_t)) > DMA_MEMCPY_2D_MAX_CTRLBLOCK_BYTES)
+	{
+		dma_memcpy_release(job);
+		return false;
+	}
+
+	if(!dma_memcpy_alloc_ctrlblocks(job, (uint32_t) n_ctrlblock))
+	{
+		dma_memcpy_release(job);
+		return false;
+	}
+
+	if(!dma_memcpy_build_2d(job, dst->bus_addr + dst_offset, dst_pitch, src->bus_addr + src_offset, src_pitch, width, height, tdmode, lite))
+	{
+		dma_memcpy_release(job);
+		return false;
+	}
+
+	ctrlblock = (dma_ctrlblock_t*) job->ctrlblocks.virt;
+	job->ctrlblock_offset[0] = 0;
+	job->pending = true;
+	job->start_ns = dma_memcpy_get_time_ns();
+
+	if(dma_memcpy_simulated) return true;
+
+	dma_enable_ctrl(job->dma_ctrl[0], true);
+	dma_set_ctrlblock_addr_phys(job->dma_ctrl[0], dma_buffer_get_bus_addr(&job->ctrlblocks, ctrlblock));
+	dma_set_transfer_active(job->dma_ctrl[0], true);
+	return true;
+}
+
+int dma_memcpy_2d(const dma_buffer_t *dst, uint32_t dst_offset, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_offset, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+	dma_memcpy_job_t job;
+
+	if(!dma_memcpy_2d_async(&job, dst, dst_offset, dst_pitch, src, src_offset, src_pitch, width, height, 0)) return -1;
+	return dma_memcpy_wait(&job, 0);
+}
+
+void *dma_memcpy_sim_get_virt(dma_memcpy_job_t *job, uint32_t bus_addr, uint32_t length)
+{
+	const dma_buffer_t *buffers[3] = {&job->ctrlblocks, &job->dst, &job->src};
+	uint8_t n_buffer = 0;
+
+	while(n_buffer < 3)
+	{
+		if((bus_addr >= buffers[n_buffer]->bus_addr) && (((uint64_t) bus_addr + length) <= ((uint64_t) buffers[n_buffer]->bus_addr + buffers[n_buffer]->size)))
+			return (((uint8_t*) buffers[n_buffer]->virt) + (bus_addr - buffers[n_buffer]->bus_addr));
+
+		n_buffer++;
+	}
+
+	return NULL;
+}
+
+//Executes one TDMODE control block in software: YLENGTH + 1 rows of XLENGTH bytes, moving by the signed strides after each row.
+bool dma_memcpy_sim_run_2d(dma_memcpy_job_t *job, const dma_ctrlblock_t *p_ctrlblock)
+{
+	uint32_t width = (p_ctrlblock->transfer_length & 0xFFFF);
+	uint32_t n_rows = ((p_ctrlblock->transfer_length >> 16) & 0x3FFF) + 1;
+	uint32_t dst_addr = p_ctrlblock->dst_addr;
+	uint32_t src_addr = p_ctrlblock->src_addr;
+	int16_t dst_stride = (int16_t) (p_ctrlblock->stride >> 16);
+	int16_t src_stride = (int16_t) (p_ctrlblock->stride & 0xFFFF);
+	void *p_dst = NULL;
+	void *p_src = NULL;
+	uint32_t n_row = 0;
+
+	while(n_row < n_rows)
+	{
+		p_dst = dma_memcpy_sim_get_virt(job, dst_addr, width);
+		p_src = dma_memcpy_sim_get_virt(job, src_addr, width);
+		if((p_dst == NULL) || (p_src == NULL)) return false;
+
+		memcpy(p_dst, p_src, width);
+
+		dst_addr += width + dst_stride;
+		src_addr += width + src_stride;
+		n_row++;
+	}
+
+	return true;
+}
+
+//Executes one stripe in software. Returns false if the chain points outside the job buffers.
+bool dma_memcpy_sim_run_stripe(dma_memcpy_job_t *job, uint8_t n_channel)
+{
+	dma_ctrlblock_t *p_ctrlblock = &((dma_ctrlblock_t*) job->ctrlblocks.virt)[job->ctrlblock_offset[n_channel]];
+	void *p_dst = NULL;
+	void *p_src = NULL;
+
+	while(true)
+	{
+		if(p_ctrlblock->transfer_info & DMA_MEMCPY_TI_TDMODE)
+		{
+			if(!dma_memcpy_sim_run_2d(job, p_ctrlblock)) return false;
+		}
+		else
+		{
+			p_dst = dma_memcpy_sim_get_virt(job, p_ctrlblock->dst_addr, p_ctrlblock->transfer_length);
+			p_src = dma_memcpy_sim_get_virt(job, p_ctrlblock->src_addr, p_ctrlblock->transfer_length);
+			if((p_dst == NULL) || (p_src == NULL)) return false;
+
+			memcpy(p_dst, p_src, p_ctrlblock->transfer_length);
+		}
+
+		if(p_ctrlblock->next_ctrlblock_addr == 0) return true;
+
+		p_ctrlblock = (dma_ctrlblock_t*) dma_memcpy_sim_get_virt(job, p_ctrlblock->next_ctrlblock_addr, sizeof(dma_ctrlblock_t));
+		if(p_ctrlblock == NULL) return false;
+	}
+}
+
+//Waits for one channel without completion interrupt, by polling its ACTIVE flag. Returns 1 if finished, 0 on timeout.
+int dma_memcpy_poll_channel(uint8_t dma_ctrl, uint64_t deadline_ns)
+{
+	while(dma_get_transfer_active(dma_ctrl))
+	{
+		if(deadline_ns && (dma_memcpy_get_time_ns() >= deadline_ns)) return 0;
+	}
+
+	return 1;
+}
+
+int dma_memcpy_wait(dma_memcpy_job_t *job, uint32_t timeout_us)
+{
+	uint64_t deadline_ns = 0;
+	uint64_t now_ns = 0;
+	uint32_t remaining_us = 0;
+	uint8_t n_channel = 0;
+	int ret = 0;
+
+	if((job == NULL) || !job->pending) return -1;
+
+	if(timeout_us) deadline_ns = dma_memcpy_get_time_ns() + ((uint64_t) timeout_us)*1000;
+
+	while(n_channel < job->n_channels)
+	{
+		if(job->channel_done[n_channel])
+		{
+			n_channel++;
+			continue;
+		}
+
+		if(dma_memcpy_simulated)
+		{
+			if(!dma_memcpy_sim_run_stripe(job, n_channel)) job->error = true;
+			job->channel_done[n_channel] = true;
+			n_channel++;
+			continue;
+		}
+
+		remaining_us = 0;
+		if(deadline_ns)
+		{
+			now_ns = dma_memcpy_get_time_ns();
+			if(now_ns >= deadline_ns) return 0;
+
+			remaining_us = (uint32_t) ((deadline_ns - now_ns)/1000);
+			if(remaining_us == 0) remaining_us = 1;
+		}
+
+		ret = dma_wait(job->dma_ctrl[n_channel], remaining_us);
+		if(ret == 0) return 0;
+
+		if(ret < 0)
+		{
+			//No completion interrupt for this channel: poll it instead.
+			if(dma_error_occurred(job->dma_ctrl[n_channel])) job->error = true;
+			else if(dma_memcpy_poll_channel(job->dma_ctrl[n_channel], deadline_ns) == 0) return 0;
+		}
+		else
+		{
+			//A completion left over from an earlier transfer returns early. The stripe is only done once ACTIVE is cleared.
+			if(dma_memcpy_poll_channel(job->dma_ctrl[n_channel], deadline_ns) == 0) return 0;
+		}
+
+		job->channel_done[n_channel] = true;
+		n_channel++;
+	}
+
+	job->end_ns = dma_memcpy_get_time_ns();
+	dma_memcpy_release(job);
+
+	if(job->error) return -1;
+	return 1;
+}
+
+uint64_t dma_memcpy_get_elapsed_ns(const dma_memcpy_job_t *job)
+{
+	if(job->end_ns < job->start_ns) return 0;
+	return (job->end_ns - job->start_ns);
+}
+
+float dma_memcpy_get_bandwidth(const dma_memcpy_job_t *job)
+{
+	uint64_t elapsed_ns = dma_memcpy_get_elapsed_ns(job);
+
+	if(job->pending || job->error || (elapsed_ns == 0)) return 0.0f;
+
+	//bytes/ns = GB/s
+	return (((float) job->length)*1000.0f)/((float) elapsed_ns);
+}
+
+float dma_memcpy_cpu_bandwidth(void *dst, const void *src, uint32_t length, uint32_t n_runs)
+{
+	uint64_t start_ns = 0;
+	uint64_t elapsed_ns = 0;
+	uint32_t n_run = 0;
+
+	if((dst == NULL) || (src == NULL) || (length == 0) || (n_runs == 0)) return 0.0f;
+
+	start_ns = dma_memcpy_get_time_ns();
+	while(n_run < n_runs)
+	{
+		memcpy(dst, src, length);
+		n_run++;
+	}
+
+	elapsed_ns = dma_memcpy_get_time_ns() - start_ns;
+	if(elapsed_ns == 0) return 0.0f;
+
+	return (((float) length)*((float) n_runs)*1000.0f)/((float) elapsed_ns);
+}
+
+float dma_memcpy_2d_bandwidth(uint64_t bytes, uint64_t elapsed_ns)
+{
+	if(elapsed_ns == 0) return 0.0f;
+	return (((float) bytes)*1000.0f)/((float) elapsed_ns);
+}
+
+bool dma_memcpy_2d_benchmark(const dma_buffer_t *dst, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_pitch, uint32_t width, uint32_t height, uint32_t n_runs, dma_memcpy_2d_bench_t *p_result)
+{
+	dma_memcpy_job_t job;
+	uint64_t start_ns = 0;
+	uint64_t bytes = 0;
+	uint32_t n_run = 0;
+	uint32_t n_row = 0;
+
+	if((p_result == NULL) || (n_runs == 0)) return false;
+
+	memset(p_result, 0, sizeof(dma_memcpy_2d_bench_t));
+	bytes = ((uint64_t) width)*height*n_runs;
+
+	//DMA timings include building the control blocks, since that is what the per row loop costs.
+	start_ns = dma_memcpy_get_time_ns();
+	while(n_run < n_runs)
+	{
+		if(!dma_memcpy_2d_async(&job, dst, 0, dst_pitch, src, 0, src_pitch, width, height, 0)) return false;
+		if(dma_memcpy_wait(&job, 0) != 1) return false;
+		n_run++;
+	}
+	p_result->dma_2d = dma_memcpy_2d_bandwidth(bytes, dma_memcpy_get_time_ns() - start_ns);
+
+	n_run = 0;
+	start_ns = dma_memcpy_get_time_ns();
+	while(n_run < n_runs)
+	{
+		if(!dma_memcpy_2d_async(&job, dst, 0, dst_pitch, src, 0, src_pitch, width, height, DMA_MEMCPY_2D_PER_ROW)) return false;
+		if(dma_memcpy_wait(&job, 0) != 1) return false;
+		n_run++;
+	}
+	p_result->dma_per_row = dma_memcpy_2d_bandwidth(bytes, dma_memcpy_get_time_ns() - start_ns);
+
+	n_run = 0;
+	start_ns = dma_memcpy_get_time_ns();
+	while(n_run < n_runs)
+	{
+		n_row = 0;
+		while(n_row < height)
+		{
+			memcpy(((uint8_t*) dst->virt) + n_row*dst_pitch, ((const uint8_t*) src->virt) + n_row*src_pitch, width);
+			n_row++;
+		}
+
+		n_run++;
+	}
+	p_result->cpu = dma_memcpy_2d_bandwidth(bytes, dma_memcpy_get_time_ns() - start_ns);
+
+	return true;
+}
@@ -0,0 +1,78 @@
+//DMA memory copy engine
+
+#ifndef DMA_MEMCPY_H
+#define DMA_MEMCPY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DMA_Ctrl.h"
+
+#define DMA_MEMCPY_MAX_CHANNELS 8
+
+//Flags of "dma_memcpy_2d_async()".
+//"DMA_MEMCPY_2D_PER_ROW": one control block per row, even where 2D mode is available. Meant for comparisons.
+#define DMA_MEMCPY_2D_PER_ROW 0x1
+
+//One copy in progress. Filled by "dma_memcpy_async()", only read by the application.
+typedef struct {
+	uint8_t n_channels;
+	uint8_t dma_ctrl[DMA_MEMCPY_MAX_CHANNELS];
+	bool channel_done[DMA_MEMCPY_MAX_CHANNELS];
+	uint32_t ctrlblock_offset[DMA_MEMCPY_MAX_CHANNELS];
+	dma_buffer_t ctrlblocks;
+	uint32_t n_ctrlblock;
+	dma_buffer_t dst;
+	dma_buffer_t src;
+	uint32_t length;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	bool pending;
+	bool error;
+} dma_memcpy_job_t;
+
+//Bandwidths measured by "dma_memcpy_2d_benchmark()", in MB/s.
+typedef struct {
+	float dma_2d;
+	float dma_per_row;
+	float cpu;
+} dma_memcpy_2d_bench_t;
+
+//Initializes the copy engine.
+//If "simulate" is true, no driver is used at all. Buffers may then be any memory with made up (non overlapping) bus addresses, and copies are executed in software by "dma_memcpy_wait()", following the control block chains.
+//Returns true if initialization is successful.
+bool dma_memcpy_init(bool simulate);
+//Releases the copy engine. Copies still in progress must be waited for first.
+void dma_memcpy_deinit(void);
+
+//Starts copying "length" bytes from "src" (at "src_offset") to "dst" (at "dst_offset"). Both are buffers allocated with "dma_buffer_alloc()".
+//The copy is striped over up to "max_channels" channels (1 to DMA_MEMCPY_MAX_CHANNELS), as many as the channel allocator has free. STD channels are used first.
+//If no channel is free at all, waits for one.
+//Control blocks are split at the LITE channel length limit (64 KB) when needed. 128 bit reads and writes are used where both addresses are 16 byte aligned.
+//Returns false if the copy could not be started.
+bool dma_memcpy_async(dma_memcpy_job_t *job, const dma_buffer_t *dst, uint32_t dst_offset, const dma_buffer_t *src, uint32_t src_offset, uint32_t length, uint8_t max_channels);
+//Waits up to "timeout_us" microseconds (0 waits indefinitely) for the copy to finish. The channels and control blocks are released once it's finished.
+//Returns 1 if the copy is finished, 0 on timeout (call again later), or -1 on error (a channel reported an error, or the job is not pending).
+int dma_memcpy_wait(dma_memcpy_job_t *job, uint32_t timeout_us);
+
+//Starts copying a "width" x "height" bytes rectangle from "src" (first row at "src_offset", rows "src_pitch" bytes apart) to "dst" (same, with "dst_offset" and "dst_pitch").
+//Runs on one channel. On a STD channel, every 16384 rows are one 2D mode (TDMODE) control block, as long as both (pitch - width) fit in 16 bits signed and width is at most 65535.
+//Otherwise (LITE channel, or DMA_MEMCPY_2D_PER_ROW in "flags") a chain of one control block per row is generated.
+//"dst_pitch" must be at least "width". "src_pitch" may be smaller (even 0, to repeat one row).
+//Wait for it with "dma_memcpy_wait()". Returns false if the copy could not be started.
+bool dma_memcpy_2d_async(dma_memcpy_job_t *job, const dma_buffer_t *dst, uint32_t dst_offset, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_offset, uint32_t src_pitch, uint32_t width, uint32_t height, uint32_t flags);
+//Same as "dma_memcpy_2d_async()" followed by "dma_memcpy_wait()" without timeout. Returns 1 if the copy is finished, or -1 on error.
+int dma_memcpy_2d(const dma_buffer_t *dst, uint32_t dst_offset, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_offset, uint32_t src_pitch, uint32_t width, uint32_t height);
+
+//Returns the time between the start of the copy and the moment "dma_memcpy_wait()" saw it finished, in nanoseconds.
+uint64_t dma_memcpy_get_elapsed_ns(const dma_memcpy_job_t *job);
+//Returns the achieved bandwidth of a finished copy, in MB/s (10^6 bytes per second), or 0 if not available.
+//Compare with "dma_memcpy_cpu_bandwidth()" to see if the copy is worth offloading.
+float dma_memcpy_get_bandwidth(const dma_memcpy_job_t *job);
+//Copies "length" bytes with memcpy() (CPU), "n_runs" times, and returns the average bandwidth in MB/s.
+float dma_memcpy_cpu_bandwidth(void *dst, const void *src, uint32_t length, uint32_t n_runs);
+//Copies a rectangle (offsets 0) "n_runs" times with each method: 2D mode DMA, one DMA control block per row, and memcpy() per row (CPU).
+//DMA bandwidths include building the control blocks and waiting for completion. Returns false if a copy failed.
+bool dma_memcpy_2d_benchmark(const dma_buffer_t *dst, uint32_t dst_pitch, const dma_buffer_t *src, uint32_t src_pitch, uint32_t width, uint32_t height, uint32_t n_runs, dma_memcpy_2d_bench_t *p_result);
+
+#endif
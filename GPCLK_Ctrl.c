@@ -3,8 +3,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #include "GPIO_Ctrl.h"
 
@@ -16,6 +19,7 @@ Else, application will wait a specific time (defined in GPCLK_CTRL_WAIT_TIME_US)
 #define GPCLK_CTRL_WAIT_KERNEL_RESPONSE
 
 #define GPCLK_CTRL_PROC_FILE_DIR "/proc/GPCLK_Ctrl"
+#define GPCLK_CTRL_DEV_FILE_DIR "/dev/GPCLK_Ctrl"
 #define GPCLK_CTRL_WAIT_TIME_US 1
 
 #define GPCLK_DATAIO_SIZE_BYTES 4
@@ -36,10 +40,27 @@ Else, application will wait a specific time (defined in GPCLK_CTRL_WAIT_TIME_US)
 #define GPCLK_CMD_SET_KILL_BIT 13
 #define GPCLK_CMD_GET_KILL_BIT 14
 
+#define GPCLK_CMD_RING_DOORBELL 0xFE
 #define GPCLK_CMD_KERNEL_RESPONSE 0xFF
 
+#define GPCLK_IOCTL_MAGIC 'c'
+#define GPCLK_IOCTL_RUN_CMD _IOWR(GPCLK_IOCTL_MAGIC, 0, uint8_t[GPCLK_DATAIO_SIZE_BYTES])
+
+#define GPCLK_RING_SIZE_BYTES 4096
+#define GPCLK_RING_HEADER_SIZE_BYTES 16
+#define GPCLK_RING_ENTRY_SIZE_BYTES 8
+#define GPCLK_RING_ENTRIES 256
+
+#define GPCLK_RING_SQ_TAIL_UINTP_POS 0
+#define GPCLK_RING_SQ_HEAD_UINTP_POS 1
+#define GPCLK_RING_FLAGS_UINTP_POS 2
+
+#define GPCLK_RING_FLAG_KERNEL_POLL 0x1
+
 int gpclk_proc_fd = -1;
+int gpclk_dev_fd = -1;
 void *gpclk_data_io = NULL;
+void *gpclk_ring = NULL;
 
 void gpclk_ctrl_wait(void)
 {
@@ -62,6 +83,9 @@ bool gpclk_init(void)
 	gpclk_proc_fd = open(GPCLK_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(gpclk_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	gpclk_dev_fd = open(GPCLK_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	gpclk_data_io = malloc(GPCLK_DATAIO_SIZE_BYTES);
 	return true;
 }
@@ -146,8 +170,13 @@ void gpclk_init_gpio(uint8_t gpclk, uint8_t endpoint)
 	uint8_t pinmode = 0;
 	gpclk_endpoint_map_to_gpio_pinmode(gpclk, endpoint, &gpio, &pinmode);
 
-	gpio_reset_pin(gpio);
-	gpio_set_pinmode(gpio, pinmode);
+	gpio_pin_config_t config;
+	config.pin = gpio;
+	config.pinmode = pinmode;
+	config.pudctrl = GPIO_PUDCTRL_NOPULL;
+	config.detect = 0;
+
+	gpio_apply_config(&config, 1);
 	return;
 }
 
@@ -163,27 +192,98 @@ void gpclk_deinit_gpio(uint8_t gpclk, uint8_t endpoint)
 }
 
 #ifdef GPCLK_CTRL_WAIT_KERNEL_RESPONSE
-void gpclk_call_kernel(void)
+void gpclk_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) gpclk_data_io;
-	write(gpclk_proc_fd, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(gpclk_proc_fd, data_io, GPCLK_DATAIO_SIZE_BYTES);
 
 	do{
-		read(gpclk_proc_fd, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
+		read(gpclk_proc_fd, data_io, GPCLK_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != GPCLK_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void gpclk_call_kernel(void)
+void gpclk_call_kernel_proc(void *data_io)
 {
-	write(gpclk_proc_fd, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
+	write(gpclk_proc_fd, data_io, GPCLK_DATAIO_SIZE_BYTES);
 	gpclk_ctrl_wait();
-	read(gpclk_proc_fd, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
+	read(gpclk_proc_fd, data_io, GPCLK_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void gpclk_call_kernel_ioctl(void *data_io)
+{
+	ioctl(gpclk_dev_fd, GPCLK_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void gpclk_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) gpclk_ring;
+	uint8_t *ring_entries = ((uint8_t*) gpclk_ring) + GPCLK_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[GPCLK_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%GPCLK_RING_ENTRIES)*GPCLK_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[GPCLK_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[GPCLK_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[GPCLK_RING_FLAGS_UINTP_POS] & GPCLK_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, GPCLK_DATAIO_SIZE_BYTES);
+		doorbell[0] = GPCLK_CMD_RING_DOORBELL;
+		if(gpclk_dev_fd >= 0) gpclk_call_kernel_ioctl(doorbell);
+		else gpclk_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[GPCLK_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(gpclk_data_io, pentry, GPCLK_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void gpclk_call_kernel(void)
+{
+	if(gpclk_ring != NULL) gpclk_call_kernel_ring();
+	else if(gpclk_dev_fd >= 0) gpclk_call_kernel_ioctl(gpclk_data_io);
+	else gpclk_call_kernel_proc(gpclk_data_io);
+
+	return;
+}
+
+bool gpclk_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(gpclk_ring != NULL) munmap(gpclk_ring, GPCLK_RING_SIZE_BYTES);
+		gpclk_ring = NULL;
+		return true;
+	}
+
+	if(gpclk_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (gpclk_dev_fd >= 0) ? gpclk_dev_fd : gpclk_proc_fd;
+	void *p_ring = mmap(NULL, GPCLK_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	gpclk_ring = p_ring;
+	return true;
+}
+
+bool gpclk_ring_is_enabled(void)
+{
+	return (gpclk_ring != NULL);
+}
+
+bool gpclk_ioctl_is_enabled(void)
+{
+	return (gpclk_dev_fd >= 0);
+}
+
 void gpclk_enable(uint8_t gpclk, bool enable)
 {
 	uint8_t *pbyte = (uint8_t*) gpclk_data_io;
@@ -28,6 +28,15 @@ bool gpclk_is_active(void);
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool gpclk_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool gpclk_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool gpclk_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/GPCLK_Ctrl" instead of write()/read() calls on the proc file.
+bool gpclk_ioctl_is_enabled(void);
 
 void gpclk_endpoint_map_to_gpio_pinmode(uint8_t gpclk, uint8_t endpoint, uint8_t *p_gpio, uint8_t *p_pinmode);
 void gpclk_init_gpio(uint8_t gpclk, uint8_t endpoint);
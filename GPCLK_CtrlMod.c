@@ -5,8 +5,15 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 #define GPCLK_KEY 0x5A
@@ -49,11 +56,59 @@
 #define GPCLK_CMD_SET_KILL_BIT 13
 #define GPCLK_CMD_GET_KILL_BIT 14
 
+#define GPCLK_CMD_RING_DOORBELL 0xFE
 #define GPCLK_CMD_KERNEL_RESPONSE 0xFF
 
+#define GPCLK_IOCTL_MAGIC 'c'
+#define GPCLK_IOCTL_RUN_CMD _IOWR(GPCLK_IOCTL_MAGIC, 0, unsigned char[GPCLK_DATAIO_SIZE_BYTES])
+
+/*
+ * GPCLK Command Ring Structure (GPCLK_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: GPCLK_RING_ENTRIES entries of GPCLK_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%GPCLK_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a GPCLK_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define GPCLK_RING_SIZE_BYTES 4096
+#define GPCLK_RING_HEADER_SIZE_BYTES 16
+#define GPCLK_RING_ENTRY_SIZE_BYTES 8
+#define GPCLK_RING_ENTRIES 256
+
+#define GPCLK_RING_SQ_TAIL_UINTP_POS 0
+#define GPCLK_RING_SQ_HEAD_UINTP_POS 1
+#define GPCLK_RING_FLAGS_UINTP_POS 2
+
+#define GPCLK_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} gpclk_file_ctx_t;
+
 static struct proc_dir_entry *gpclk_proc = NULL;
 static unsigned int *gpclk_mapping = NULL;
-static void *gpclk_data_io = NULL;
+static spinlock_t gpclk_lock[3];
+static struct task_struct *gpclk_ring_thread = NULL;
+static LIST_HEAD(gpclk_file_ctx_list);
+static DEFINE_MUTEX(gpclk_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int gpclk_is_reg_bit_active(unsigned int register_value, unsigned int reference_bit)
 {
@@ -241,18 +296,18 @@ unsigned int gpclk_get_fractional_divider(unsigned int gpclk)
 	return divider;
 }
 
-ssize_t gpclk_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+void gpclk_run_cmd(unsigned char *pbyte)
 {
-	copy_to_user(user, gpclk_data_io, GPCLK_DATAIO_SIZE_BYTES);
-	return size;
-}
+	unsigned short *pushort = (unsigned short*) &pbyte[2];
 
-ssize_t gpclk_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
-{
-	copy_from_user(gpclk_data_io, user, GPCLK_DATAIO_SIZE_BYTES);
+	if(pbyte[1] > GPCLK2)
+	{
+		pbyte[0] = GPCLK_CMD_KERNEL_RESPONSE;
+		return;
+	}
 
-	unsigned char *pbyte = (unsigned char*) gpclk_data_io;
-	unsigned short *pushort = (unsigned short*) &pbyte[2];
+	//Commands are serialized per clock, so different clocks can be driven concurrently.
+	spin_lock(&gpclk_lock[pbyte[1]]);
 
 	switch(pbyte[0])
 	{
@@ -317,17 +372,171 @@ ssize_t gpclk_mod_usrwrite(struct file *file, const char __user *user, size_t si
 			break;
 	}
 
+	spin_unlock(&gpclk_lock[pbyte[1]]);
+
 	pbyte[0] = GPCLK_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void gpclk_ring_drain(gpclk_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + GPCLK_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[GPCLK_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > GPCLK_RING_ENTRIES) sq_tail = ctx->ring_sq_head + GPCLK_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		gpclk_run_cmd(&ring_entries[(ctx->ring_sq_head%GPCLK_RING_ENTRIES)*GPCLK_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[GPCLK_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int gpclk_ring_poll_thread(void *arg)
+{
+	gpclk_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&gpclk_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &gpclk_file_ctx_list, list) gpclk_ring_drain(ctx);
+		mutex_unlock(&gpclk_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+int gpclk_mod_open(struct inode *inode, struct file *file)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) kzalloc(sizeof(gpclk_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(GPCLK_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(GPCLK_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(gpclk_ring_thread != NULL) ((unsigned int*) ctx->ring)[GPCLK_RING_FLAGS_UINTP_POS] = GPCLK_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&gpclk_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &gpclk_file_ctx_list);
+	mutex_unlock(&gpclk_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int gpclk_mod_release(struct inode *inode, struct file *file)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) file->private_data;
+
+	mutex_lock(&gpclk_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&gpclk_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t gpclk_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) file->private_data;
+
+	if(size > GPCLK_DATAIO_SIZE_BYTES) size = GPCLK_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t gpclk_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) file->private_data;
+
+	if(size != GPCLK_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == GPCLK_CMD_RING_DOORBELL) gpclk_ring_drain(ctx);
+
+	gpclk_run_cmd(pbyte);
 	return size;
 }
 
+int gpclk_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long gpclk_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	gpclk_file_ctx_t *ctx = (gpclk_file_ctx_t*) file->private_data;
+	unsigned char pbyte[GPCLK_DATAIO_SIZE_BYTES];
+
+	if(cmd != GPCLK_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, GPCLK_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == GPCLK_CMD_RING_DOORBELL) gpclk_ring_drain(ctx);
+
+	gpclk_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, GPCLK_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops gpclk_proc_ops = {
+	.proc_open = gpclk_mod_open,
+	.proc_release = gpclk_mod_release,
 	.proc_read = gpclk_mod_usrread,
-	.proc_write = gpclk_mod_usrwrite
+	.proc_write = gpclk_mod_usrwrite,
+	.proc_mmap = gpclk_mod_usrmmap
+};
+
+static const struct file_operations gpclk_fops = {
+	.owner = THIS_MODULE,
+	.open = gpclk_mod_open,
+	.release = gpclk_mod_release,
+	.read = gpclk_mod_usrread,
+	.write = gpclk_mod_usrwrite,
+	.mmap = gpclk_mod_usrmmap,
+	.unlocked_ioctl = gpclk_mod_ioctl
+};
+
+static struct miscdevice gpclk_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "GPCLK_Ctrl",
+	.fops = &gpclk_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
 {
+	spin_lock_init(&gpclk_lock[GPCLK0]);
+	spin_lock_init(&gpclk_lock[GPCLK1]);
+	spin_lock_init(&gpclk_lock[GPCLK2]);
+
 	gpclk_mapping = (unsigned int*) ioremap(GPCLK_BASE_ADDR, GPCLK_MAPPING_SIZE_BYTES);
 	if(gpclk_mapping == NULL)
 	{
@@ -342,16 +551,30 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	gpclk_data_io = vmalloc(GPCLK_DATAIO_SIZE_BYTES);
+	if(misc_register(&gpclk_misc) < 0)
+	{
+		printk("GPCLK: Error registering device file\n");
+		proc_remove(gpclk_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		gpclk_ring_thread = kthread_run(gpclk_ring_poll_thread, NULL, "GPCLK_Ctrl_ring");
+		if(IS_ERR(gpclk_ring_thread)) gpclk_ring_thread = NULL;
+	}
+
 	printk("GPCLK Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
-	iounmap(gpclk_mapping);
+	//Interfaces and the ring thread go first, so no command can run on unmapped registers.
+	misc_deregister(&gpclk_misc);
 	proc_remove(gpclk_proc);
-	vfree(gpclk_data_io);
+	if(gpclk_ring_thread != NULL) kthread_stop(gpclk_ring_thread);
+	iounmap(gpclk_mapping);
 	printk("GPCLK Control Driver Disabled\n");
 	return;
 }
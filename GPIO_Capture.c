@@ -0,0 +1,461 @@
+#include "GPIO_Capture.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "DMA_Ctrl.h"
+
+/*
+ * Ring memory layout (one coherent buffer from "dma_buffer_alloc()", page aligned heap memory in simulation):
+ *
+ * Samples: n_pages*GPIO_CAPTURE_PAGE_SAMPLES words.
+ * Control blocks: 2 per sample.
+ *   READ (2n): copies GPLEV0 to sample "n". Not paced.
+ *   PACE (2n + 1): writes the zero word to the pacing FIFO. DREQ paced, so the next READ waits one sample period.
+ *   The PACE control block of the last sample of each page raises the DMA interrupt. The last one points back to the first READ.
+ * Zero word.
+ *
+ * While control block "c" is loaded, samples 0 to ((c + 1)/2 - 1) of the current lap are complete.
+ */
+
+#define GPIO_CAPTURE_MEM_PAGE_SIZE 4096
+
+#define GPIO_CAPTURE_GPLEV0_BUS_ADDR 0x7E200034
+#define GPIO_CAPTURE_PWM_FIFO_BUS_ADDR 0x7E20C018
+#define GPIO_CAPTURE_PCM_FIFO_BUS_ADDR 0x7E203004
+
+#define GPIO_CAPTURE_SIM_BUS_ADDR 0x30000000
+
+dma_buffer_t gpio_capture_buffer;
+uint32_t *gpio_capture_samples = NULL;
+dma_ctrlblock_t *gpio_capture_ctrlblock = NULL;
+uint32_t *gpio_capture_zero_word = NULL;
+
+bool gpio_capture_active = false;
+bool gpio_capture_simulated = false;
+bool gpio_capture_running = false;
+uint8_t gpio_capture_dma_ctrl = 0;
+uint16_t gpio_capture_n_pages = 0;
+uint32_t gpio_capture_n_samples = 0;
+
+//Write position (ring index of the next sample) as last observed, and total samples written since start.
+uint32_t gpio_capture_write_pos = 0;
+uint64_t gpio_capture_samples_written = 0;
+uint64_t gpio_capture_pages_read = 0;
+uint32_t gpio_capture_read_offset = 0;
+uint32_t gpio_capture_overruns = 0;
+
+//Pages completed according to the page end interrupts collected by "gpio_capture_wait()".
+uint64_t gpio_capture_irq_pages = 0;
+
+uint32_t gpio_capture_trigger_mask = 0;
+uint32_t gpio_capture_trigger_value = 0;
+bool gpio_capture_triggered = true;
+
+gpio_capture_sim_source_t gpio_capture_sim_source = NULL;
+void *gpio_capture_sim_arg = NULL;
+uint32_t gpio_capture_sim_ctrlblock_addr = 0;
+uint64_t gpio_capture_sim_n_sample = 0;
+
+void gpio_capture_mem_free(void)
+{
+	if(gpio_capture_simulated)
+	{
+		if(gpio_capture_buffer.virt != NULL) free(gpio_capture_buffer.virt);
+		memset(&gpio_capture_buffer, 0, sizeof(dma_buffer_t));
+	}
+	else dma_buffer_free(&gpio_capture_buffer);
+
+	gpio_capture_samples = NULL;
+	gpio_capture_ctrlblock = NULL;
+	gpio_capture_zero_word = NULL;
+	return;
+}
+
+bool gpio_capture_mem_alloc(uint32_t size)
+{
+	size = ((size + GPIO_CAPTURE_MEM_PAGE_SIZE - 1)/GPIO_CAPTURE_MEM_PAGE_SIZE)*GPIO_CAPTURE_MEM_PAGE_SIZE;
+
+	if(!gpio_capture_simulated) return dma_buffer_alloc(&gpio_capture_buffer, size);
+
+	if(posix_memalign(&gpio_capture_buffer.virt, GPIO_CAPTURE_MEM_PAGE_SIZE, size))
+	{
+		gpio_capture_buffer.virt = NULL;
+		return false;
+	}
+
+	memset(gpio_capture_buffer.virt, 0, size);
+	gpio_capture_buffer.bus_addr = GPIO_CAPTURE_SIM_BUS_ADDR;
+	gpio_capture_buffer.size = size;
+	return true;
+}
+
+uint32_t gpio_capture_get_bus_addr(void *p)
+{
+	return dma_buffer_get_bus_addr(&gpio_capture_buffer, p);
+}
+
+//Returns the offset of "bus_addr" in the ring memory, or -1 if it's not in the ring memory.
+int64_t gpio_capture_get_offset(uint32_t bus_addr)
+{
+	if((bus_addr < gpio_capture_buffer.bus_addr) || (bus_addr >= (gpio_capture_buffer.bus_addr + gpio_capture_buffer.size))) return -1;
+
+	return (int64_t) (bus_addr - gpio_capture_buffer.bus_addr);
+}
+
+void *gpio_capture_sim_get_virt(uint32_t bus_addr)
+{
+	int64_t offset = gpio_capture_get_offset(bus_addr);
+	if(offset < 0) return NULL;
+
+	return (((uint8_t*) gpio_capture_buffer.virt) + offset);
+}
+
+void gpio_capture_compile(uint8_t permap, uint32_t fifo_bus_addr)
+{
+	dma_ctrlblock_t *p_ctrlblock = gpio_capture_ctrlblock;
+	uint32_t n_sample = 0;
+
+	while(n_sample < gpio_capture_n_samples)
+	{
+		dma_reset_ctrlblock(p_ctrlblock);
+		dma_disable_wide_bursts(p_ctrlblock, true);
+		dma_enable_wait_write_response(p_ctrlblock, true);
+		dma_set_src_addr_phys(p_ctrlblock, GPIO_CAPTURE_GPLEV0_BUS_ADDR);
+		dma_set_dst_addr_phys(p_ctrlblock, gpio_capture_get_bus_addr(&gpio_capture_samples[n_sample]));
+		dma_set_transfer_length_bytes(p_ctrlblock, sizeof(uint32_t));
+		dma_set_next_ctrlblock_addr_phys(p_ctrlblock, gpio_capture_get_bus_addr(&p_ctrlblock[1]));
+		p_ctrlblock++;
+
+		dma_reset_ctrlblock(p_ctrlblock);
+		dma_disable_wide_bursts(p_ctrlblock, true);
+		dma_enable_wait_write_response(p_ctrlblock, true);
+		dma_set_permap(p_ctrlblock, permap);
+		dma_set_dreq_calls_dst_writes(p_ctrlblock, true);
+		if((n_sample%GPIO_CAPTURE_PAGE_SAMPLES) == (GPIO_CAPTURE_PAGE_SAMPLES - 1)) dma_enable_intr(p_ctrlblock, true);
+		dma_set_src_addr_phys(p_ctrlblock, gpio_capture_get_bus_addr(gpio_capture_zero_word));
+		dma_set_dst_addr_phys(p_ctrlblock, fifo_bus_addr);
+		dma_set_transfer_length_bytes(p_ctrlblock, sizeof(uint32_t));
+
+		if(n_sample == (gpio_capture_n_samples - 1)) dma_set_next_ctrlblock_addr_phys(p_ctrlblock, gpio_capture_get_bus_addr(gpio_capture_ctrlblock));
+		else dma_set_next_ctrlblock_addr_phys(p_ctrlblock, gpio_capture_get_bus_addr(&p_ctrlblock[1]));
+
+		p_ctrlblock++;
+		n_sample++;
+	}
+
+	__sync_synchronize();
+	return;
+}
+
+bool gpio_capture_init(uint8_t dma_ctrl, uint8_t pacing, uint16_t n_pages, bool simulate)
+{
+	uint8_t permap = 0;
+	uint32_t fifo_bus_addr = 0;
+	uint32_t samples_size = 0;
+	uint32_t ctrlblock_size = 0;
+
+	if(gpio_capture_active) gpio_capture_deinit();
+
+	if(dma_ctrl > DMA_LITE_CH7) return false;
+	if((n_pages < 2) || (n_pages > GPIO_CAPTURE_MAX_PAGES)) return false;
+
+	switch(pacing)
+	{
+		case GPIO_CAPTURE_PACING_PWM:
+			permap = DMA_PERMAP_PWM;
+			fifo_bus_addr = GPIO_CAPTURE_PWM_FIFO_BUS_ADDR;
+			break;
+
+		case GPIO_CAPTURE_PACING_PCM:
+			permap = DMA_PERMAP_PCM_TX;
+			fifo_bus_addr = GPIO_CAPTURE_PCM_FIFO_BUS_ADDR;
+			break;
+
+		default:
+			return false;
+	}
+
+	if(!simulate) if(!dma_is_active()) if(!dma_init()) return false;
+
+	gpio_capture_simulated = simulate;
+	gpio_capture_n_pages = n_pages;
+	gpio_capture_n_samples = ((uint32_t) n_pages)*GPIO_CAPTURE_PAGE_SAMPLES;
+
+	samples_size = gpio_capture_n_samples*sizeof(uint32_t);
+	ctrlblock_size = 2*gpio_capture_n_samples*sizeof(dma_ctrlblock_t);
+
+	if(!gpio_capture_mem_alloc(samples_size + ctrlblock_size + sizeof(uint32_t))) return false;
+
+	gpio_capture_samples = (uint32_t*) gpio_capture_buffer.virt;
+	gpio_capture_ctrlblock = (dma_ctrlblock_t*) (((uint8_t*) gpio_capture_buffer.virt) + samples_size);
+	gpio_capture_zero_word = (uint32_t*) (((uint8_t*) gpio_capture_buffer.virt) + samples_size + ctrlblock_size);
+	gpio_capture_zero_word[0] = 0;
+
+	gpio_capture_compile(permap, fifo_bus_addr);
+
+	gpio_capture_dma_ctrl = dma_ctrl;
+	gpio_capture_running = false;
+	gpio_capture_set_trigger(0, 0);
+	gpio_capture_active = true;
+	return true;
+}
+
+void gpio_capture_deinit(void)
+{
+	if(!gpio_capture_active) return;
+
+	gpio_capture_stop();
+	gpio_capture_mem_free();
+	gpio_capture_active = false;
+	return;
+}
+
+void gpio_capture_set_sim_source(gpio_capture_sim_source_t source, void *arg)
+{
+	gpio_capture_sim_source = source;
+	gpio_capture_sim_arg = arg;
+	return;
+}
+
+bool gpio_capture_start(void)
+{
+	if(!gpio_capture_active) return false;
+	if(gpio_capture_running) return true;
+
+	gpio_capture_write_pos = 0;
+	gpio_capture_samples_written = 0;
+	gpio_capture_pages_read = 0;
+	gpio_capture_read_offset = 0;
+	gpio_capture_overruns = 0;
+	gpio_capture_irq_pages = 0;
+	gpio_capture_triggered = (gpio_capture_trigger_mask == 0);
+
+	if(gpio_capture_simulated)
+	{
+		gpio_capture_sim_ctrlblock_addr = gpio_capture_get_bus_addr(gpio_capture_ctrlblock);
+		gpio_capture_sim_n_sample = 0;
+	}
+	else
+	{
+		dma_enable_ctrl(gpio_capture_dma_ctrl, true);
+		dma_reset(gpio_capture_dma_ctrl);
+
+		//Discard interrupts left over from a previous run, so they are not counted as pages.
+		dma_wait(gpio_capture_dma_ctrl, 1);
+
+		dma_set_ctrlblock_addr_phys(gpio_capture_dma_ctrl, gpio_capture_get_bus_addr(gpio_capture_ctrlblock));
+		dma_set_transfer_active(gpio_capture_dma_ctrl, true);
+	}
+
+	gpio_capture_running = true;
+	return true;
+}
+
+void gpio_capture_stop(void)
+{
+	if(!gpio_capture_running) return;
+
+	if(!gpio_capture_simulated)
+	{
+		dma_set_transfer_active(gpio_capture_dma_ctrl, false);
+		dma_abort(gpio_capture_dma_ctrl);
+		dma_reset(gpio_capture_dma_ctrl);
+	}
+
+	gpio_capture_running = false;
+	return;
+}
+
+bool gpio_capture_is_running(void)
+{
+	if(!gpio_capture_running) return false;
+	if(gpio_capture_simulated) return true;
+
+	return dma_get_transfer_active(gpio_capture_dma_ctrl);
+}
+
+void gpio_capture_update(void)
+{
+	uint32_t ctrlblock_addr = 0;
+	int64_t offset = 0;
+	uint32_t write_pos = 0;
+	uint64_t pages_full = 0;
+
+	if(!gpio_capture_running) return;
+
+	if(gpio_capture_simulated) ctrlblock_addr = gpio_capture_sim_ctrlblock_addr;
+	else ctrlblock_addr = dma_get_ctrlblock_addr_phys(gpio_capture_dma_ctrl);
+
+	offset = gpio_capture_get_offset(ctrlblock_addr);
+	if(offset < 0) return;
+
+	offset -= (int64_t) (gpio_capture_n_samples*sizeof(uint32_t));
+	if((offset < 0) || (offset >= (int64_t) (2*gpio_capture_n_samples*sizeof(dma_ctrlblock_t)))) return;
+
+	write_pos = ((uint32_t) (offset/sizeof(dma_ctrlblock_t)) + 1)/2;
+	write_pos %= gpio_capture_n_samples;
+
+	gpio_capture_samples_written += ((write_pos + gpio_capture_n_samples - gpio_capture_write_pos)%gpio_capture_n_samples);
+	gpio_capture_write_pos = write_pos;
+
+	//The write position alone can't tell whole laps apart. The page end interrupts can.
+	while((gpio_capture_samples_written/GPIO_CAPTURE_PAGE_SAMPLES) < gpio_capture_irq_pages) gpio_capture_samples_written += gpio_capture_n_samples;
+
+	//The page being written is never handed out.
+	pages_full = gpio_capture_samples_written/GPIO_CAPTURE_PAGE_SAMPLES;
+	if((pages_full - gpio_capture_pages_read) > (uint64_t) (gpio_capture_n_pages - 1))
+	{
+		gpio_capture_overruns += (uint32_t) (pages_full - (gpio_capture_n_pages - 1) - gpio_capture_pages_read);
+		gpio_capture_pages_read = pages_full - (gpio_capture_n_pages - 1);
+		gpio_capture_read_offset = 0;
+	}
+
+	return;
+}
+
+uint16_t gpio_capture_get_available_pages(void)
+{
+	gpio_capture_update();
+	return (uint16_t) (gpio_capture_samples_written/GPIO_CAPTURE_PAGE_SAMPLES - gpio_capture_pages_read);
+}
+
+const uint32_t *gpio_capture_get_page(void)
+{
+	if(!gpio_capture_active) return NULL;
+	if(gpio_capture_get_available_pages() == 0) return NULL;
+
+	return &gpio_capture_samples[(gpio_capture_pages_read%gpio_capture_n_pages)*GPIO_CAPTURE_PAGE_SAMPLES];
+}
+
+void gpio_capture_release_page(void)
+{
+	if(!gpio_capture_active) return;
+	if((gpio_capture_samples_written/GPIO_CAPTURE_PAGE_SAMPLES) == gpio_capture_pages_read) return;
+
+	gpio_capture_pages_read++;
+	gpio_capture_read_offset = 0;
+	return;
+}
+
+int gpio_capture_wait(uint32_t timeout_us)
+{
+	int n_irqs = 0;
+	uint16_t n_pages = 0;
+
+	if(!gpio_capture_active || !gpio_capture_running) return -1;
+
+	n_pages = gpio_capture_get_available_pages();
+	if((n_pages > 0) || gpio_capture_simulated) return (int) n_pages;
+
+	n_irqs = dma_wait(gpio_capture_dma_ctrl, timeout_us);
+	if(n_irqs < 0) return -1;
+
+	gpio_capture_irq_pages += (uint64_t) n_irqs;
+	return (int) gpio_capture_get_available_pages();
+}
+
+uint32_t gpio_capture_get_overruns(void)
+{
+	return gpio_capture_overruns;
+}
+
+void gpio_capture_set_trigger(uint32_t mask, uint32_t value)
+{
+	gpio_capture_trigger_mask = mask;
+	gpio_capture_trigger_value = (value & mask);
+	gpio_capture_triggered = (mask == 0);
+	return;
+}
+
+bool gpio_capture_is_triggered(void)
+{
+	return gpio_capture_triggered;
+}
+
+uint32_t gpio_capture_export_rle(gpio_capture_run_t *runs, uint32_t max_runs, uint32_t pin_mask)
+{
+	const uint32_t *page = NULL;
+	uint32_t sample = 0;
+	uint32_t n_runs = 0;
+
+	if((runs == NULL) || (max_runs == 0)) return 0;
+
+	page = gpio_capture_get_page();
+	while(page != NULL)
+	{
+		while(gpio_capture_read_offset < GPIO_CAPTURE_PAGE_SAMPLES)
+		{
+			sample = page[gpio_capture_read_offset];
+
+			if(!gpio_capture_triggered)
+			{
+				if((sample & gpio_capture_trigger_mask) != gpio_capture_trigger_value)
+				{
+					gpio_capture_read_offset++;
+					continue;
+				}
+
+				gpio_capture_triggered = true;
+			}
+
+			sample &= pin_mask;
+
+			if((n_runs > 0) && (runs[n_runs - 1].levels == sample) && (runs[n_runs - 1].n_samples < 0xFFFFFFFF))
+			{
+				runs[n_runs - 1].n_samples++;
+			}
+			else
+			{
+				if(n_runs == max_runs) return n_runs;
+
+				runs[n_runs].levels = sample;
+				runs[n_runs].n_samples = 1;
+				n_runs++;
+			}
+
+			gpio_capture_read_offset++;
+		}
+
+		gpio_capture_release_page();
+		page = gpio_capture_get_page();
+	}
+
+	return n_runs;
+}
+
+uint32_t gpio_capture_sim_run(uint32_t n_samples)
+{
+	dma_ctrlblock_t *p_ctrlblock = NULL;
+	uint32_t *p_dst = NULL;
+	uint32_t n_sample = 0;
+
+	if(!gpio_capture_active || !gpio_capture_simulated || !gpio_capture_running) return 0;
+
+	while(n_sample < n_samples)
+	{
+		p_ctrlblock = (dma_ctrlblock_t*) gpio_capture_sim_get_virt(gpio_capture_sim_ctrlblock_addr);
+		if(p_ctrlblock == NULL) break;
+
+		if(p_ctrlblock->src_addr == GPIO_CAPTURE_GPLEV0_BUS_ADDR)
+		{
+			p_dst = (uint32_t*) gpio_capture_sim_get_virt(p_ctrlblock->dst_addr);
+			if(p_dst == NULL) break;
+
+			if(gpio_capture_sim_source != NULL) p_dst[0] = gpio_capture_sim_source(gpio_capture_sim_n_sample, gpio_capture_sim_arg);
+			else p_dst[0] = 0;
+
+			gpio_capture_sim_n_sample++;
+			n_sample++;
+		}
+
+		gpio_capture_sim_ctrlblock_addr = p_ctrlblock->next_ctrlblock_addr;
+
+		//Keep the reader in sync at least once per page, as the DMA interrupt would.
+		if((n_sample%GPIO_CAPTURE_PAGE_SAMPLES) == 0) gpio_capture_update();
+	}
+
+	gpio_capture_update();
+	return n_sample;
+}
@@ -0,0 +1,76 @@
+//DMA streamed GPIO logic analyzer
+
+#ifndef GPIO_CAPTURE_H
+#define GPIO_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPIO_CAPTURE_PACING_PWM 0
+#define GPIO_CAPTURE_PACING_PCM 1
+
+//Samples per ring page. Each sample is the raw value of GPLEV0 (pins 0 to 31).
+#define GPIO_CAPTURE_PAGE_SAMPLES 1024
+//The ring (samples and 2 control blocks per sample, 68 KiB per page) must fit in one DMA buffer of the driver (16 MiB).
+#define GPIO_CAPTURE_MAX_PAGES 240
+
+//Run length compressed samples: "n_samples" consecutive samples equal to "levels".
+typedef struct {
+	uint32_t levels;
+	uint32_t n_samples;
+} gpio_capture_run_t;
+
+//Simulated GPLEV0 source. Returns the value of sample "n_sample" (counted from "gpio_capture_start()").
+typedef uint32_t (*gpio_capture_sim_source_t)(uint64_t n_sample, void *arg);
+
+//Initializes the capture engine with a ring of "n_pages" pages (2 to GPIO_CAPTURE_MAX_PAGES).
+//"dma_ctrl" is the DMA channel used to sample GPLEV0. "pacing" is GPIO_CAPTURE_PACING_PWM or GPIO_CAPTURE_PACING_PCM.
+//Each sample is paced by one DREQ paced write to the PWM (or PCM) FIFO. That peripheral must already be configured to consume one FIFO word per sample period, with DMA requests enabled.
+//If "simulate" is true, no driver is used at all. Samples are produced by "gpio_capture_sim_run()".
+//Returns true if initialization is successful.
+bool gpio_capture_init(uint8_t dma_ctrl, uint8_t pacing, uint16_t n_pages, bool simulate);
+//Stops the capture (if running) and releases the ring.
+void gpio_capture_deinit(void);
+//Sets the simulated GPLEV0 source. If no source is set, simulated samples are 0.
+void gpio_capture_set_sim_source(gpio_capture_sim_source_t source, void *arg);
+
+//Starts sampling into the ring from its first page. Pending pages are discarded and the trigger is rearmed.
+bool gpio_capture_start(void);
+//Stops the DMA channel immediately.
+void gpio_capture_stop(void);
+//Returns true if the capture is running.
+bool gpio_capture_is_running(void);
+
+//Returns the number of full pages ready to be read.
+//The write position is taken from the DMA channel. Without "gpio_capture_wait()", this must be called (directly or through the functions below) at least once per ring lap.
+//If the DMA controller laps the reader, the oldest pages are dropped and counted as overruns.
+uint16_t gpio_capture_get_available_pages(void);
+//Sleeps until at least one full page is ready, for up to "timeout_us" microseconds (0 waits indefinitely), on the page end interrupts of the DMA channel.
+//Pages counted by the interrupts also catch whole ring laps missed by the reader, so overruns are exact while the reader waits here.
+//Interrupt coalescing must be disabled on the channel. In simulate mode, returns immediately.
+//Returns the number of full pages ready (0 on timeout), or -1 on error (capture not running, transfer error or no "/dev/DMA_Ctrl").
+int gpio_capture_wait(uint32_t timeout_us);
+//Returns the oldest full page (GPIO_CAPTURE_PAGE_SAMPLES samples), directly from the ring (zero copy), or NULL if no page is ready.
+//The page stays valid until "gpio_capture_release_page()" is called, as long as the reader keeps up with the DMA controller.
+const uint32_t *gpio_capture_get_page(void);
+//Hands the oldest full page back to the DMA controller.
+void gpio_capture_release_page(void);
+//Returns the number of pages dropped since the capture was started, because the reader fell behind.
+uint32_t gpio_capture_get_overruns(void);
+
+//Sets the trigger condition, evaluated by "gpio_capture_export_rle()": samples are discarded until ((sample & mask) == value).
+//mask = 0 disables the trigger. Rearms the trigger.
+void gpio_capture_set_trigger(uint32_t mask, uint32_t value);
+//Returns true once the trigger condition has been met.
+bool gpio_capture_is_triggered(void);
+//Consumes full pages and exports them as runs of equal samples, after applying the trigger and "pin_mask" to each sample.
+//Stops when no full page is left or when "max_runs" runs are written. The last run may continue in the next call (same "levels").
+//Returns the number of runs written to "runs".
+uint32_t gpio_capture_export_rle(gpio_capture_run_t *runs, uint32_t max_runs, uint32_t pin_mask);
+
+//Executes the control block chain in software for "n_samples" samples, reading GPLEV0 from the simulated source.
+//Only valid in simulate mode, while the capture is running.
+//Returns the number of samples produced.
+uint32_t gpio_capture_sim_run(uint32_t n_samples);
+
+#endif
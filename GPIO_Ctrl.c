@@ -4,7 +4,11 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <poll.h>
 #include <time.h>
+#include <string.h>
 
 /*
 "GPIO_CTRL_WAIT_KERNEL_RESPONSE"
@@ -14,10 +18,27 @@ Else, application will wait a specific time (defined in GPIO_CTRL_WAIT_TIME_US)
 #define GPIO_CTRL_WAIT_KERNEL_RESPONSE
 
 #define GPIO_CTRL_PROC_FILE_DIR "/proc/GPIO_Ctrl"
+#define GPIO_CTRL_DEV_FILE_DIR "/dev/GPIO_Ctrl"
+#define GPIO_EVENT_DEV_FILE_DIR "/dev/GPIO_Event"
 #define GPIO_CTRL_WAIT_TIME_US 1
 
 #define GPIO_DATAIO_SIZE_BYTES 3
 
+#define GPIO_BATCH_MAX_SIZE_BYTES (GPIO_BATCH_MAX_CMDS*GPIO_DATAIO_SIZE_BYTES)
+
+#define GPIO_MASK_DATAIO_SIZE_BYTES 20
+#define GPIO_MASK_DATAIO_SIZE_UINT 5
+
+#define GPIO_CONFIG_HEADER_SIZE_BYTES 4
+#define GPIO_CONFIG_ENTRY_SIZE_BYTES 4
+#define GPIO_CONFIG_DATAIO_SIZE_BYTES (GPIO_CONFIG_HEADER_SIZE_BYTES + GPIO_CONFIG_MAX_PINS*GPIO_CONFIG_ENTRY_SIZE_BYTES)
+
+#define GPIO_CONFIG_N_DETECT 6
+
+#define GPIO_COUNTER_HEADER_SIZE_BYTES 8
+#define GPIO_COUNTER_RECORD_SIZE_BYTES 40
+#define GPIO_COUNTER_DATAIO_SIZE_BYTES (GPIO_COUNTER_HEADER_SIZE_BYTES + GPIO_PIN_COUNT*GPIO_COUNTER_RECORD_SIZE_BYTES)
+
 #define GPIO_CMD_RESET_PIN 0
 #define GPIO_CMD_SET_LEVEL 1
 #define GPIO_CMD_GET_LEVEL 2
@@ -37,11 +58,57 @@ Else, application will wait a specific time (defined in GPIO_CTRL_WAIT_TIME_US)
 #define GPIO_CMD_GET_ENABLE_HIGHDETECT 16
 #define GPIO_CMD_SET_ENABLE_LOWDETECT 17
 #define GPIO_CMD_GET_ENABLE_LOWDETECT 18
-
+#define GPIO_CMD_SET_MASK 19
+#define GPIO_CMD_CLEAR_MASK 20
+#define GPIO_CMD_WRITE_MASKED 21
+#define GPIO_CMD_GET_ALL_LEVELS 22
+#define GPIO_CMD_APPLY_CONFIG 23
+#define GPIO_CMD_SET_PUDCTRL_MASK 24
+#define GPIO_CMD_SET_DEBOUNCE 25
+#define GPIO_CMD_GET_DEBOUNCE 26
+#define GPIO_CMD_SET_GLITCH_FILTER 27
+#define GPIO_CMD_GET_GLITCH_FILTER 28
+#define GPIO_CMD_SET_ENABLE_COUNTER 29
+#define GPIO_CMD_GET_ENABLE_COUNTER 30
+#define GPIO_CMD_SET_FREQ_WINDOW 31
+#define GPIO_CMD_GET_FREQ_WINDOW 32
+#define GPIO_CMD_GET_COUNTERS 33
+
+#define GPIO_CMD_RING_DOORBELL 0xFE
 #define GPIO_CMD_KERNEL_RESPONSE 0xFF
 
+#define GPIO_IOCTL_MAGIC 'g'
+#define GPIO_IOCTL_RUN_CMD _IOWR(GPIO_IOCTL_MAGIC, 0, uint8_t[GPIO_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_RUN_MASK_CMD _IOWR(GPIO_IOCTL_MAGIC, 1, uint8_t[GPIO_MASK_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_APPLY_CONFIG _IOWR(GPIO_IOCTL_MAGIC, 2, uint8_t[GPIO_CONFIG_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_GET_COUNTERS _IOWR(GPIO_IOCTL_MAGIC, 3, uint8_t[GPIO_COUNTER_DATAIO_SIZE_BYTES])
+
+#define GPIO_RING_SIZE_BYTES 4096
+#define GPIO_RING_HEADER_SIZE_BYTES 16
+#define GPIO_RING_ENTRY_SIZE_BYTES 8
+#define GPIO_RING_ENTRIES 256
+
+#define GPIO_RING_SQ_TAIL_UINTP_POS 0
+#define GPIO_RING_SQ_HEAD_UINTP_POS 1
+#define GPIO_RING_FLAGS_UINTP_POS 2
+
+#define GPIO_RING_FLAG_KERNEL_POLL 0x1
+
+#define GPIO_MMAP_RING_PGOFF 0
+#define GPIO_MMAP_REGS_PGOFF 1
+
 int gpio_proc_fd = -1;
+int gpio_dev_fd = -1;
+int gpio_event_fd = -1;
 void *gpio_data_io = NULL;
+void *gpio_ring = NULL;
+volatile uint32_t *gpio_fastpath_regs = NULL;
+bool gpio_fastpath_writable = false;
+
+void *gpio_batch_io = NULL;
+bool gpio_batch_open = false;
+uint16_t gpio_batch_length = 0;
+uint16_t gpio_batch_n_refused = 0;
 
 void gpio_ctrl_wait(void)
 {
@@ -62,32 +129,240 @@ bool gpio_init(void)
 	gpio_proc_fd = open(GPIO_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(gpio_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	gpio_dev_fd = open(GPIO_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	gpio_data_io = malloc(GPIO_DATAIO_SIZE_BYTES);
+	gpio_batch_io = malloc(GPIO_BATCH_MAX_SIZE_BYTES);
 	return true;
 }
 
 #ifdef GPIO_CTRL_WAIT_KERNEL_RESPONSE
-void gpio_call_kernel(void)
+void gpio_call_kernel_proc(void *data_io, size_t size)
 {
-	uint8_t *pbyte = (uint8_t*) gpio_data_io;
-	write(gpio_proc_fd, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(gpio_proc_fd, data_io, size);
 
 	do{
-		read(gpio_proc_fd, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+		read(gpio_proc_fd, data_io, size);
 	}while(pbyte[0] != GPIO_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void gpio_call_kernel(void)
+void gpio_call_kernel_proc(void *data_io, size_t size)
 {
-	write(gpio_proc_fd, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+	write(gpio_proc_fd, data_io, size);
 	gpio_ctrl_wait();
-	read(gpio_proc_fd, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+	read(gpio_proc_fd, data_io, size);
 	return;
 }
 #endif
 
+void gpio_call_kernel_ioctl(void *data_io)
+{
+	ioctl(gpio_dev_fd, GPIO_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void gpio_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) gpio_ring;
+	uint8_t *ring_entries = ((uint8_t*) gpio_ring) + GPIO_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[GPIO_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%GPIO_RING_ENTRIES)*GPIO_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[GPIO_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[GPIO_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[GPIO_RING_FLAGS_UINTP_POS] & GPIO_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, GPIO_DATAIO_SIZE_BYTES);
+		doorbell[0] = GPIO_CMD_RING_DOORBELL;
+		if(gpio_dev_fd >= 0) gpio_call_kernel_ioctl(doorbell);
+		else gpio_call_kernel_proc(doorbell, GPIO_DATAIO_SIZE_BYTES);
+	}
+
+	while(__atomic_load_n(&ring_header[GPIO_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(gpio_data_io, pentry, GPIO_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void gpio_call_kernel(void)
+{
+	if(gpio_batch_open)
+	{
+		//Flushing here would overwrite the results of the queued commands and shift their indexes: the command is refused instead.
+		if(gpio_batch_length >= GPIO_BATCH_MAX_CMDS)
+		{
+			gpio_batch_n_refused++;
+			return;
+		}
+
+		uint8_t *pbyte = (uint8_t*) gpio_batch_io;
+		memcpy(&pbyte[gpio_batch_length*GPIO_DATAIO_SIZE_BYTES], gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+		gpio_batch_length++;
+		return;
+	}
+
+	if(gpio_ring != NULL) gpio_call_kernel_ring();
+	else if(gpio_dev_fd >= 0) gpio_call_kernel_ioctl(gpio_data_io);
+	else gpio_call_kernel_proc(gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
+
+	return;
+}
+
+bool gpio_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(gpio_ring != NULL) munmap(gpio_ring, GPIO_RING_SIZE_BYTES);
+		gpio_ring = NULL;
+		return true;
+	}
+
+	if(gpio_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (gpio_dev_fd >= 0) ? gpio_dev_fd : gpio_proc_fd;
+	void *p_ring = mmap(NULL, GPIO_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, GPIO_MMAP_RING_PGOFF);
+	if(p_ring == MAP_FAILED) return false;
+
+	gpio_ring = p_ring;
+	return true;
+}
+
+bool gpio_ring_is_enabled(void)
+{
+	return (gpio_ring != NULL);
+}
+
+bool gpio_ioctl_is_enabled(void)
+{
+	return (gpio_dev_fd >= 0);
+}
+
+bool gpio_fastpath_enable(bool enable)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if(!enable)
+	{
+		if(gpio_fastpath_regs != NULL) munmap((void*) gpio_fastpath_regs, page_size);
+		gpio_fastpath_regs = NULL;
+		gpio_fastpath_writable = false;
+		return true;
+	}
+
+	if(gpio_fastpath_regs != NULL) return true;
+
+	void *p_regs = mmap(NULL, page_size, (PROT_READ | PROT_WRITE), MAP_SHARED, gpio_proc_fd, GPIO_MMAP_REGS_PGOFF*page_size);
+	gpio_fastpath_writable = (p_regs != MAP_FAILED);
+
+	//Writable mappings need CAP_SYS_RAWIO. Without it, levels are still read directly.
+	if(p_regs == MAP_FAILED) p_regs = mmap(NULL, page_size, PROT_READ, MAP_SHARED, gpio_proc_fd, GPIO_MMAP_REGS_PGOFF*page_size);
+	if(p_regs == MAP_FAILED) return false;
+
+	gpio_fastpath_regs = (volatile uint32_t*) p_regs;
+	return true;
+}
+
+bool gpio_fastpath_is_enabled(void)
+{
+	return (gpio_fastpath_regs != NULL);
+}
+
+bool gpio_fastpath_is_writable(void)
+{
+	return gpio_fastpath_writable;
+}
+
+bool gpio_event_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(gpio_event_fd >= 0) close(gpio_event_fd);
+		gpio_event_fd = -1;
+		return true;
+	}
+
+	if(gpio_event_fd >= 0) return true;
+
+	gpio_event_fd = open(GPIO_EVENT_DEV_FILE_DIR, (O_RDONLY | O_NONBLOCK));
+	return (gpio_event_fd >= 0);
+}
+
+int gpio_event_get_fd(void)
+{
+	return gpio_event_fd;
+}
+
+int gpio_event_read(gpio_event_t *events, int max_events, int timeout_ms)
+{
+	struct pollfd event_pollfd;
+	ssize_t n_bytes = 0;
+
+	if((gpio_event_fd < 0) || (events == NULL) || (max_events <= 0)) return -1;
+
+	if(timeout_ms != 0)
+	{
+		event_pollfd.fd = gpio_event_fd;
+		event_pollfd.events = POLLIN;
+		event_pollfd.revents = 0;
+		if(poll(&event_pollfd, 1, timeout_ms) <= 0) return 0;
+	}
+
+	n_bytes = read(gpio_event_fd, events, (max_events*sizeof(gpio_event_t)));
+	if(n_bytes < 0) return 0;
+
+	return (n_bytes/sizeof(gpio_event_t));
+}
+
+void gpio_batch_begin(void)
+{
+	gpio_batch_open = true;
+	gpio_batch_length = 0;
+	gpio_batch_n_refused = 0;
+	return;
+}
+
+bool gpio_batch_is_open(void)
+{
+	return gpio_batch_open;
+}
+
+uint16_t gpio_batch_get_length(void)
+{
+	return gpio_batch_length;
+}
+
+uint16_t gpio_batch_get_refused(void)
+{
+	return gpio_batch_n_refused;
+}
+
+uint16_t gpio_batch_flush(void)
+{
+	if(!gpio_batch_open) return 0;
+
+	gpio_batch_open = false;
+	if(gpio_batch_length == 0) return 0;
+
+	gpio_call_kernel_proc(gpio_batch_io, gpio_batch_length*GPIO_DATAIO_SIZE_BYTES);
+	return gpio_batch_length;
+}
+
+uint8_t gpio_batch_get_result(uint16_t index)
+{
+	if(index >= gpio_batch_length) return 0;
+
+	uint8_t *pbyte = (uint8_t*) gpio_batch_io;
+	return pbyte[index*GPIO_DATAIO_SIZE_BYTES + 2];
+}
+
 void gpio_reset_pin(uint8_t pin_number)
 {
 	uint8_t *pbyte = (uint8_t*) gpio_data_io;
@@ -132,6 +407,12 @@ void gpio_set_pudctrl(uint8_t pin_number, uint8_t pudctrl)
 
 void gpio_set_level(uint8_t pin_number, bool level)
 {
+	if(gpio_fastpath_writable && !gpio_batch_open)
+	{
+		gpio_fast_set_level(pin_number, level);
+		return;
+	}
+
 	uint8_t *pbyte = (uint8_t*) gpio_data_io;
 	pbyte[0] = GPIO_CMD_SET_LEVEL;
 	pbyte[1] = pin_number;
@@ -143,6 +424,8 @@ void gpio_set_level(uint8_t pin_number, bool level)
 
 bool gpio_get_level(uint8_t pin_number)
 {
+	if((gpio_fastpath_regs != NULL) && !gpio_batch_open) return gpio_fast_get_level(pin_number);
+
 	uint8_t *pbyte = (uint8_t*) gpio_data_io;
 	pbyte[0] = GPIO_CMD_GET_LEVEL;
 	pbyte[1] = pin_number;
@@ -151,6 +434,244 @@ bool gpio_get_level(uint8_t pin_number)
 	return (pbyte[2] & 0x01);
 }
 
+void gpio_call_kernel_mask(uint32_t *puint)
+{
+	uint8_t *pbyte = (uint8_t*) puint;
+	uint8_t cmd_io[GPIO_PIN_COUNT*GPIO_DATAIO_SIZE_BYTES];
+	uint64_t mask = ((((uint64_t) puint[2]) << 32) | puint[1]);
+	uint64_t value = ((((uint64_t) puint[4]) << 32) | puint[3]);
+	uint16_t n_cmd = 0;
+	uint8_t n_pin = 0;
+
+	//Pull-up/down programming needs timed waits. It's always done by the driver. Writes need a writable register page.
+	if((gpio_fastpath_regs != NULL) && (pbyte[0] != GPIO_CMD_SET_PUDCTRL_MASK) && (gpio_fastpath_writable || (pbyte[0] == GPIO_CMD_GET_ALL_LEVELS)))
+	{
+		switch(pbyte[0])
+		{
+			case GPIO_CMD_SET_MASK:
+				gpio_fastpath_regs[GPIO_OUTPUT0_SET_UINTP_POS] = puint[1];
+				gpio_fastpath_regs[GPIO_OUTPUT1_SET_UINTP_POS] = (puint[2] & 0x003FFFFF);
+				break;
+
+			case GPIO_CMD_CLEAR_MASK:
+				gpio_fastpath_regs[GPIO_OUTPUT0_CLR_UINTP_POS] = puint[1];
+				gpio_fastpath_regs[GPIO_OUTPUT1_CLR_UINTP_POS] = (puint[2] & 0x003FFFFF);
+				break;
+
+			case GPIO_CMD_WRITE_MASKED:
+				gpio_fastpath_regs[GPIO_OUTPUT0_SET_UINTP_POS] = (puint[1] & puint[3]);
+				gpio_fastpath_regs[GPIO_OUTPUT0_CLR_UINTP_POS] = (puint[1] & ~puint[3]);
+				gpio_fastpath_regs[GPIO_OUTPUT1_SET_UINTP_POS] = (puint[2] & puint[4] & 0x003FFFFF);
+				gpio_fastpath_regs[GPIO_OUTPUT1_CLR_UINTP_POS] = (puint[2] & ~puint[4] & 0x003FFFFF);
+				break;
+
+			case GPIO_CMD_GET_ALL_LEVELS:
+				puint[3] = gpio_fastpath_regs[GPIO_INPUT0_UINTP_POS];
+				puint[4] = (gpio_fastpath_regs[GPIO_INPUT1_UINTP_POS] & 0x003FFFFF);
+				break;
+		}
+
+		pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+		return;
+	}
+
+	if(gpio_dev_fd >= 0)
+	{
+		ioctl(gpio_dev_fd, GPIO_IOCTL_RUN_MASK_CMD, puint);
+		return;
+	}
+
+	//Older drivers don't provide the device file. Send one single pin command per pin, all in a single write.
+	if(pbyte[0] == GPIO_CMD_SET_MASK) value = mask;
+	else if(pbyte[0] == GPIO_CMD_CLEAR_MASK) value = 0;
+	else if(pbyte[0] == GPIO_CMD_GET_ALL_LEVELS) mask = 0x003FFFFFFFFFFFFF;
+
+	while(n_pin < GPIO_PIN_COUNT)
+	{
+		if((mask >> n_pin) & 0x1)
+		{
+			if(pbyte[0] == GPIO_CMD_GET_ALL_LEVELS) cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = GPIO_CMD_GET_LEVEL;
+			else if(pbyte[0] == GPIO_CMD_SET_PUDCTRL_MASK) cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = GPIO_CMD_SET_PUDCTRL;
+			else cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = GPIO_CMD_SET_LEVEL;
+
+			cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 1] = n_pin;
+			if(pbyte[0] == GPIO_CMD_SET_PUDCTRL_MASK) cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 2] = pbyte[1];
+			else cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 2] = ((value >> n_pin) & 0x1);
+			n_cmd++;
+		}
+
+		n_pin++;
+	}
+
+	if(n_cmd > 0) gpio_call_kernel_proc(cmd_io, n_cmd*GPIO_DATAIO_SIZE_BYTES);
+
+	if(pbyte[0] == GPIO_CMD_GET_ALL_LEVELS)
+	{
+		value = 0;
+		n_pin = 0;
+		while(n_pin < GPIO_PIN_COUNT)
+		{
+			value |= (((uint64_t) (cmd_io[n_pin*GPIO_DATAIO_SIZE_BYTES + 2] & 0x01)) << n_pin);
+			n_pin++;
+		}
+
+		puint[3] = (uint32_t) value;
+		puint[4] = (uint32_t) (value >> 32);
+	}
+
+	pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void gpio_set_mask(uint64_t mask)
+{
+	uint32_t puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	uint8_t *pbyte = (uint8_t*) puint;
+	memset(puint, 0, GPIO_MASK_DATAIO_SIZE_BYTES);
+	pbyte[0] = GPIO_CMD_SET_MASK;
+	puint[1] = (uint32_t) mask;
+	puint[2] = (uint32_t) (mask >> 32);
+
+	gpio_call_kernel_mask(puint);
+	return;
+}
+
+void gpio_clear_mask(uint64_t mask)
+{
+	uint32_t puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	uint8_t *pbyte = (uint8_t*) puint;
+	memset(puint, 0, GPIO_MASK_DATAIO_SIZE_BYTES);
+	pbyte[0] = GPIO_CMD_CLEAR_MASK;
+	puint[1] = (uint32_t) mask;
+	puint[2] = (uint32_t) (mask >> 32);
+
+	gpio_call_kernel_mask(puint);
+	return;
+}
+
+void gpio_write_masked(uint64_t mask, uint64_t value)
+{
+	uint32_t puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	uint8_t *pbyte = (uint8_t*) puint;
+	memset(puint, 0, GPIO_MASK_DATAIO_SIZE_BYTES);
+	pbyte[0] = GPIO_CMD_WRITE_MASKED;
+	puint[1] = (uint32_t) mask;
+	puint[2] = (uint32_t) (mask >> 32);
+	puint[3] = (uint32_t) value;
+	puint[4] = (uint32_t) (value >> 32);
+
+	gpio_call_kernel_mask(puint);
+	return;
+}
+
+uint64_t gpio_read_all(void)
+{
+	uint32_t puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	uint8_t *pbyte = (uint8_t*) puint;
+	memset(puint, 0, GPIO_MASK_DATAIO_SIZE_BYTES);
+	pbyte[0] = GPIO_CMD_GET_ALL_LEVELS;
+
+	gpio_call_kernel_mask(puint);
+	return ((((uint64_t) puint[4]) << 32) | puint[3]);
+}
+
+void gpio_set_pudctrl_mask(uint64_t mask, uint8_t pudctrl)
+{
+	uint32_t puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	uint8_t *pbyte = (uint8_t*) puint;
+	memset(puint, 0, GPIO_MASK_DATAIO_SIZE_BYTES);
+	pbyte[0] = GPIO_CMD_SET_PUDCTRL_MASK;
+	pbyte[1] = pudctrl;
+	puint[1] = (uint32_t) mask;
+	puint[2] = (uint32_t) (mask >> 32);
+
+	gpio_call_kernel_mask(puint);
+	return;
+}
+
+bool gpio_apply_config(const gpio_pin_config_t *table, uint8_t n_pins)
+{
+	//Detect enable commands, in GPIO_CONFIG_DETECT_* bit order.
+	const uint8_t detect_cmd[GPIO_CONFIG_N_DETECT] = {
+		GPIO_CMD_SET_ENABLE_REDGEDETECT,
+		GPIO_CMD_SET_ENABLE_FEDGEDETECT,
+		GPIO_CMD_SET_ENABLE_ASYNC_REDGEDETECT,
+		GPIO_CMD_SET_ENABLE_ASYNC_FEDGEDETECT,
+		GPIO_CMD_SET_ENABLE_HIGHDETECT,
+		GPIO_CMD_SET_ENABLE_LOWDETECT
+	};
+
+	uint8_t config_io[GPIO_CONFIG_DATAIO_SIZE_BYTES];
+	uint8_t *pentry = &config_io[GPIO_CONFIG_HEADER_SIZE_BYTES];
+	uint8_t *cmd_io = NULL;
+	uint16_t n_cmd = 0;
+	uint8_t n_pin = 0;
+	uint8_t n_detect = 0;
+
+	if(n_pins > GPIO_CONFIG_MAX_PINS) return false;
+	if(n_pins == 0) return true;
+
+	if(gpio_dev_fd >= 0)
+	{
+		memset(config_io, 0, GPIO_CONFIG_DATAIO_SIZE_BYTES);
+		config_io[0] = GPIO_CMD_APPLY_CONFIG;
+		config_io[1] = n_pins;
+
+		while(n_pin < n_pins)
+		{
+			pentry[0] = table[n_pin].pin;
+			pentry[1] = table[n_pin].pinmode;
+			pentry[2] = table[n_pin].pudctrl;
+			pentry[3] = table[n_pin].detect;
+			pentry += GPIO_CONFIG_ENTRY_SIZE_BYTES;
+			n_pin++;
+		}
+
+		ioctl(gpio_dev_fd, GPIO_IOCTL_APPLY_CONFIG, config_io);
+		return true;
+	}
+
+	//Older drivers don't provide the device file. Send the single pin commands in as few writes as possible.
+	cmd_io = (uint8_t*) malloc(GPIO_BATCH_MAX_SIZE_BYTES);
+	if(cmd_io == NULL) return false;
+
+	while(n_pin < n_pins)
+	{
+		if((n_cmd + 2 + GPIO_CONFIG_N_DETECT) > GPIO_BATCH_MAX_CMDS)
+		{
+			gpio_call_kernel_proc(cmd_io, n_cmd*GPIO_DATAIO_SIZE_BYTES);
+			n_cmd = 0;
+		}
+
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = GPIO_CMD_SET_PINMODE;
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 1] = table[n_pin].pin;
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 2] = table[n_pin].pinmode;
+		n_cmd++;
+
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = GPIO_CMD_SET_PUDCTRL;
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 1] = table[n_pin].pin;
+		cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 2] = table[n_pin].pudctrl;
+		n_cmd++;
+
+		n_detect = 0;
+		while(n_detect < GPIO_CONFIG_N_DETECT)
+		{
+			cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES] = detect_cmd[n_detect];
+			cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 1] = table[n_pin].pin;
+			cmd_io[n_cmd*GPIO_DATAIO_SIZE_BYTES + 2] = ((table[n_pin].detect >> n_detect) & 0x1);
+			n_cmd++;
+			n_detect++;
+		}
+
+		n_pin++;
+	}
+
+	if(n_cmd > 0) gpio_call_kernel_proc(cmd_io, n_cmd*GPIO_DATAIO_SIZE_BYTES);
+
+	free(cmd_io);
+	return true;
+}
+
 bool gpio_event_detected(uint8_t pin_number)
 {
 	uint8_t *pbyte = (uint8_t*) gpio_data_io;
@@ -287,3 +808,114 @@ bool gpio_low_detect_is_enabled(uint8_t pin_number)
 	return (pbyte[2] & 0x01);
 }
 
+void gpio_set_debounce(uint8_t pin_number, uint8_t stable_ms)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_SET_DEBOUNCE;
+	pbyte[1] = pin_number;
+	pbyte[2] = stable_ms;
+
+	gpio_call_kernel();
+	return;
+}
+
+uint8_t gpio_get_debounce(uint8_t pin_number)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_GET_DEBOUNCE;
+	pbyte[1] = pin_number;
+
+	gpio_call_kernel();
+	return pbyte[2];
+}
+
+void gpio_set_glitch_filter(uint8_t pin_number, uint8_t min_pulse_us)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_SET_GLITCH_FILTER;
+	pbyte[1] = pin_number;
+	pbyte[2] = min_pulse_us;
+
+	gpio_call_kernel();
+	return;
+}
+
+uint8_t gpio_get_glitch_filter(uint8_t pin_number)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_GET_GLITCH_FILTER;
+	pbyte[1] = pin_number;
+
+	gpio_call_kernel();
+	return pbyte[2];
+}
+
+void gpio_enable_counter(uint8_t pin_number, bool enable)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_SET_ENABLE_COUNTER;
+	pbyte[1] = pin_number;
+	pbyte[2] = enable;
+
+	gpio_call_kernel();
+	return;
+}
+
+bool gpio_counter_is_enabled(uint8_t pin_number)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_GET_ENABLE_COUNTER;
+	pbyte[1] = pin_number;
+
+	gpio_call_kernel();
+	return (pbyte[2] & 0x01);
+}
+
+void gpio_set_freq_window(uint8_t window_10ms)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_SET_FREQ_WINDOW;
+	pbyte[1] = 0;
+	pbyte[2] = window_10ms;
+
+	gpio_call_kernel();
+	return;
+}
+
+uint8_t gpio_get_freq_window(void)
+{
+	uint8_t *pbyte = (uint8_t*) gpio_data_io;
+	pbyte[0] = GPIO_CMD_GET_FREQ_WINDOW;
+	pbyte[1] = 0;
+
+	gpio_call_kernel();
+	return pbyte[2];
+}
+
+int gpio_get_counters(gpio_counter_t *counters, uint8_t max_counters, uint32_t *p_window_us)
+{
+	uint8_t counter_io[GPIO_COUNTER_DATAIO_SIZE_BYTES];
+	uint32_t *puint = (uint32_t*) counter_io;
+	uint8_t n_counters = 0;
+
+	if(gpio_dev_fd < 0) return -1;
+
+	memset(counter_io, 0, GPIO_COUNTER_HEADER_SIZE_BYTES);
+	counter_io[0] = GPIO_CMD_GET_COUNTERS;
+
+	if(ioctl(gpio_dev_fd, GPIO_IOCTL_GET_COUNTERS, counter_io) < 0) return -1;
+
+	n_counters = counter_io[1];
+	if(n_counters > max_counters) n_counters = max_counters;
+
+	if(n_counters > 0) memcpy(counters, &counter_io[GPIO_COUNTER_HEADER_SIZE_BYTES], n_counters*GPIO_COUNTER_RECORD_SIZE_BYTES);
+	if(p_window_us != NULL) *p_window_us = puint[1];
+
+	return n_counters;
+}
+
+float gpio_counter_get_frequency(const gpio_counter_t *counter, uint32_t window_us)
+{
+	if(window_us == 0) return 0.0f;
+	return (((float) counter->window_edges)*1000000.0f/((float) window_us));
+}
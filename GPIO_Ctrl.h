@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "BCM2837_GPIO_RegisterMapping.h"
+
 #define GPIO_PINMODE_INPUT 0
 #define GPIO_PINMODE_OUTPUT 1
 #define GPIO_PINMODE_ALTFUNC0 4
@@ -17,12 +19,133 @@
 #define GPIO_PUDCTRL_PULLUP 2
 #define GPIO_PUDCTRL_PULLDOWN 1
 
+#define GPIO_BATCH_MAX_CMDS 256
+
+#define GPIO_PIN_COUNT 54
+
+#define GPIO_CONFIG_MAX_PINS 54
+
+#define GPIO_CONFIG_DETECT_REDGE 0x01
+#define GPIO_CONFIG_DETECT_FEDGE 0x02
+#define GPIO_CONFIG_DETECT_ASYNC_REDGE 0x04
+#define GPIO_CONFIG_DETECT_ASYNC_FEDGE 0x08
+#define GPIO_CONFIG_DETECT_HIGH 0x10
+#define GPIO_CONFIG_DETECT_LOW 0x20
+
+#define GPIO_EVENT_EDGE_FALLING 0
+#define GPIO_EVENT_EDGE_RISING 1
+
+//Full configuration of one pin, for "gpio_apply_config()".
+//"detect" is a combination of GPIO_CONFIG_DETECT_* flags. Detections not flagged are disabled.
+typedef struct {
+	uint8_t pin;
+	uint8_t pinmode;
+	uint8_t pudctrl;
+	uint8_t detect;
+} gpio_pin_config_t;
+
+//Edge counter snapshot of one pin, as returned by "gpio_get_counters()".
+//Periods are measured between consecutive counted edges (SYSTIMER timestamps), and are 0 until two edges are counted.
+//"window_edges" is the number of edges counted during the last complete frequency window.
+typedef struct {
+	uint64_t count;
+	uint64_t last_timestamp_us;
+	uint32_t last_period_us;
+	uint32_t min_period_us;
+	uint32_t max_period_us;
+	uint32_t window_edges;
+	uint8_t pin;
+	uint8_t reserved[7];
+} gpio_counter_t;
+
+//Edge event, as queued by the driver.
+//"timestamp_us" is the SYSTIMER counter value (microseconds) when the event was handled.
+typedef struct {
+	uint64_t timestamp_us;
+	uint8_t pin;
+	uint8_t edge;
+	uint8_t reserved[6];
+} gpio_event_t;
+
+//GPIO register page. Only valid while "gpio_fastpath_is_enabled()" returns true.
+extern volatile uint32_t *gpio_fastpath_regs;
+
 //Returns true if "gpio_init()" has already been called.
 bool gpio_is_active(void);
 //Initializes GPIO procedure.
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool gpio_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool gpio_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool gpio_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/GPIO_Ctrl" instead of write()/read() calls on the proc file.
+bool gpio_ioctl_is_enabled(void);
+//Maps the GPIO register page into the application (enable = true) or unmaps it (enable = false).
+//While mapped, "gpio_set_level()", "gpio_get_level()" and the multi pin functions access GPSET/GPCLR/GPLEV directly, without any system call (unless a batch is open).
+//The page is only writable with CAP_SYS_RAWIO. Otherwise it's mapped read only: levels are read directly, and outputs are still set through the driver.
+//Only GPSET/GPCLR may be written through "gpio_fastpath_regs". The other registers belong to the driver.
+//Returns true if successful.
+bool gpio_fastpath_enable(bool enable);
+//Returns true if the GPIO register page is mapped.
+bool gpio_fastpath_is_enabled(void);
+//Returns true if the GPIO register page is mapped writable ("gpio_fast_set_level()" can be used).
+bool gpio_fastpath_is_writable(void);
+//Opens the edge event queue of this application (enable = true) or closes it (enable = false).
+//While open, every edge detected on an input pin with edge detection enabled (see "gpio_enable_risingedge_detect()" and similar) is queued with a timestamp.
+//Enabling edge detection on a pin makes the driver request the pin IRQ, which clears the event detect status, so "gpio_event_detected()" no longer reports those pins.
+//Returns true if successful.
+bool gpio_event_enable(bool enable);
+//Returns the file descriptor of the event queue (for poll()/epoll), or -1 if it's not open.
+int gpio_event_get_fd(void);
+//Reads up to "max_events" queued events into "events".
+//Waits up to "timeout_ms" milliseconds for the first event. timeout_ms = 0 doesn't wait, timeout_ms < 0 waits indefinitely.
+//Returns the number of events read, or -1 if the event queue is not open.
+int gpio_event_read(gpio_event_t *events, int max_events, int timeout_ms);
+
+//Inline fast path. Only valid while "gpio_fastpath_is_enabled()" returns true ("gpio_fastpath_is_writable()" for "gpio_fast_set_level()"). No checks are made.
+static inline void gpio_fast_set_level(uint8_t pin_number, bool value)
+{
+	if(pin_number < 32)
+	{
+		if(value) gpio_fastpath_regs[GPIO_OUTPUT0_SET_UINTP_POS] = (1u << pin_number);
+		else gpio_fastpath_regs[GPIO_OUTPUT0_CLR_UINTP_POS] = (1u << pin_number);
+	}
+	else
+	{
+		if(value) gpio_fastpath_regs[GPIO_OUTPUT1_SET_UINTP_POS] = (1u << (pin_number%32));
+		else gpio_fastpath_regs[GPIO_OUTPUT1_CLR_UINTP_POS] = (1u << (pin_number%32));
+	}
+
+	return;
+}
+
+static inline bool gpio_fast_get_level(uint8_t pin_number)
+{
+	if(pin_number < 32) return ((gpio_fastpath_regs[GPIO_INPUT0_UINTP_POS] >> pin_number) & 0x1);
+	return ((gpio_fastpath_regs[GPIO_INPUT1_UINTP_POS] >> (pin_number%32)) & 0x1);
+}
+
+//Opens a command batch. Until "gpio_batch_flush()" is called, every function below "gpio_batch_get_result()" is queued instead of sent to the kernel.
+//Values returned by queued GET functions are not valid. Read them back with "gpio_batch_get_result()" after flushing.
+//A batch holds up to GPIO_BATCH_MAX_CMDS commands. Commands issued once it is full are refused (not queued and never executed),
+//so the results and indexes of the queued commands stay valid. Check "gpio_batch_get_refused()" before relying on a batch.
+void gpio_batch_begin(void);
+//Returns true if a command batch is open.
+bool gpio_batch_is_open(void);
+//Returns the number of queued commands. The next queued command takes this value as its index.
+uint16_t gpio_batch_get_length(void);
+//Returns the number of commands refused because the batch was full, since the last "gpio_batch_begin()".
+uint16_t gpio_batch_get_refused(void);
+//Sends all queued commands in a single write, reads all results back in a single read and closes the batch.
+//Returns the number of commands executed.
+uint16_t gpio_batch_flush(void);
+//Returns the result of command "index" of the last flushed batch. Only meaningful for GET functions.
+uint8_t gpio_batch_get_result(uint16_t index);
 
 void gpio_reset_pin(uint8_t pin_number);
 void gpio_set_pinmode(uint8_t pin_number, uint8_t pinmode);
@@ -30,6 +153,23 @@ uint8_t gpio_get_pinmode(uint8_t pin_number);
 void gpio_set_pudctrl(uint8_t pin_number, uint8_t pudctrl);
 void gpio_set_level(uint8_t pin_number, bool value);
 bool gpio_get_level(uint8_t pin_number);
+
+//Multi pin functions. Bit "n" of "mask"/"value" refers to pin "n" (pins 0 to 53).
+//Each 32 pin bank is updated with a single register store, so all masked pins of a bank change at the same time.
+//These are executed immediately, even while a batch is open.
+void gpio_set_mask(uint64_t mask);
+void gpio_clear_mask(uint64_t mask);
+//Sets the masked pins whose bit in "value" is 1 and clears the masked pins whose bit in "value" is 0.
+void gpio_write_masked(uint64_t mask, uint64_t value);
+//Returns the levels of all 54 pins.
+uint64_t gpio_read_all(void);
+//Sets the pull-up/down control of all masked pins with a single, correctly timed GPPUD/GPPUDCLK sequence.
+void gpio_set_pudctrl_mask(uint64_t mask, uint8_t pudctrl);
+//Applies the configuration of up to GPIO_CONFIG_MAX_PINS pins in a single command.
+//The driver groups the entries by register, so each FSEL and detect enable register is written once, and a single pull-up/down sequence is run per pull type.
+//Executed immediately, even while a batch is open.
+//Returns false if "n_pins" is greater than GPIO_CONFIG_MAX_PINS.
+bool gpio_apply_config(const gpio_pin_config_t *table, uint8_t n_pins);
 bool gpio_event_detected(uint8_t pin_number);
 void gpio_enable_risingedge_detect(uint8_t pin_number, bool enable);
 bool gpio_risingedge_detect_is_enabled(uint8_t pin_number);
@@ -39,9 +179,35 @@ void gpio_enable_async_risingedge_detect(uint8_t pin_number, bool enable);
 bool gpio_async_risingedge_detect_is_enabled(uint8_t pin_number);
 void gpio_enable_async_fallingedge_detect(uint8_t pin_number, bool enable);
 bool gpio_async_fallingedge_detect_is_enabled(uint8_t pin_number);
+//Level detection is refused on pins with any edge detection enabled, and cleared when edge detection is enabled:
+//the level keeps the event status set, so it can't be used with edge events. The same applies to GPIO_CONFIG_DETECT_HIGH/LOW in "gpio_apply_config()".
 void gpio_enable_high_detect(uint8_t pin_number, bool enable);
 bool gpio_high_detect_is_enabled(uint8_t pin_number);
 void gpio_enable_low_detect(uint8_t pin_number, bool enable);
 bool gpio_low_detect_is_enabled(uint8_t pin_number);
 
+//Input filters, applied by the driver to edge events before they are queued (see "gpio_event_enable()").
+//Debounce: a transition is only reported once the pin has kept its new level for "stable_ms" milliseconds. The event timestamp is the first edge of the burst.
+//Glitch filter: level changes shorter than "min_pulse_us" microseconds are discarded. The event timestamp is the last edge of the burst.
+//0 disables the filter. Direct level reads are not filtered.
+void gpio_set_debounce(uint8_t pin_number, uint8_t stable_ms);
+uint8_t gpio_get_debounce(uint8_t pin_number);
+void gpio_set_glitch_filter(uint8_t pin_number, uint8_t min_pulse_us);
+uint8_t gpio_get_glitch_filter(uint8_t pin_number);
+
+//Edge counters, updated by the driver from the edge IRQ (raw edges, before filtering). Edge detection must be enabled on the pin.
+//Enable a single edge direction to measure the signal period. Enabling a counter resets it.
+void gpio_enable_counter(uint8_t pin_number, bool enable);
+bool gpio_counter_is_enabled(uint8_t pin_number);
+//Sets the gated frequency measurement window in units of 10 milliseconds (0 disables it). Applies to all counters.
+void gpio_set_freq_window(uint8_t window_10ms);
+uint8_t gpio_get_freq_window(void);
+//Reads a consistent snapshot of all enabled counters (in pin order) in a single call.
+//If "p_window_us" is not NULL, the frequency window in microseconds is written to it.
+//Returns the number of counters written, or -1 if "/dev/GPIO_Ctrl" is not available.
+//Executed immediately, even while a batch is open.
+int gpio_get_counters(gpio_counter_t *counters, uint8_t max_counters, uint32_t *p_window_us);
+//Returns the frequency (Hz) of counted edges during the last complete window.
+float gpio_counter_get_frequency(const gpio_counter_t *counter, uint32_t window_us);
+
 #endif
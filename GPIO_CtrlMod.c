@@ -1,12 +1,28 @@
 //BCM2837 GPIO Driver
 
 #include "BCM2837_GPIO_RegisterMapping.h"
+#include "BCM2837_SYSTIMER_RegisterMapping.h"
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/consumer.h>
+#include <linux/version.h>
+#include <linux/capability.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
 #include <asm/io.h>
 
 #define GPIO_PINMODE_INPUT 0
@@ -28,10 +44,74 @@
  * BYTE0: CMD
  * BYTE1: PIN
  * BYTE2: ARG
+ *
+ * Up to GPIO_BATCH_MAX_CMDS commands may be packed back to back in a single write.
+ * They are executed in order, and the next read returns the whole batch with every BYTE0 set to GPIO_CMD_KERNEL_RESPONSE.
  */
 
 #define GPIO_DATAIO_SIZE_BYTES 3
 
+#define GPIO_BATCH_MAX_CMDS 256
+#define GPIO_BATCH_MAX_SIZE_BYTES (GPIO_BATCH_MAX_CMDS*GPIO_DATAIO_SIZE_BYTES)
+
+/*
+ * GPIO Mask Command Structure (20 BYTES, only accepted through GPIO_IOCTL_RUN_MASK_CMD):
+ *
+ * BYTE0: CMD
+ * BYTE1: PUDCTRL (GPIO_CMD_SET_PUDCTRL_MASK only)
+ * BYTES 2 to 3: RESERVED
+ * UINT1: MASK (pins 0 to 31)
+ * UINT2: MASK (pins 32 to 53)
+ * UINT3: VALUE (pins 0 to 31)
+ * UINT4: VALUE (pins 32 to 53)
+ *
+ * Each bank is updated with a single store to its SET and/or CLR register.
+ */
+
+#define GPIO_MASK_DATAIO_SIZE_BYTES 20
+#define GPIO_MASK_DATAIO_SIZE_UINT 5
+
+/*
+ * Pull-up/down programming sequence (run once per pull type, for all masked pins):
+ * write GPPUD, wait, write GPPUDCLK0/1, wait, clear GPPUD and GPPUDCLK0/1.
+ * The datasheet asks for 150 core cycles per wait. The SYSTIMER runs at 1MHz, so waiting for 2 counter ticks gives at least 1us.
+ */
+
+#define GPIO_PUDCTRL_WAIT_US 2
+
+/*
+ * GPIO Config Command Structure (GPIO_CONFIG_DATAIO_SIZE_BYTES, only accepted through GPIO_IOCTL_APPLY_CONFIG):
+ *
+ * BYTE0: CMD
+ * BYTE1: N ENTRIES (up to GPIO_CONFIG_MAX_PINS)
+ * BYTES 2 to 3: RESERVED
+ * BYTES 4 onwards: N ENTRIES of GPIO_CONFIG_ENTRY_SIZE_BYTES
+ *
+ * GPIO Config Entry Structure (4 BYTES):
+ *
+ * BYTE0: PIN
+ * BYTE1: PINMODE
+ * BYTE2: PUDCTRL
+ * BYTE3: DETECT FLAGS (GPIO_CONFIG_DETECT_*). Detections not flagged are disabled. HIGH/LOW are ignored if an edge is flagged.
+ *
+ * Entries are grouped by register. Each FSEL and detect enable register is written once, and a single GPPUD/GPPUDCLK sequence is run per pull type.
+ * Entries with an invalid pin are ignored.
+ */
+
+#define GPIO_CONFIG_MAX_PINS 54
+#define GPIO_CONFIG_HEADER_SIZE_BYTES 4
+#define GPIO_CONFIG_ENTRY_SIZE_BYTES 4
+#define GPIO_CONFIG_DATAIO_SIZE_BYTES (GPIO_CONFIG_HEADER_SIZE_BYTES + GPIO_CONFIG_MAX_PINS*GPIO_CONFIG_ENTRY_SIZE_BYTES)
+
+#define GPIO_CONFIG_DETECT_REDGE 0x01
+#define GPIO_CONFIG_DETECT_FEDGE 0x02
+#define GPIO_CONFIG_DETECT_ASYNC_REDGE 0x04
+#define GPIO_CONFIG_DETECT_ASYNC_FEDGE 0x08
+#define GPIO_CONFIG_DETECT_HIGH 0x10
+#define GPIO_CONFIG_DETECT_LOW 0x20
+
+#define GPIO_CONFIG_N_DETECT 6
+
 #define GPIO_CMD_RESET_PIN 0
 #define GPIO_CMD_SET_LEVEL 1
 #define GPIO_CMD_GET_LEVEL 2
@@ -51,12 +131,255 @@
 #define GPIO_CMD_GET_ENABLE_HIGHDETECT 16
 #define GPIO_CMD_SET_ENABLE_LOWDETECT 17
 #define GPIO_CMD_GET_ENABLE_LOWDETECT 18
-
+#define GPIO_CMD_SET_MASK 19
+#define GPIO_CMD_CLEAR_MASK 20
+#define GPIO_CMD_WRITE_MASKED 21
+#define GPIO_CMD_GET_ALL_LEVELS 22
+#define GPIO_CMD_APPLY_CONFIG 23
+#define GPIO_CMD_SET_PUDCTRL_MASK 24
+#define GPIO_CMD_SET_DEBOUNCE 25
+#define GPIO_CMD_GET_DEBOUNCE 26
+#define GPIO_CMD_SET_GLITCH_FILTER 27
+#define GPIO_CMD_GET_GLITCH_FILTER 28
+#define GPIO_CMD_SET_ENABLE_COUNTER 29
+#define GPIO_CMD_GET_ENABLE_COUNTER 30
+#define GPIO_CMD_SET_FREQ_WINDOW 31
+#define GPIO_CMD_GET_FREQ_WINDOW 32
+#define GPIO_CMD_GET_COUNTERS 33
+
+#define GPIO_CMD_RING_DOORBELL 0xFE
 #define GPIO_CMD_KERNEL_RESPONSE 0xFF
 
+#define GPIO_IOCTL_MAGIC 'g'
+#define GPIO_IOCTL_RUN_CMD _IOWR(GPIO_IOCTL_MAGIC, 0, unsigned char[GPIO_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_RUN_MASK_CMD _IOWR(GPIO_IOCTL_MAGIC, 1, unsigned char[GPIO_MASK_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_APPLY_CONFIG _IOWR(GPIO_IOCTL_MAGIC, 2, unsigned char[GPIO_CONFIG_DATAIO_SIZE_BYTES])
+#define GPIO_IOCTL_GET_COUNTERS _IOWR(GPIO_IOCTL_MAGIC, 3, unsigned char[GPIO_COUNTER_DATAIO_SIZE_BYTES])
+
+/*
+ * GPIO Command Ring Structure (GPIO_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: GPIO_RING_ENTRIES entries of GPIO_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%GPIO_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a GPIO_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define GPIO_RING_SIZE_BYTES 4096
+#define GPIO_RING_HEADER_SIZE_BYTES 16
+#define GPIO_RING_ENTRY_SIZE_BYTES 8
+#define GPIO_RING_ENTRIES 256
+
+#define GPIO_RING_SQ_TAIL_UINTP_POS 0
+#define GPIO_RING_SQ_HEAD_UINTP_POS 1
+#define GPIO_RING_FLAGS_UINTP_POS 2
+
+#define GPIO_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * mmap() offsets (in pages):
+ *
+ * GPIO_MMAP_RING_PGOFF: Command ring of the open file.
+ * GPIO_MMAP_REGS_PGOFF: GPIO register page at GPIO_BASE_ADDR, mapped uncached. At most one page, no execute permission.
+ * The registers in "BCM2837_GPIO_RegisterMapping.h" are the only ones in this page.
+ * Only GPSET/GPCLR may be written through the mapping: the other registers belong to the driver (shadow copy, pinctrl-bcm2835 IRQs).
+ * The MMU can't restrict writes within the page, so writable mappings require CAP_SYS_RAWIO. Read only mappings can't be made writable with mprotect().
+ */
+
+#define GPIO_MMAP_RING_PGOFF 0
+#define GPIO_MMAP_REGS_PGOFF 1
+
+/*
+ * GPIO Edge Event Structure (GPIO_EVENT_SIZE_BYTES, read from "/dev/GPIO_Event"):
+ *
+ * BYTES 0 to 7: TIMESTAMP (SYSTIMER counter, microseconds)
+ * BYTE8: PIN
+ * BYTE9: EDGE (GPIO_EVENT_EDGE_FALLING or GPIO_EVENT_EDGE_RISING)
+ * BYTES 10 to 15: RESERVED
+ *
+ * Events are queued by per pin IRQs, for every pin with an edge detect enabled (synchronous or asynchronous).
+ * The GPIO bank IRQs belong to pinctrl-bcm2835 (chained handlers), so pin IRQs are requested through gpiolib. pinctrl-bcm2835 acks GPEDS
+ * and also sets the synchronous edge enables of the requested trigger. The pin must be an input for its IRQ to be granted.
+ * High/low level detection is refused on pins with an edge detect enabled (and cleared when one is enabled): GPEDS can't be cleared while
+ * the level holds, so the pin IRQ would fire continuously.
+ * Every opener of "/dev/GPIO_Event" gets its own ring of GPIO_EVENT_RING_ENTRIES events. If a ring is full, new events are dropped for that opener.
+ * A read() returns as many whole events as fit in the buffer. It blocks until at least one event is queued, unless O_NONBLOCK is set.
+ * If only rising (or only falling) detection is enabled for a pin, EDGE is taken from that. Otherwise it is taken from the pin level when the IRQ is handled.
+ */
+
+#define GPIO_EVENT_SIZE_BYTES 16
+#define GPIO_EVENT_RING_ENTRIES 1024
+
+#define GPIO_EVENT_EDGE_FALLING 0
+#define GPIO_EVENT_EDGE_RISING 1
+
+#define GPIO_EVENT_CHIP_LABEL "pinctrl-bcm2835"
+
+/*
+ * Per pin input filter, applied to edge events before they are queued:
+ *
+ * GPIO_CMD_SET_DEBOUNCE: ARG is the stable time in milliseconds. A transition is only reported once the pin has kept its new level for that long.
+ * The event timestamp is the first edge of the burst.
+ * GPIO_CMD_SET_GLITCH_FILTER: ARG is the minimum pulse width in microseconds. Level changes that don't last that long are discarded.
+ * The event timestamp is the last edge of the burst.
+ *
+ * ARG = 0 disables the setting. If both are set, the pin must be stable for the longer of the two, and the debounce timestamp is used.
+ * Every raw edge of a filtered pin only restarts the pin's timer. When the timer expires, the pin level is compared with the last reported level,
+ * and one event is queued if it changed (and detection is enabled for that direction).
+ */
+
+#define GPIO_PIN_COUNT 54
+
+/*
+ * Per pin edge counters (GPIO_CMD_SET_ENABLE_COUNTER, ARG = 0 or 1). Enabling a counter resets it.
+ * Every edge IRQ of a counted pin increments its count and updates the period statistics (time between consecutive counted edges, from the IRQ timestamps).
+ * Edges are counted before debounce/glitch filtering. Edge detection must be enabled on the pin. Enable a single edge direction to measure the signal period.
+ * Edges closer than the IRQ latency are counted once.
+ *
+ * Gated frequency measurement (GPIO_CMD_SET_FREQ_WINDOW, ARG = window in units of 10 milliseconds, 0 disables. PIN is ignored):
+ * At the end of every window, WINDOW EDGES is set to the number of edges counted during that window.
+ *
+ * GPIO Counter Snapshot Structure (GPIO_COUNTER_DATAIO_SIZE_BYTES, only through GPIO_IOCTL_GET_COUNTERS):
+ *
+ * BYTE0: CMD (GPIO_CMD_GET_COUNTERS)
+ * BYTE1: N RECORDS (written by kernel)
+ * BYTES 2 to 3: RESERVED
+ * UINT1: WINDOW (microseconds, 0 if disabled)
+ * BYTES 8 onwards: N RECORDS of GPIO_COUNTER_RECORD_SIZE_BYTES, one per enabled counter, in pin order.
+ *
+ * GPIO Counter Record Structure (40 BYTES):
+ *
+ * BYTES 0 to 7: COUNT
+ * BYTES 8 to 15: LAST EDGE TIMESTAMP (SYSTIMER counter, microseconds)
+ * UINT4: LAST PERIOD (microseconds)
+ * UINT5: MIN PERIOD (microseconds)
+ * UINT6: MAX PERIOD (microseconds)
+ * UINT7: WINDOW EDGES
+ * BYTE32: PIN
+ * BYTES 33 to 39: RESERVED
+ *
+ * Periods are 0 until two edges are counted.
+ */
+
+#define GPIO_COUNTER_HEADER_SIZE_BYTES 8
+#define GPIO_COUNTER_RECORD_SIZE_BYTES 40
+#define GPIO_COUNTER_DATAIO_SIZE_BYTES (GPIO_COUNTER_HEADER_SIZE_BYTES + GPIO_PIN_COUNT*GPIO_COUNTER_RECORD_SIZE_BYTES)
+
+#define GPIO_FREQ_WINDOW_UNIT_US 10000
+
+/*
+ * The driver keeps a shadow copy of the configuration registers (FSEL0 to ASYNC_FEDGEDETECT1_ENABLE, same positions as in the mapping).
+ * Changes are applied to the shadow under gpio_shadow_lock, and each register is written once. Configuration getters only read the shadow.
+ * The shadow is loaded from the hardware when the driver is enabled. Nothing else should change the function selects while the driver is loaded.
+ * The detect enables (REDGEDETECT0_ENABLE to ASYNC_FEDGEDETECT1_ENABLE) are shared with pinctrl-bcm2835, which changes them when any GPIO IRQ is requested or freed:
+ * they are read back from the hardware before each change, and reloaded into the shadow after every request_irq()/free_irq() of the event IRQs.
+ */
+
+#define GPIO_SHADOW_N_REGS (GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS + 1)
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	size_t data_io_length;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} gpio_file_ctx_t;
+
+typedef struct {
+	unsigned long long timestamp;
+	unsigned char pin;
+	unsigned char edge;
+	unsigned char reserved[6];
+} gpio_event_t;
+
+/*
+ * Single producer (IRQ handler, serialized by gpio_event_lock), single consumer (read(), serialized by read_mutex).
+ * "head" is only written by the producer and "tail" only by the consumer.
+ */
+
+typedef struct {
+	unsigned int stable_us;
+	unsigned int min_pulse_us;
+	unsigned int level;
+	unsigned int pending;
+	unsigned long long first_timestamp;
+	unsigned long long last_timestamp;
+	struct hrtimer timer;
+} gpio_filter_t;
+
+typedef struct {
+	unsigned long long count;
+	unsigned long long last_timestamp;
+	unsigned int last_period_us;
+	unsigned int min_period_us;
+	unsigned int max_period_us;
+	unsigned int window_edges;
+	unsigned char pin;
+	unsigned char reserved[7];
+} gpio_counter_record_t;
+
+typedef struct {
+	gpio_counter_record_t record;
+	unsigned int enabled;
+	unsigned long long window_start_count;
+} gpio_counter_t;
+
+typedef struct {
+	gpio_event_t *ring;
+	unsigned int head;
+	unsigned int tail;
+	struct mutex read_mutex;
+	wait_queue_head_t wait;
+	struct list_head list;
+} gpio_event_ctx_t;
+
 static struct proc_dir_entry *gpio_proc = NULL;
 static unsigned int *gpio_mapping = NULL;
-static void *gpio_data_io = NULL;
+static unsigned int gpio_shadow[GPIO_SHADOW_N_REGS] = {0};
+static DEFINE_SPINLOCK(gpio_shadow_lock);
+static DEFINE_SPINLOCK(gpio_pudctrl_lock);
+
+//Detect enable registers, in GPIO_CONFIG_DETECT_* bit order.
+static const unsigned int gpio_detect_enable_pos[GPIO_CONFIG_N_DETECT][2] = {
+	{GPIO_REDGEDETECT0_ENABLE_UINTP_POS, GPIO_REDGEDETECT1_ENABLE_UINTP_POS},
+	{GPIO_FEDGEDETECT0_ENABLE_UINTP_POS, GPIO_FEDGEDETECT1_ENABLE_UINTP_POS},
+	{GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS, GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS},
+	{GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS, GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS},
+	{GPIO_HIGHDETECT0_ENABLE_UINTP_POS, GPIO_HIGHDETECT1_ENABLE_UINTP_POS},
+	{GPIO_LOWDETECT0_ENABLE_UINTP_POS, GPIO_LOWDETECT1_ENABLE_UINTP_POS}
+};
+static struct task_struct *gpio_ring_thread = NULL;
+static LIST_HEAD(gpio_file_ctx_list);
+static DEFINE_MUTEX(gpio_file_ctx_list_mutex);
+static unsigned int *gpio_systimer_mapping = NULL;
+static unsigned int gpio_event_irq[GPIO_PIN_COUNT] = {0};
+static unsigned int gpio_event_irq_trigger[GPIO_PIN_COUNT] = {0};
+static DEFINE_MUTEX(gpio_event_irq_mutex);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+static struct gpio_device *gpio_event_gdev = NULL;
+#else
+static struct gpio_chip *gpio_event_chip = NULL;
+#endif
+static LIST_HEAD(gpio_event_ctx_list);
+static DEFINE_SPINLOCK(gpio_event_lock);
+static gpio_filter_t gpio_filter[GPIO_PIN_COUNT];
+static gpio_counter_t gpio_counter[GPIO_PIN_COUNT];
+static unsigned int gpio_freq_window_us = 0;
+static struct hrtimer gpio_freq_timer;
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int gpio_is_reg_bit_active(unsigned int register_value, unsigned int reference_bit)
 {
@@ -65,6 +388,56 @@ unsigned int gpio_is_reg_bit_active(unsigned int register_value, unsigned int re
 	return 0;
 }
 
+//Must be called with gpio_shadow_lock held.
+void gpio_shadow_write(unsigned int mapping_pos, unsigned int mask, unsigned int value)
+{
+	//Read-modify-write the detect enables, so the bits set by pinctrl-bcm2835 for other pins are kept.
+	if(mapping_pos >= GPIO_REDGEDETECT0_ENABLE_UINTP_POS) gpio_shadow[mapping_pos] = gpio_mapping[mapping_pos];
+
+	gpio_shadow[mapping_pos] &= ~mask;
+	gpio_shadow[mapping_pos] |= (value & mask);
+	gpio_mapping[mapping_pos] = gpio_shadow[mapping_pos];
+	return;
+}
+
+//Updates the "mask" bits of a configuration register in the shadow copy, then writes the register once.
+void gpio_shadow_update(unsigned int mapping_pos, unsigned int mask, unsigned int value)
+{
+	spin_lock(&gpio_shadow_lock);
+	gpio_shadow_write(mapping_pos, mask, value);
+	spin_unlock(&gpio_shadow_lock);
+	return;
+}
+
+void gpio_shadow_load(void)
+{
+	unsigned int mapping_pos = 0;
+	while(mapping_pos < GPIO_SHADOW_N_REGS)
+	{
+		gpio_shadow[mapping_pos] = gpio_mapping[mapping_pos];
+		mapping_pos++;
+	}
+
+	return;
+}
+
+//Reloads the detect enables into the shadow. Must be called after request_irq()/free_irq() on a GPIO IRQ.
+void gpio_shadow_reload_detect(void)
+{
+	unsigned int mapping_pos = GPIO_REDGEDETECT0_ENABLE_UINTP_POS;
+
+	spin_lock(&gpio_shadow_lock);
+
+	while(mapping_pos < GPIO_SHADOW_N_REGS)
+	{
+		gpio_shadow[mapping_pos] = gpio_mapping[mapping_pos];
+		mapping_pos++;
+	}
+
+	spin_unlock(&gpio_shadow_lock);
+	return;
+}
+
 void gpio_set_pinmode(unsigned int pin_number, unsigned int pinmode)
 {
 	pinmode &= 0x00000007;
@@ -98,8 +471,7 @@ void gpio_set_pinmode(unsigned int pin_number, unsigned int pinmode)
 			break;
 	}
 
-	gpio_mapping[mapping_pos] &= ~(0x7 << bit_offset);
-	gpio_mapping[mapping_pos] |= (pinmode << bit_offset);
+	gpio_shadow_update(mapping_pos, (0x7 << bit_offset), (pinmode << bit_offset));
 	return;
 }
 
@@ -136,7 +508,7 @@ unsigned int gpio_get_pinmode(unsigned int pin_number)
 			break;
 	}
 
-	pinmode = gpio_mapping[mapping_pos];
+	pinmode = gpio_shadow[mapping_pos];
 	pinmode &= (0x7 << bit_offset);
 	return (pinmode >> bit_offset);
 }
@@ -173,213 +545,801 @@ void gpio_set_level(unsigned int pin_number, unsigned int value)
 	return;
 }
 
-void gpio_set_pudctrl(unsigned int pin_number, unsigned int pudctrl)
+void gpio_set_mask(unsigned int bank, unsigned int mask)
 {
-	pudctrl &= 0x00000003;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-
-	if(pin_number < 32) mapping_pos = GPIO_PUDCTRL0_UINTP_POS;
-	else mapping_pos = GPIO_PUDCTRL1_UINTP_POS;
-
-	gpio_mapping[GPIO_PUDCTRL_ENABLE_UINTP_POS] = pudctrl;
-	gpio_mapping[mapping_pos] = (1 << bit_offset);
+	if(bank == 0) gpio_mapping[GPIO_OUTPUT0_SET_UINTP_POS] = mask;
+	else gpio_mapping[GPIO_OUTPUT1_SET_UINTP_POS] = (mask & 0x003FFFFF);
 	return;
 }
 
-unsigned int gpio_event_detected(unsigned int pin_number)
+void gpio_clear_mask(unsigned int bank, unsigned int mask)
 {
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-
-	if(pin_number < 32) mapping_pos = GPIO_EVENTDETECT0_STATUS_UINTP_POS;
-	else mapping_pos = GPIO_EVENTDETECT1_STATUS_UINTP_POS;
-
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+	if(bank == 0) gpio_mapping[GPIO_OUTPUT0_CLR_UINTP_POS] = mask;
+	else gpio_mapping[GPIO_OUTPUT1_CLR_UINTP_POS] = (mask & 0x003FFFFF);
+	return;
 }
 
-void gpio_enable_risingedge_detect(unsigned int pin_number, unsigned int enable)
+void gpio_write_masked(unsigned int bank, unsigned int mask, unsigned int value)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-	
-	if(pin_number < 32) mapping_pos = GPIO_REDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_REDGEDETECT1_ENABLE_UINTP_POS;
-
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
+	gpio_set_mask(bank, (mask & value));
+	gpio_clear_mask(bank, (mask & ~value));
 	return;
 }
 
-unsigned int gpio_risingedge_detect_is_enabled(unsigned int pin_number)
+unsigned int gpio_get_all_levels(unsigned int bank)
 {
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-
-	if(pin_number < 32) mapping_pos = GPIO_REDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_REDGEDETECT1_ENABLE_UINTP_POS;
+	if(bank == 0) return gpio_mapping[GPIO_INPUT0_UINTP_POS];
+	return (gpio_mapping[GPIO_INPUT1_UINTP_POS] & 0x003FFFFF);
+}
 
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+//Busy waits at least GPIO_PUDCTRL_WAIT_US, measured with the SYSTIMER counter.
+void gpio_pudctrl_wait(void)
+{
+	unsigned int start_time = gpio_systimer_mapping[SYSTIMER_COUNTER_L32_UINTP_POS];
+	while((gpio_systimer_mapping[SYSTIMER_COUNTER_L32_UINTP_POS] - start_time) < GPIO_PUDCTRL_WAIT_US) cpu_relax();
+	return;
 }
 
-void gpio_enable_fallingedge_detect(unsigned int pin_number, unsigned int enable)
+//Runs the full GPPUD/GPPUDCLK sequence once for every pin in "mask0" (pins 0 to 31) and "mask1" (pins 32 to 53).
+void gpio_set_pudctrl_mask(unsigned int pudctrl, unsigned int mask0, unsigned int mask1)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	pudctrl &= 0x00000003;
+	mask1 &= 0x003FFFFF;
 
-	if(pin_number < 32) mapping_pos = GPIO_FEDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_FEDGEDETECT1_ENABLE_UINTP_POS;
+	if(!mask0 && !mask1) return;
 
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
+	spin_lock(&gpio_pudctrl_lock);
+	gpio_mapping[GPIO_PUDCTRL_ENABLE_UINTP_POS] = pudctrl;
+	gpio_pudctrl_wait();
+	gpio_mapping[GPIO_PUDCTRL0_UINTP_POS] = mask0;
+	gpio_mapping[GPIO_PUDCTRL1_UINTP_POS] = mask1;
+	gpio_pudctrl_wait();
+	gpio_mapping[GPIO_PUDCTRL_ENABLE_UINTP_POS] = GPIO_PUDCTRL_NOPULL;
+	gpio_mapping[GPIO_PUDCTRL0_UINTP_POS] = 0;
+	gpio_mapping[GPIO_PUDCTRL1_UINTP_POS] = 0;
+	spin_unlock(&gpio_pudctrl_lock);
 	return;
 }
 
-unsigned int gpio_fallingedge_detect_is_enabled(unsigned int pin_number)
+void gpio_set_pudctrl(unsigned int pin_number, unsigned int pudctrl)
 {
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-
-	if(pin_number < 32) mapping_pos = GPIO_FEDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_FEDGEDETECT1_ENABLE_UINTP_POS;
-
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+	if(pin_number < 32) gpio_set_pudctrl_mask(pudctrl, (1 << pin_number), 0);
+	else gpio_set_pudctrl_mask(pudctrl, 0, (1 << (pin_number%32)));
+	return;
 }
 
-void gpio_enable_high_detect(unsigned int pin_number, unsigned int enable)
+unsigned long long gpio_event_get_timestamp(void)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	unsigned int counter_h32 = 0;
+	unsigned int counter_l32 = 0;
 
-	if(pin_number < 32) mapping_pos = GPIO_HIGHDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_HIGHDETECT1_ENABLE_UINTP_POS;
+	do{
+		counter_h32 = gpio_systimer_mapping[SYSTIMER_COUNTER_H32_UINTP_POS];
+		counter_l32 = gpio_systimer_mapping[SYSTIMER_COUNTER_L32_UINTP_POS];
+	}while(counter_h32 != gpio_systimer_mapping[SYSTIMER_COUNTER_H32_UINTP_POS]);
 
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
-	return;
+	return ((((unsigned long long) counter_h32) << 32) | counter_l32);
 }
 
-unsigned int gpio_high_detect_is_enabled(unsigned int pin_number)
+unsigned int gpio_event_get_edge(unsigned int reference_bit, unsigned int level, unsigned int rising_enabled, unsigned int falling_enabled)
 {
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
-	
-	if(pin_number < 32) mapping_pos = GPIO_HIGHDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_HIGHDETECT1_ENABLE_UINTP_POS;
-
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+	if((rising_enabled & reference_bit) && !(falling_enabled & reference_bit)) return GPIO_EVENT_EDGE_RISING;
+	if((falling_enabled & reference_bit) && !(rising_enabled & reference_bit)) return GPIO_EVENT_EDGE_FALLING;
+	if(level & reference_bit) return GPIO_EVENT_EDGE_RISING;
+	return GPIO_EVENT_EDGE_FALLING;
 }
 
-void gpio_enable_low_detect(unsigned int pin_number, unsigned int enable)
+//Must be called with gpio_event_lock held.
+void gpio_event_push(unsigned int pin_number, unsigned int edge, unsigned long long timestamp)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	gpio_event_ctx_t *ctx = NULL;
+	gpio_event_t *p_event = NULL;
 
-	if(pin_number < 32) mapping_pos = GPIO_LOWDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_LOWDETECT1_ENABLE_UINTP_POS;
+	list_for_each_entry(ctx, &gpio_event_ctx_list, list)
+	{
+		if((ctx->head - smp_load_acquire(&ctx->tail)) >= GPIO_EVENT_RING_ENTRIES) continue;
+
+		p_event = &ctx->ring[ctx->head%GPIO_EVENT_RING_ENTRIES];
+		p_event->timestamp = timestamp;
+		p_event->pin = pin_number;
+		p_event->edge = edge;
+		smp_store_release(&ctx->head, ctx->head + 1);
+	}
 
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
 	return;
 }
 
-unsigned int gpio_low_detect_is_enabled(unsigned int pin_number)
+//Must be called with gpio_event_lock held.
+void gpio_counter_edge(unsigned int pin_number, unsigned long long timestamp)
 {
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	gpio_counter_record_t *record = &gpio_counter[pin_number].record;
+	unsigned long long period = 0;
 
-	if(pin_number < 32) mapping_pos = GPIO_LOWDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_LOWDETECT1_ENABLE_UINTP_POS;
+	if(record->count)
+	{
+		period = timestamp - record->last_timestamp;
+		if(period > 0xFFFFFFFF) period = 0xFFFFFFFF;
 
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+		record->last_period_us = (unsigned int) period;
+		if((record->min_period_us == 0) || (record->last_period_us < record->min_period_us)) record->min_period_us = record->last_period_us;
+		if(record->last_period_us > record->max_period_us) record->max_period_us = record->last_period_us;
+	}
+
+	record->count++;
+	record->last_timestamp = timestamp;
+	return;
 }
 
-void gpio_enable_async_risingedge_detect(unsigned int pin_number, unsigned int enable)
+enum hrtimer_restart gpio_freq_timer_handler(struct hrtimer *timer)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	unsigned int pin_number = 0;
 
-	if(pin_number < 32) mapping_pos = GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS;
+	spin_lock(&gpio_event_lock);
 
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
-	return;
-}
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		if(gpio_counter[pin_number].enabled)
+		{
+			gpio_counter[pin_number].record.window_edges = (unsigned int) (gpio_counter[pin_number].record.count - gpio_counter[pin_number].window_start_count);
+			gpio_counter[pin_number].window_start_count = gpio_counter[pin_number].record.count;
+		}
 
-unsigned int gpio_async_risingedge_detect_is_enabled(unsigned int pin_number)
-{
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+		pin_number++;
+	}
 
-	if(pin_number < 32) mapping_pos = GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS;
+	spin_unlock(&gpio_event_lock);
 
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+	hrtimer_forward_now(timer, ns_to_ktime(((u64) gpio_freq_window_us)*1000));
+	return HRTIMER_RESTART;
 }
 
-void gpio_enable_async_fallingedge_detect(unsigned int pin_number, unsigned int enable)
+//Must be called with gpio_event_lock held.
+void gpio_filter_edge(unsigned int pin_number, unsigned long long timestamp)
 {
-	enable &= 0x00000001;
-	unsigned int mapping_pos = 0;
-	unsigned int bit_offset = pin_number%32;
+	gpio_filter_t *filter = &gpio_filter[pin_number];
+	unsigned int window_us = filter->stable_us;
 
-	if(pin_number < 32) mapping_pos = GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS;
+	if(filter->min_pulse_us > window_us) window_us = filter->min_pulse_us;
+
+	if(!filter->pending) filter->first_timestamp = timestamp;
+	filter->last_timestamp = timestamp;
+	filter->pending = 1;
 
-	gpio_mapping[mapping_pos] &= ~(1 << bit_offset);
-	gpio_mapping[mapping_pos] |= (enable << bit_offset);
+	hrtimer_start(&filter->timer, ns_to_ktime(((u64) window_us)*1000), HRTIMER_MODE_REL);
 	return;
 }
 
-unsigned int gpio_async_fallingedge_detect_is_enabled(unsigned int pin_number)
+enum hrtimer_restart gpio_filter_timer_handler(struct hrtimer *timer)
 {
-	unsigned int mapping_pos = 0;
+	gpio_filter_t *filter = container_of(timer, gpio_filter_t, timer);
+	unsigned int pin_number = (unsigned int) (filter - gpio_filter);
 	unsigned int bit_offset = pin_number%32;
+	unsigned int bank = pin_number/32;
+	unsigned int level = gpio_get_level(pin_number);
+	unsigned int edge_enabled = 0;
+	gpio_event_ctx_t *ctx = NULL;
 
-	if(pin_number < 32) mapping_pos = GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS;
-	else mapping_pos = GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS;
+	if(level && (bank == 0)) edge_enabled = (gpio_shadow[GPIO_REDGEDETECT0_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS]);
+	else if(level) edge_enabled = (gpio_shadow[GPIO_REDGEDETECT1_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS]);
+	else if(bank == 0) edge_enabled = (gpio_shadow[GPIO_FEDGEDETECT0_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS]);
+	else edge_enabled = (gpio_shadow[GPIO_FEDGEDETECT1_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS]);
 
-	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+	spin_lock(&gpio_event_lock);
+
+	if(filter->pending && (level != filter->level))
+	{
+		filter->level = level;
+
+		if(edge_enabled & (1 << bit_offset))
+		{
+			if(level) gpio_event_push(pin_number, GPIO_EVENT_EDGE_RISING, (filter->stable_us ? filter->first_timestamp : filter->last_timestamp));
+			else gpio_event_push(pin_number, GPIO_EVENT_EDGE_FALLING, (filter->stable_us ? filter->first_timestamp : filter->last_timestamp));
+
+			list_for_each_entry(ctx, &gpio_event_ctx_list, list) wake_up_interruptible(&ctx->wait);
+		}
+	}
+
+	filter->pending = 0;
+
+	spin_unlock(&gpio_event_lock);
+	return HRTIMER_NORESTART;
 }
 
-void gpio_reset_pin(unsigned int pin_number)
+void gpio_filter_init(void)
 {
-	gpio_set_pinmode(pin_number, GPIO_PINMODE_INPUT);
-	gpio_set_pudctrl(pin_number, GPIO_PUDCTRL_NOPULL);
-	gpio_enable_async_risingedge_detect(pin_number, 0);
-	gpio_enable_async_fallingedge_detect(pin_number, 0);
-	gpio_enable_risingedge_detect(pin_number, 0);
-	gpio_enable_fallingedge_detect(pin_number, 0);
-	gpio_enable_high_detect(pin_number, 0);
-	gpio_enable_low_detect(pin_number, 0);
-	gpio_event_detected(pin_number);
+	unsigned int pin_number = 0;
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		hrtimer_init(&gpio_filter[pin_number].timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		gpio_filter[pin_number].timer.function = gpio_filter_timer_handler;
+		pin_number++;
+	}
+
+	hrtimer_init(&gpio_freq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	gpio_freq_timer.function = gpio_freq_timer_handler;
+
 	return;
 }
 
-ssize_t gpio_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+void gpio_filter_deinit(void)
 {
-	copy_to_user(user, gpio_data_io, GPIO_DATAIO_SIZE_BYTES);
-	return size;
+	unsigned int pin_number = 0;
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		hrtimer_cancel(&gpio_filter[pin_number].timer);
+		pin_number++;
+	}
+
+	hrtimer_cancel(&gpio_freq_timer);
+
+	return;
 }
 
-ssize_t gpio_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+irqreturn_t gpio_irq_handler(int irq, void *dev_id)
 {
-	copy_from_user(gpio_data_io, user, GPIO_DATAIO_SIZE_BYTES);
-
-	unsigned char *pbyte = (unsigned char*) gpio_data_io;
+	unsigned int pin_number = (unsigned int) (((unsigned int*) dev_id) - gpio_event_irq);
+	unsigned int bit_offset = pin_number%32;
+	unsigned int level = 0;
+	unsigned int rising_enabled = 0;
+	unsigned int falling_enabled = 0;
+	unsigned long long timestamp = gpio_event_get_timestamp();
+	gpio_event_ctx_t *ctx = NULL;
 
-	switch(pbyte[0])
+	//GPEDS was already acked by pinctrl-bcm2835 before dispatching the pin IRQ.
+	if(pin_number < 32)
 	{
-		case GPIO_CMD_RESET_PIN:
-			gpio_reset_pin(pbyte[1]);
-			break;
-
+		level = gpio_mapping[GPIO_INPUT0_UINTP_POS];
+		rising_enabled = (gpio_shadow[GPIO_REDGEDETECT0_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS]);
+		falling_enabled = (gpio_shadow[GPIO_FEDGEDETECT0_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS]);
+	}
+	else
+	{
+		level = gpio_mapping[GPIO_INPUT1_UINTP_POS];
+		rising_enabled = (gpio_shadow[GPIO_REDGEDETECT1_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS]);
+		falling_enabled = (gpio_shadow[GPIO_FEDGEDETECT1_ENABLE_UINTP_POS] | gpio_shadow[GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS]);
+	}
+
+	spin_lock(&gpio_event_lock);
+
+	if(gpio_counter[pin_number].enabled) gpio_counter_edge(pin_number, timestamp);
+
+	if(gpio_filter[pin_number].stable_us || gpio_filter[pin_number].min_pulse_us)
+	{
+		gpio_filter_edge(pin_number, timestamp);
+	}
+	else
+	{
+		gpio_event_push(pin_number, gpio_event_get_edge((1 << bit_offset), level, rising_enabled, falling_enabled), timestamp);
+		list_for_each_entry(ctx, &gpio_event_ctx_list, list) wake_up_interruptible(&ctx->wait);
+	}
+
+	spin_unlock(&gpio_event_lock);
+	return IRQ_HANDLED;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+int gpio_event_chip_match(struct gpio_chip *gc, void *data)
+{
+	return ((gc->label != NULL) && !strcmp(gc->label, (const char*) data));
+}
+#endif
+
+//Looks up the gpiolib chip of the GPIO block. Returns false if it's not registered (edge events are then unavailable).
+bool gpio_event_irq_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	gpio_event_gdev = gpio_device_find_by_label(GPIO_EVENT_CHIP_LABEL);
+	return (gpio_event_gdev != NULL);
+#else
+	gpio_event_chip = gpiochip_find(GPIO_EVENT_CHIP_LABEL, gpio_event_chip_match);
+	return (gpio_event_chip != NULL);
+#endif
+}
+
+struct gpio_desc *gpio_event_get_desc(unsigned int pin_number)
+{
+	struct gpio_desc *desc = NULL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	if(gpio_event_gdev == NULL) return NULL;
+	desc = gpio_device_get_desc(gpio_event_gdev, pin_number);
+#else
+	if(gpio_event_chip == NULL) return NULL;
+	desc = gpiochip_get_desc(gpio_event_chip, pin_number);
+#endif
+
+	if(IS_ERR(desc)) return NULL;
+	return desc;
+}
+
+//Returns 1 if any (synchronous or asynchronous) edge detection is enabled on "pin_number", which then has an event IRQ.
+unsigned int gpio_event_pin_has_irq(unsigned int pin_number)
+{
+	unsigned int bank = pin_number/32;
+	unsigned int edge_enabled = (gpio_shadow[gpio_detect_enable_pos[0][bank]] | gpio_shadow[gpio_detect_enable_pos[1][bank]] | gpio_shadow[gpio_detect_enable_pos[2][bank]] | gpio_shadow[gpio_detect_enable_pos[3][bank]]);
+
+	return gpio_is_reg_bit_active(edge_enabled, (1 << (pin_number%32)));
+}
+
+//Requests, changes or frees the IRQ of "pin_number" so that its trigger matches the edge detection enabled on the pin.
+//Must be called from process context, after changing the edge detect enables.
+void gpio_event_update_irq(unsigned int pin_number)
+{
+	unsigned int bit_offset = pin_number%32;
+	unsigned int bank = pin_number/32;
+	unsigned int trigger = 0;
+	struct gpio_desc *desc = NULL;
+	int irq = 0;
+
+	if(pin_number >= GPIO_PIN_COUNT) return;
+
+	if((gpio_shadow[gpio_detect_enable_pos[0][bank]] | gpio_shadow[gpio_detect_enable_pos[2][bank]]) & (1 << bit_offset)) trigger |= IRQF_TRIGGER_RISING;
+	if((gpio_shadow[gpio_detect_enable_pos[1][bank]] | gpio_shadow[gpio_detect_enable_pos[3][bank]]) & (1 << bit_offset)) trigger |= IRQF_TRIGGER_FALLING;
+
+	mutex_lock(&gpio_event_irq_mutex);
+
+	if(trigger == gpio_event_irq_trigger[pin_number])
+	{
+		mutex_unlock(&gpio_event_irq_mutex);
+		return;
+	}
+
+	if(gpio_event_irq[pin_number]) free_irq(gpio_event_irq[pin_number], &gpio_event_irq[pin_number]);
+	gpio_event_irq[pin_number] = 0;
+	gpio_event_irq_trigger[pin_number] = trigger;
+
+	if(trigger)
+	{
+		//Level detection would keep the IRQ asserted.
+		gpio_shadow_update(gpio_detect_enable_pos[4][bank], (1 << bit_offset), 0);
+		gpio_shadow_update(gpio_detect_enable_pos[5][bank], (1 << bit_offset), 0);
+
+		desc = gpio_event_get_desc(pin_number);
+		if(desc != NULL) irq = gpiod_to_irq(desc);
+
+		if(irq > 0)
+		{
+			gpio_event_irq[pin_number] = irq;
+			if(request_irq(irq, gpio_irq_handler, trigger, "GPIO_Ctrl", &gpio_event_irq[pin_number]) < 0) gpio_event_irq[pin_number] = 0;
+		}
+
+		if(gpio_event_irq[pin_number] == 0) printk("GPIO: Error requesting IRQ for pin %d. Edge events disabled on this pin\n", pin_number);
+	}
+
+	gpio_shadow_reload_detect();
+	mutex_unlock(&gpio_event_irq_mutex);
+	return;
+}
+
+void gpio_event_free_irqs(void)
+{
+	unsigned int pin_number = 0;
+
+	mutex_lock(&gpio_event_irq_mutex);
+
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		if(gpio_event_irq[pin_number]) free_irq(gpio_event_irq[pin_number], &gpio_event_irq[pin_number]);
+		gpio_event_irq[pin_number] = 0;
+		gpio_event_irq_trigger[pin_number] = 0;
+		pin_number++;
+	}
+
+	gpio_shadow_reload_detect();
+	mutex_unlock(&gpio_event_irq_mutex);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	if(gpio_event_gdev != NULL) gpio_device_put(gpio_event_gdev);
+	gpio_event_gdev = NULL;
+#endif
+
+	return;
+}
+
+unsigned int gpio_event_detected(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_EVENTDETECT0_STATUS_UINTP_POS;
+	else mapping_pos = GPIO_EVENTDETECT1_STATUS_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_mapping[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_risingedge_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+	
+	if(pin_number < 32) mapping_pos = GPIO_REDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_REDGEDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	gpio_event_update_irq(pin_number);
+	return;
+}
+
+unsigned int gpio_risingedge_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_REDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_REDGEDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_fallingedge_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_FEDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_FEDGEDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	gpio_event_update_irq(pin_number);
+	return;
+}
+
+unsigned int gpio_fallingedge_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_FEDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_FEDGEDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_high_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(enable && gpio_event_pin_has_irq(pin_number)) return;
+
+	if(pin_number < 32) mapping_pos = GPIO_HIGHDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_HIGHDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	return;
+}
+
+unsigned int gpio_high_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+	
+	if(pin_number < 32) mapping_pos = GPIO_HIGHDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_HIGHDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_low_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(enable && gpio_event_pin_has_irq(pin_number)) return;
+
+	if(pin_number < 32) mapping_pos = GPIO_LOWDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_LOWDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	return;
+}
+
+unsigned int gpio_low_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_LOWDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_LOWDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_async_risingedge_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	gpio_event_update_irq(pin_number);
+	return;
+}
+
+unsigned int gpio_async_risingedge_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_ASYNC_REDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_ASYNC_REDGEDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_enable_async_fallingedge_detect(unsigned int pin_number, unsigned int enable)
+{
+	enable &= 0x00000001;
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS;
+
+	gpio_shadow_update(mapping_pos, (1 << bit_offset), (enable << bit_offset));
+	gpio_event_update_irq(pin_number);
+	return;
+}
+
+unsigned int gpio_async_fallingedge_detect_is_enabled(unsigned int pin_number)
+{
+	unsigned int mapping_pos = 0;
+	unsigned int bit_offset = pin_number%32;
+
+	if(pin_number < 32) mapping_pos = GPIO_ASYNC_FEDGEDETECT0_ENABLE_UINTP_POS;
+	else mapping_pos = GPIO_ASYNC_FEDGEDETECT1_ENABLE_UINTP_POS;
+
+	return gpio_is_reg_bit_active(gpio_shadow[mapping_pos], (1 << bit_offset));
+}
+
+void gpio_reset_pin(unsigned int pin_number)
+{
+	gpio_set_pinmode(pin_number, GPIO_PINMODE_INPUT);
+	gpio_set_pudctrl(pin_number, GPIO_PUDCTRL_NOPULL);
+	gpio_enable_async_risingedge_detect(pin_number, 0);
+	gpio_enable_async_fallingedge_detect(pin_number, 0);
+	gpio_enable_risingedge_detect(pin_number, 0);
+	gpio_enable_fallingedge_detect(pin_number, 0);
+	gpio_enable_high_detect(pin_number, 0);
+	gpio_enable_low_detect(pin_number, 0);
+	gpio_event_detected(pin_number);
+	return;
+}
+
+void gpio_apply_config(unsigned char *pbyte)
+{
+	unsigned char *pentry = &pbyte[GPIO_CONFIG_HEADER_SIZE_BYTES];
+	unsigned int n_entries = pbyte[1];
+	unsigned int fsel_mask[6] = {0, 0, 0, 0, 0, 0};
+	unsigned int fsel_value[6] = {0, 0, 0, 0, 0, 0};
+	unsigned int pin_mask[2] = {0, 0};
+	unsigned int detect_value[GPIO_CONFIG_N_DETECT][2];
+	unsigned int pud_mask[3][2];
+	unsigned int pin_number = 0;
+	unsigned int pudctrl = 0;
+	unsigned int detect = 0;
+	unsigned int bank = 0;
+	unsigned int n_entry = 0;
+	unsigned int n_detect = 0;
+
+	memset(detect_value, 0, sizeof(detect_value));
+	memset(pud_mask, 0, sizeof(pud_mask));
+
+	if(n_entries > GPIO_CONFIG_MAX_PINS) n_entries = GPIO_CONFIG_MAX_PINS;
+
+	while(n_entry < n_entries)
+	{
+		pin_number = pentry[0];
+		if(pin_number < GPIO_CONFIG_MAX_PINS)
+		{
+			bank = pin_number/32;
+			pin_mask[bank] |= (1 << (pin_number%32));
+
+			fsel_mask[pin_number/10] |= (0x7 << ((pin_number%10)*3));
+			fsel_value[pin_number/10] |= ((pentry[1] & 0x7) << ((pin_number%10)*3));
+
+			pudctrl = pentry[2];
+			if(pudctrl > GPIO_PUDCTRL_PULLUP) pudctrl = GPIO_PUDCTRL_NOPULL;
+			pud_mask[pudctrl][bank] |= (1 << (pin_number%32));
+
+			//Level detection is refused on pins with edge detection (event IRQ).
+			detect = pentry[3];
+			if(detect & (GPIO_CONFIG_DETECT_REDGE | GPIO_CONFIG_DETECT_FEDGE | GPIO_CONFIG_DETECT_ASYNC_REDGE | GPIO_CONFIG_DETECT_ASYNC_FEDGE)) detect &= ~(GPIO_CONFIG_DETECT_HIGH | GPIO_CONFIG_DETECT_LOW);
+
+			n_detect = 0;
+			while(n_detect < GPIO_CONFIG_N_DETECT)
+			{
+				if(detect & (1 << n_detect)) detect_value[n_detect][bank] |= (1 << (pin_number%32));
+				n_detect++;
+			}
+		}
+
+		pentry += GPIO_CONFIG_ENTRY_SIZE_BYTES;
+		n_entry++;
+	}
+
+	spin_lock(&gpio_shadow_lock);
+
+	n_entry = 0;
+	while(n_entry < 6)
+	{
+		if(fsel_mask[n_entry]) gpio_shadow_write((GPIO_FSEL0_UINTP_POS + n_entry), fsel_mask[n_entry], fsel_value[n_entry]);
+		n_entry++;
+	}
+
+	bank = 0;
+	while(bank < 2)
+	{
+		if(pin_mask[bank])
+		{
+			n_detect = 0;
+			while(n_detect < GPIO_CONFIG_N_DETECT)
+			{
+				gpio_shadow_write(gpio_detect_enable_pos[n_detect][bank], pin_mask[bank], detect_value[n_detect][bank]);
+				n_detect++;
+			}
+		}
+
+		bank++;
+	}
+
+	spin_unlock(&gpio_shadow_lock);
+
+	pin_number = 0;
+	while(pin_number < GPIO_CONFIG_MAX_PINS)
+	{
+		if(pin_mask[pin_number/32] & (1 << (pin_number%32))) gpio_event_update_irq(pin_number);
+		pin_number++;
+	}
+
+	pudctrl = 0;
+	while(pudctrl < 3)
+	{
+		if(pud_mask[pudctrl][0] || pud_mask[pudctrl][1]) gpio_set_pudctrl_mask(pudctrl, pud_mask[pudctrl][0], pud_mask[pudctrl][1]);
+		pudctrl++;
+	}
+
+	pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void gpio_set_filter(unsigned int pin_number, unsigned int stable_us, unsigned int min_pulse_us)
+{
+	gpio_filter_t *filter = NULL;
+	unsigned long lock_flags = 0;
+
+	if(pin_number >= GPIO_PIN_COUNT) return;
+	filter = &gpio_filter[pin_number];
+
+	//Let a pending transition settle with the old settings first.
+	hrtimer_cancel(&filter->timer);
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+	filter->stable_us = stable_us;
+	filter->min_pulse_us = min_pulse_us;
+	filter->level = gpio_get_level(pin_number);
+	filter->pending = 0;
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+	return;
+}
+
+void gpio_set_debounce(unsigned int pin_number, unsigned int stable_ms)
+{
+	if(pin_number >= GPIO_PIN_COUNT) return;
+	gpio_set_filter(pin_number, (stable_ms*1000), gpio_filter[pin_number].min_pulse_us);
+	return;
+}
+
+unsigned int gpio_get_debounce(unsigned int pin_number)
+{
+	if(pin_number >= GPIO_PIN_COUNT) return 0;
+	return (gpio_filter[pin_number].stable_us/1000);
+}
+
+void gpio_set_glitch_filter(unsigned int pin_number, unsigned int min_pulse_us)
+{
+	if(pin_number >= GPIO_PIN_COUNT) return;
+	gpio_set_filter(pin_number, gpio_filter[pin_number].stable_us, min_pulse_us);
+	return;
+}
+
+unsigned int gpio_get_glitch_filter(unsigned int pin_number)
+{
+	if(pin_number >= GPIO_PIN_COUNT) return 0;
+	return gpio_filter[pin_number].min_pulse_us;
+}
+
+void gpio_enable_counter(unsigned int pin_number, unsigned int enable)
+{
+	unsigned long lock_flags = 0;
+
+	if(pin_number >= GPIO_PIN_COUNT) return;
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+	memset(&gpio_counter[pin_number], 0, sizeof(gpio_counter_t));
+	gpio_counter[pin_number].record.pin = pin_number;
+	gpio_counter[pin_number].enabled = (enable & 0x1);
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+	return;
+}
+
+unsigned int gpio_counter_is_enabled(unsigned int pin_number)
+{
+	if(pin_number >= GPIO_PIN_COUNT) return 0;
+	return gpio_counter[pin_number].enabled;
+}
+
+void gpio_set_freq_window(unsigned int window_units)
+{
+	unsigned long lock_flags = 0;
+	unsigned int pin_number = 0;
+
+	hrtimer_cancel(&gpio_freq_timer);
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+	gpio_freq_window_us = window_units*GPIO_FREQ_WINDOW_UNIT_US;
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		gpio_counter[pin_number].record.window_edges = 0;
+		gpio_counter[pin_number].window_start_count = gpio_counter[pin_number].record.count;
+		pin_number++;
+	}
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+
+	if(gpio_freq_window_us) hrtimer_start(&gpio_freq_timer, ns_to_ktime(((u64) gpio_freq_window_us)*1000), HRTIMER_MODE_REL);
+	return;
+}
+
+unsigned int gpio_get_freq_window(void)
+{
+	return (gpio_freq_window_us/GPIO_FREQ_WINDOW_UNIT_US);
+}
+
+//Fills "pbyte" (GPIO_COUNTER_DATAIO_SIZE_BYTES) with a consistent snapshot of every enabled counter.
+void gpio_get_counters(unsigned char *pbyte)
+{
+	unsigned int *puint = (unsigned int*) pbyte;
+	gpio_counter_record_t *p_record = (gpio_counter_record_t*) &pbyte[GPIO_COUNTER_HEADER_SIZE_BYTES];
+	unsigned long lock_flags = 0;
+	unsigned int pin_number = 0;
+	unsigned int n_records = 0;
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+
+	puint[1] = gpio_freq_window_us;
+	while(pin_number < GPIO_PIN_COUNT)
+	{
+		if(gpio_counter[pin_number].enabled)
+		{
+			p_record[n_records] = gpio_counter[pin_number].record;
+			n_records++;
+		}
+
+		pin_number++;
+	}
+
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+
+	pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+	pbyte[1] = n_records;
+	return;
+}
+
+void gpio_run_cmd(unsigned char *pbyte)
+{
+	switch(pbyte[0])
+	{
+		case GPIO_CMD_RESET_PIN:
+			gpio_reset_pin(pbyte[1]);
+			break;
+
 		case GPIO_CMD_SET_LEVEL:
 			gpio_set_level(pbyte[1], pbyte[2]);
 			break;
@@ -451,15 +1411,399 @@ ssize_t gpio_mod_usrwrite(struct file *file, const char __user *user, size_t siz
 		case GPIO_CMD_GET_ENABLE_LOWDETECT:
 			pbyte[2] = gpio_low_detect_is_enabled(pbyte[1]);
 			break;
+
+		case GPIO_CMD_SET_DEBOUNCE:
+			gpio_set_debounce(pbyte[1], pbyte[2]);
+			break;
+
+		case GPIO_CMD_GET_DEBOUNCE:
+			pbyte[2] = gpio_get_debounce(pbyte[1]);
+			break;
+
+		case GPIO_CMD_SET_GLITCH_FILTER:
+			gpio_set_glitch_filter(pbyte[1], pbyte[2]);
+			break;
+
+		case GPIO_CMD_GET_GLITCH_FILTER:
+			pbyte[2] = gpio_get_glitch_filter(pbyte[1]);
+			break;
+
+		case GPIO_CMD_SET_ENABLE_COUNTER:
+			gpio_enable_counter(pbyte[1], pbyte[2]);
+			break;
+
+		case GPIO_CMD_GET_ENABLE_COUNTER:
+			pbyte[2] = gpio_counter_is_enabled(pbyte[1]);
+			break;
+
+		case GPIO_CMD_SET_FREQ_WINDOW:
+			gpio_set_freq_window(pbyte[2]);
+			break;
+
+		case GPIO_CMD_GET_FREQ_WINDOW:
+			pbyte[2] = gpio_get_freq_window();
+			break;
 	}
 
 	pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void gpio_run_mask_cmd(unsigned int *puint)
+{
+	unsigned char *pbyte = (unsigned char*) puint;
+
+	switch(pbyte[0])
+	{
+		case GPIO_CMD_SET_MASK:
+			gpio_set_mask(0, puint[1]);
+			gpio_set_mask(1, puint[2]);
+			break;
+
+		case GPIO_CMD_CLEAR_MASK:
+			gpio_clear_mask(0, puint[1]);
+			gpio_clear_mask(1, puint[2]);
+			break;
+
+		case GPIO_CMD_WRITE_MASKED:
+			gpio_write_masked(0, puint[1], puint[3]);
+			gpio_write_masked(1, puint[2], puint[4]);
+			break;
+
+		case GPIO_CMD_GET_ALL_LEVELS:
+			puint[3] = gpio_get_all_levels(0);
+			puint[4] = gpio_get_all_levels(1);
+			break;
+
+		case GPIO_CMD_SET_PUDCTRL_MASK:
+			gpio_set_pudctrl_mask(pbyte[1], puint[1], puint[2]);
+			break;
+	}
+
+	pbyte[0] = GPIO_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void gpio_ring_drain(gpio_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + GPIO_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[GPIO_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > GPIO_RING_ENTRIES) sq_tail = ctx->ring_sq_head + GPIO_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		gpio_run_cmd(&ring_entries[(ctx->ring_sq_head%GPIO_RING_ENTRIES)*GPIO_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[GPIO_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int gpio_ring_poll_thread(void *arg)
+{
+	gpio_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&gpio_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &gpio_file_ctx_list, list) gpio_ring_drain(ctx);
+		mutex_unlock(&gpio_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+int gpio_mod_open(struct inode *inode, struct file *file)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) kzalloc(sizeof(gpio_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(GPIO_BATCH_MAX_SIZE_BYTES);
+	ctx->ring = vmalloc_user(GPIO_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	ctx->data_io_length = GPIO_DATAIO_SIZE_BYTES;
+	mutex_init(&ctx->ring_mutex);
+	if(gpio_ring_thread != NULL) ((unsigned int*) ctx->ring)[GPIO_RING_FLAGS_UINTP_POS] = GPIO_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&gpio_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &gpio_file_ctx_list);
+	mutex_unlock(&gpio_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int gpio_mod_release(struct inode *inode, struct file *file)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) file->private_data;
+
+	mutex_lock(&gpio_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&gpio_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t gpio_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) file->private_data;
+
+	if(size > ctx->data_io_length) size = ctx->data_io_length;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
 	return size;
 }
 
+ssize_t gpio_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) file->private_data;
+
+	if(size > GPIO_BATCH_MAX_SIZE_BYTES) size = GPIO_BATCH_MAX_SIZE_BYTES;
+	size -= (size%GPIO_DATAIO_SIZE_BYTES);
+	if(size == 0) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	size_t n_byte = 0;
+
+	while(n_byte < size)
+	{
+		if(pbyte[n_byte] == GPIO_CMD_RING_DOORBELL) gpio_ring_drain(ctx);
+
+		gpio_run_cmd(&pbyte[n_byte]);
+		n_byte += GPIO_DATAIO_SIZE_BYTES;
+	}
+
+	ctx->data_io_length = size;
+	return size;
+}
+
+int gpio_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff == GPIO_MMAP_REGS_PGOFF)
+	{
+		if((vma->vm_end - vma->vm_start) > PAGE_SIZE) return -EINVAL;
+		if(vma->vm_flags & VM_EXEC) return -EPERM;
+		if((vma->vm_flags & VM_WRITE) && !capable(CAP_SYS_RAWIO)) return -EPERM;
+
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+		vm_flags_set(vma, (VM_IO | VM_DONTEXPAND | VM_DONTDUMP));
+		if(!(vma->vm_flags & VM_WRITE)) vm_flags_clear(vma, VM_MAYWRITE);
+#else
+		vma->vm_flags |= (VM_IO | VM_DONTEXPAND | VM_DONTDUMP);
+		if(!(vma->vm_flags & VM_WRITE)) vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+		return io_remap_pfn_range(vma, vma->vm_start, (GPIO_BASE_ADDR >> PAGE_SHIFT), (vma->vm_end - vma->vm_start), vma->vm_page_prot);
+	}
+
+	if(vma->vm_pgoff != GPIO_MMAP_RING_PGOFF) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long gpio_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	gpio_file_ctx_t *ctx = (gpio_file_ctx_t*) file->private_data;
+	unsigned char pbyte[GPIO_DATAIO_SIZE_BYTES];
+	unsigned int puint[GPIO_MASK_DATAIO_SIZE_UINT];
+	unsigned char config_io[GPIO_CONFIG_DATAIO_SIZE_BYTES];
+	unsigned char *counter_io = NULL;
+
+	if(cmd == GPIO_IOCTL_GET_COUNTERS)
+	{
+		counter_io = (unsigned char*) kzalloc(GPIO_COUNTER_DATAIO_SIZE_BYTES, GFP_KERNEL);
+		if(counter_io == NULL) return -ENOMEM;
+
+		gpio_get_counters(counter_io);
+
+		if(copy_to_user((void __user*) arg, counter_io, GPIO_COUNTER_DATAIO_SIZE_BYTES))
+		{
+			kfree(counter_io);
+			return -EFAULT;
+		}
+
+		kfree(counter_io);
+		return 0;
+	}
+
+	if(cmd == GPIO_IOCTL_APPLY_CONFIG)
+	{
+		if(copy_from_user(config_io, (void __user*) arg, GPIO_CONFIG_DATAIO_SIZE_BYTES)) return -EFAULT;
+		if(config_io[0] != GPIO_CMD_APPLY_CONFIG) return -EINVAL;
+
+		gpio_apply_config(config_io);
+
+		if(copy_to_user((void __user*) arg, config_io, GPIO_CONFIG_HEADER_SIZE_BYTES)) return -EFAULT;
+		return 0;
+	}
+
+	if(cmd == GPIO_IOCTL_RUN_MASK_CMD)
+	{
+		if(copy_from_user(puint, (void __user*) arg, GPIO_MASK_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+		gpio_run_mask_cmd(puint);
+
+		if(copy_to_user((void __user*) arg, puint, GPIO_MASK_DATAIO_SIZE_BYTES)) return -EFAULT;
+		return 0;
+	}
+
+	if(cmd != GPIO_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, GPIO_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == GPIO_CMD_RING_DOORBELL) gpio_ring_drain(ctx);
+
+	gpio_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, GPIO_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops gpio_proc_ops = {
+	.proc_open = gpio_mod_open,
+	.proc_release = gpio_mod_release,
 	.proc_read = gpio_mod_usrread,
-	.proc_write = gpio_mod_usrwrite
+	.proc_write = gpio_mod_usrwrite,
+	.proc_mmap = gpio_mod_usrmmap
+};
+
+static const struct file_operations gpio_fops = {
+	.owner = THIS_MODULE,
+	.open = gpio_mod_open,
+	.release = gpio_mod_release,
+	.read = gpio_mod_usrread,
+	.write = gpio_mod_usrwrite,
+	.mmap = gpio_mod_usrmmap,
+	.unlocked_ioctl = gpio_mod_ioctl
+};
+
+static struct miscdevice gpio_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "GPIO_Ctrl",
+	.fops = &gpio_fops,
+	.mode = 0666
+};
+
+int gpio_event_open(struct inode *inode, struct file *file)
+{
+	unsigned long lock_flags = 0;
+	gpio_event_ctx_t *ctx = (gpio_event_ctx_t*) kzalloc(sizeof(gpio_event_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->ring = (gpio_event_t*) vmalloc(GPIO_EVENT_RING_ENTRIES*sizeof(gpio_event_t));
+	if(ctx->ring == NULL)
+	{
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->read_mutex);
+	init_waitqueue_head(&ctx->wait);
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+	list_add_tail(&ctx->list, &gpio_event_ctx_list);
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int gpio_event_release(struct inode *inode, struct file *file)
+{
+	unsigned long lock_flags = 0;
+	gpio_event_ctx_t *ctx = (gpio_event_ctx_t*) file->private_data;
+
+	spin_lock_irqsave(&gpio_event_lock, lock_flags);
+	list_del(&ctx->list);
+	spin_unlock_irqrestore(&gpio_event_lock, lock_flags);
+
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t gpio_event_read(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	gpio_event_ctx_t *ctx = (gpio_event_ctx_t*) file->private_data;
+	size_t max_events = size/GPIO_EVENT_SIZE_BYTES;
+	size_t n_event = 0;
+	unsigned int head = 0;
+
+	if(max_events == 0) return -EINVAL;
+
+	if(mutex_lock_interruptible(&ctx->read_mutex)) return -ERESTARTSYS;
+
+	while(smp_load_acquire(&ctx->head) == ctx->tail)
+	{
+		mutex_unlock(&ctx->read_mutex);
+
+		if(file->f_flags & O_NONBLOCK) return -EAGAIN;
+		if(wait_event_interruptible(ctx->wait, (smp_load_acquire(&ctx->head) != ctx->tail))) return -ERESTARTSYS;
+		if(mutex_lock_interruptible(&ctx->read_mutex)) return -ERESTARTSYS;
+	}
+
+	head = smp_load_acquire(&ctx->head);
+
+	while((ctx->tail != head) && (n_event < max_events))
+	{
+		if(copy_to_user(&user[n_event*GPIO_EVENT_SIZE_BYTES], &ctx->ring[ctx->tail%GPIO_EVENT_RING_ENTRIES], GPIO_EVENT_SIZE_BYTES)) break;
+
+		smp_store_release(&ctx->tail, ctx->tail + 1);
+		n_event++;
+	}
+
+	mutex_unlock(&ctx->read_mutex);
+
+	if(n_event == 0) return -EFAULT;
+	return (n_event*GPIO_EVENT_SIZE_BYTES);
+}
+
+__poll_t gpio_event_poll(struct file *file, poll_table *wait)
+{
+	gpio_event_ctx_t *ctx = (gpio_event_ctx_t*) file->private_data;
+
+	poll_wait(file, &ctx->wait, wait);
+
+	if(smp_load_acquire(&ctx->head) != ctx->tail) return (EPOLLIN | EPOLLRDNORM);
+	return 0;
+}
+
+static const struct file_operations gpio_event_fops = {
+	.owner = THIS_MODULE,
+	.open = gpio_event_open,
+	.release = gpio_event_release,
+	.read = gpio_event_read,
+	.poll = gpio_event_poll,
+	.llseek = noop_llseek
+};
+
+static struct miscdevice gpio_event_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "GPIO_Event",
+	.fops = &gpio_event_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -471,6 +1815,15 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
+	gpio_shadow_load();
+
+	gpio_systimer_mapping = (unsigned int*) ioremap(SYSTIMER_BASE_ADDR, SYSTIMER_MAPPING_SIZE_BYTES);
+	if(gpio_systimer_mapping == NULL)
+	{
+		printk("GPIO: Error mapping SYSTIMER\n");
+		return -1;
+	}
+
 	gpio_proc = proc_create("GPIO_Ctrl", 0x1B6, NULL, &gpio_proc_ops);
 	if(gpio_proc == NULL)
 	{
@@ -478,16 +1831,45 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	gpio_data_io = vmalloc(GPIO_DATAIO_SIZE_BYTES);
+	if(misc_register(&gpio_misc) < 0)
+	{
+		printk("GPIO: Error registering device file\n");
+		proc_remove(gpio_proc);
+		return -1;
+	}
+
+	if(misc_register(&gpio_event_misc) < 0)
+	{
+		printk("GPIO: Error registering event device file\n");
+		misc_deregister(&gpio_misc);
+		proc_remove(gpio_proc);
+		return -1;
+	}
+
+	gpio_filter_init();
+	if(!gpio_event_irq_init()) printk("GPIO: Error finding %s GPIO chip. Edge events disabled\n", GPIO_EVENT_CHIP_LABEL);
+
+	if(ring_poll_us)
+	{
+		gpio_ring_thread = kthread_run(gpio_ring_poll_thread, NULL, "GPIO_Ctrl_ring");
+		if(IS_ERR(gpio_ring_thread)) gpio_ring_thread = NULL;
+	}
+
 	printk("GPIO Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
-	iounmap(gpio_mapping);
+	//Interfaces and the ring thread go first, then IRQs, so nothing can touch the registers once they are unmapped.
+	misc_deregister(&gpio_event_misc);
+	misc_deregister(&gpio_misc);
 	proc_remove(gpio_proc);
-	vfree(gpio_data_io);
+	if(gpio_ring_thread != NULL) kthread_stop(gpio_ring_thread);
+	gpio_event_free_irqs();
+	gpio_filter_deinit();
+	iounmap(gpio_systimer_mapping);
+	iounmap(gpio_mapping);
 	printk("GPIO Control Driver Disabled\n");
 	return;
 }
@@ -0,0 +1,492 @@
+#include "GPIO_Waveform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "DMA_Ctrl.h"
+
+/*
+ * Each step is compiled to up to 3 kinds of control blocks:
+ *
+ * SET: writes one word (set_mask) to GPSET0. Skipped if set_mask is 0.
+ * CLEAR: writes one word (clear_mask) to GPCLR0. Skipped if clear_mask is 0.
+ * DELAY: writes (duration_us/tick_us) zero words to the pacing FIFO, one word per DREQ. Split in several control blocks if too long.
+ *
+ * Control blocks and their data words are kept in coherent buffers from "dma_buffer_alloc()" (page aligned heap memory in simulation).
+ * There are two buffers, so a new waveform can be compiled while the other one plays.
+ * The last control block points back to the first one (looping waveform), to the first control block of the next waveform (swap) or to 0 (end).
+ */
+
+#define GPIO_WAVE_PAGE_SIZE 4096
+
+#define GPIO_WAVE_GPSET0_BUS_ADDR 0x7E20001C
+#define GPIO_WAVE_GPCLR0_BUS_ADDR 0x7E200028
+#define GPIO_WAVE_PWM_FIFO_BUS_ADDR 0x7E20C018
+#define GPIO_WAVE_PCM_FIFO_BUS_ADDR 0x7E203004
+
+#define GPIO_WAVE_MAX_TICKS_PER_CTRLBLOCK 16383
+
+#define GPIO_WAVE_SIM_BUFFER0_BUS_ADDR 0x10000000
+#define GPIO_WAVE_SIM_BUFFER1_BUS_ADDR 0x20000000
+
+#define GPIO_WAVE_MAX_PAUSE_POLLS 1000
+
+typedef struct {
+	dma_buffer_t buffer;
+	dma_ctrlblock_t *ctrlblock;
+	uint32_t n_ctrlblock;
+	uint32_t sim_bus_addr;
+} gpio_wave_buffer_t;
+
+gpio_wave_buffer_t gpio_wave_buffer[2];
+bool gpio_wave_active = false;
+bool gpio_wave_simulated = false;
+bool gpio_wave_running = false;
+uint8_t gpio_wave_dma_ctrl = 0;
+uint8_t gpio_wave_permap = 0;
+uint32_t gpio_wave_fifo_bus_addr = 0;
+uint32_t gpio_wave_tick_us = 1;
+
+//Buffer the chain starts at, and buffer the chain ends at. Same buffer unless a swap is pending.
+int8_t gpio_wave_first = -1;
+int8_t gpio_wave_last = -1;
+
+//Simulated channel registers: loaded control block (CONBLK_AD) and its next control block as copied when it was loaded (NEXTCONBK).
+uint32_t gpio_wave_sim_ctrlblock_addr = 0;
+uint32_t gpio_wave_sim_next_ctrlblock_addr = 0;
+uint32_t gpio_wave_sim_time_us = 0;
+uint32_t gpio_wave_sim_levels = 0;
+
+void gpio_wave_buffer_free(gpio_wave_buffer_t *p_buffer)
+{
+	if(gpio_wave_simulated)
+	{
+		if(p_buffer->buffer.virt != NULL) free(p_buffer->buffer.virt);
+		memset(&p_buffer->buffer, 0, sizeof(dma_buffer_t));
+	}
+	else dma_buffer_free(&p_buffer->buffer);
+
+	p_buffer->ctrlblock = NULL;
+	p_buffer->n_ctrlblock = 0;
+	return;
+}
+
+bool gpio_wave_buffer_alloc(gpio_wave_buffer_t *p_buffer, uint32_t size)
+{
+	size = ((size + GPIO_WAVE_PAGE_SIZE - 1)/GPIO_WAVE_PAGE_SIZE)*GPIO_WAVE_PAGE_SIZE;
+	if(size <= p_buffer->buffer.size)
+	{
+		memset(p_buffer->buffer.virt, 0, p_buffer->buffer.size);
+		return true;
+	}
+
+	gpio_wave_buffer_free(p_buffer);
+
+	if(!gpio_wave_simulated) return dma_buffer_alloc(&p_buffer->buffer, size);
+
+	if(posix_memalign(&p_buffer->buffer.virt, GPIO_WAVE_PAGE_SIZE, size))
+	{
+		p_buffer->buffer.virt = NULL;
+		return false;
+	}
+
+	memset(p_buffer->buffer.virt, 0, size);
+	p_buffer->buffer.bus_addr = p_buffer->sim_bus_addr;
+	p_buffer->buffer.size = size;
+	return true;
+}
+
+uint32_t gpio_wave_get_bus_addr(gpio_wave_buffer_t *p_buffer, void *p)
+{
+	return dma_buffer_get_bus_addr(&p_buffer->buffer, p);
+}
+
+void *gpio_wave_sim_get_virt(uint32_t bus_addr)
+{
+	uint8_t n_buffer = 0;
+	while(n_buffer < 2)
+	{
+		if((bus_addr >= gpio_wave_buffer[n_buffer].buffer.bus_addr) && (bus_addr < (gpio_wave_buffer[n_buffer].buffer.bus_addr + gpio_wave_buffer[n_buffer].buffer.size)))
+			return (((uint8_t*) gpio_wave_buffer[n_buffer].buffer.virt) + (bus_addr - gpio_wave_buffer[n_buffer].buffer.bus_addr));
+
+		n_buffer++;
+	}
+
+	return NULL;
+}
+
+//Loads a control block in the simulated channel, as the DMA controller does: NEXTCONBK is copied from the control block.
+void gpio_wave_sim_load_ctrlblock(uint32_t ctrlblock_addr)
+{
+	dma_ctrlblock_t *p_ctrlblock = NULL;
+
+	gpio_wave_sim_ctrlblock_addr = 0;
+	gpio_wave_sim_next_ctrlblock_addr = 0;
+
+	if(ctrlblock_addr == 0) return;
+
+	p_ctrlblock = (dma_ctrlblock_t*) gpio_wave_sim_get_virt(ctrlblock_addr);
+	if(p_ctrlblock == NULL) return;
+
+	gpio_wave_sim_ctrlblock_addr = ctrlblock_addr;
+	gpio_wave_sim_next_ctrlblock_addr = p_ctrlblock->next_ctrlblock_addr;
+	return;
+}
+
+//Returns the control block loaded in the channel (0 once the chain has ended).
+uint32_t gpio_wave_get_ctrlblock_addr(void)
+{
+	if(gpio_wave_simulated) return gpio_wave_sim_ctrlblock_addr;
+
+	return dma_get_ctrlblock_addr_phys(gpio_wave_dma_ctrl);
+}
+
+//Pauses the channel, so the loaded control block can't change. Returns the loaded control block (0 once the chain has ended).
+uint32_t gpio_wave_pause_channel(void)
+{
+	uint32_t n_poll = 0;
+
+	if(gpio_wave_simulated) return gpio_wave_sim_ctrlblock_addr;
+
+	dma_set_transfer_active(gpio_wave_dma_ctrl, false);
+	while(!dma_is_paused(gpio_wave_dma_ctrl) && (n_poll < GPIO_WAVE_MAX_PAUSE_POLLS)) n_poll++;
+
+	return dma_get_ctrlblock_addr_phys(gpio_wave_dma_ctrl);
+}
+
+void gpio_wave_resume_channel(void)
+{
+	if(gpio_wave_simulated) return;
+
+	dma_set_transfer_active(gpio_wave_dma_ctrl, true);
+	return;
+}
+
+//Changes the control block that follows the loaded one. The channel must be paused.
+void gpio_wave_set_next_ctrlblock_addr(uint32_t ctrlblock_addr)
+{
+	if(gpio_wave_simulated) gpio_wave_sim_next_ctrlblock_addr = ctrlblock_addr;
+	else dma_set_channel_next_ctrlblock_addr_phys(gpio_wave_dma_ctrl, ctrlblock_addr);
+
+	return;
+}
+
+//Returns true if the DMA channel is currently executing a control block of this buffer.
+bool gpio_wave_buffer_is_in_use(gpio_wave_buffer_t *p_buffer)
+{
+	uint32_t ctrlblock_addr = 0;
+
+	if(!gpio_wave_running || (p_buffer->buffer.virt == NULL)) return false;
+
+	ctrlblock_addr = gpio_wave_get_ctrlblock_addr();
+	return ((ctrlblock_addr >= p_buffer->buffer.bus_addr) && (ctrlblock_addr < (p_buffer->buffer.bus_addr + p_buffer->buffer.size)));
+}
+
+uint32_t gpio_wave_get_ticks(uint32_t duration_us)
+{
+	return ((duration_us + gpio_wave_tick_us/2)/gpio_wave_tick_us);
+}
+
+void gpio_wave_init_ctrlblock(gpio_wave_buffer_t *p_buffer, dma_ctrlblock_t *p_ctrlblock, uint32_t *p_src, uint32_t dst_addr, uint32_t n_words, bool paced)
+{
+	dma_reset_ctrlblock(p_ctrlblock);
+	dma_disable_wide_bursts(p_ctrlblock, true);
+	dma_enable_wait_write_response(p_ctrlblock, true);
+
+	if(paced)
+	{
+		dma_set_permap(p_ctrlblock, gpio_wave_permap);
+		dma_set_dreq_calls_dst_writes(p_ctrlblock, true);
+	}
+
+	dma_set_src_addr_phys(p_ctrlblock, gpio_wave_get_bus_addr(p_buffer, p_src));
+	dma_set_dst_addr_phys(p_ctrlblock, dst_addr);
+	dma_set_transfer_length_bytes(p_ctrlblock, (n_words*sizeof(uint32_t)));
+	return;
+}
+
+bool gpio_wave_compile(gpio_wave_buffer_t *p_buffer, const gpio_wave_step_t *steps, uint16_t n_steps, bool loop)
+{
+	dma_ctrlblock_t *p_ctrlblock = NULL;
+	uint32_t *data = NULL;
+	uint32_t n_ctrlblock = 0;
+	uint32_t n_data = 1;
+	uint32_t n_ticks = 0;
+	uint32_t n_chunk = 0;
+	uint16_t n_step = 0;
+
+	while(n_step < n_steps)
+	{
+		if(steps[n_step].set_mask) n_ctrlblock++;
+		if(steps[n_step].clear_mask) n_ctrlblock++;
+		n_ctrlblock += ((gpio_wave_get_ticks(steps[n_step].duration_us) + GPIO_WAVE_MAX_TICKS_PER_CTRLBLOCK - 1)/GPIO_WAVE_MAX_TICKS_PER_CTRLBLOCK);
+		n_step++;
+	}
+
+	if(n_ctrlblock == 0) return false;
+
+	if(!gpio_wave_buffer_alloc(p_buffer, (n_ctrlblock*sizeof(dma_ctrlblock_t) + (2*n_steps + 1)*sizeof(uint32_t)))) return false;
+
+	p_buffer->ctrlblock = (dma_ctrlblock_t*) p_buffer->buffer.virt;
+	p_buffer->n_ctrlblock = n_ctrlblock;
+
+	//data[0] is the zero word written to the pacing FIFO.
+	data = (uint32_t*) &p_buffer->ctrlblock[n_ctrlblock];
+	data[0] = 0;
+
+	p_ctrlblock = p_buffer->ctrlblock;
+	n_step = 0;
+	while(n_step < n_steps)
+	{
+		if(steps[n_step].set_mask)
+		{
+			data[n_data] = steps[n_step].set_mask;
+			gpio_wave_init_ctrlblock(p_buffer, p_ctrlblock, &data[n_data], GPIO_WAVE_GPSET0_BUS_ADDR, 1, false);
+			n_data++;
+			p_ctrlblock++;
+		}
+
+		if(steps[n_step].clear_mask)
+		{
+			data[n_data] = steps[n_step].clear_mask;
+			gpio_wave_init_ctrlblock(p_buffer, p_ctrlblock, &data[n_data], GPIO_WAVE_GPCLR0_BUS_ADDR, 1, false);
+			n_data++;
+			p_ctrlblock++;
+		}
+
+		n_ticks = gpio_wave_get_ticks(steps[n_step].duration_us);
+		while(n_ticks > 0)
+		{
+			n_chunk = n_ticks;
+			if(n_chunk > GPIO_WAVE_MAX_TICKS_PER_CTRLBLOCK) n_chunk = GPIO_WAVE_MAX_TICKS_PER_CTRLBLOCK;
+
+			gpio_wave_init_ctrlblock(p_buffer, p_ctrlblock, &data[0], gpio_wave_fifo_bus_addr, n_chunk, true);
+			n_ticks -= n_chunk;
+			p_ctrlblock++;
+		}
+
+		n_step++;
+	}
+
+	n_ctrlblock = 0;
+	while(n_ctrlblock < (p_buffer->n_ctrlblock - 1))
+	{
+		dma_set_next_ctrlblock_addr_phys(&p_buffer->ctrlblock[n_ctrlblock], gpio_wave_get_bus_addr(p_buffer, &p_buffer->ctrlblock[n_ctrlblock + 1]));
+		n_ctrlblock++;
+	}
+
+	if(loop) dma_set_next_ctrlblock_addr_phys(&p_buffer->ctrlblock[n_ctrlblock], gpio_wave_get_bus_addr(p_buffer, &p_buffer->ctrlblock[0]));
+	else dma_set_next_ctrlblock_addr_phys(&p_buffer->ctrlblock[n_ctrlblock], 0);
+
+	__sync_synchronize();
+	return true;
+}
+
+void gpio_wave_start_channel(int8_t n_buffer)
+{
+	uint32_t ctrlblock_addr = gpio_wave_get_bus_addr(&gpio_wave_buffer[n_buffer], gpio_wave_buffer[n_buffer].ctrlblock);
+
+	if(gpio_wave_simulated)
+	{
+		gpio_wave_sim_load_ctrlblock(ctrlblock_addr);
+		return;
+	}
+
+	dma_enable_ctrl(gpio_wave_dma_ctrl, true);
+	dma_reset(gpio_wave_dma_ctrl);
+	dma_set_ctrlblock_addr_phys(gpio_wave_dma_ctrl, ctrlblock_addr);
+	dma_set_transfer_active(gpio_wave_dma_ctrl, true);
+	return;
+}
+
+bool gpio_wave_init(uint8_t dma_ctrl, uint8_t pacing, uint32_t tick_us, bool simulate)
+{
+	if(gpio_wave_active) gpio_wave_deinit();
+
+	if(dma_ctrl > DMA_LITE_CH7) return false;
+	if(tick_us == 0) return false;
+
+	switch(pacing)
+	{
+		case GPIO_WAVE_PACING_PWM:
+			gpio_wave_permap = DMA_PERMAP_PWM;
+			gpio_wave_fifo_bus_addr = GPIO_WAVE_PWM_FIFO_BUS_ADDR;
+			break;
+
+		case GPIO_WAVE_PACING_PCM:
+			gpio_wave_permap = DMA_PERMAP_PCM_TX;
+			gpio_wave_fifo_bus_addr = GPIO_WAVE_PCM_FIFO_BUS_ADDR;
+			break;
+
+		default:
+			return false;
+	}
+
+	if(!simulate) if(!dma_is_active()) if(!dma_init()) return false;
+
+	memset(gpio_wave_buffer, 0, sizeof(gpio_wave_buffer));
+	gpio_wave_buffer[0].sim_bus_addr = GPIO_WAVE_SIM_BUFFER0_BUS_ADDR;
+	gpio_wave_buffer[1].sim_bus_addr = GPIO_WAVE_SIM_BUFFER1_BUS_ADDR;
+
+	gpio_wave_dma_ctrl = dma_ctrl;
+	gpio_wave_tick_us = tick_us;
+	gpio_wave_simulated = simulate;
+	gpio_wave_running = false;
+	gpio_wave_first = -1;
+	gpio_wave_last = -1;
+	gpio_wave_active = true;
+	return true;
+}
+
+void gpio_wave_deinit(void)
+{
+	if(!gpio_wave_active) return;
+
+	gpio_wave_stop();
+	gpio_wave_buffer_free(&gpio_wave_buffer[0]);
+	gpio_wave_buffer_free(&gpio_wave_buffer[1]);
+	gpio_wave_active = false;
+	return;
+}
+
+bool gpio_wave_load(const gpio_wave_step_t *steps, uint16_t n_steps, bool loop)
+{
+	int8_t n_target = 0;
+	gpio_wave_buffer_t *p_last = NULL;
+	dma_ctrlblock_t *p_tail = NULL;
+	uint32_t head_addr = 0;
+	uint32_t ctrlblock_addr = 0;
+
+	if(!gpio_wave_active) return false;
+	if((steps == NULL) || (n_steps == 0) || (n_steps > GPIO_WAVE_MAX_STEPS)) return false;
+
+	if(gpio_wave_last == 0) n_target = 1;
+
+	if(!gpio_wave_running)
+	{
+		if(!gpio_wave_compile(&gpio_wave_buffer[n_target], steps, n_steps, loop)) return false;
+
+		gpio_wave_first = n_target;
+		gpio_wave_last = n_target;
+		return true;
+	}
+
+	//The target buffer may still hold the waveform played before the running one.
+	if(gpio_wave_first == n_target)
+	{
+		if(gpio_wave_buffer_is_in_use(&gpio_wave_buffer[n_target])) return false;
+		gpio_wave_first = gpio_wave_last;
+	}
+
+	if(!gpio_wave_compile(&gpio_wave_buffer[n_target], steps, n_steps, loop)) return false;
+
+	p_last = &gpio_wave_buffer[gpio_wave_last];
+	p_tail = &p_last->ctrlblock[p_last->n_ctrlblock - 1];
+	head_addr = gpio_wave_get_bus_addr(&gpio_wave_buffer[n_target], gpio_wave_buffer[n_target].ctrlblock);
+	dma_set_next_ctrlblock_addr_phys(p_tail, head_addr);
+	__sync_synchronize();
+
+	gpio_wave_last = n_target;
+
+	//The channel copies NEXTCONBK when it loads a control block, so the relink above is too late if the tail is already loaded: patch the register too.
+	ctrlblock_addr = gpio_wave_pause_channel();
+
+	//A non looping waveform may have ended before it was linked to the new one.
+	if(ctrlblock_addr == 0)
+	{
+		gpio_wave_first = n_target;
+		gpio_wave_start_channel(n_target);
+		return true;
+	}
+
+	if(ctrlblock_addr == gpio_wave_get_bus_addr(p_last, p_tail)) gpio_wave_set_next_ctrlblock_addr(head_addr);
+
+	gpio_wave_resume_channel();
+	return true;
+}
+
+bool gpio_wave_start(void)
+{
+	if(!gpio_wave_active) return false;
+	if(gpio_wave_running) return true;
+	if(gpio_wave_last < 0) return false;
+
+	gpio_wave_first = gpio_wave_last;
+	gpio_wave_sim_time_us = 0;
+	gpio_wave_sim_levels = 0;
+	gpio_wave_start_channel(gpio_wave_first);
+	gpio_wave_running = true;
+	return true;
+}
+
+void gpio_wave_stop(void)
+{
+	if(!gpio_wave_running) return;
+
+	if(gpio_wave_simulated) gpio_wave_sim_load_ctrlblock(0);
+	else
+	{
+		dma_set_transfer_active(gpio_wave_dma_ctrl, false);
+		dma_abort(gpio_wave_dma_ctrl);
+		dma_reset(gpio_wave_dma_ctrl);
+	}
+
+	gpio_wave_first = gpio_wave_last;
+	gpio_wave_running = false;
+	return;
+}
+
+bool gpio_wave_is_running(void)
+{
+	if(!gpio_wave_running) return false;
+	if(gpio_wave_simulated) return (gpio_wave_sim_ctrlblock_addr != 0);
+
+	return dma_get_transfer_active(gpio_wave_dma_ctrl);
+}
+
+uint32_t gpio_wave_simulate(gpio_wave_trace_t *trace, uint32_t max_trace, uint32_t max_time_us)
+{
+	dma_ctrlblock_t *p_ctrlblock = NULL;
+	uint32_t *p_src = NULL;
+	uint32_t start_us = 0;
+	uint32_t n_trace = 0;
+
+	if(!gpio_wave_active || !gpio_wave_simulated || !gpio_wave_running) return 0;
+	if(trace == NULL) return 0;
+
+	start_us = gpio_wave_sim_time_us;
+
+	while((gpio_wave_sim_ctrlblock_addr != 0) && (n_trace < max_trace) && ((gpio_wave_sim_time_us - start_us) <= max_time_us))
+	{
+		p_ctrlblock = (dma_ctrlblock_t*) gpio_wave_sim_get_virt(gpio_wave_sim_ctrlblock_addr);
+		if(p_ctrlblock == NULL) break;
+
+		p_src = (uint32_t*) gpio_wave_sim_get_virt(p_ctrlblock->src_addr);
+		if(p_src == NULL) break;
+
+		if(p_ctrlblock->dst_addr == GPIO_WAVE_GPSET0_BUS_ADDR)
+		{
+			gpio_wave_sim_levels |= p_src[0];
+			trace[n_trace].time_us = gpio_wave_sim_time_us;
+			trace[n_trace].levels = gpio_wave_sim_levels;
+			n_trace++;
+		}
+		else if(p_ctrlblock->dst_addr == GPIO_WAVE_GPCLR0_BUS_ADDR)
+		{
+			gpio_wave_sim_levels &= ~p_src[0];
+			trace[n_trace].time_us = gpio_wave_sim_time_us;
+			trace[n_trace].levels = gpio_wave_sim_levels;
+			n_trace++;
+		}
+		else if(p_ctrlblock->transfer_info & (1 << 6))
+		{
+			gpio_wave_sim_time_us += ((p_ctrlblock->transfer_length & 0xFFFF)/sizeof(uint32_t))*gpio_wave_tick_us;
+		}
+
+		//The next control block comes from NEXTCONBK, not from the control block in memory.
+		gpio_wave_sim_load_ctrlblock(gpio_wave_sim_next_ctrlblock_addr);
+	}
+
+	return n_trace;
+}
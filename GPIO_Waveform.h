@@ -0,0 +1,56 @@
+//DMA paced GPIO waveform engine
+
+#ifndef GPIO_WAVEFORM_H
+#define GPIO_WAVEFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPIO_WAVE_PACING_PWM 0
+#define GPIO_WAVE_PACING_PCM 1
+
+#define GPIO_WAVE_MAX_STEPS 4096
+
+//One waveform step. Pins in "set_mask" are set, then pins in "clear_mask" are cleared (pins 0 to 31), then the output is held for "duration_us".
+typedef struct {
+	uint32_t set_mask;
+	uint32_t clear_mask;
+	uint32_t duration_us;
+} gpio_wave_step_t;
+
+//One simulated GPIO write. "levels" is the output state of pins 0 to 31 after the write.
+typedef struct {
+	uint32_t time_us;
+	uint32_t levels;
+} gpio_wave_trace_t;
+
+//Initializes the waveform engine.
+//"dma_ctrl" is the DMA channel used to play waveforms. "pacing" is GPIO_WAVE_PACING_PWM or GPIO_WAVE_PACING_PCM.
+//Delays are made of DREQ paced writes to the PWM (or PCM) FIFO. That peripheral must already be configured to consume one FIFO word every "tick_us" microseconds, with DMA requests enabled.
+//If "simulate" is true, no driver is used at all. Waveforms are only compiled, and can be played back with "gpio_wave_start()" and "gpio_wave_simulate()".
+//Returns true if initialization is successful.
+bool gpio_wave_init(uint8_t dma_ctrl, uint8_t pacing, uint32_t tick_us, bool simulate);
+//Stops the waveform (if running) and releases all waveform memory.
+void gpio_wave_deinit(void);
+
+//Compiles "n_steps" steps into a DMA control block chain. Durations are rounded to the nearest multiple of "tick_us".
+//If "loop" is true, the waveform repeats until another waveform is loaded or the engine is stopped. Else the DMA channel stops at the end of the waveform.
+//If a waveform is running, the new one starts seamlessly at the end of the current pass (double buffered).
+//The channel is paused for a few register accesses while the chains are linked, so the running step may be stretched by that time if the pacing FIFO runs dry.
+//Returns false if the waveform is invalid, or if the waveform loaded before the running one is still being played (try again later).
+bool gpio_wave_load(const gpio_wave_step_t *steps, uint16_t n_steps, bool loop);
+//Starts playing the last loaded waveform.
+bool gpio_wave_start(void);
+//Stops the DMA channel immediately.
+void gpio_wave_stop(void);
+//Returns true if the DMA channel is playing a waveform.
+bool gpio_wave_is_running(void);
+
+//Runs the simulated DMA channel, started by "gpio_wave_start()", through the compiled control block chains. Each call continues where the previous one stopped.
+//Like the DMA controller, the channel copies the next control block address when it loads a control block, so loading a waveform between calls behaves as on hardware.
+//GPIO writes are considered instantaneous. Each paced FIFO write takes "tick_us". Trace times are counted from "gpio_wave_start()".
+//Stops after "max_time_us" more microseconds, after "max_trace" GPIO writes, or at the end of a non looping waveform.
+//Returns the number of entries written to "trace".
+uint32_t gpio_wave_simulate(gpio_wave_trace_t *trace, uint32_t max_trace, uint32_t max_time_us);
+
+#endif
@@ -3,8 +3,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #include "GPIO_Ctrl.h"
 
@@ -16,6 +19,7 @@ Else, application will wait a specific time (defined in I2C_CTRL_WAIT_TIME_US) i
 #define I2C_CTRL_WAIT_KERNEL_RESPONSE
 
 #define I2C_CTRL_PROC_FILE_DIR "/proc/I2C_Ctrl"
+#define I2C_CTRL_DEV_FILE_DIR "/dev/I2C_Ctrl"
 #define I2C_CTRL_WAIT_TIME_US 1
 
 #define I2C_DATAIO_SIZE_BYTES 4
@@ -61,10 +65,40 @@ Else, application will wait a specific time (defined in I2C_CTRL_WAIT_TIME_US) i
 #define I2C_CMD_SET_STD_CLKDIV 38
 #define I2C_CMD_SET_STD_DATADELAY 39
 
+#define I2C_CMD_RING_DOORBELL 0xFE
 #define I2C_CMD_KERNEL_RESPONSE 0xFF
 
+#define I2C_IOCTL_MAGIC 'i'
+#define I2C_IOCTL_RUN_CMD _IOWR(I2C_IOCTL_MAGIC, 0, uint8_t[I2C_DATAIO_SIZE_BYTES])
+
+#define I2C_RING_SIZE_BYTES 4096
+#define I2C_RING_HEADER_SIZE_BYTES 16
+#define I2C_RING_ENTRY_SIZE_BYTES 8
+#define I2C_RING_ENTRIES 256
+
+#define I2C_RING_SQ_TAIL_UINTP_POS 0
+#define I2C_RING_SQ_HEAD_UINTP_POS 1
+#define I2C_RING_FLAGS_UINTP_POS 2
+
+#define I2C_RING_FLAG_KERNEL_POLL 0x1
+
+#define I2C_XFER_HEADER_SIZE_BYTES 12
+#define I2C_XFER_DATAIO_SIZE_BYTES (I2C_XFER_HEADER_SIZE_BYTES + I2C_XFER_MAX_DATA_BYTES)
+
+#define I2C_XFER_CTRL_BYTEP_POS 0
+#define I2C_XFER_ADDR_BYTEP_POS 1
+#define I2C_XFER_STATUS_BYTEP_POS 3
+#define I2C_XFER_WRITE_LENGTH_USHORTP_POS 2
+#define I2C_XFER_READ_LENGTH_USHORTP_POS 3
+#define I2C_XFER_WRITE_DONE_USHORTP_POS 4
+#define I2C_XFER_READ_DONE_USHORTP_POS 5
+
+#define I2C_IOCTL_XFER _IOWR(I2C_IOCTL_MAGIC, 1, uint8_t[I2C_XFER_DATAIO_SIZE_BYTES])
+
 int i2c_proc_fd = -1;
+int i2c_dev_fd = -1;
 void *i2c_data_io = NULL;
+void *i2c_ring = NULL;
 
 void i2c_ctrl_wait(void)
 {
@@ -87,6 +121,9 @@ bool i2c_init(void)
 	i2c_proc_fd = open(I2C_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(i2c_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	i2c_dev_fd = open(I2C_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	i2c_data_io = malloc(I2C_DATAIO_SIZE_BYTES);
 	return true;
 }
@@ -149,27 +186,98 @@ void i2c_ctrl_endpoint_map_to_gpio_pinmode(uint8_t i2c_ctrl, uint8_t endpoint, u
 }
 
 #ifdef I2C_CTRL_WAIT_KERNEL_RESPONSE
-void i2c_call_kernel(void)
+void i2c_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) i2c_data_io;
-	write(i2c_proc_fd, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(i2c_proc_fd, data_io, I2C_DATAIO_SIZE_BYTES);
 
 	do{
-		read(i2c_proc_fd, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
+		read(i2c_proc_fd, data_io, I2C_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != I2C_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void i2c_call_kernel(void)
+void i2c_call_kernel_proc(void *data_io)
 {
-	write(i2c_proc_fd, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
+	write(i2c_proc_fd, data_io, I2C_DATAIO_SIZE_BYTES);
 	i2c_ctrl_wait();
-	read(i2c_proc_fd, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
+	read(i2c_proc_fd, data_io, I2C_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void i2c_call_kernel_ioctl(void *data_io)
+{
+	ioctl(i2c_dev_fd, I2C_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void i2c_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) i2c_ring;
+	uint8_t *ring_entries = ((uint8_t*) i2c_ring) + I2C_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[I2C_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%I2C_RING_ENTRIES)*I2C_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[I2C_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[I2C_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[I2C_RING_FLAGS_UINTP_POS] & I2C_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, I2C_DATAIO_SIZE_BYTES);
+		doorbell[0] = I2C_CMD_RING_DOORBELL;
+		if(i2c_dev_fd >= 0) i2c_call_kernel_ioctl(doorbell);
+		else i2c_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[I2C_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(i2c_data_io, pentry, I2C_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void i2c_call_kernel(void)
+{
+	if(i2c_ring != NULL) i2c_call_kernel_ring();
+	else if(i2c_dev_fd >= 0) i2c_call_kernel_ioctl(i2c_data_io);
+	else i2c_call_kernel_proc(i2c_data_io);
+
+	return;
+}
+
+bool i2c_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(i2c_ring != NULL) munmap(i2c_ring, I2C_RING_SIZE_BYTES);
+		i2c_ring = NULL;
+		return true;
+	}
+
+	if(i2c_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (i2c_dev_fd >= 0) ? i2c_dev_fd : i2c_proc_fd;
+	void *p_ring = mmap(NULL, I2C_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	i2c_ring = p_ring;
+	return true;
+}
+
+bool i2c_ring_is_enabled(void)
+{
+	return (i2c_ring != NULL);
+}
+
+bool i2c_ioctl_is_enabled(void)
+{
+	return (i2c_dev_fd >= 0);
+}
+
 void i2c_init_gpio_default(uint8_t i2c_ctrl, uint8_t endpoint, bool enable_pullup)
 {
 	if((i2c_ctrl == I2C_CTRL2) && (endpoint != I2C_ENDPOINT0)) return;
@@ -178,21 +286,29 @@ void i2c_init_gpio_default(uint8_t i2c_ctrl, uint8_t endpoint, bool enable_pullu
 	uint8_t sda = 0;
 	uint8_t scl = 0;
 	uint8_t pinmode = 0;
+	gpio_pin_config_t config[2];
 
 	i2c_ctrl_endpoint_map_to_gpio_pinmode(i2c_ctrl, endpoint, &sda, &scl, &pinmode);
 
-	gpio_reset_pin(sda);
-	gpio_reset_pin(scl);
-
-	gpio_set_pinmode(sda, pinmode);
-	gpio_set_pinmode(scl, pinmode);
+	config[0].pin = sda;
+	config[1].pin = scl;
+	config[0].pinmode = pinmode;
+	config[1].pinmode = pinmode;
+	config[0].detect = 0;
+	config[1].detect = 0;
 
 	if(enable_pullup)
 	{
-		gpio_set_pudctrl(sda, GPIO_PUDCTRL_PULLUP);
-		gpio_set_pudctrl(scl, GPIO_PUDCTRL_PULLUP);
+		config[0].pudctrl = GPIO_PUDCTRL_PULLUP;
+		config[1].pudctrl = GPIO_PUDCTRL_PULLUP;
+	}
+	else
+	{
+		config[0].pudctrl = GPIO_PUDCTRL_NOPULL;
+		config[1].pudctrl = GPIO_PUDCTRL_NOPULL;
 	}
 
+	gpio_apply_config(config, 2);
 	return;
 }
 
@@ -203,11 +319,20 @@ void i2c_deinit_gpio_default(uint8_t i2c_ctrl, uint8_t endpoint)
 
 	uint8_t sda = 0;
 	uint8_t scl = 0;
+	gpio_pin_config_t config[2];
 
 	i2c_ctrl_endpoint_map_to_gpio_pinmode(i2c_ctrl, endpoint, &sda, &scl, NULL);
 
-	gpio_reset_pin(sda);
-	gpio_reset_pin(scl);
+	config[0].pin = sda;
+	config[1].pin = scl;
+	config[0].pinmode = GPIO_PINMODE_INPUT;
+	config[1].pinmode = GPIO_PINMODE_INPUT;
+	config[0].pudctrl = GPIO_PUDCTRL_NOPULL;
+	config[1].pudctrl = GPIO_PUDCTRL_NOPULL;
+	config[0].detect = 0;
+	config[1].detect = 0;
+
+	gpio_apply_config(config, 2);
 	return;
 }
 
@@ -677,4 +802,47 @@ void i2c_set_std_data_delay(uint8_t i2c_ctrl, bool use_400kbps)
 	return;
 }
 
+int i2c_write_read(uint8_t i2c_ctrl, uint8_t slave_addr, const uint8_t *write_buf, uint16_t write_length, uint8_t *read_buf, uint16_t read_length)
+{
+	if(i2c_dev_fd < 0) return -1;
+	if((write_length && (write_buf == NULL)) || (read_length && (read_buf == NULL))) return -1;
+	if((write_length == 0) && (read_length == 0)) return -1;
+	if((((uint32_t) write_length) + ((uint32_t) read_length)) > I2C_XFER_MAX_DATA_BYTES) return -1;
 
+	uint32_t xfer_io[I2C_XFER_DATAIO_SIZE_BYTES/4];
+	uint8_t *xfer = (uint8_t*) xfer_io;
+	uint16_t *pushort = (uint16_t*) xfer_io;
+
+	memset(xfer, 0, I2C_XFER_HEADER_SIZE_BYTES);
+	xfer[I2C_XFER_CTRL_BYTEP_POS] = i2c_ctrl;
+	xfer[I2C_XFER_ADDR_BYTEP_POS] = slave_addr;
+	pushort[I2C_XFER_WRITE_LENGTH_USHORTP_POS] = write_length;
+	pushort[I2C_XFER_READ_LENGTH_USHORTP_POS] = read_length;
+	if(write_length) memcpy(&xfer[I2C_XFER_HEADER_SIZE_BYTES], write_buf, write_length);
+
+	if(ioctl(i2c_dev_fd, I2C_IOCTL_XFER, xfer_io) < 0) return -1;
+
+	if(read_length) memcpy(read_buf, &xfer[I2C_XFER_HEADER_SIZE_BYTES + write_length], pushort[I2C_XFER_READ_DONE_USHORTP_POS]);
+	return xfer[I2C_XFER_STATUS_BYTEP_POS];
+}
+
+int i2c_write(uint8_t i2c_ctrl, uint8_t slave_addr, const uint8_t *buf, uint16_t length)
+{
+	if((buf == NULL) || (length == 0)) return -1;
+
+	return i2c_write_read(i2c_ctrl, slave_addr, buf, length, NULL, 0);
+}
+
+int i2c_read(uint8_t i2c_ctrl, uint8_t slave_addr, uint8_t *buf, uint16_t length)
+{
+	if((buf == NULL) || (length == 0)) return -1;
+
+	return i2c_write_read(i2c_ctrl, slave_addr, NULL, 0, buf, length);
+}
+
+int i2c_read_reg(uint8_t i2c_ctrl, uint8_t slave_addr, uint8_t reg, uint8_t *buf, uint16_t length)
+{
+	if((buf == NULL) || (length == 0)) return -1;
+
+	return i2c_write_read(i2c_ctrl, slave_addr, &reg, 1, buf, length);
+}
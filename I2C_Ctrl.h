@@ -15,12 +15,29 @@
 #define I2C_WRITE_BIT 0
 #define I2C_READ_BIT 1
 
+#define I2C_XFER_MAX_DATA_BYTES 4096
+
+#define I2C_XFER_STATUS_OK 0
+#define I2C_XFER_STATUS_ACK_ERR 1
+#define I2C_XFER_STATUS_CLK_TIMEOUT 2
+#define I2C_XFER_STATUS_TIMEOUT 3
+#define I2C_XFER_STATUS_NO_RESTART 4
+
 //Returns true if "i2c_init()" has already been called.
 bool i2c_is_active(void);
 //Initializes I2C procedure.
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool i2c_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool i2c_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool i2c_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/I2C_Ctrl" instead of write()/read() calls on the proc file.
+bool i2c_ioctl_is_enabled(void);
 
 void i2c_ctrl_endpoint_map_to_gpio_pinmode(uint8_t i2c_ctrl, uint8_t endpoint, uint8_t *p_sda_gpio, uint8_t *p_scl_gpio, uint8_t *p_pinmode);
 void i2c_init_gpio_default(uint8_t i2c_ctrl, uint8_t endpoint, bool enable_pullup);
@@ -69,4 +86,19 @@ bool i2c_transfer_is_active(uint8_t i2c_ctrl);
 void i2c_set_std_clkdiv(uint8_t i2c_ctrl, bool use_400kbps);
 void i2c_set_std_data_delay(uint8_t i2c_ctrl, bool use_400kbps);
 
+//Whole transfers, run by the driver in a single call (requires "/dev/I2C_Ctrl", see "i2c_ioctl_is_enabled()").
+//The driver sets the slave address and length, keeps the FIFO fed/drained and waits for the transfer to end.
+//Up to I2C_XFER_MAX_DATA_BYTES bytes per transfer. The controller must have been initialized ("i2c_init_default()").
+//Returns I2C_XFER_STATUS_OK, I2C_XFER_STATUS_ACK_ERR (slave NACK), I2C_XFER_STATUS_CLK_TIMEOUT (clock stretched too long),
+//I2C_XFER_STATUS_TIMEOUT (transfer never completed), or -1 if the transfer could not be run.
+int i2c_write(uint8_t i2c_ctrl, uint8_t slave_addr, const uint8_t *buf, uint16_t length);
+int i2c_read(uint8_t i2c_ctrl, uint8_t slave_addr, uint8_t *buf, uint16_t length);
+//Writes "write_length" bytes, then reads "read_length" bytes with a repeated start instead of a STOP in between.
+//The transaction is atomic with respect to other masters, unless I2C_XFER_STATUS_NO_RESTART is returned: the write ended before the read
+//could be chained (interrupt load), so both parts are done but a STOP went in between. "write_length" + "read_length" must not exceed I2C_XFER_MAX_DATA_BYTES.
+//If either length is 0, behaves like "i2c_write()" or "i2c_read()".
+int i2c_write_read(uint8_t i2c_ctrl, uint8_t slave_addr, const uint8_t *write_buf, uint16_t write_length, uint8_t *read_buf, uint16_t read_length);
+//Register read: writes the register pointer "reg", then reads "length" bytes, with a repeated start (see "i2c_write_read()").
+int i2c_read_reg(uint8_t i2c_ctrl, uint8_t slave_addr, uint8_t reg, uint8_t *buf, uint16_t length);
+
 #endif
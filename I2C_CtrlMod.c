@@ -5,8 +5,15 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/preempt.h>
 #include <asm/io.h>
 
 #define I2C_CTRL0 0
@@ -76,13 +83,105 @@
 #define I2C_CMD_SET_STD_CLKDIV 38
 #define I2C_CMD_SET_STD_DATADELAY 39
 
+#define I2C_CMD_RING_DOORBELL 0xFE
 #define I2C_CMD_KERNEL_RESPONSE 0xFF
 
+#define I2C_IOCTL_MAGIC 'i'
+#define I2C_IOCTL_RUN_CMD _IOWR(I2C_IOCTL_MAGIC, 0, unsigned char[I2C_DATAIO_SIZE_BYTES])
+
+/*
+ * I2C Command Ring Structure (I2C_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: I2C_RING_ENTRIES entries of I2C_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%I2C_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a I2C_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define I2C_RING_SIZE_BYTES 4096
+#define I2C_RING_HEADER_SIZE_BYTES 16
+#define I2C_RING_ENTRY_SIZE_BYTES 8
+#define I2C_RING_ENTRIES 256
+
+#define I2C_RING_SQ_TAIL_UINTP_POS 0
+#define I2C_RING_SQ_HEAD_UINTP_POS 1
+#define I2C_RING_FLAGS_UINTP_POS 2
+
+#define I2C_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * I2C Transfer Structure (I2C_XFER_HEADER_SIZE_BYTES + data, "/dev/I2C_Ctrl" ioctl only):
+ *
+ * BYTE0: I2C CTRL
+ * BYTE1: SLAVE ADDR
+ * BYTE2: RESERVED
+ * BYTE3: STATUS (written by kernel)
+ * USHORT2 (BYTES 4-5): WRITE LENGTH
+ * USHORT3 (BYTES 6-7): READ LENGTH
+ * USHORT4 (BYTES 8-9): BYTES WRITTEN (written by kernel)
+ * USHORT5 (BYTES 10-11): BYTES READ (written by kernel)
+ * BYTES 12 onwards: WRITE LENGTH bytes to write (written by user), followed by READ LENGTH bytes read (written by kernel).
+ *
+ * The whole transaction runs in one call, with the FIFO kept fed/drained by the kernel.
+ * If both WRITE LENGTH and READ LENGTH are non zero, the write is followed by the read with a repeated start (no STOP in between).
+ * STATUS is I2C_XFER_STATUS_NO_RESTART (4) if the write ended before the read could be chained: both parts are done, but with a STOP in between.
+ */
+
+#define I2C_XFER_HEADER_SIZE_BYTES 12
+#define I2C_XFER_MAX_DATA_BYTES 4096
+#define I2C_XFER_DATAIO_SIZE_BYTES (I2C_XFER_HEADER_SIZE_BYTES + I2C_XFER_MAX_DATA_BYTES)
+
+#define I2C_XFER_CTRL_BYTEP_POS 0
+#define I2C_XFER_ADDR_BYTEP_POS 1
+#define I2C_XFER_STATUS_BYTEP_POS 3
+#define I2C_XFER_WRITE_LENGTH_USHORTP_POS 2
+#define I2C_XFER_READ_LENGTH_USHORTP_POS 3
+#define I2C_XFER_WRITE_DONE_USHORTP_POS 4
+#define I2C_XFER_READ_DONE_USHORTP_POS 5
+
+#define I2C_XFER_STATUS_OK 0
+#define I2C_XFER_STATUS_ACK_ERR 1
+#define I2C_XFER_STATUS_CLK_TIMEOUT 2
+#define I2C_XFER_STATUS_TIMEOUT 3
+#define I2C_XFER_STATUS_NO_RESTART 4
+
+//Transfer timeout: I2C_XFER_TIMEOUT_BASE_MS plus 1 ms per byte (about 10x a byte time at 100 kbps).
+#define I2C_XFER_TIMEOUT_BASE_MS 100
+#define I2C_XFER_POLL_US 20
+
+#define I2C_IOCTL_XFER _IOWR(I2C_IOCTL_MAGIC, 1, unsigned char[I2C_XFER_DATAIO_SIZE_BYTES])
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} i2c_file_ctx_t;
+
 static struct proc_dir_entry *i2c_proc = NULL;
 static unsigned int *i2c0_mapping = NULL;
 static unsigned int *i2c1_mapping = NULL;
 static unsigned int *i2c2_mapping = NULL;
-static void *i2c_data_io = NULL;
+static DEFINE_MUTEX(i2c0_mutex);
+static DEFINE_MUTEX(i2c1_mutex);
+static DEFINE_MUTEX(i2c2_mutex);
+static struct task_struct *i2c_ring_thread = NULL;
+static LIST_HEAD(i2c_file_ctx_list);
+static DEFINE_MUTEX(i2c_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 //======================================================================================================
 
@@ -115,6 +214,28 @@ void i2c_ctrl_map_to_pointer(unsigned int i2c_ctrl, unsigned int **p_pointer)
 	return;
 }
 
+void i2c_ctrl_map_to_mutex(unsigned int i2c_ctrl, struct mutex **p_mutex)
+{
+	if(p_mutex == NULL) return;
+
+	switch(i2c_ctrl)
+	{
+		case I2C_CTRL0:
+			*p_mutex = &i2c0_mutex;
+			break;
+
+		case I2C_CTRL1:
+			*p_mutex = &i2c1_mutex;
+			break;
+
+		case I2C_CTRL2:
+			*p_mutex = &i2c2_mutex;
+			break;
+	}
+
+	return;
+}
+
 //======================================================================================================
 //I2C CTRL
 
@@ -573,19 +694,296 @@ void i2c_deinit_default(unsigned int i2c_ctrl)
 
 //I2C GENERIC
 //======================================================================================================
+//I2C TRANSFER
 
-ssize_t i2c_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+unsigned int i2c_xfer_get_status(unsigned int i2c_ctrl)
 {
-	copy_to_user(user, i2c_data_io, I2C_DATAIO_SIZE_BYTES);
-	return size;
+	unsigned int *i2c_mapping = NULL;
+	i2c_ctrl_map_to_pointer(i2c_ctrl, &i2c_mapping);
+
+	return i2c_mapping[I2C_STATUS_UINTP_POS];
 }
 
-ssize_t i2c_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+//Clears CLKT, ERR and DONE in a single write (flags are cleared by writing 1).
+void i2c_xfer_clear_status(unsigned int i2c_ctrl)
+{
+	unsigned int *i2c_mapping = NULL;
+	i2c_ctrl_map_to_pointer(i2c_ctrl, &i2c_mapping);
+
+	i2c_mapping[I2C_STATUS_UINTP_POS] = ((1 << 9) | (1 << 8) | (1 << 1));
+	return;
+}
+
+//Pushes bytes from "data" while the FIFO can accept them (TXD). Returns the new byte count.
+unsigned int i2c_xfer_fill_fifo(unsigned int i2c_ctrl, const unsigned char *data, unsigned int n_byte, unsigned int length)
+{
+	while(n_byte < length)
+	{
+		if(!(i2c_xfer_get_status(i2c_ctrl) & (1 << 4))) break;
+
+		i2c_set_fifo_data(i2c_ctrl, data[n_byte]);
+		n_byte++;
+	}
+
+	return n_byte;
+}
+
+//Pops bytes into "data" while the FIFO has any (RXD). Returns the new byte count.
+unsigned int i2c_xfer_drain_fifo(unsigned int i2c_ctrl, unsigned char *data, unsigned int n_byte, unsigned int length)
+{
+	while(n_byte < length)
+	{
+		if(!(i2c_xfer_get_status(i2c_ctrl) & (1 << 5))) break;
+
+		data[n_byte] = (unsigned char) i2c_get_fifo_data(i2c_ctrl);
+		n_byte++;
+	}
+
+	return n_byte;
+}
+
+//Converts the ERR/CLKT flags of "status" to an I2C_XFER_STATUS_* code.
+unsigned int i2c_xfer_check_error(unsigned int status)
+{
+	if(status & (1 << 8)) return I2C_XFER_STATUS_ACK_ERR;
+	if(status & (1 << 9)) return I2C_XFER_STATUS_CLK_TIMEOUT;
+	return I2C_XFER_STATUS_OK;
+}
+
+//Leaves the controller idle after a transfer. On error, pending FIFO data is discarded.
+//If the transfer is still active (driver timeout), toggling I2CEN aborts it.
+void i2c_xfer_finish(unsigned int i2c_ctrl, unsigned int ret)
+{
+	if(ret == I2C_XFER_STATUS_TIMEOUT)
+	{
+		i2c_ctrl_enable(i2c_ctrl, 0);
+		i2c_ctrl_enable(i2c_ctrl, 1);
+	}
+
+	if(ret != I2C_XFER_STATUS_OK) i2c_clear_fifo(i2c_ctrl);
+
+	i2c_xfer_clear_status(i2c_ctrl);
+	return;
+}
+
+//Programs slave "addr" and a transfer of "length" bytes in direction "rw_bit" on an idle controller.
+void i2c_xfer_setup(unsigned int i2c_ctrl, unsigned int addr, unsigned int rw_bit, unsigned int length)
 {
-	copy_from_user(i2c_data_io, user, I2C_DATAIO_SIZE_BYTES);
+	i2c_clear_fifo(i2c_ctrl);
+	i2c_xfer_clear_status(i2c_ctrl);
+	i2c_set_slave_addr(i2c_ctrl, addr);
+	i2c_set_transfer_length_bytes(i2c_ctrl, length);
+	i2c_set_rw_bit(i2c_ctrl, rw_bit);
+	return;
+}
+
+//Waits for the transfer in progress to end, feeding/draining the FIFO byte by byte as TXD/RXD allow, so TXW/RXR are never waited for.
+//"p_n_byte" holds the bytes of "data" already moved and is updated.
+//Returns an I2C_XFER_STATUS_* code.
+unsigned int i2c_xfer_wait(unsigned int i2c_ctrl, unsigned int rw_bit, unsigned char *data, unsigned int length, unsigned int *p_n_byte, unsigned long deadline)
+{
+	unsigned int ret = I2C_XFER_STATUS_OK;
+	unsigned int status = 0;
+
+	while(true)
+	{
+		//Status is sampled before moving data: once DONE is seen, the last bytes are already in the FIFO.
+		status = i2c_xfer_get_status(i2c_ctrl);
+
+		if(rw_bit == I2C_WRITE_BIT) *p_n_byte = i2c_xfer_fill_fifo(i2c_ctrl, data, *p_n_byte, length);
+		else *p_n_byte = i2c_xfer_drain_fifo(i2c_ctrl, data, *p_n_byte, length);
+
+		ret = i2c_xfer_check_error(status);
+		if(ret != I2C_XFER_STATUS_OK) return ret;
+
+		if(status & (1 << 1)) return I2C_XFER_STATUS_OK;
 
-	unsigned char *pbyte = (unsigned char*) i2c_data_io;
+		if(time_after(jiffies, deadline)) return I2C_XFER_STATUS_TIMEOUT;
+
+		usleep_range(I2C_XFER_POLL_US, 2*I2C_XFER_POLL_US);
+	}
+
+	return ret;
+}
+
+//Bytes sent by a write that ended with an error, out of "n_byte" queued: DLEN holds the bytes that were not transferred.
+unsigned int i2c_xfer_get_write_done(unsigned int i2c_ctrl, unsigned int n_byte, unsigned int length)
+{
+	unsigned int remaining = i2c_get_transfer_length_bytes(i2c_ctrl);
+
+	if(remaining > length) remaining = length;
+	if((length - remaining) < n_byte) return (length - remaining);
+	return n_byte;
+}
+
+//Runs a whole write ("rw_bit" = I2C_WRITE_BIT) or read of "length" bytes to/from slave "addr".
+//The number of bytes moved is stored in "p_done". Must be called with the mutex of the controller held.
+//Returns an I2C_XFER_STATUS_* code.
+unsigned int i2c_xfer_run(unsigned int i2c_ctrl, unsigned int addr, unsigned int rw_bit, unsigned char *data, unsigned int length, unsigned int *p_done)
+{
+	unsigned long deadline = jiffies + msecs_to_jiffies(I2C_XFER_TIMEOUT_BASE_MS + length);
+	unsigned int ret = I2C_XFER_STATUS_OK;
+	unsigned int n_byte = 0;
+
+	i2c_xfer_setup(i2c_ctrl, addr, rw_bit, length);
+
+	//Prefill the FIFO, so the first bytes go out right after the address.
+	if(rw_bit == I2C_WRITE_BIT) n_byte = i2c_xfer_fill_fifo(i2c_ctrl, data, n_byte, length);
+
+	i2c_start_transfer(i2c_ctrl);
+
+	ret = i2c_xfer_wait(i2c_ctrl, rw_bit, data, length, &n_byte, deadline);
+	if((ret != I2C_XFER_STATUS_OK) && (rw_bit == I2C_WRITE_BIT)) n_byte = i2c_xfer_get_write_done(i2c_ctrl, n_byte, length);
+
+	i2c_xfer_finish(i2c_ctrl, ret);
+
+	*p_done = n_byte;
+	return ret;
+}
+
+//Reprograms the controller for the read part of a combined transfer. Setting ST while the write is still active (TA) makes the controller
+//issue a repeated start once the write is over, instead of a STOP.
+void i2c_xfer_start_read(unsigned int i2c_ctrl, unsigned int length)
+{
+	i2c_set_transfer_length_bytes(i2c_ctrl, length);
+	i2c_set_rw_bit(i2c_ctrl, I2C_READ_BIT);
+	i2c_start_transfer(i2c_ctrl);
+	return;
+}
+
+//Runs a write of "write_length" bytes followed by a read of "read_length" bytes from slave "addr", joined by a repeated start.
+//There is no STOP in between, so no other master can take the bus and the slave keeps its register pointer.
+//The read is started as soon as the write is active (TA) and all its bytes are in the FIFO.
+//Preemption is disabled from the last FIFO fill until then, so the write can't end while the task is scheduled out.
+//If it still ends before that (DONE: interrupt handlers held the CPU for the rest of the write), the read runs as a separate transfer
+//and I2C_XFER_STATUS_NO_RESTART is returned instead of I2C_XFER_STATUS_OK.
+//Byte counts are stored in "p_write_done" and "p_read_done". Must be called with the mutex of the controller held.
+//Returns an I2C_XFER_STATUS_* code.
+unsigned int i2c_xfer_run_combined(unsigned int i2c_ctrl, unsigned int addr, unsigned char *write_data, unsigned int write_length, unsigned char *read_data, unsigned int read_length, unsigned int *p_write_done, unsigned int *p_read_done)
+{
+	unsigned long deadline = jiffies + msecs_to_jiffies(I2C_XFER_TIMEOUT_BASE_MS + write_length + read_length);
+	unsigned long flags = 0;
+	unsigned int ret = I2C_XFER_STATUS_OK;
+	unsigned int status = 0;
+	unsigned int n_write = 0;
+	unsigned int n_read = 0;
+	bool restart = true;
+
+	i2c_xfer_setup(i2c_ctrl, addr, I2C_WRITE_BIT, write_length);
+	n_write = i2c_xfer_fill_fifo(i2c_ctrl, write_data, n_write, write_length);
+	if(n_write == write_length) preempt_disable();
+	i2c_start_transfer(i2c_ctrl);
+
+	while(true)
+	{
+		status = i2c_xfer_get_status(i2c_ctrl);
+		if(n_write < write_length)
+		{
+			n_write = i2c_xfer_fill_fifo(i2c_ctrl, write_data, n_write, write_length);
+			//Last fill: the write may now end within a FIFO time, keep the task on the CPU until the read is chained.
+			if(n_write == write_length) preempt_disable();
+		}
+
+		ret = i2c_xfer_check_error(status);
+		if(ret != I2C_XFER_STATUS_OK) break;
+
+		if((n_write == write_length) && (status & 1))
+		{
+			//Interrupts are held off so the write can't end between checking DONE and setting ST.
+			local_irq_save(flags);
+			status = i2c_xfer_get_status(i2c_ctrl);
+			if(!(status & (1 << 1))) i2c_xfer_start_read(i2c_ctrl, read_length);
+			local_irq_restore(flags);
+
+			if(!(status & (1 << 1))) break;
+		}
+
+		if(status & (1 << 1))
+		{
+			//The write ended with a STOP: run the read on its own.
+			ret = i2c_xfer_check_error(i2c_xfer_get_status(i2c_ctrl));
+			if(ret != I2C_XFER_STATUS_OK) break;
+
+			i2c_xfer_clear_status(i2c_ctrl);
+			i2c_xfer_start_read(i2c_ctrl, read_length);
+			restart = false;
+			break;
+		}
+
+		if(time_after(jiffies, deadline))
+		{
+			ret = I2C_XFER_STATUS_TIMEOUT;
+			break;
+		}
+
+		//TA comes up within a few bit times once all bytes are queued: spin for it rather than sleeping past the end of the write.
+		if(n_write == write_length) cpu_relax();
+		else usleep_range(I2C_XFER_POLL_US, 2*I2C_XFER_POLL_US);
+	}
+
+	if(n_write == write_length) preempt_enable();
+
+	if(ret == I2C_XFER_STATUS_OK) ret = i2c_xfer_wait(i2c_ctrl, I2C_READ_BIT, read_data, read_length, &n_read, deadline);
+	else n_write = i2c_xfer_get_write_done(i2c_ctrl, n_write, write_length);
+
+	i2c_xfer_finish(i2c_ctrl, ret);
+
+	//Both parts went through, but with a STOP in between: let the caller know the transaction was not atomic.
+	if((ret == I2C_XFER_STATUS_OK) && !restart) ret = I2C_XFER_STATUS_NO_RESTART;
+
+	*p_write_done = n_write;
+	*p_read_done = n_read;
+	return ret;
+}
+
+//Runs the transfer described by the header in "xfer" (see I2C Transfer Structure). Data starts at "xfer" + I2C_XFER_HEADER_SIZE_BYTES.
+//Lengths must have been checked by the caller.
+void i2c_xfer(unsigned char *xfer)
+{
+	unsigned short *pushort = (unsigned short*) xfer;
+	unsigned char *data = &xfer[I2C_XFER_HEADER_SIZE_BYTES];
+	unsigned int i2c_ctrl = xfer[I2C_XFER_CTRL_BYTEP_POS];
+	unsigned int addr = xfer[I2C_XFER_ADDR_BYTEP_POS];
+	unsigned int write_length = pushort[I2C_XFER_WRITE_LENGTH_USHORTP_POS];
+	unsigned int read_length = pushort[I2C_XFER_READ_LENGTH_USHORTP_POS];
+	unsigned int write_done = 0;
+	unsigned int read_done = 0;
+	unsigned int ret = I2C_XFER_STATUS_OK;
+	struct mutex *i2c_mutex = NULL;
+
+	i2c_ctrl_map_to_mutex(i2c_ctrl, &i2c_mutex);
+
+	mutex_lock(i2c_mutex);
+
+	if(write_length && read_length) ret = i2c_xfer_run_combined(i2c_ctrl, addr, data, write_length, &data[write_length], read_length, &write_done, &read_done);
+	else if(write_length) ret = i2c_xfer_run(i2c_ctrl, addr, I2C_WRITE_BIT, data, write_length, &write_done);
+	else ret = i2c_xfer_run(i2c_ctrl, addr, I2C_READ_BIT, &data[write_length], read_length, &read_done);
+
+	mutex_unlock(i2c_mutex);
+
+	xfer[I2C_XFER_STATUS_BYTEP_POS] = (unsigned char) ret;
+	pushort[I2C_XFER_WRITE_DONE_USHORTP_POS] = (unsigned short) write_done;
+	pushort[I2C_XFER_READ_DONE_USHORTP_POS] = (unsigned short) read_done;
+	return;
+}
+
+//I2C TRANSFER
+//======================================================================================================
+
+void i2c_run_cmd(unsigned char *pbyte)
+{
 	unsigned short *pushort = (unsigned short*) &pbyte[2];
+	struct mutex *i2c_mutex = NULL;
+
+	//Commands are serialized per controller, so different controllers can be driven concurrently.
+	i2c_ctrl_map_to_mutex(pbyte[1], &i2c_mutex);
+	if(i2c_mutex == NULL)
+	{
+		pbyte[0] = I2C_CMD_KERNEL_RESPONSE;
+		return;
+	}
+
+	mutex_lock(i2c_mutex);
 
 	switch(pbyte[0])
 	{
@@ -750,13 +1148,212 @@ ssize_t i2c_mod_usrwrite(struct file *file, const char __user *user, size_t size
 			break;
 	}
 
+	mutex_unlock(i2c_mutex);
+
 	pbyte[0] = I2C_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+//======================================================================================================
+//COMMAND RING
+
+void i2c_ring_drain(i2c_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + I2C_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[I2C_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > I2C_RING_ENTRIES) sq_tail = ctx->ring_sq_head + I2C_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		i2c_run_cmd(&ring_entries[(ctx->ring_sq_head%I2C_RING_ENTRIES)*I2C_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[I2C_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int i2c_ring_poll_thread(void *arg)
+{
+	i2c_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&i2c_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &i2c_file_ctx_list, list) i2c_ring_drain(ctx);
+		mutex_unlock(&i2c_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+//COMMAND RING
+//======================================================================================================
+
+int i2c_mod_open(struct inode *inode, struct file *file)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) kzalloc(sizeof(i2c_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(I2C_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(I2C_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(i2c_ring_thread != NULL) ((unsigned int*) ctx->ring)[I2C_RING_FLAGS_UINTP_POS] = I2C_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&i2c_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &i2c_file_ctx_list);
+	mutex_unlock(&i2c_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int i2c_mod_release(struct inode *inode, struct file *file)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) file->private_data;
+
+	mutex_lock(&i2c_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&i2c_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t i2c_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) file->private_data;
+
+	if(size > I2C_DATAIO_SIZE_BYTES) size = I2C_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t i2c_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) file->private_data;
+
+	if(size != I2C_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == I2C_CMD_RING_DOORBELL) i2c_ring_drain(ctx);
+
+	i2c_run_cmd(pbyte);
 	return size;
 }
 
+int i2c_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long i2c_mod_ioctl_xfer(unsigned long arg)
+{
+	unsigned char header[I2C_XFER_HEADER_SIZE_BYTES];
+	unsigned short *pushort = (unsigned short*) header;
+	unsigned char *xfer = NULL;
+	unsigned int write_length = 0;
+	unsigned int read_length = 0;
+
+	if(copy_from_user(header, (void __user*) arg, I2C_XFER_HEADER_SIZE_BYTES)) return -EFAULT;
+
+	write_length = pushort[I2C_XFER_WRITE_LENGTH_USHORTP_POS];
+	read_length = pushort[I2C_XFER_READ_LENGTH_USHORTP_POS];
+
+	if(header[I2C_XFER_CTRL_BYTEP_POS] > I2C_CTRL2) return -EINVAL;
+	if(header[I2C_XFER_ADDR_BYTEP_POS] > 0x7F) return -EINVAL;
+	if((write_length + read_length) == 0) return -EINVAL;
+	if((write_length + read_length) > I2C_XFER_MAX_DATA_BYTES) return -EINVAL;
+
+	xfer = (unsigned char*) kmalloc(I2C_XFER_HEADER_SIZE_BYTES + write_length + read_length, GFP_KERNEL);
+	if(xfer == NULL) return -ENOMEM;
+
+	memcpy(xfer, header, I2C_XFER_HEADER_SIZE_BYTES);
+
+	if(copy_from_user(&xfer[I2C_XFER_HEADER_SIZE_BYTES], ((unsigned char __user*) arg) + I2C_XFER_HEADER_SIZE_BYTES, write_length))
+	{
+		kfree(xfer);
+		return -EFAULT;
+	}
+
+	i2c_xfer(xfer);
+
+	//The write data is left untouched, so only the header and the read data are copied back.
+	if(copy_to_user((void __user*) arg, xfer, I2C_XFER_HEADER_SIZE_BYTES) || copy_to_user(((unsigned char __user*) arg) + I2C_XFER_HEADER_SIZE_BYTES + write_length, &xfer[I2C_XFER_HEADER_SIZE_BYTES + write_length], read_length))
+	{
+		kfree(xfer);
+		return -EFAULT;
+	}
+
+	kfree(xfer);
+	return 0;
+}
+
+long i2c_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	i2c_file_ctx_t *ctx = (i2c_file_ctx_t*) file->private_data;
+	unsigned char pbyte[I2C_DATAIO_SIZE_BYTES];
+
+	if(cmd == I2C_IOCTL_XFER) return i2c_mod_ioctl_xfer(arg);
+	if(cmd != I2C_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, I2C_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == I2C_CMD_RING_DOORBELL) i2c_ring_drain(ctx);
+
+	i2c_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, I2C_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops i2c_proc_ops = {
+	.proc_open = i2c_mod_open,
+	.proc_release = i2c_mod_release,
 	.proc_read = i2c_mod_usrread,
-	.proc_write = i2c_mod_usrwrite
+	.proc_write = i2c_mod_usrwrite,
+	.proc_mmap = i2c_mod_usrmmap
+};
+
+static const struct file_operations i2c_fops = {
+	.owner = THIS_MODULE,
+	.open = i2c_mod_open,
+	.release = i2c_mod_release,
+	.read = i2c_mod_usrread,
+	.write = i2c_mod_usrwrite,
+	.mmap = i2c_mod_usrmmap,
+	.unlocked_ioctl = i2c_mod_ioctl
+};
+
+static struct miscdevice i2c_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "I2C_Ctrl",
+	.fops = &i2c_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -788,18 +1385,32 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	i2c_data_io = vmalloc(I2C_DATAIO_SIZE_BYTES);
+	if(misc_register(&i2c_misc) < 0)
+	{
+		printk("I2C: Error registering device file\n");
+		proc_remove(i2c_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		i2c_ring_thread = kthread_run(i2c_ring_poll_thread, NULL, "I2C_Ctrl_ring");
+		if(IS_ERR(i2c_ring_thread)) i2c_ring_thread = NULL;
+	}
+
 	printk("I2C Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
+	//Interfaces and the ring thread go first, so no command can run on unmapped registers.
+	misc_deregister(&i2c_misc);
+	proc_remove(i2c_proc);
+	if(i2c_ring_thread != NULL) kthread_stop(i2c_ring_thread);
 	iounmap(i2c0_mapping);
 	iounmap(i2c1_mapping);
 	iounmap(i2c2_mapping);
-	proc_remove(i2c_proc);
-	vfree(i2c_data_io);
 	printk("I2C Control Driver Disabled\n");
 	return;
 }
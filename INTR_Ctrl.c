@@ -3,8 +3,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 /*
 "INTR_CTRL_WAIT_KERNEL_RESPONSE"
@@ -14,6 +17,7 @@ Else, application will wait a specific time (defined in INTR_CTRL_WAIT_TIME_US)
 #define INTR_CTRL_WAIT_KERNEL_RESPONSE
 
 #define INTR_CTRL_PROC_FILE_DIR "/proc/INTR_Ctrl"
+#define INTR_CTRL_DEV_FILE_DIR "/dev/INTR_Ctrl"
 #define INTR_CTRL_WAIT_TIME_US 1
 
 #define INTR_DATAIO_SIZE_BYTES 3
@@ -27,10 +31,27 @@ Else, application will wait a specific time (defined in INTR_CTRL_WAIT_TIME_US)
 #define INTR_CMD_SET_ENABLE_GPU_IRQ 6
 #define INTR_CMD_SET_ENABLE_BASIC_IRQ 7
 
+#define INTR_CMD_RING_DOORBELL 0xFE
 #define INTR_CMD_KERNEL_RESPONSE 0xFF
 
+#define INTR_IOCTL_MAGIC 'n'
+#define INTR_IOCTL_RUN_CMD _IOWR(INTR_IOCTL_MAGIC, 0, uint8_t[INTR_DATAIO_SIZE_BYTES])
+
+#define INTR_RING_SIZE_BYTES 4096
+#define INTR_RING_HEADER_SIZE_BYTES 16
+#define INTR_RING_ENTRY_SIZE_BYTES 8
+#define INTR_RING_ENTRIES 256
+
+#define INTR_RING_SQ_TAIL_UINTP_POS 0
+#define INTR_RING_SQ_HEAD_UINTP_POS 1
+#define INTR_RING_FLAGS_UINTP_POS 2
+
+#define INTR_RING_FLAG_KERNEL_POLL 0x1
+
 int intr_proc_fd = -1;
+int intr_dev_fd = -1;
 void *intr_data_io = NULL;
+void *intr_ring = NULL;
 
 void intr_ctrl_wait(void)
 {
@@ -51,32 +72,106 @@ bool intr_init(void)
 	intr_proc_fd = open(INTR_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(intr_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	intr_dev_fd = open(INTR_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	intr_data_io = malloc(INTR_DATAIO_SIZE_BYTES);
 	return true;
 }
 
 #ifdef INTR_CTRL_WAIT_KERNEL_RESPONSE
-void intr_call_kernel(void)
+void intr_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) intr_data_io;
-	write(intr_proc_fd, intr_data_io, INTR_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(intr_proc_fd, data_io, INTR_DATAIO_SIZE_BYTES);
 
 	do{
-		read(intr_proc_fd, intr_data_io, INTR_DATAIO_SIZE_BYTES);
+		read(intr_proc_fd, data_io, INTR_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != INTR_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void intr_call_kernel(void)
+void intr_call_kernel_proc(void *data_io)
 {
-	write(intr_proc_fd, intr_data_io, INTR_DATAIO_SIZE_BYTES);
+	write(intr_proc_fd, data_io, INTR_DATAIO_SIZE_BYTES);
 	intr_ctrl_wait();
-	read(intr_proc_fd, intr_data_io, INTR_DATAIO_SIZE_BYTES);
+	read(intr_proc_fd, data_io, INTR_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void intr_call_kernel_ioctl(void *data_io)
+{
+	ioctl(intr_dev_fd, INTR_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void intr_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) intr_ring;
+	uint8_t *ring_entries = ((uint8_t*) intr_ring) + INTR_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[INTR_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%INTR_RING_ENTRIES)*INTR_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[INTR_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, intr_data_io, INTR_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[INTR_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[INTR_RING_FLAGS_UINTP_POS] & INTR_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, INTR_DATAIO_SIZE_BYTES);
+		doorbell[0] = INTR_CMD_RING_DOORBELL;
+		if(intr_dev_fd >= 0) intr_call_kernel_ioctl(doorbell);
+		else intr_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[INTR_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(intr_data_io, pentry, INTR_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void intr_call_kernel(void)
+{
+	if(intr_ring != NULL) intr_call_kernel_ring();
+	else if(intr_dev_fd >= 0) intr_call_kernel_ioctl(intr_data_io);
+	else intr_call_kernel_proc(intr_data_io);
+
+	return;
+}
+
+bool intr_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(intr_ring != NULL) munmap(intr_ring, INTR_RING_SIZE_BYTES);
+		intr_ring = NULL;
+		return true;
+	}
+
+	if(intr_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (intr_dev_fd >= 0) ? intr_dev_fd : intr_proc_fd;
+	void *p_ring = mmap(NULL, INTR_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	intr_ring = p_ring;
+	return true;
+}
+
+bool intr_ring_is_enabled(void)
+{
+	return (intr_ring != NULL);
+}
+
+bool intr_ioctl_is_enabled(void)
+{
+	return (intr_dev_fd >= 0);
+}
+
 bool intr_basic_irq_occurred(uint8_t irq_id)
 {
 	uint8_t *pbyte = (uint8_t*) intr_data_io;
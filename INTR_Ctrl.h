@@ -35,6 +35,15 @@ bool intr_is_active(void);
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool intr_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool intr_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool intr_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/INTR_Ctrl" instead of write()/read() calls on the proc file.
+bool intr_ioctl_is_enabled(void);
 
 bool intr_basic_irq_occurred(uint8_t irq_id);
 bool intr_gpu_irq_occurred(uint8_t irq_id);
@@ -5,8 +5,15 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 #define INTR_IRQ_ID_SYSTIMER_MATCH1 1
@@ -52,11 +59,59 @@
 #define INTR_CMD_SET_ENABLE_GPU_IRQ 6
 #define INTR_CMD_SET_ENABLE_BASIC_IRQ 7
 
+#define INTR_CMD_RING_DOORBELL 0xFE
 #define INTR_CMD_KERNEL_RESPONSE 0xFF
 
+#define INTR_IOCTL_MAGIC 'n'
+#define INTR_IOCTL_RUN_CMD _IOWR(INTR_IOCTL_MAGIC, 0, unsigned char[INTR_DATAIO_SIZE_BYTES])
+
+/*
+ * INTR Command Ring Structure (INTR_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: INTR_RING_ENTRIES entries of INTR_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%INTR_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a INTR_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define INTR_RING_SIZE_BYTES 4096
+#define INTR_RING_HEADER_SIZE_BYTES 16
+#define INTR_RING_ENTRY_SIZE_BYTES 8
+#define INTR_RING_ENTRIES 256
+
+#define INTR_RING_SQ_TAIL_UINTP_POS 0
+#define INTR_RING_SQ_HEAD_UINTP_POS 1
+#define INTR_RING_FLAGS_UINTP_POS 2
+
+#define INTR_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} intr_file_ctx_t;
+
 static struct proc_dir_entry *intr_proc = NULL;
 static unsigned int *intr_mapping = NULL;
-static void *intr_data_io = NULL;
+static DEFINE_SPINLOCK(intr_fiq_ctrl_lock);
+static struct task_struct *intr_ring_thread = NULL;
+static LIST_HEAD(intr_file_ctx_list);
+static DEFINE_MUTEX(intr_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int intr_is_reg_bit_active(unsigned int register_value, unsigned int reference_bit)
 {
@@ -99,8 +154,10 @@ unsigned int intr_gpu_irq_occurred(unsigned int irq_id)
 void intr_enable_fiq(unsigned int enable)
 {
 	enable &= 0x00000001;
+	spin_lock(&intr_fiq_ctrl_lock);
 	intr_mapping[INTR_FIQ_CTRL_UINTP_POS] &= ~(1 << 7);
 	intr_mapping[INTR_FIQ_CTRL_UINTP_POS] |= (enable << 7);
+	spin_unlock(&intr_fiq_ctrl_lock);
 	return;
 }
 
@@ -113,8 +170,10 @@ void intr_set_fiq_src(unsigned int irq_id)
 {
 	if(irq_id > 71) return;
 
+	spin_lock(&intr_fiq_ctrl_lock);
 	intr_mapping[INTR_FIQ_CTRL_UINTP_POS] &= ~(0x7F);
 	intr_mapping[INTR_FIQ_CTRL_UINTP_POS] |= (irq_id);
+	spin_unlock(&intr_fiq_ctrl_lock);
 	return;
 }
 
@@ -172,18 +231,8 @@ void intr_enable_basic_irq(unsigned int irq_id, unsigned int enable)
 //INTR BASIC ENABLE/DISABLE
 //=======================================================================================================
 
-ssize_t intr_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
-{
-	copy_to_user(user, intr_data_io, INTR_DATAIO_SIZE_BYTES);
-	return size;
-}
-
-ssize_t intr_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+void intr_run_cmd(unsigned char *pbyte)
 {
-	copy_from_user(intr_data_io, user, INTR_DATAIO_SIZE_BYTES);
-
-	unsigned char *pbyte = (unsigned char*) intr_data_io;
-
 	switch(pbyte[0])
 	{
 		case INTR_CMD_GET_BASIC_IRQ_OCCURRED:
@@ -220,12 +269,166 @@ ssize_t intr_mod_usrwrite(struct file *file, const char __user *user, size_t siz
 	}
 
 	pbyte[0] = INTR_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+//=======================================================================================================
+//COMMAND RING
+
+void intr_ring_drain(intr_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + INTR_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[INTR_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > INTR_RING_ENTRIES) sq_tail = ctx->ring_sq_head + INTR_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		intr_run_cmd(&ring_entries[(ctx->ring_sq_head%INTR_RING_ENTRIES)*INTR_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[INTR_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int intr_ring_poll_thread(void *arg)
+{
+	intr_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&intr_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &intr_file_ctx_list, list) intr_ring_drain(ctx);
+		mutex_unlock(&intr_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+//COMMAND RING
+//=======================================================================================================
+
+int intr_mod_open(struct inode *inode, struct file *file)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) kzalloc(sizeof(intr_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(INTR_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(INTR_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(intr_ring_thread != NULL) ((unsigned int*) ctx->ring)[INTR_RING_FLAGS_UINTP_POS] = INTR_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&intr_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &intr_file_ctx_list);
+	mutex_unlock(&intr_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int intr_mod_release(struct inode *inode, struct file *file)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) file->private_data;
+
+	mutex_lock(&intr_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&intr_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t intr_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) file->private_data;
+
+	if(size > INTR_DATAIO_SIZE_BYTES) size = INTR_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t intr_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) file->private_data;
+
+	if(size != INTR_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == INTR_CMD_RING_DOORBELL) intr_ring_drain(ctx);
+
+	intr_run_cmd(pbyte);
 	return size;
 }
 
+int intr_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long intr_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	intr_file_ctx_t *ctx = (intr_file_ctx_t*) file->private_data;
+	unsigned char pbyte[INTR_DATAIO_SIZE_BYTES];
+
+	if(cmd != INTR_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, INTR_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == INTR_CMD_RING_DOORBELL) intr_ring_drain(ctx);
+
+	intr_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, INTR_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops intr_proc_ops = {
+	.proc_open = intr_mod_open,
+	.proc_release = intr_mod_release,
 	.proc_read = intr_mod_usrread,
-	.proc_write = intr_mod_usrwrite
+	.proc_write = intr_mod_usrwrite,
+	.proc_mmap = intr_mod_usrmmap
+};
+
+static const struct file_operations intr_fops = {
+	.owner = THIS_MODULE,
+	.open = intr_mod_open,
+	.release = intr_mod_release,
+	.read = intr_mod_usrread,
+	.write = intr_mod_usrwrite,
+	.mmap = intr_mod_usrmmap,
+	.unlocked_ioctl = intr_mod_ioctl
+};
+
+static struct miscdevice intr_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "INTR_Ctrl",
+	.fops = &intr_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -244,16 +447,30 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	intr_data_io = vmalloc(INTR_DATAIO_SIZE_BYTES);
+	if(misc_register(&intr_misc) < 0)
+	{
+		printk("INTR: Error registering device file\n");
+		proc_remove(intr_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		intr_ring_thread = kthread_run(intr_ring_poll_thread, NULL, "INTR_Ctrl_ring");
+		if(IS_ERR(intr_ring_thread)) intr_ring_thread = NULL;
+	}
+
 	printk("INTR Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
-	iounmap(intr_mapping);
+	//Interfaces and the ring thread go first, so no command can run on unmapped registers.
+	misc_deregister(&intr_misc);
 	proc_remove(intr_proc);
-	vfree(intr_data_io);
+	if(intr_ring_thread != NULL) kthread_stop(intr_ring_thread);
+	iounmap(intr_mapping);
 	printk("INTR Control Driver Disabled\n");
 	return;
 }
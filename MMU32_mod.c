@@ -8,8 +8,14 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 /*
@@ -24,10 +30,57 @@
 #define MMU_CMD_GET_PHYSICAL_ADDR 1
 #define MMU_CMD_GET_VIRTUAL_ADDR 2
 
+#define MMU_CMD_RING_DOORBELL 0xFE
 #define MMU_CMD_KERNEL_RESPONSE 0xFF
 
+#define MMU_IOCTL_MAGIC 'm'
+#define MMU_IOCTL_RUN_CMD _IOWR(MMU_IOCTL_MAGIC, 0, unsigned char[MMU_DATAIO_SIZE_BYTES])
+
+/*
+ * MMU Command Ring Structure (MMU_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: MMU_RING_ENTRIES entries of MMU_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%MMU_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a MMU_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define MMU_RING_SIZE_BYTES 4096
+#define MMU_RING_HEADER_SIZE_BYTES 16
+#define MMU_RING_ENTRY_SIZE_BYTES 8
+#define MMU_RING_ENTRIES 256
+
+#define MMU_RING_SQ_TAIL_UINTP_POS 0
+#define MMU_RING_SQ_HEAD_UINTP_POS 1
+#define MMU_RING_FLAGS_UINTP_POS 2
+
+#define MMU_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} mmu_file_ctx_t;
+
 static struct proc_dir_entry *mmu_proc = NULL;
-static void *mmu_data_io = NULL;
+static struct task_struct *mmu_ring_thread = NULL;
+static LIST_HEAD(mmu_file_ctx_list);
+static DEFINE_MUTEX(mmu_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int mmu_get_physical_addr(unsigned int virtual_addr)
 {
@@ -39,17 +92,8 @@ unsigned int mmu_get_virtual_addr(unsigned int physical_addr)
 	return (unsigned int) phys_to_virt(physical_addr);
 }
 
-ssize_t mmu_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
-{
-	copy_to_user(user, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
-	return size;
-}
-
-ssize_t mmu_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+void mmu_run_cmd(unsigned char *pbyte)
 {
-	copy_from_user(mmu_data_io, user, MMU_DATAIO_SIZE_BYTES);
-
-	unsigned char *pbyte = (unsigned char*) mmu_data_io;
 	unsigned int *puint = (unsigned int*) &pbyte[1];
 
 	switch(pbyte[0])
@@ -64,12 +108,160 @@ ssize_t mmu_mod_usrwrite(struct file *file, const char __user *user, size_t size
 	}
 
 	pbyte[0] = MMU_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void mmu_ring_drain(mmu_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + MMU_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[MMU_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > MMU_RING_ENTRIES) sq_tail = ctx->ring_sq_head + MMU_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		mmu_run_cmd(&ring_entries[(ctx->ring_sq_head%MMU_RING_ENTRIES)*MMU_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[MMU_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int mmu_ring_poll_thread(void *arg)
+{
+	mmu_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&mmu_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &mmu_file_ctx_list, list) mmu_ring_drain(ctx);
+		mutex_unlock(&mmu_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+int mmu_mod_open(struct inode *inode, struct file *file)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) kzalloc(sizeof(mmu_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(MMU_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(MMU_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(mmu_ring_thread != NULL) ((unsigned int*) ctx->ring)[MMU_RING_FLAGS_UINTP_POS] = MMU_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&mmu_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &mmu_file_ctx_list);
+	mutex_unlock(&mmu_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int mmu_mod_release(struct inode *inode, struct file *file)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) file->private_data;
+
+	mutex_lock(&mmu_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&mmu_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t mmu_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) file->private_data;
+
+	if(size > MMU_DATAIO_SIZE_BYTES) size = MMU_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t mmu_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) file->private_data;
+
+	if(size != MMU_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == MMU_CMD_RING_DOORBELL) mmu_ring_drain(ctx);
+
+	mmu_run_cmd(pbyte);
 	return size;
 }
 
+int mmu_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long mmu_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	mmu_file_ctx_t *ctx = (mmu_file_ctx_t*) file->private_data;
+	unsigned char pbyte[MMU_DATAIO_SIZE_BYTES];
+
+	if(cmd != MMU_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, MMU_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == MMU_CMD_RING_DOORBELL) mmu_ring_drain(ctx);
+
+	mmu_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, MMU_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops mmu_proc_ops = {
+	.proc_open = mmu_mod_open,
+	.proc_release = mmu_mod_release,
 	.proc_read = mmu_mod_usrread,
-	.proc_write = mmu_mod_usrwrite
+	.proc_write = mmu_mod_usrwrite,
+	.proc_mmap = mmu_mod_usrmmap
+};
+
+static const struct file_operations mmu_fops = {
+	.owner = THIS_MODULE,
+	.open = mmu_mod_open,
+	.release = mmu_mod_release,
+	.read = mmu_mod_usrread,
+	.write = mmu_mod_usrwrite,
+	.mmap = mmu_mod_usrmmap,
+	.unlocked_ioctl = mmu_mod_ioctl
+};
+
+static struct miscdevice mmu_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "MMU32",
+	.fops = &mmu_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -81,15 +273,28 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	mmu_data_io = vmalloc(MMU_DATAIO_SIZE_BYTES);
+	if(misc_register(&mmu_misc) < 0)
+	{
+		printk("MMU: Error registering device file\n");
+		proc_remove(mmu_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		mmu_ring_thread = kthread_run(mmu_ring_poll_thread, NULL, "MMU32_ring");
+		if(IS_ERR(mmu_ring_thread)) mmu_ring_thread = NULL;
+	}
+
 	printk("MMU Tool Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
+	misc_deregister(&mmu_misc);
 	proc_remove(mmu_proc);
-	vfree(mmu_data_io);
+	if(mmu_ring_thread != NULL) kthread_stop(mmu_ring_thread);
 	printk("MMU Tool Disabled\n");
 	return;
 }
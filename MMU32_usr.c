@@ -5,8 +5,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 /*
 "MMU_WAIT_KERNEL_RESPONSE"
@@ -16,6 +19,7 @@ Else, application will wait a specific time (defined in MMU_WAIT_TIME_US) is mic
 #define MMU_WAIT_KERNEL_RESPONSE
 
 #define MMU_PROC_FILE_DIR "/proc/MMU32"
+#define MMU_DEV_FILE_DIR "/dev/MMU32"
 #define MMU_WAIT_TIME_US 1
 
 #define MMU_DATAIO_SIZE_BYTES 5
@@ -23,10 +27,27 @@ Else, application will wait a specific time (defined in MMU_WAIT_TIME_US) is mic
 #define MMU_CMD_GET_PHYSICAL_ADDR 1
 #define MMU_CMD_GET_VIRTUAL_ADDR 2
 
+#define MMU_CMD_RING_DOORBELL 0xFE
 #define MMU_CMD_KERNEL_RESPONSE 0xFF
 
+#define MMU_IOCTL_MAGIC 'm'
+#define MMU_IOCTL_RUN_CMD _IOWR(MMU_IOCTL_MAGIC, 0, uint8_t[MMU_DATAIO_SIZE_BYTES])
+
+#define MMU_RING_SIZE_BYTES 4096
+#define MMU_RING_HEADER_SIZE_BYTES 16
+#define MMU_RING_ENTRY_SIZE_BYTES 8
+#define MMU_RING_ENTRIES 256
+
+#define MMU_RING_SQ_TAIL_UINTP_POS 0
+#define MMU_RING_SQ_HEAD_UINTP_POS 1
+#define MMU_RING_FLAGS_UINTP_POS 2
+
+#define MMU_RING_FLAG_KERNEL_POLL 0x1
+
 int mmu_proc_fd = -1;
+int mmu_dev_fd = -1;
 void *mmu_data_io = NULL;
+void *mmu_ring = NULL;
 
 void mmu_wait(void)
 {
@@ -47,32 +68,106 @@ bool mmu_init(void)
 	mmu_proc_fd = open(MMU_PROC_FILE_DIR, O_RDWR);
 	if(mmu_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	mmu_dev_fd = open(MMU_DEV_FILE_DIR, O_RDWR);
+
 	mmu_data_io = malloc(MMU_DATAIO_SIZE_BYTES);
 	return true;
 }
 
 #ifdef MMU_WAIT_KERNEL_RESPONSE
-void mmu_call_kernel(void)
+void mmu_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) mmu_data_io;
-	write(mmu_proc_fd, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(mmu_proc_fd, data_io, MMU_DATAIO_SIZE_BYTES);
 
 	do{
-		read(mmu_proc_fd, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
+		read(mmu_proc_fd, data_io, MMU_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != MMU_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void mmu_call_kernel(void)
+void mmu_call_kernel_proc(void *data_io)
 {
-	write(mmu_proc_fd, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
+	write(mmu_proc_fd, data_io, MMU_DATAIO_SIZE_BYTES);
 	mmu_wait();
-	read(mmu_proc_fd, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
+	read(mmu_proc_fd, data_io, MMU_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void mmu_call_kernel_ioctl(void *data_io)
+{
+	ioctl(mmu_dev_fd, MMU_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void mmu_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) mmu_ring;
+	uint8_t *ring_entries = ((uint8_t*) mmu_ring) + MMU_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[MMU_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%MMU_RING_ENTRIES)*MMU_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[MMU_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, mmu_data_io, MMU_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[MMU_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[MMU_RING_FLAGS_UINTP_POS] & MMU_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, MMU_DATAIO_SIZE_BYTES);
+		doorbell[0] = MMU_CMD_RING_DOORBELL;
+		if(mmu_dev_fd >= 0) mmu_call_kernel_ioctl(doorbell);
+		else mmu_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[MMU_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(mmu_data_io, pentry, MMU_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void mmu_call_kernel(void)
+{
+	if(mmu_ring != NULL) mmu_call_kernel_ring();
+	else if(mmu_dev_fd >= 0) mmu_call_kernel_ioctl(mmu_data_io);
+	else mmu_call_kernel_proc(mmu_data_io);
+
+	return;
+}
+
+bool mmu_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(mmu_ring != NULL) munmap(mmu_ring, MMU_RING_SIZE_BYTES);
+		mmu_ring = NULL;
+		return true;
+	}
+
+	if(mmu_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (mmu_dev_fd >= 0) ? mmu_dev_fd : mmu_proc_fd;
+	void *p_ring = mmap(NULL, MMU_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	mmu_ring = p_ring;
+	return true;
+}
+
+bool mmu_ring_is_enabled(void)
+{
+	return (mmu_ring != NULL);
+}
+
+bool mmu_ioctl_is_enabled(void)
+{
+	return (mmu_dev_fd >= 0);
+}
+
 uint32_t mmu_get_phys_from_virt(void *virtaddr)
 {
 	uint8_t *pbyte = (uint8_t*) mmu_data_io;
@@ -12,6 +12,15 @@ bool mmu_is_active(void);
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool mmu_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool mmu_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool mmu_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/MMU32" instead of write()/read() calls on the proc file.
+bool mmu_ioctl_is_enabled(void);
 
 uint32_t mmu_get_phys_from_virt(void *virtaddr);
 void *mmu_get_virt_from_phys(uint32_t physaddr);
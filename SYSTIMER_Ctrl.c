@@ -3,8 +3,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 /*
 "SYSTIMER_CTRL_WAIT_KERNEL_RESPONSE"
@@ -14,6 +17,7 @@ Else, application will wait a specific time (defined in SYSTIMER_CTRL_WAIT_TIME_
 #define SYSTIMER_CTRL_WAIT_KERNEL_RESPONSE
 
 #define SYSTIMER_CTRL_PROC_FILE_DIR "/proc/SYSTIMER_Ctrl"
+#define SYSTIMER_CTRL_DEV_FILE_DIR "/dev/SYSTIMER_Ctrl"
 #define SYSTIMER_CTRL_WAIT_TIME_US 1
 
 #define SYSTIMER_DATAIO_SIZE_BYTES 6
@@ -24,10 +28,27 @@ Else, application will wait a specific time (defined in SYSTIMER_CTRL_WAIT_TIME_
 #define SYSTIMER_CMD_SET_TIMER_MATCH_VALUE 3
 #define SYSTIMER_CMD_GET_TIMER_MATCH_VALUE 4
 
+#define SYSTIMER_CMD_RING_DOORBELL 0xFE
 #define SYSTIMER_CMD_KERNEL_RESPONSE 0xFF
 
+#define SYSTIMER_IOCTL_MAGIC 's'
+#define SYSTIMER_IOCTL_RUN_CMD _IOWR(SYSTIMER_IOCTL_MAGIC, 0, uint8_t[SYSTIMER_DATAIO_SIZE_BYTES])
+
+#define SYSTIMER_RING_SIZE_BYTES 4096
+#define SYSTIMER_RING_HEADER_SIZE_BYTES 16
+#define SYSTIMER_RING_ENTRY_SIZE_BYTES 8
+#define SYSTIMER_RING_ENTRIES 256
+
+#define SYSTIMER_RING_SQ_TAIL_UINTP_POS 0
+#define SYSTIMER_RING_SQ_HEAD_UINTP_POS 1
+#define SYSTIMER_RING_FLAGS_UINTP_POS 2
+
+#define SYSTIMER_RING_FLAG_KERNEL_POLL 0x1
+
 int systimer_proc_fd = -1;
+int systimer_dev_fd = -1;
 void *systimer_data_io = NULL;
+void *systimer_ring = NULL;
 
 void systimer_ctrl_wait(void)
 {
@@ -48,32 +69,106 @@ bool systimer_init(void)
 	systimer_proc_fd = open(SYSTIMER_CTRL_PROC_FILE_DIR, O_RDWR);
 	if(systimer_proc_fd < 0) return false;
 
+	//Optional. Older drivers only provide the proc file.
+	systimer_dev_fd = open(SYSTIMER_CTRL_DEV_FILE_DIR, O_RDWR);
+
 	systimer_data_io = malloc(SYSTIMER_DATAIO_SIZE_BYTES);
 	return true;
 }
 
 #ifdef SYSTIMER_CTRL_WAIT_KERNEL_RESPONSE
-void systimer_call_kernel(void)
+void systimer_call_kernel_proc(void *data_io)
 {
-	uint8_t *pbyte = (uint8_t*) systimer_data_io;
-	write(systimer_proc_fd, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
+	uint8_t *pbyte = (uint8_t*) data_io;
+	write(systimer_proc_fd, data_io, SYSTIMER_DATAIO_SIZE_BYTES);
 
 	do{
-		read(systimer_proc_fd, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
+		read(systimer_proc_fd, data_io, SYSTIMER_DATAIO_SIZE_BYTES);
 	}while(pbyte[0] != SYSTIMER_CMD_KERNEL_RESPONSE);
 
 	return;
 }
 #else
-void systimer_call_kernel(void)
+void systimer_call_kernel_proc(void *data_io)
 {
-	write(systimer_proc_fd, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
+	write(systimer_proc_fd, data_io, SYSTIMER_DATAIO_SIZE_BYTES);
 	systimer_ctrl_wait();
-	read(systimer_proc_fd, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
+	read(systimer_proc_fd, data_io, SYSTIMER_DATAIO_SIZE_BYTES);
 	return;
 }
 #endif
 
+void systimer_call_kernel_ioctl(void *data_io)
+{
+	ioctl(systimer_dev_fd, SYSTIMER_IOCTL_RUN_CMD, data_io);
+	return;
+}
+
+void systimer_call_kernel_ring(void)
+{
+	uint32_t *ring_header = (uint32_t*) systimer_ring;
+	uint8_t *ring_entries = ((uint8_t*) systimer_ring) + SYSTIMER_RING_HEADER_SIZE_BYTES;
+	uint32_t sq_tail = ring_header[SYSTIMER_RING_SQ_TAIL_UINTP_POS];
+	uint8_t *pentry = &ring_entries[(sq_tail%SYSTIMER_RING_ENTRIES)*SYSTIMER_RING_ENTRY_SIZE_BYTES];
+	uint8_t doorbell[SYSTIMER_DATAIO_SIZE_BYTES];
+
+	memcpy(pentry, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
+	sq_tail++;
+	__atomic_store_n(&ring_header[SYSTIMER_RING_SQ_TAIL_UINTP_POS], sq_tail, __ATOMIC_RELEASE);
+
+	if(!(ring_header[SYSTIMER_RING_FLAGS_UINTP_POS] & SYSTIMER_RING_FLAG_KERNEL_POLL))
+	{
+		memset(doorbell, 0, SYSTIMER_DATAIO_SIZE_BYTES);
+		doorbell[0] = SYSTIMER_CMD_RING_DOORBELL;
+		if(systimer_dev_fd >= 0) systimer_call_kernel_ioctl(doorbell);
+		else systimer_call_kernel_proc(doorbell);
+	}
+
+	while(__atomic_load_n(&ring_header[SYSTIMER_RING_SQ_HEAD_UINTP_POS], __ATOMIC_ACQUIRE) != sq_tail);
+
+	memcpy(systimer_data_io, pentry, SYSTIMER_DATAIO_SIZE_BYTES);
+	return;
+}
+
+void systimer_call_kernel(void)
+{
+	if(systimer_ring != NULL) systimer_call_kernel_ring();
+	else if(systimer_dev_fd >= 0) systimer_call_kernel_ioctl(systimer_data_io);
+	else systimer_call_kernel_proc(systimer_data_io);
+
+	return;
+}
+
+bool systimer_ring_enable(bool enable)
+{
+	if(!enable)
+	{
+		if(systimer_ring != NULL) munmap(systimer_ring, SYSTIMER_RING_SIZE_BYTES);
+		systimer_ring = NULL;
+		return true;
+	}
+
+	if(systimer_ring != NULL) return true;
+
+	//Every open file has its own ring: map the one of the file the doorbell is sent to.
+	int ring_fd = (systimer_dev_fd >= 0) ? systimer_dev_fd : systimer_proc_fd;
+	void *p_ring = mmap(NULL, SYSTIMER_RING_SIZE_BYTES, (PROT_READ | PROT_WRITE), MAP_SHARED, ring_fd, 0);
+	if(p_ring == MAP_FAILED) return false;
+
+	systimer_ring = p_ring;
+	return true;
+}
+
+bool systimer_ring_is_enabled(void)
+{
+	return (systimer_ring != NULL);
+}
+
+bool systimer_ioctl_is_enabled(void)
+{
+	return (systimer_dev_fd >= 0);
+}
+
 bool systimer_timer_match_occurred(uint8_t timer_num)
 {
 	uint8_t *pbyte = (uint8_t*) systimer_data_io;
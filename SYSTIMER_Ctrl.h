@@ -10,6 +10,15 @@ bool systimer_is_active(void);
 //This function must be called before calling any other functions in this header.
 //Returns true if initialization is successful.
 bool systimer_init(void);
+//Maps the shared command ring of the driver (enable = true) or unmaps it (enable = false).
+//While mapped, commands are posted through shared memory instead of write()/read() calls.
+//If the driver was loaded with "ring_poll_us" set, commands are executed without any system call.
+//Returns true if successful.
+bool systimer_ring_enable(bool enable);
+//Returns true if the command ring is mapped.
+bool systimer_ring_is_enabled(void);
+//Returns true if commands are sent through the ioctl interface of "/dev/SYSTIMER_Ctrl" instead of write()/read() calls on the proc file.
+bool systimer_ioctl_is_enabled(void);
 
 bool systimer_timer_match_occurred(uint8_t timer_num);
 uint32_t systimer_get_counter_value_l32(void);
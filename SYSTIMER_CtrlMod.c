@@ -5,8 +5,14 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/miscdevice.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
 #include <asm/io.h>
 
 /*
@@ -25,11 +31,58 @@
 #define SYSTIMER_CMD_SET_TIMER_MATCH_VALUE 3
 #define SYSTIMER_CMD_GET_TIMER_MATCH_VALUE 4
 
+#define SYSTIMER_CMD_RING_DOORBELL 0xFE
 #define SYSTIMER_CMD_KERNEL_RESPONSE 0xFF
 
+#define SYSTIMER_IOCTL_MAGIC 's'
+#define SYSTIMER_IOCTL_RUN_CMD _IOWR(SYSTIMER_IOCTL_MAGIC, 0, unsigned char[SYSTIMER_DATAIO_SIZE_BYTES])
+
+/*
+ * SYSTIMER Command Ring Structure (SYSTIMER_RING_SIZE_BYTES, mapped with mmap()):
+ *
+ * UINT0: SQ TAIL (written by user)
+ * UINT1: SQ HEAD (written by kernel)
+ * UINT2: FLAGS (written by kernel)
+ * UINT3: RESERVED
+ * BYTES 16 onwards: SYSTIMER_RING_ENTRIES entries of SYSTIMER_RING_ENTRY_SIZE_BYTES. Entry "n" is stored in slot (n%SYSTIMER_RING_ENTRIES).
+ *
+ * Each entry holds one command in the regular command structure.
+ * Entries from SQ HEAD to SQ TAIL are executed on a SYSTIMER_CMD_RING_DOORBELL command, or periodically if "ring_poll_us" is set.
+ * Results are written back in place. An entry is complete once SQ HEAD has moved past it.
+ */
+
+#define SYSTIMER_RING_SIZE_BYTES 4096
+#define SYSTIMER_RING_HEADER_SIZE_BYTES 16
+#define SYSTIMER_RING_ENTRY_SIZE_BYTES 8
+#define SYSTIMER_RING_ENTRIES 256
+
+#define SYSTIMER_RING_SQ_TAIL_UINTP_POS 0
+#define SYSTIMER_RING_SQ_HEAD_UINTP_POS 1
+#define SYSTIMER_RING_FLAGS_UINTP_POS 2
+
+#define SYSTIMER_RING_FLAG_KERNEL_POLL 0x1
+
+/*
+ * Every open file gets its own command buffer and command ring, so multiple processes can use the driver at the same time.
+ */
+
+typedef struct {
+	void *data_io;
+	void *ring;
+	unsigned int ring_sq_head;
+	struct mutex ring_mutex;
+	struct list_head list;
+} systimer_file_ctx_t;
+
 static struct proc_dir_entry *systimer_proc = NULL;
 static unsigned int *systimer_mapping = NULL;
-static void *systimer_data_io = NULL;
+static struct task_struct *systimer_ring_thread = NULL;
+static LIST_HEAD(systimer_file_ctx_list);
+static DEFINE_MUTEX(systimer_file_ctx_list_mutex);
+
+static unsigned int ring_poll_us = 0;
+module_param(ring_poll_us, uint, 0444);
+MODULE_PARM_DESC(ring_poll_us, "Command ring polling period in microseconds. 0 disables polling (doorbell only).");
 
 unsigned int systimer_is_reg_bit_active(unsigned int register_value, unsigned int reference_bit)
 {
@@ -44,7 +97,8 @@ unsigned int systimer_timer_match_occurred(unsigned int timer_num)
 
 	if(systimer_is_reg_bit_active(systimer_mapping[SYSTIMER_CTRL_STATUS_UINTP_POS], (1 << timer_num)))
 	{
-		systimer_mapping[SYSTIMER_CTRL_STATUS_UINTP_POS] |= (1 << timer_num);
+		//Match bits are write 1 to clear. Writing only this timer's bit leaves the other timers untouched, so no lock is needed.
+		systimer_mapping[SYSTIMER_CTRL_STATUS_UINTP_POS] = (1 << timer_num);
 		return 1;
 	}
 
@@ -116,17 +170,8 @@ unsigned int systimer_get_timer_compare_match_value(unsigned int timer_num)
 	return systimer_mapping[mapping_pos];
 }
 
-ssize_t systimer_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
-{
-	copy_to_user(user, systimer_data_io, SYSTIMER_DATAIO_SIZE_BYTES);
-	return size;
-}
-
-ssize_t systimer_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+void systimer_run_cmd(unsigned char *pbyte)
 {
-	copy_from_user(systimer_data_io, user, SYSTIMER_DATAIO_SIZE_BYTES);
-
-	unsigned char *pbyte = (unsigned char*) systimer_data_io;
 	unsigned int *puint = (unsigned int*) &pbyte[2];
 
 	switch(pbyte[0])
@@ -153,12 +198,160 @@ ssize_t systimer_mod_usrwrite(struct file *file, const char __user *user, size_t
 	}
 
 	pbyte[0] = SYSTIMER_CMD_KERNEL_RESPONSE;
+	return;
+}
+
+void systimer_ring_drain(systimer_file_ctx_t *ctx)
+{
+	unsigned int *ring_header = (unsigned int*) ctx->ring;
+	unsigned char *ring_entries = ((unsigned char*) ctx->ring) + SYSTIMER_RING_HEADER_SIZE_BYTES;
+	unsigned int sq_tail = 0;
+
+	mutex_lock(&ctx->ring_mutex);
+
+	sq_tail = smp_load_acquire(&ring_header[SYSTIMER_RING_SQ_TAIL_UINTP_POS]);
+	if((sq_tail - ctx->ring_sq_head) > SYSTIMER_RING_ENTRIES) sq_tail = ctx->ring_sq_head + SYSTIMER_RING_ENTRIES;
+
+	while(ctx->ring_sq_head != sq_tail)
+	{
+		systimer_run_cmd(&ring_entries[(ctx->ring_sq_head%SYSTIMER_RING_ENTRIES)*SYSTIMER_RING_ENTRY_SIZE_BYTES]);
+		ctx->ring_sq_head++;
+		smp_store_release(&ring_header[SYSTIMER_RING_SQ_HEAD_UINTP_POS], ctx->ring_sq_head);
+	}
+
+	mutex_unlock(&ctx->ring_mutex);
+	return;
+}
+
+int systimer_ring_poll_thread(void *arg)
+{
+	systimer_file_ctx_t *ctx = NULL;
+
+	while(!kthread_should_stop())
+	{
+		mutex_lock(&systimer_file_ctx_list_mutex);
+		list_for_each_entry(ctx, &systimer_file_ctx_list, list) systimer_ring_drain(ctx);
+		mutex_unlock(&systimer_file_ctx_list_mutex);
+
+		usleep_range(ring_poll_us, ring_poll_us + 1);
+	}
+
+	return 0;
+}
+
+int systimer_mod_open(struct inode *inode, struct file *file)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) kzalloc(sizeof(systimer_file_ctx_t), GFP_KERNEL);
+	if(ctx == NULL) return -ENOMEM;
+
+	ctx->data_io = vmalloc(SYSTIMER_DATAIO_SIZE_BYTES);
+	ctx->ring = vmalloc_user(SYSTIMER_RING_SIZE_BYTES);
+	if((ctx->data_io == NULL) || (ctx->ring == NULL))
+	{
+		vfree(ctx->data_io);
+		vfree(ctx->ring);
+		kfree(ctx);
+		return -ENOMEM;
+	}
+
+	mutex_init(&ctx->ring_mutex);
+	if(systimer_ring_thread != NULL) ((unsigned int*) ctx->ring)[SYSTIMER_RING_FLAGS_UINTP_POS] = SYSTIMER_RING_FLAG_KERNEL_POLL;
+
+	mutex_lock(&systimer_file_ctx_list_mutex);
+	list_add_tail(&ctx->list, &systimer_file_ctx_list);
+	mutex_unlock(&systimer_file_ctx_list_mutex);
+
+	file->private_data = ctx;
+	return 0;
+}
+
+int systimer_mod_release(struct inode *inode, struct file *file)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) file->private_data;
+
+	mutex_lock(&systimer_file_ctx_list_mutex);
+	list_del(&ctx->list);
+	mutex_unlock(&systimer_file_ctx_list_mutex);
+
+	vfree(ctx->data_io);
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+ssize_t systimer_mod_usrread(struct file *file, char __user *user, size_t size, loff_t *offset)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) file->private_data;
+
+	if(size > SYSTIMER_DATAIO_SIZE_BYTES) size = SYSTIMER_DATAIO_SIZE_BYTES;
+
+	if(copy_to_user(user, ctx->data_io, size)) return -EFAULT;
+	return size;
+}
+
+ssize_t systimer_mod_usrwrite(struct file *file, const char __user *user, size_t size, loff_t *offset)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) file->private_data;
+
+	if(size != SYSTIMER_DATAIO_SIZE_BYTES) return -EINVAL;
+
+	if(copy_from_user(ctx->data_io, user, size)) return -EFAULT;
+
+	unsigned char *pbyte = (unsigned char*) ctx->data_io;
+	if(pbyte[0] == SYSTIMER_CMD_RING_DOORBELL) systimer_ring_drain(ctx);
+
+	systimer_run_cmd(pbyte);
 	return size;
 }
 
+int systimer_mod_usrmmap(struct file *file, struct vm_area_struct *vma)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) file->private_data;
+
+	if(vma->vm_pgoff != 0) return -EINVAL;
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+long systimer_mod_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	systimer_file_ctx_t *ctx = (systimer_file_ctx_t*) file->private_data;
+	unsigned char pbyte[SYSTIMER_DATAIO_SIZE_BYTES];
+
+	if(cmd != SYSTIMER_IOCTL_RUN_CMD) return -ENOTTY;
+
+	if(copy_from_user(pbyte, (void __user*) arg, SYSTIMER_DATAIO_SIZE_BYTES)) return -EFAULT;
+
+	if(pbyte[0] == SYSTIMER_CMD_RING_DOORBELL) systimer_ring_drain(ctx);
+
+	systimer_run_cmd(pbyte);
+
+	if(copy_to_user((void __user*) arg, pbyte, SYSTIMER_DATAIO_SIZE_BYTES)) return -EFAULT;
+	return 0;
+}
+
 static const struct proc_ops systimer_proc_ops = {
+	.proc_open = systimer_mod_open,
+	.proc_release = systimer_mod_release,
 	.proc_read = systimer_mod_usrread,
-	.proc_write = systimer_mod_usrwrite
+	.proc_write = systimer_mod_usrwrite,
+	.proc_mmap = systimer_mod_usrmmap
+};
+
+static const struct file_operations systimer_fops = {
+	.owner = THIS_MODULE,
+	.open = systimer_mod_open,
+	.release = systimer_mod_release,
+	.read = systimer_mod_usrread,
+	.write = systimer_mod_usrwrite,
+	.mmap = systimer_mod_usrmmap,
+	.unlocked_ioctl = systimer_mod_ioctl
+};
+
+static struct miscdevice systimer_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "SYSTIMER_Ctrl",
+	.fops = &systimer_fops,
+	.mode = 0666
 };
 
 static int __init driver_enable(void)
@@ -177,16 +370,30 @@ static int __init driver_enable(void)
 		return -1;
 	}
 
-	systimer_data_io = vmalloc(SYSTIMER_DATAIO_SIZE_BYTES);
+	if(misc_register(&systimer_misc) < 0)
+	{
+		printk("SYSTIMER: Error registering device file\n");
+		proc_remove(systimer_proc);
+		return -1;
+	}
+
+	if(ring_poll_us)
+	{
+		systimer_ring_thread = kthread_run(systimer_ring_poll_thread, NULL, "SYSTIMER_Ctrl_ring");
+		if(IS_ERR(systimer_ring_thread)) systimer_ring_thread = NULL;
+	}
+
 	printk("SYSTIMER Control Driver Enabled\n");
 	return 0;
 }
 
 static void __exit driver_disable(void)
 {
-	iounmap(systimer_mapping);
+	//Interfaces and the ring thread go first, so no command can run on unmapped registers.
+	misc_deregister(&systimer_misc);
 	proc_remove(systimer_proc);
-	vfree(systimer_data_io);
+	if(systimer_ring_thread != NULL) kthread_stop(systimer_ring_thread);
+	iounmap(systimer_mapping);
 	printk("SYSTIMER Control Driver Disabled\n");
 	return;
 }